@@ -25,7 +25,7 @@ struct vector* array_brackets_node_vector(struct array_brackets* brackets)
     return brackets->n_brackets;
 }
 
-size_t array_brackets_calculate_size_from_index(struct datatype* dtype, struct array_brackets* brackets, int index)
+size_t array_brackets_calculate_size_from_index(const struct datatype* dtype, struct array_brackets* brackets, int index)
 {
     struct vector* array_vec = array_brackets_node_vector(brackets);
     size_t size = dtype->size;
@@ -54,17 +54,17 @@ size_t array_brackets_calculate_size_from_index(struct datatype* dtype, struct a
     return size;
 }
 
-size_t array_brackets_count(struct datatype* dtype)
+size_t array_brackets_count(const struct datatype* dtype)
 {
     return vector_count(dtype->array.brackets->n_brackets);
 }
 
-size_t array_brackets_calculate_size(struct datatype* dtype, struct array_brackets* brackets)
+size_t array_brackets_calculate_size(const struct datatype* dtype, struct array_brackets* brackets)
 {
     return array_brackets_calculate_size_from_index(dtype, brackets, 0);
 }
 
-int array_total_indexes(struct datatype* dtype)
+int array_total_indexes(const struct datatype* dtype)
 {
     assert(dtype->flags & DATATYPE_FLAG_IS_ARRAY);
     struct array_brackets* brackets = dtype->array.brackets;
@@ -0,0 +1,504 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdarg.h>
+
+/**
+ * Instruction level IR sitting between codegen and the NASM text.
+ *
+ * Codegen builds every instruction from an opcode and structured operands, only directives and
+ * data definitions are kept as text in ASM_OP_DIRECTIVE. The NASM text is written when the IR is printed.
+ */
+
+static const char *asm_ir_opcode_names[] = {
+    [ASM_OP_MOV] = "mov",
+    [ASM_OP_MOVZX] = "movzx",
+    [ASM_OP_MOVSX] = "movsx",
+    [ASM_OP_MOVSXD] = "movsxd",
+    [ASM_OP_LEA] = "lea",
+    [ASM_OP_PUSH] = "push",
+    [ASM_OP_POP] = "pop",
+    [ASM_OP_ADD] = "add",
+    [ASM_OP_SUB] = "sub",
+    [ASM_OP_IMUL] = "imul",
+    [ASM_OP_MUL] = "mul",
+    [ASM_OP_IDIV] = "idiv",
+    [ASM_OP_DIV] = "div",
+    [ASM_OP_CDQ] = "cdq",
+    [ASM_OP_CQO] = "cqo",
+    [ASM_OP_INC] = "inc",
+    [ASM_OP_DEC] = "dec",
+    [ASM_OP_NEG] = "neg",
+    [ASM_OP_NOT] = "not",
+    [ASM_OP_AND] = "and",
+    [ASM_OP_OR] = "or",
+    [ASM_OP_XOR] = "xor",
+    [ASM_OP_SAL] = "sal",
+    [ASM_OP_SHL] = "shl",
+    [ASM_OP_SAR] = "sar",
+    [ASM_OP_SHR] = "shr",
+    [ASM_OP_CMP] = "cmp",
+    [ASM_OP_TEST] = "test",
+    [ASM_OP_SETE] = "sete",
+    [ASM_OP_SETNE] = "setne",
+    [ASM_OP_SETG] = "setg",
+    [ASM_OP_SETGE] = "setge",
+    [ASM_OP_SETL] = "setl",
+    [ASM_OP_SETLE] = "setle",
+    [ASM_OP_SETA] = "seta",
+    [ASM_OP_SETAE] = "setae",
+    [ASM_OP_SETB] = "setb",
+    [ASM_OP_SETBE] = "setbe",
+    [ASM_OP_JMP] = "jmp",
+    [ASM_OP_JE] = "je",
+    [ASM_OP_JNE] = "jne",
+    [ASM_OP_JG] = "jg",
+    [ASM_OP_JGE] = "jge",
+    [ASM_OP_JL] = "jl",
+    [ASM_OP_JLE] = "jle",
+    [ASM_OP_JA] = "ja",
+    [ASM_OP_JAE] = "jae",
+    [ASM_OP_JB] = "jb",
+    [ASM_OP_JBE] = "jbe",
+    [ASM_OP_CALL] = "call",
+    [ASM_OP_RET] = "ret",
+    [ASM_OP_LEAVE] = "leave",
+    [ASM_OP_NOP] = "nop",
+    [ASM_OP_ALIGN] = "align",
+    [ASM_OP_REP_MOVSD] = "rep movsd",
+};
+
+static const char *asm_ir_registers[] = {
+    "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
+    "ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
+    "al", "bl", "cl", "dl", "ah", "bh", "ch", "dh",
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+
+const char *asm_ir_opcode_name(int op)
+{
+    if (op <= ASM_OP_COMMENT || op >= ASM_OP_TOTAL)
+    {
+        return NULL;
+    }
+
+    return asm_ir_opcode_names[op];
+}
+
+/**
+ * Returns the canonical register string so registers can be compared by address.
+ */
+const char *asm_ir_register(const char *name, size_t len)
+{
+    for (int i = 0; i < sizeof(asm_ir_registers) / sizeof(asm_ir_registers[0]); i++)
+    {
+        if (strlen(asm_ir_registers[i]) == len && strncmp(asm_ir_registers[i], name, len) == 0)
+        {
+            return asm_ir_registers[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns the ASM_IR_REG_* of the full register a canonical register string belongs to, -1 for anything else.
+ */
+int asm_ir_register_id(const char *reg)
+{
+    for (int i = 0; i < sizeof(asm_ir_registers) / sizeof(asm_ir_registers[0]); i++)
+    {
+        if (asm_ir_registers[i] == reg)
+        {
+            // The byte registers only exist for eax, ebx, ecx and edx
+            return i < 16 ? i % 8 : i < 24 ? (i - 16) % 4 : i < 40 ? i - 24 : i - 32;
+        }
+    }
+
+    return -1;
+}
+
+const char *asm_ir_register_name(int id)
+{
+    return id < ASM_IR_REG_R8 ? asm_ir_registers[id] : asm_ir_registers[id + 32];
+}
+
+int asm_ir_register_size(const char *reg)
+{
+    int id = 0;
+    while (asm_ir_registers[id] != reg)
+    {
+        id++;
+    }
+
+    return id < 8 ? DATA_SIZE_DWORD : id < 16 ? DATA_SIZE_WORD : id < 24 ? DATA_SIZE_BYTE : id < 40 ? DATA_SIZE_DDWORD : DATA_SIZE_DWORD;
+}
+
+const char *asm_ir_register_64(const char *reg)
+{
+    return asm_ir_registers[24 + asm_ir_register_id(reg)];
+}
+
+bool asm_ir_operand_is_dword(struct asm_ir_operand *operand)
+{
+    switch (operand->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+        return asm_ir_register_size(operand->reg) == DATA_SIZE_DWORD;
+
+    case ASM_IR_OPERAND_MEMORY:
+        return operand->mem.size == 0 || operand->mem.size == DATA_SIZE_DWORD;
+
+    case ASM_IR_OPERAND_IMMEDIATE:
+    case ASM_IR_OPERAND_SYMBOL:
+        return operand->size == 0 || operand->size == DATA_SIZE_DWORD;
+    }
+    return false;
+}
+
+bool asm_ir_operand_is_stack_slot(struct asm_ir_operand *operand)
+{
+    int slot_size = target_current()->stack_push_size;
+    switch (operand->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+        return asm_ir_register_size(operand->reg) == slot_size;
+
+    case ASM_IR_OPERAND_MEMORY:
+        return operand->mem.size == 0 || operand->mem.size == slot_size;
+
+    case ASM_IR_OPERAND_IMMEDIATE:
+    case ASM_IR_OPERAND_SYMBOL:
+        return operand->size == 0 || operand->size == slot_size;
+    }
+    return false;
+}
+
+int asm_ir_callee_saved_registers()
+{
+    struct compile_target *target = target_current();
+    int saved = 0;
+    for (int i = 0; i < target->total_callee_saved_registers; i++)
+    {
+        const char *reg = target->callee_saved_registers[i];
+        saved |= ASM_IR_REG_MASK(asm_ir_register_id(asm_ir_register(reg, strlen(reg))));
+    }
+    return saved;
+}
+
+static bool asm_ir_string_equal(const char *a, const char *b)
+{
+    return a == b || (a && b && S_EQ(a, b));
+}
+
+bool asm_ir_operand_equal(struct asm_ir_operand *a, struct asm_ir_operand *b)
+{
+    if (a->type != b->type || a->size != b->size)
+    {
+        return false;
+    }
+
+    switch (a->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+        return a->reg == b->reg;
+
+    case ASM_IR_OPERAND_IMMEDIATE:
+        return a->imm == b->imm;
+
+    case ASM_IR_OPERAND_MEMORY:
+        return asm_ir_string_equal(a->mem.base, b->mem.base) && a->mem.index == b->mem.index && a->mem.scale == b->mem.scale &&
+               a->mem.displacement == b->mem.displacement && a->mem.size == b->mem.size;
+
+    case ASM_IR_OPERAND_SYMBOL:
+        return S_EQ(a->symbol, b->symbol);
+    }
+    return true;
+}
+
+bool asm_ir_is_jump(int op)
+{
+    return op >= ASM_OP_JMP && op <= ASM_OP_JBE;
+}
+
+bool asm_ir_is_conditional_jump(int op)
+{
+    return op > ASM_OP_JMP && op <= ASM_OP_JBE;
+}
+
+bool asm_ir_ends_block(int op)
+{
+    return asm_ir_is_jump(op) || op == ASM_OP_RET;
+}
+
+struct asm_ir *asm_ir_new()
+{
+    struct asm_ir *ir = calloc(1, sizeof(struct asm_ir));
+    ir->instructions = vector_create(sizeof(struct asm_ir_instruction *));
+    return ir;
+}
+
+struct asm_ir_instruction *asm_ir_instruction_new(int op, const char *text)
+{
+    struct asm_ir_instruction *ins = calloc(1, sizeof(struct asm_ir_instruction));
+    ins->op = op;
+    ins->text = text ? strdup(text) : NULL;
+    return ins;
+}
+
+struct asm_ir_operand asm_ir_reg(const char *reg)
+{
+    const char *canonical = asm_ir_register(reg, strlen(reg));
+    assert(canonical);
+    return (struct asm_ir_operand){.type = ASM_IR_OPERAND_REGISTER, .reg = canonical};
+}
+
+struct asm_ir_operand asm_ir_imm(long long value)
+{
+    return (struct asm_ir_operand){.type = ASM_IR_OPERAND_IMMEDIATE, .imm = value};
+}
+
+struct asm_ir_operand asm_ir_sized(int size, struct asm_ir_operand operand)
+{
+    operand.size = size;
+    return operand;
+}
+
+struct asm_ir_operand asm_ir_mem(struct asm_operand mem)
+{
+    struct asm_ir_operand operand = {.type = ASM_IR_OPERAND_MEMORY, .mem = mem};
+    if (mem.base)
+    {
+        const char *reg = asm_ir_register(mem.base, strlen(mem.base));
+        operand.mem.base = reg ? reg : strdup(mem.base);
+        operand.owns_base = !reg;
+    }
+
+    if (mem.index)
+    {
+        operand.mem.index = asm_ir_register(mem.index, strlen(mem.index));
+        assert(operand.mem.index);
+    }
+    return operand;
+}
+
+struct asm_ir_operand asm_ir_symbol(const char *fmt, ...)
+{
+    char symbol[ASM_LINE_MAX_LENGTH];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(symbol, sizeof(symbol), fmt, args);
+    va_end(args);
+    return (struct asm_ir_operand){.type = ASM_IR_OPERAND_SYMBOL, .symbol = strdup(symbol)};
+}
+
+void asm_ir_instruction_free(struct asm_ir_instruction *ins)
+{
+    for (int i = 0; i < ins->total_operands; i++)
+    {
+        struct asm_ir_operand *operand = &ins->operands[i];
+        if (operand->type == ASM_IR_OPERAND_SYMBOL)
+        {
+            free((char *)operand->symbol);
+        }
+        else if (operand->type == ASM_IR_OPERAND_MEMORY && operand->owns_base)
+        {
+            free((char *)operand->mem.base);
+        }
+    }
+    free(ins->text);
+    free(ins);
+}
+
+static const struct
+{
+    const char *keyword;
+    int size;
+} size_keywords[] = {{"byte ", DATA_SIZE_BYTE}, {"word ", DATA_SIZE_WORD}, {"dword ", DATA_SIZE_DWORD}, {"qword ", DATA_SIZE_DDWORD}};
+
+
+static const char *asm_ir_size_keyword(int size)
+{
+    for (int i = 0; i < sizeof(size_keywords) / sizeof(size_keywords[0]); i++)
+    {
+        if (size_keywords[i].size == size)
+        {
+            return size_keywords[i].keyword;
+        }
+    }
+    return "";
+}
+
+static void asm_ir_printf(struct buffer *out, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    buffer_vprintf(out, fmt, args);
+    va_end(args);
+}
+
+// base+index*scale+displacement, "ebp-4" or "name+8"
+static void asm_ir_print_address(struct asm_operand *mem, struct buffer *out)
+{
+    const char *separator = "";
+    if (mem->base)
+    {
+        asm_ir_printf(out, "%s", mem->base);
+        separator = "+";
+    }
+
+    if (mem->index)
+    {
+        asm_ir_printf(out, "%s%s*%i", separator, mem->index, mem->scale);
+        separator = "+";
+    }
+
+    if (mem->displacement || !*separator)
+    {
+        asm_ir_printf(out, *separator ? "%+i" : "%i", mem->displacement);
+    }
+}
+
+static void asm_ir_print_operand(struct asm_ir_operand *operand, struct buffer *out)
+{
+    if (operand->type != ASM_IR_OPERAND_MEMORY)
+    {
+        asm_ir_printf(out, "%s", asm_ir_size_keyword(operand->size));
+    }
+
+    switch (operand->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+        asm_ir_printf(out, "%s", operand->reg);
+        break;
+
+    case ASM_IR_OPERAND_IMMEDIATE:
+        asm_ir_printf(out, "%lld", operand->imm);
+        break;
+
+    case ASM_IR_OPERAND_MEMORY:
+        asm_ir_printf(out, "%s[", asm_ir_size_keyword(operand->mem.size));
+        asm_ir_print_address(&operand->mem, out);
+        asm_ir_printf(out, "]");
+        break;
+
+    case ASM_IR_OPERAND_SYMBOL:
+        asm_ir_printf(out, "%s", operand->symbol);
+        break;
+    }
+}
+
+void asm_ir_print_instruction(struct asm_ir_instruction *ins, struct buffer *out)
+{
+    if (ins->flags & ASM_IR_INSTRUCTION_FLAG_DELETED)
+    {
+        return;
+    }
+
+    switch (ins->op)
+    {
+    case ASM_OP_DIRECTIVE:
+        asm_ir_printf(out, "%s", ins->text);
+        break;
+
+    case ASM_OP_COMMENT:
+        asm_ir_printf(out, "; %s", ins->text);
+        break;
+
+    case ASM_OP_LABEL:
+        asm_ir_printf(out, "%s:", ins->text);
+        break;
+
+    default:
+        asm_ir_printf(out, "%s", asm_ir_opcode_name(ins->op));
+        for (int i = 0; i < ins->total_operands; i++)
+        {
+            asm_ir_printf(out, i == 0 ? " " : ", ");
+            asm_ir_print_operand(&ins->operands[i], out);
+        }
+    }
+    buffer_write(out, '\n');
+}
+
+struct asm_ir_instruction *asm_ir_at(struct asm_ir *ir, int index)
+{
+    return vector_peek_ptr_at(ir->instructions, index);
+}
+
+void asm_ir_push(struct asm_ir *ir, struct asm_ir_instruction *ins)
+{
+    vector_push(ir->instructions, &ins);
+}
+
+void asm_ir_print(struct asm_ir *ir, struct buffer *out)
+{
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        asm_ir_print_instruction(asm_ir_at(ir, i), out);
+    }
+}
+
+void asm_ir_clear(struct asm_ir *ir)
+{
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        asm_ir_instruction_free(asm_ir_at(ir, i));
+    }
+    vector_clear(ir->instructions);
+}
+
+void asm_ir_compact(struct asm_ir *ir)
+{
+    struct asm_ir_instruction **instructions = vector_data_ptr(ir->instructions);
+    int total = vector_count(ir->instructions);
+    int kept = 0;
+    for (int i = 0; i < total; i++)
+    {
+        if (instructions[i]->flags & ASM_IR_INSTRUCTION_FLAG_DELETED)
+        {
+            asm_ir_instruction_free(instructions[i]);
+            continue;
+        }
+        instructions[kept++] = instructions[i];
+    }
+
+    for (int i = kept; i < total; i++)
+    {
+        vector_pop(ir->instructions);
+    }
+}
+
+struct vector *asm_ir_basic_blocks(struct asm_ir *ir)
+{
+    struct vector *blocks = vector_create(sizeof(struct asm_ir_block));
+    struct asm_ir_block block = {.start = 0};
+    int total = vector_count(ir->instructions);
+    for (int i = 0; i < total; i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        // Labels, including the entry and exit points of loops and functions, start a block
+        if (ins->op == ASM_OP_LABEL && i > block.start)
+        {
+            block.end = i;
+            vector_push(blocks, &block);
+            block.start = i;
+        }
+
+        if (asm_ir_ends_block(ins->op))
+        {
+            block.end = i + 1;
+            vector_push(blocks, &block);
+            block.start = i + 1;
+        }
+    }
+
+    if (block.start < total)
+    {
+        block.end = total;
+        vector_push(blocks, &block);
+    }
+    return blocks;
+}
@@ -0,0 +1,867 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Binary AST files.
+ *
+ * The file is a header followed by flat sections of fixed size records. Records never hold
+ * pointers, every reference is a one based index into another section with zero meaning NULL,
+ * so the file is position independent and can be mapped and read in place. Strings are NUL
+ * terminated and deduplicated, the loader points straight into the mapping for them.
+ *
+ * Lists (vectors) live in the refs section as a count followed by that many entries.
+ */
+
+struct ast_file_header
+{
+    char magic[8];
+    uint32_t version;
+    // Datatype sizes depend on the target the file was parsed for
+    uint32_t target;
+
+    uint32_t total_nodes;
+    uint32_t total_datatypes;
+    uint32_t total_refs;
+    uint32_t strings_size;
+    // Lists in the refs section
+    uint32_t roots;
+    uint32_t includes;
+
+    uint32_t nodes_offset;
+    uint32_t datatypes_offset;
+    uint32_t refs_offset;
+    uint32_t strings_offset;
+};
+
+struct ast_file_node
+{
+    int32_t type;
+    int32_t flags;
+    int32_t line;
+    int32_t col;
+    uint32_t filename;
+    uint32_t owner;
+    uint32_t function;
+
+    // Child nodes, lists, datatype and name or operator, meaning depends on the node type.
+    uint32_t nodes[4];
+    uint32_t lists[1];
+    uint32_t dtype;
+    uint32_t str;
+    int64_t ints[3];
+
+    // The literal value union, sval is stored through str instead.
+    uint64_t value;
+};
+
+struct ast_file_datatype
+{
+    int32_t flags;
+    int32_t type;
+    uint32_t secondary;
+    uint32_t type_str;
+    uint64_t size;
+    int32_t pointer_depth;
+    uint32_t struct_node;
+    // List of bracket nodes, zero when there are no brackets.
+    uint32_t brackets;
+    uint64_t array_size;
+};
+
+struct ast_map_entry
+{
+    const void *key;
+    uint32_t value;
+    struct ast_map_entry *next;
+};
+
+struct ast_map
+{
+    struct ast_map_entry *buckets[AST_MAP_BUCKETS];
+    // Compare keys as strings instead of by address
+    bool by_content;
+};
+
+struct ast_writer
+{
+    struct ast_map nodes_map;
+    struct ast_map datatypes_map;
+    struct ast_map strings_map;
+
+    // Vector of struct ast_file_node
+    struct vector *nodes;
+    // Vector of struct ast_file_datatype
+    struct vector *datatypes;
+    // Vector of uint32_t
+    struct vector *refs;
+    // Vector of char
+    struct vector *strings;
+};
+
+static unsigned int ast_map_hash(struct ast_map *map, const void *key)
+{
+    if (!map->by_content)
+    {
+        uintptr_t value = (uintptr_t)key;
+        return (value >> 3) ^ (value >> 17);
+    }
+
+    unsigned int hash = 5381;
+    for (const char *c = key; *c; c++)
+    {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+    return hash;
+}
+
+static struct ast_map_entry *ast_map_get(struct ast_map *map, const void *key)
+{
+    unsigned int bucket = ast_map_hash(map, key) & (AST_MAP_BUCKETS - 1);
+    for (struct ast_map_entry *entry = map->buckets[bucket]; entry; entry = entry->next)
+    {
+        if (entry->key == key || (map->by_content && S_EQ((const char *)entry->key, (const char *)key)))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void ast_map_set(struct ast_map *map, const void *key, uint32_t value)
+{
+    unsigned int bucket = ast_map_hash(map, key) & (AST_MAP_BUCKETS - 1);
+    struct ast_map_entry *entry = calloc(1, sizeof(struct ast_map_entry));
+    entry->key = key;
+    entry->value = value;
+    entry->next = map->buckets[bucket];
+    map->buckets[bucket] = entry;
+}
+
+static void ast_map_free(struct ast_map *map)
+{
+    for (int i = 0; i < AST_MAP_BUCKETS; i++)
+    {
+        struct ast_map_entry *entry = map->buckets[i];
+        while (entry)
+        {
+            struct ast_map_entry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+}
+
+static uint32_t ast_write_string(struct ast_writer *writer, const char *str)
+{
+    if (!str)
+    {
+        return 0;
+    }
+
+    struct ast_map_entry *entry = ast_map_get(&writer->strings_map, str);
+    if (entry)
+    {
+        return entry->value;
+    }
+
+    uint32_t offset = vector_count(writer->strings);
+    for (const char *c = str; *c; c++)
+    {
+        vector_push(writer->strings, (void *)c);
+    }
+    char terminator = 0;
+    vector_push(writer->strings, &terminator);
+    ast_map_set(&writer->strings_map, str, offset + 1);
+    return offset + 1;
+}
+
+static uint32_t ast_write_ref(struct ast_writer *writer, uint32_t value)
+{
+    vector_push(writer->refs, &value);
+    return vector_count(writer->refs) - 1;
+}
+
+static uint32_t ast_write_node(struct ast_writer *writer, struct node *node);
+
+static uint32_t ast_write_node_list(struct ast_writer *writer, struct vector *vec)
+{
+    if (!vec)
+    {
+        return 0;
+    }
+
+    // Children may write their own lists, so reserve ours first and fill it in after.
+    int total = vector_count(vec);
+    uint32_t list_index = ast_write_ref(writer, total);
+    for (int i = 0; i < total; i++)
+    {
+        ast_write_ref(writer, 0);
+    }
+
+    for (int i = 0; i < total; i++)
+    {
+        uint32_t node_index = ast_write_node(writer, vector_peek_ptr_at(vec, i));
+        *(uint32_t *)vector_at(writer->refs, list_index + 1 + i) = node_index;
+    }
+
+    return list_index + 1;
+}
+
+static uint32_t ast_write_switch_cases(struct ast_writer *writer, struct vector *cases)
+{
+    if (!cases)
+    {
+        return 0;
+    }
+
+    uint32_t list_index = ast_write_ref(writer, vector_count(cases));
+    for (int i = 0; i < vector_count(cases); i++)
+    {
+        struct parsed_switch_case *switch_case = vector_at(cases, i);
+        ast_write_ref(writer, switch_case->index);
+    }
+    return list_index + 1;
+}
+
+static uint32_t ast_write_datatype(struct ast_writer *writer, const struct datatype *dtype)
+{
+    struct ast_map_entry *entry = ast_map_get(&writer->datatypes_map, dtype);
+    if (entry)
+    {
+        return entry->value;
+    }
+
+    struct ast_file_datatype record = {};
+    vector_push(writer->datatypes, &record);
+    uint32_t index = vector_count(writer->datatypes);
+    ast_map_set(&writer->datatypes_map, dtype, index);
+
+    record.flags = dtype->flags;
+    record.type = dtype->type;
+    record.secondary = dtype->secondary ? ast_write_datatype(writer, dtype->secondary) : 0;
+    record.type_str = ast_write_string(writer, dtype->type_str);
+    record.size = dtype->size;
+    record.pointer_depth = dtype->pointer_depth;
+    record.struct_node = ast_write_node(writer, dtype->struct_node);
+    record.brackets = dtype->array.brackets ? ast_write_node_list(writer, array_brackets_node_vector(dtype->array.brackets)) : 0;
+    record.array_size = dtype->array.size;
+    memcpy(vector_at(writer->datatypes, index - 1), &record, sizeof(record));
+    return index;
+}
+
+static void ast_write_node_fields(struct ast_writer *writer, struct node *node, struct ast_file_node *record)
+{
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        record->nodes[0] = ast_write_node(writer, node->exp.left);
+        record->nodes[1] = ast_write_node(writer, node->exp.right);
+        record->str = ast_write_string(writer, node->exp.op);
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        record->nodes[0] = ast_write_node(writer, node->parenthesis.exp);
+        break;
+
+    case NODE_TYPE_IDENTIFIER:
+    case NODE_TYPE_STRING:
+        record->str = ast_write_string(writer, node->sval);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        record->dtype = ast_write_datatype(writer, node->var.type);
+        record->ints[0] = node->var.padding;
+        record->ints[1] = node->var.aoffset;
+        record->str = ast_write_string(writer, node->var.name);
+        record->nodes[0] = ast_write_node(writer, node->var.val);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        record->lists[0] = ast_write_node_list(writer, node->var_list.list);
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        record->ints[0] = node->func.flags;
+        record->ints[1] = node->func.args.stack_addition;
+        record->ints[2] = node->func.stack_size;
+        record->dtype = ast_write_datatype(writer, node->func.rtype);
+        record->str = ast_write_string(writer, node->func.name);
+        record->lists[0] = ast_write_node_list(writer, node->func.args.vector);
+        record->nodes[0] = ast_write_node(writer, node->func.body_n);
+        break;
+
+    case NODE_TYPE_BODY:
+        record->lists[0] = ast_write_node_list(writer, node->body.statements);
+        record->ints[0] = node->body.size;
+        record->ints[1] = node->body.padded;
+        record->nodes[0] = ast_write_node(writer, node->body.largest_var_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        record->nodes[0] = ast_write_node(writer, node->stmt.return_stmt.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        record->nodes[0] = ast_write_node(writer, node->stmt.if_stmt.cond_node);
+        record->nodes[1] = ast_write_node(writer, node->stmt.if_stmt.body_node);
+        record->nodes[2] = ast_write_node(writer, node->stmt.if_stmt.next);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        record->nodes[0] = ast_write_node(writer, node->stmt.else_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        record->nodes[0] = ast_write_node(writer, node->stmt.while_stmt.exp_node);
+        record->nodes[1] = ast_write_node(writer, node->stmt.while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        record->nodes[0] = ast_write_node(writer, node->stmt.do_while_stmt.exp_node);
+        record->nodes[1] = ast_write_node(writer, node->stmt.do_while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        record->nodes[0] = ast_write_node(writer, node->stmt.for_stmt.init_node);
+        record->nodes[1] = ast_write_node(writer, node->stmt.for_stmt.cond_node);
+        record->nodes[2] = ast_write_node(writer, node->stmt.for_stmt.loop_node);
+        record->nodes[3] = ast_write_node(writer, node->stmt.for_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        record->nodes[0] = ast_write_node(writer, node->stmt.switch_stmt.exp);
+        record->nodes[1] = ast_write_node(writer, node->stmt.switch_stmt.body);
+        record->lists[0] = ast_write_switch_cases(writer, node->stmt.switch_stmt.cases);
+        record->ints[0] = node->stmt.switch_stmt.has_default_case;
+        break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+        record->nodes[0] = ast_write_node(writer, node->stmt._case.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_GOTO:
+        record->nodes[0] = ast_write_node(writer, node->stmt._goto.label);
+        break;
+
+    case NODE_TYPE_LABEL:
+        record->nodes[0] = ast_write_node(writer, node->label.name);
+        break;
+
+    case NODE_TYPE_UNARY:
+        record->ints[0] = node->unary.flags;
+        record->ints[1] = node->unary.indirection.depth;
+        record->str = ast_write_string(writer, node->unary.op);
+        record->nodes[0] = ast_write_node(writer, node->unary.operand);
+        break;
+
+    case NODE_TYPE_TENARY:
+        record->nodes[0] = ast_write_node(writer, node->tenary.true_node);
+        record->nodes[1] = ast_write_node(writer, node->tenary.false_node);
+        break;
+
+    case NODE_TYPE_STRUCT:
+    case NODE_TYPE_UNION:
+        record->str = ast_write_string(writer, node->_struct.name);
+        record->nodes[0] = ast_write_node(writer, node->_struct.body_n);
+        record->nodes[1] = ast_write_node(writer, node->_struct.var);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        record->nodes[0] = ast_write_node(writer, node->bracket.inner);
+        break;
+
+    case NODE_TYPE_CAST:
+        record->dtype = ast_write_datatype(writer, node->cast.dtype);
+        record->nodes[0] = ast_write_node(writer, node->cast.operand);
+        break;
+    }
+}
+
+static uint32_t ast_write_node(struct ast_writer *writer, struct node *node)
+{
+    if (!node)
+    {
+        return 0;
+    }
+
+    struct ast_map_entry *entry = ast_map_get(&writer->nodes_map, node);
+    if (entry)
+    {
+        return entry->value;
+    }
+
+    // Reserve the slot before recursing so cycles through binded pointers terminate.
+    struct ast_file_node record = {};
+    vector_push(writer->nodes, &record);
+    uint32_t index = vector_count(writer->nodes);
+    ast_map_set(&writer->nodes_map, node, index);
+
+    record.type = node->type;
+    record.flags = node->flags;
+    record.line = node->pos.line;
+    record.col = node->pos.col;
+    record.filename = ast_write_string(writer, node->pos.filename);
+    if (node->type != NODE_TYPE_IDENTIFIER && node->type != NODE_TYPE_STRING)
+    {
+        record.value = node->llnum;
+    }
+    ast_write_node_fields(writer, node, &record);
+    record.owner = ast_write_node(writer, node->binded.owner);
+    record.function = ast_write_node(writer, node->binded.function);
+    memcpy(vector_at(writer->nodes, index - 1), &record, sizeof(record));
+    return index;
+}
+
+static void ast_write_section(FILE *fp, struct vector *vec, uint32_t *offset_out)
+{
+    *offset_out = ftell(fp);
+    if (vector_count(vec))
+    {
+        fwrite(vector_data_ptr(vec), vec->esize, vector_count(vec), fp);
+    }
+}
+
+int ast_write(struct compile_process *process, FILE *fp)
+{
+    struct ast_writer writer = {};
+    writer.strings_map.by_content = true;
+    writer.nodes = vector_create(sizeof(struct ast_file_node));
+    writer.datatypes = vector_create(sizeof(struct ast_file_datatype));
+    writer.refs = vector_create(sizeof(uint32_t));
+    writer.strings = vector_create(sizeof(char));
+
+    struct ast_file_header header = {};
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    header.version = AST_FILE_VERSION;
+    header.target = target_current()->type;
+    header.roots = ast_write_node_list(&writer, process->node_tree_vec);
+
+    struct vector *includes = process->preprocessor->includes;
+    header.includes = ast_write_ref(&writer, vector_count(includes)) + 1;
+    for (int i = 0; i < vector_count(includes); i++)
+    {
+        struct preprocessor_included_file *included_file = vector_peek_ptr_at(includes, i);
+        ast_write_ref(&writer, ast_write_string(&writer, included_file->filename));
+    }
+
+    header.total_nodes = vector_count(writer.nodes);
+    header.total_datatypes = vector_count(writer.datatypes);
+    header.total_refs = vector_count(writer.refs);
+    header.strings_size = vector_count(writer.strings);
+
+    fwrite(&header, sizeof(header), 1, fp);
+    ast_write_section(fp, writer.nodes, &header.nodes_offset);
+    ast_write_section(fp, writer.datatypes, &header.datatypes_offset);
+    ast_write_section(fp, writer.refs, &header.refs_offset);
+    ast_write_section(fp, writer.strings, &header.strings_offset);
+
+    // Rewrite the header now the section offsets are known.
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    fseek(fp, 0, SEEK_END);
+
+    ast_map_free(&writer.nodes_map);
+    ast_map_free(&writer.datatypes_map);
+    ast_map_free(&writer.strings_map);
+    vector_free(writer.nodes);
+    vector_free(writer.datatypes);
+    vector_free(writer.refs);
+    vector_free(writer.strings);
+    return 0;
+}
+
+struct ast_reader
+{
+    const struct ast_file_header *header;
+    const struct ast_file_node *records;
+    const struct ast_file_datatype *datatype_records;
+    const uint32_t *refs;
+    const char *strings;
+
+    struct node *nodes;
+    struct datatype *datatypes;
+
+    // Node datatypes are interned in this process's datatype table
+    struct compile_process *process;
+};
+
+static struct node *ast_read_node(struct ast_reader *reader, uint32_t index)
+{
+    if (index == 0 || index > reader->header->total_nodes)
+    {
+        return NULL;
+    }
+
+    return &reader->nodes[index - 1];
+}
+
+static const char *ast_read_string(struct ast_reader *reader, uint32_t offset)
+{
+    if (offset == 0 || offset > reader->header->strings_size)
+    {
+        return NULL;
+    }
+
+    return &reader->strings[offset - 1];
+}
+
+static bool ast_read_list_valid(struct ast_reader *reader, uint32_t list)
+{
+    return list != 0 && list <= reader->header->total_refs &&
+           reader->refs[list - 1] <= reader->header->total_refs - list;
+}
+
+static struct vector *ast_read_node_list(struct ast_reader *reader, uint32_t list)
+{
+    if (!ast_read_list_valid(reader, list))
+    {
+        return NULL;
+    }
+
+    struct vector *vec = vector_create(sizeof(struct node *));
+    uint32_t total = reader->refs[list - 1];
+    for (uint32_t i = 0; i < total; i++)
+    {
+        struct node *node = ast_read_node(reader, reader->refs[list + i]);
+        vector_push(vec, &node);
+    }
+    return vec;
+}
+
+static struct vector *ast_read_switch_cases(struct ast_reader *reader, uint32_t list)
+{
+    struct vector *cases = vector_create(sizeof(struct parsed_switch_case));
+    if (!ast_read_list_valid(reader, list))
+    {
+        return cases;
+    }
+
+    uint32_t total = reader->refs[list - 1];
+    for (uint32_t i = 0; i < total; i++)
+    {
+        struct parsed_switch_case switch_case = {.index = (int32_t)reader->refs[list + i]};
+        vector_push(cases, &switch_case);
+    }
+    return cases;
+}
+
+static const struct datatype *ast_read_datatype(struct ast_reader *reader, uint32_t index)
+{
+    if (index == 0 || index > reader->header->total_datatypes)
+    {
+        return reader->process->datatypes->empty;
+    }
+
+    return datatype_intern(reader->process, &reader->datatypes[index - 1]);
+}
+
+static void ast_read_datatypes(struct ast_reader *reader)
+{
+    for (uint32_t i = 0; i < reader->header->total_datatypes; i++)
+    {
+        const struct ast_file_datatype *record = &reader->datatype_records[i];
+        struct datatype *dtype = &reader->datatypes[i];
+        dtype->flags = record->flags;
+        dtype->type = record->type;
+        dtype->type_str = ast_read_string(reader, record->type_str);
+        dtype->size = record->size;
+        dtype->pointer_depth = record->pointer_depth;
+        dtype->struct_node = ast_read_node(reader, record->struct_node);
+        dtype->array.size = record->array_size;
+        if (record->secondary && record->secondary <= reader->header->total_datatypes)
+        {
+            dtype->secondary = &reader->datatypes[record->secondary - 1];
+        }
+
+        if (record->brackets)
+        {
+            dtype->array.brackets = array_brackets_new();
+            vector_free(dtype->array.brackets->n_brackets);
+            dtype->array.brackets->n_brackets = ast_read_node_list(reader, record->brackets);
+        }
+    }
+}
+
+static void ast_read_node_fields(struct ast_reader *reader, const struct ast_file_node *record, struct node *node)
+{
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        node->exp.left = ast_read_node(reader, record->nodes[0]);
+        node->exp.right = ast_read_node(reader, record->nodes[1]);
+        node->exp.op = ast_read_string(reader, record->str);
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        node->parenthesis.exp = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_IDENTIFIER:
+    case NODE_TYPE_STRING:
+        node->sval = ast_read_string(reader, record->str);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        node->var.type = ast_read_datatype(reader, record->dtype);
+        node->var.padding = record->ints[0];
+        node->var.aoffset = record->ints[1];
+        node->var.name = ast_read_string(reader, record->str);
+        node->var.val = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        node->var_list.list = ast_read_node_list(reader, record->lists[0]);
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        node->func.flags = record->ints[0];
+        node->func.args.stack_addition = record->ints[1];
+        node->func.stack_size = record->ints[2];
+        node->func.rtype = ast_read_datatype(reader, record->dtype);
+        node->func.name = ast_read_string(reader, record->str);
+        node->func.args.vector = ast_read_node_list(reader, record->lists[0]);
+        node->func.body_n = ast_read_node(reader, record->nodes[0]);
+        node->func.frame.elements = vector_create(sizeof(struct stack_frame_element));
+        break;
+
+    case NODE_TYPE_BODY:
+        node->body.statements = ast_read_node_list(reader, record->lists[0]);
+        node->body.size = record->ints[0];
+        node->body.padded = record->ints[1];
+        node->body.largest_var_node = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        node->stmt.return_stmt.exp = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        node->stmt.if_stmt.cond_node = ast_read_node(reader, record->nodes[0]);
+        node->stmt.if_stmt.body_node = ast_read_node(reader, record->nodes[1]);
+        node->stmt.if_stmt.next = ast_read_node(reader, record->nodes[2]);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        node->stmt.else_stmt.body_node = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        node->stmt.while_stmt.exp_node = ast_read_node(reader, record->nodes[0]);
+        node->stmt.while_stmt.body_node = ast_read_node(reader, record->nodes[1]);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        node->stmt.do_while_stmt.exp_node = ast_read_node(reader, record->nodes[0]);
+        node->stmt.do_while_stmt.body_node = ast_read_node(reader, record->nodes[1]);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        node->stmt.for_stmt.init_node = ast_read_node(reader, record->nodes[0]);
+        node->stmt.for_stmt.cond_node = ast_read_node(reader, record->nodes[1]);
+        node->stmt.for_stmt.loop_node = ast_read_node(reader, record->nodes[2]);
+        node->stmt.for_stmt.body_node = ast_read_node(reader, record->nodes[3]);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        node->stmt.switch_stmt.exp = ast_read_node(reader, record->nodes[0]);
+        node->stmt.switch_stmt.body = ast_read_node(reader, record->nodes[1]);
+        node->stmt.switch_stmt.cases = ast_read_switch_cases(reader, record->lists[0]);
+        node->stmt.switch_stmt.has_default_case = record->ints[0];
+        break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+        node->stmt._case.exp = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_STATEMENT_GOTO:
+        node->stmt._goto.label = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_LABEL:
+        node->label.name = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_UNARY:
+        node->unary.flags = record->ints[0];
+        node->unary.indirection.depth = record->ints[1];
+        node->unary.op = ast_read_string(reader, record->str);
+        node->unary.operand = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_TENARY:
+        node->tenary.true_node = ast_read_node(reader, record->nodes[0]);
+        node->tenary.false_node = ast_read_node(reader, record->nodes[1]);
+        break;
+
+    case NODE_TYPE_STRUCT:
+    case NODE_TYPE_UNION:
+        node->_struct.name = ast_read_string(reader, record->str);
+        node->_struct.body_n = ast_read_node(reader, record->nodes[0]);
+        node->_struct.var = ast_read_node(reader, record->nodes[1]);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        node->bracket.inner = ast_read_node(reader, record->nodes[0]);
+        break;
+
+    case NODE_TYPE_CAST:
+        node->cast.dtype = ast_read_datatype(reader, record->dtype);
+        node->cast.operand = ast_read_node(reader, record->nodes[0]);
+        break;
+    }
+}
+
+static bool ast_header_valid(const struct ast_file_header *header, size_t file_size)
+{
+    if (file_size < sizeof(struct ast_file_header) ||
+        memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != AST_FILE_VERSION || header->target != target_current()->type)
+    {
+        return false;
+    }
+
+    return header->nodes_offset + (size_t)header->total_nodes * sizeof(struct ast_file_node) <= file_size &&
+           header->datatypes_offset + (size_t)header->total_datatypes * sizeof(struct ast_file_datatype) <= file_size &&
+           header->refs_offset + (size_t)header->total_refs * sizeof(uint32_t) <= file_size &&
+           header->strings_offset + (size_t)header->strings_size <= file_size &&
+           (header->strings_size == 0 || ((const char *)header)[header->strings_offset + header->strings_size - 1] == 0);
+}
+
+bool ast_file_is_ast(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        return false;
+    }
+
+    char magic[8] = {};
+    size_t read = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return read == sizeof(magic) && memcmp(magic, AST_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+static void ast_register_symbols(struct compile_process *process, struct ast_reader *reader)
+{
+    // Structures are registered when their body is parsed, before the declarations using them.
+    for (uint32_t i = 0; i < reader->header->total_nodes; i++)
+    {
+        struct node *node = &reader->nodes[i];
+        if (node_is_struct_or_union(node) && node->_struct.body_n)
+        {
+            symresolver_build_for_node(process, node);
+        }
+    }
+
+    vector_set_peek_pointer(process->node_tree_vec, 0);
+    struct node *node = vector_peek_ptr(process->node_tree_vec);
+    while (node)
+    {
+        if (node->type == NODE_TYPE_VARIABLE || node->type == NODE_TYPE_FUNCTION)
+        {
+            symresolver_build_for_node(process, node);
+        }
+        node = vector_peek_ptr(process->node_tree_vec);
+    }
+}
+
+static void ast_restore_static_includes(struct compile_process *process, struct ast_reader *reader)
+{
+    uint32_t list = reader->header->includes;
+    if (!ast_read_list_valid(reader, list))
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < reader->refs[list - 1]; i++)
+    {
+        const char *filename = ast_read_string(reader, reader->refs[list + i]);
+        PREPROCESSOR_STATIC_INCLUDE_HANDLER_POST_CREATION handler = filename ? preprocessor_static_include_handler_for(filename) : NULL;
+        if (handler)
+        {
+            preprocessor_create_static_include(process->preprocessor, filename, handler);
+        }
+    }
+}
+
+int ast_load(struct compile_process *process, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Strings are used in place, so the mapping lives as long as the process.
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    struct ast_reader reader = {.process = process};
+    reader.header = (const struct ast_file_header *)data;
+    if (!ast_header_valid(reader.header, st.st_size))
+    {
+        munmap((void *)data, st.st_size);
+        return -1;
+    }
+
+    reader.records = (const struct ast_file_node *)(data + reader.header->nodes_offset);
+    reader.datatype_records = (const struct ast_file_datatype *)(data + reader.header->datatypes_offset);
+    reader.refs = (const uint32_t *)(data + reader.header->refs_offset);
+    reader.strings = data + reader.header->strings_offset;
+    reader.nodes = calloc(reader.header->total_nodes + 1, sizeof(struct node));
+    reader.datatypes = calloc(reader.header->total_datatypes + 1, sizeof(struct datatype));
+
+    ast_read_datatypes(&reader);
+    for (uint32_t i = 0; i < reader.header->total_nodes; i++)
+    {
+        const struct ast_file_node *record = &reader.records[i];
+        struct node *node = &reader.nodes[i];
+        node->type = record->type;
+        node->flags = record->flags;
+        node->pos.line = record->line;
+        node->pos.col = record->col;
+        node->pos.filename = ast_read_string(&reader, record->filename);
+        node->binded.owner = ast_read_node(&reader, record->owner);
+        node->binded.function = ast_read_node(&reader, record->function);
+        if (node->type != NODE_TYPE_IDENTIFIER && node->type != NODE_TYPE_STRING)
+        {
+            node->llnum = record->value;
+        }
+    }
+
+    // Interning a datatype reads its array bracket numbers, so every node needs its value first
+    for (uint32_t i = 0; i < reader.header->total_nodes; i++)
+    {
+        ast_read_node_fields(&reader, &reader.records[i], &reader.nodes[i]);
+    }
+
+    struct vector *roots = ast_read_node_list(&reader, reader.header->roots);
+    for (int i = 0; roots && i < vector_count(roots); i++)
+    {
+        struct node *root = vector_peek_ptr_at(roots, i);
+        vector_push(process->node_tree_vec, &root);
+    }
+
+    ast_register_symbols(process, &reader);
+    ast_restore_static_includes(process, &reader);
+    free(reader.datatypes);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * Tight counted for, while and do while loops, the loop overhead is most of
+ * what they execute.
+ *
+ * make bench-loops compares it built with and without norotate.
+ */
+int for_loops(int outer, int inner)
+{
+    int i;
+    int j;
+    int sum = 0;
+    for (i = 0; i < outer; i++)
+    {
+        for (j = 0; j < inner; j++)
+        {
+            sum = sum + j;
+        }
+    }
+    return sum;
+}
+
+int while_loops(int outer, int inner)
+{
+    int i = 0;
+    int j;
+    int sum = 0;
+    while (i < outer)
+    {
+        j = inner;
+        while (j > 0)
+        {
+            sum = sum ^ j;
+            j--;
+        }
+        i++;
+    }
+    return sum;
+}
+
+int do_while_loops(int outer, int inner)
+{
+    int i = 0;
+    int j;
+    int sum = 0;
+    do
+    {
+        j = 0;
+        do
+        {
+            sum = sum + (j & 7) + 1;
+            j++;
+        } while (j < inner);
+        i++;
+    } while (i < outer);
+    return sum;
+}
+
+int main()
+{
+    int sum = for_loops(19999, 10001);
+    sum = sum + while_loops(19999, 10001);
+    sum = sum + do_while_loops(19999, 10001);
+    return sum & 255;
+}
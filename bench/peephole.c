@@ -0,0 +1,43 @@
+/**
+ * Expression heavy code, most of the instructions it generates go through
+ * push and pop pairs, register copies and compares of setcc results.
+ *
+ * make bench-peephole compares it with and without the peephole pass.
+ */
+int mix(int a, int b, int c)
+{
+    return (a * 3 + b) ^ (c - (a >> 2)) ^ ((b & 255) << 1);
+}
+
+int count_between(int seed, int total, int low, int high)
+{
+    int i;
+    int value = seed;
+    int count = 0;
+    for (i = 0; i < total; i++)
+    {
+        value = (value * 1103 + 12345) & 1023;
+        if ((value >= low) && (value <= high))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+int main()
+{
+    int round;
+    int hash = 7;
+    int seed = 13;
+    for (round = 0; round < 2000000; round++)
+    {
+        seed = (seed * 2654435 + 13) & 1023;
+        hash = mix(hash, seed, round) & 65535;
+        if ((hash > 1000) == (round % 3 == 0))
+        {
+            hash = hash + count_between(seed, 16, hash & 511, (hash & 511) + 256);
+        }
+    }
+    return hash & 255;
+}
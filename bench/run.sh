@@ -0,0 +1,29 @@
+#!/bin/sh
+# Builds a benchmark with the given compiler and prints the best wall time of a few runs.
+#
+# ./bench/run.sh <compiler> <file.c> <binary> [compiler options...]
+compiler=$1
+source=$2
+binary=$3
+shift 3
+
+mkdir -p "$(dirname "$binary")"
+if ! $compiler build "$binary" "$@" "$source" > /dev/null; then
+    echo "$binary: build failed"
+    exit 1
+fi
+
+best=
+for run in 1 2 3 4 5; do
+    start=$(date +%s%N)
+    "$binary"
+    status=$?
+    end=$(date +%s%N)
+    elapsed=$(( (end - start) / 1000000 ))
+    if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+        best=$elapsed
+    fi
+done
+
+# The exit code is a checksum, it has to be the same before and after
+echo "$binary: ${best}ms, exit code $status"
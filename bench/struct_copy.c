@@ -0,0 +1,71 @@
+/**
+ * Assigns structures of 64 to 512 bytes and passes them by value.
+ *
+ * make bench-struct-copy compares it built with and without noblockcopy.
+ */
+struct s64
+{
+    int first;
+    int v[14];
+    int last;
+};
+
+struct s128
+{
+    int first;
+    int v[30];
+    int last;
+};
+
+struct s512
+{
+    int first;
+    int v[126];
+    int last;
+};
+
+struct s64 a64;
+struct s64 b64;
+struct s128 a128;
+struct s128 b128;
+struct s512 a512;
+struct s512 b512;
+
+int take64(struct s64 s)
+{
+    return s.first + s.last;
+}
+
+int take128(struct s128 s)
+{
+    return s.first + s.last;
+}
+
+int take512(struct s512 s)
+{
+    return s.first + s.last;
+}
+
+int main()
+{
+    int i;
+    int sum = 0;
+    for (i = 0; i < 3000000; i++)
+    {
+        a64.first = i;
+        a64.last = 1;
+        b64 = a64;
+        sum = sum + take64(b64);
+
+        a128.first = i;
+        a128.last = 2;
+        b128 = a128;
+        sum = sum + take128(b128);
+
+        a512.first = i;
+        a512.last = 3;
+        b512 = a512;
+        sum = sum + take512(b512);
+    }
+    return sum & 255;
+}
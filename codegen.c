@@ -1,21 +1,35 @@
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/buffer.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
 
 #define STRUCTURE_PUSH_START_POSITION_ONE 1
 
 
-static struct compile_process *current_process = NULL;
-static struct node *current_function = NULL;
+static COMPILER_THREAD_LOCAL struct compile_process *current_process = NULL;
+static COMPILER_THREAD_LOCAL struct node *current_function = NULL;
+// Set when the address of a parameter or local can outlive the statement, tail calls must keep the frame
+static COMPILER_THREAD_LOCAL bool current_function_frame_escapes = false;
 
-void asm_push(const char *ins, ...);
+void asm_push_ins2(int op, struct asm_ir_operand destination, struct asm_ir_operand source);
+void asm_push_comment(const char *fmt, ...);
 struct _x86_generator_private* x86_generator_private(struct generator* generator);
 void codegen_gen_exp(struct generator* generator, struct node* node, int flags);
 void codegen_end_exp(struct generator* generator);
 void codegen_entity_address(struct generator* generator, struct resolver_entity* entity, struct generator_entity_address* address_out);
-void asm_push_ins_with_datatype(struct datatype* dtype, const char* fmt, ...);
+void asm_push_ins_with_datatype(const struct datatype* dtype, struct asm_ir_operand operand);
+void codegen_gen_multiply_by_constant(const char *reg, int value);
+bool codegen_datatype_is_wide(const struct datatype *dtype);
+const char *codegen_address_register(const char *reg);
+const char *codegen_register_for_datatype(const char *reg, const struct datatype *dtype);
+size_t codegen_push_size(const struct datatype *dtype);
+void codegen_extend_register(const char *reg64, const char *reg32, const struct datatype *from);
+void codegen_widen_register(const char *reg, const struct datatype *from, const struct datatype *to);
+void codegen_restore_callee_saved_registers(struct node *function);
+void codegen_generate_ret(struct node *function);
 
 
 struct history;
@@ -26,15 +40,18 @@ struct _x86_generator_private
         struct history* history;
     } remembered;
 
-} _x86_generator_private;
+};
+
+static COMPILER_THREAD_LOCAL struct _x86_generator_private _x86_generator_private;
 
-struct generator x86_codegen = {
-    .asm_push=asm_push,
+// The private pointer is bound in codegen() as the address of a thread local is not a constant.
+COMPILER_THREAD_LOCAL struct generator x86_codegen = {
+    .asm_push_ins2=asm_push_ins2,
+    .asm_push_comment=asm_push_comment,
     .gen_exp=codegen_gen_exp,
     .end_exp=codegen_end_exp,
     .entity_address=codegen_entity_address,
-    .ret=asm_push_ins_with_datatype,
-    .private=&_x86_generator_private
+    .ret=asm_push_ins_with_datatype
 };
 enum
 {
@@ -148,10 +165,12 @@ static struct history *history_down(struct history *history, int flags)
 void codegen_generate_exp_node(struct node *node, struct history *history);
 const char *codegen_sub_register(const char *original_register, size_t size);
 void codegen_generate_entity_access_for_function_call(struct resolver_result *result, struct resolver_entity *entity);
-void codegen_generate_structure_push(struct resolver_entity *entity, struct history *history, int start_pos);
-void codegen_plus_or_minus_string_for_value(char *out, int val, size_t len);
+void codegen_generate_structure_push(struct resolver_entity *entity, struct history *history);
 bool codegen_resolve_node_for_value(struct node *node, struct history *history);
-bool asm_datatype_back(struct datatype *dtype_out);
+bool asm_datatype_back(const struct datatype **dtype_out);
+struct stack_frame_element *asm_stack_back();
+struct stack_frame_element *asm_stack_peek();
+void asm_stack_peek_start();
 void codegen_generate_entity_access_for_unary_get_address(struct resolver_result *result, struct resolver_entity *entity);
 void codegen_generate_expressionable(struct node *node, struct history *history);
 int codegen_label_count();
@@ -183,96 +202,135 @@ void codegen_entity_address(struct generator* generator, struct resolver_entity*
 {
     struct resolver_default_entity_data* data = codegen_entity_private(entity);
     address_out->address = data->address;
-    address_out->base_address = data->base_address;
     address_out->is_stack = data->flags & RESOLVER_DEFAULT_ENTITY_FLAG_IS_LOCAL_STACK;
     address_out->offset = data->offset;
 }
 
-void asm_push_args(const char *ins, va_list args)
+void asm_flush()
 {
-    va_list args2;
-    va_copy(args2, args);
-    vfprintf(stdout, ins, args);
-    fprintf(stdout, "\n");
+    struct buffer *output = current_process->generator->output;
     if (current_process->ofile)
     {
-        vfprintf(current_process->ofile, ins, args2);
-        fprintf(current_process->ofile, "\n");
+        fwrite(buffer_ptr(output), 1, output->len, current_process->ofile);
+    }
+
+    if (current_process->flags & COMPILE_PROCESS_ECHO_ASM)
+    {
+        fwrite(buffer_ptr(output), 1, output->len, stdout);
     }
+    output->len = 0;
+}
+
+void asm_push_no_nl_args(const char *fmt, va_list args)
+{
+    buffer_vprintf(current_process->generator->line, fmt, args);
 }
 
-void asm_push(const char *ins, ...)
+// Ends the line built so far and keeps it as a directive, only data and sections are written as text
+void asm_push_directive(const char *fmt, ...)
 {
+    struct code_generator *generator = current_process->generator;
     va_list args;
-    va_start(args, ins);
-    asm_push_args(ins, args);
+    va_start(args, fmt);
+    asm_push_no_nl_args(fmt, args);
     va_end(args);
+    buffer_write(generator->line, 0);
+    asm_ir_push(generator->ir, asm_ir_instruction_new(ASM_OP_DIRECTIVE, buffer_ptr(generator->line)));
+    generator->line->len = 0;
 }
 
-void asm_push_ins_with_datatype(struct datatype* dtype, const char* fmt, ...)
+void asm_push_no_nl(const char *fmt, ...)
 {
-     char tmp_buf[200];
-    sprintf(tmp_buf, "push %s", fmt);
     va_list args;
     va_start(args, fmt);
-    asm_push_args(tmp_buf, args);
+    asm_push_no_nl_args(fmt, args);
     va_end(args);
-
-    assert(current_function);
-    stackframe_push(current_function, &(struct stack_frame_element){.type = STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, .name="result_value", .flags=STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE, .data.dtype=*dtype});
 }
 
+void asm_push_label(const char *fmt, ...)
+{
+    char label[ASM_LINE_MAX_LENGTH];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(label, sizeof(label), fmt, args);
+    va_end(args);
+    asm_ir_push(current_process->generator->ir, asm_ir_instruction_new(ASM_OP_LABEL, label));
+}
 
-void asm_push_no_nl(const char *ins, ...)
+void asm_push_comment(const char *fmt, ...)
 {
+    char comment[ASM_LINE_MAX_LENGTH];
     va_list args;
-    va_start(args, ins);
-    vfprintf(stdout, ins, args);
+    va_start(args, fmt);
+    vsnprintf(comment, sizeof(comment), fmt, args);
     va_end(args);
+    asm_ir_push(current_process->generator->ir, asm_ir_instruction_new(ASM_OP_COMMENT, comment));
+}
 
-    if (current_process->ofile)
+void asm_push_ins0(int op)
+{
+    asm_ir_push(current_process->generator->ir, asm_ir_instruction_new(op, NULL));
+}
+
+void asm_push_ins1(int op, struct asm_ir_operand operand)
+{
+    struct asm_ir_instruction *ins = asm_ir_instruction_new(op, NULL);
+    ins->operands[ins->total_operands++] = operand;
+    asm_ir_push(current_process->generator->ir, ins);
+}
+
+void asm_push_ins2(int op, struct asm_ir_operand destination, struct asm_ir_operand source)
+{
+    struct asm_ir_instruction *ins = asm_ir_instruction_new(op, NULL);
+    ins->operands[ins->total_operands++] = destination;
+    ins->operands[ins->total_operands++] = source;
+    asm_ir_push(current_process->generator->ir, ins);
+}
+
+// Prints the instructions collected so far, writes them out once enough has built up or when final is set
+void codegen_flush_ir(bool final)
+{
+    struct code_generator *generator = current_process->generator;
+    regalloc_temporaries(generator->ir);
+    regalloc_callee_saved(generator->ir);
+    if (target_is_x86_64())
+    {
+        x86_64_lower(generator->ir);
+    }
+    // After lowering so it also sees the pushes and pops codegen writes with 64 bit registers
+    peephole_optimize(generator->ir, generator->peephole_patterns, &generator->peephole_stats);
+    asm_ir_print(generator->ir, generator->output);
+    asm_ir_clear(generator->ir);
+    if (final || generator->output->len >= CODEGEN_OUTPUT_FLUSH_SIZE)
     {
-        va_list args;
-        va_start(args, ins);
-        vfprintf(current_process->ofile, ins, args);
-        va_end(args);
+        asm_flush();
     }
 }
 
-void asm_push_ins_push(const char *fmt, int stack_entity_type, const char *stack_entity_name, ...)
+void asm_push_ins_with_datatype(const struct datatype* dtype, struct asm_ir_operand operand)
 {
-    char tmp_buf[200];
-    sprintf(tmp_buf, "push %s", fmt);
-    va_list args;
-    va_start(args, stack_entity_name);
-    asm_push_args(tmp_buf, args);
-    va_end(args);
+    asm_push_ins1(ASM_OP_PUSH, operand);
+    assert(current_function);
+    stackframe_push(current_function, &(struct stack_frame_element){.type = STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, .name="result_value", .flags=STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE, .data.dtype=datatype_intern(current_process, dtype)});
+}
 
+void asm_push_ins_push(struct asm_ir_operand operand, int stack_entity_type, const char *stack_entity_name)
+{
+    asm_push_ins1(ASM_OP_PUSH, operand);
     assert(current_function);
     stackframe_push(current_function, &(struct stack_frame_element){.type = stack_entity_type, .name = stack_entity_name});
 }
 
-void asm_push_ins_push_with_flags(const char *fmt, int stack_entity_type, const char *stack_entity_name, int flags, ...)
+void asm_push_ins_push_with_flags(struct asm_ir_operand operand, int stack_entity_type, const char *stack_entity_name, int flags)
 {
-    char tmp_buf[200];
-    sprintf(tmp_buf, "push %s", fmt);
-    va_list args;
-    va_start(args, flags);
-    asm_push_args(tmp_buf, args);
-    va_end(args);
+    asm_push_ins1(ASM_OP_PUSH, operand);
     assert(current_function);
     stackframe_push(current_function, &(struct stack_frame_element){.flags = flags, .type = stack_entity_type, .name = stack_entity_name});
 }
 
-int asm_push_ins_pop(const char *fmt, int expecting_stack_entity_type, const char *expecting_stack_entity_name, ...)
+int asm_push_ins_pop(struct asm_ir_operand operand, int expecting_stack_entity_type, const char *expecting_stack_entity_name)
 {
-    char tmp_buf[200];
-    sprintf(tmp_buf, "pop %s", fmt);
-    va_list args;
-    va_start(args, expecting_stack_entity_name);
-    asm_push_args(tmp_buf, args);
-    va_end(args);
-
+    asm_push_ins1(ASM_OP_POP, operand);
     assert(current_function);
     struct stack_frame_element *element = stackframe_back(current_function);
     int flags = element->flags;
@@ -280,47 +338,37 @@ int asm_push_ins_pop(const char *fmt, int expecting_stack_entity_type, const cha
     return flags;
 }
 
-void asm_push_ins_push_with_data(const char *fmt, int stack_entity_type, const char *stack_entity_name, int flags, struct stack_frame_data *data, ...)
+void asm_push_ins_push_with_data(struct asm_ir_operand operand, int stack_entity_type, const char *stack_entity_name, int flags, const struct datatype *dtype)
 {
-    char tmp_buf[200];
-    sprintf(tmp_buf, "push %s", fmt);
-    va_list args;
-    va_start(args, data);
-    asm_push_args(tmp_buf, args);
-    va_end(args);
+    // A value that needs all 64 bits is pushed from the whole register
+    if (operand.type == ASM_IR_OPERAND_REGISTER)
+    {
+        operand = asm_ir_reg(codegen_register_for_datatype(operand.reg, dtype));
+    }
+    asm_push_ins1(ASM_OP_PUSH, operand);
 
     flags |= STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE;
     assert(current_function);
-    stackframe_push(current_function, &(struct stack_frame_element){.type = stack_entity_type, .name = stack_entity_name, .flags = flags, .data = *data});
+    stackframe_push(current_function, &(struct stack_frame_element){.type = stack_entity_type, .name = stack_entity_name, .flags = flags, .data.dtype = dtype});
 }
 void asm_push_ebp()
 {
-    asm_push_ins_push("ebp", STACK_FRAME_ELEMENT_TYPE_SAVED_BP, "function_entry_saved_ebp");
+    asm_push_ins_push(asm_ir_reg("ebp"), STACK_FRAME_ELEMENT_TYPE_SAVED_BP, "function_entry_saved_ebp");
 }
 
 void asm_pop_ebp()
 {
-    asm_push_ins_pop("ebp", STACK_FRAME_ELEMENT_TYPE_SAVED_BP, "function_entry_saved_ebp");
+    asm_push_ins_pop(asm_ir_reg("ebp"), STACK_FRAME_ELEMENT_TYPE_SAVED_BP, "function_entry_saved_ebp");
 }
 
-int asm_push_ins_pop_or_ignore(const char *fmt, int expecting_stack_entity_type, const char *expecting_stack_entity_name, ...)
+int asm_push_ins_pop_or_ignore(struct asm_ir_operand operand, int expecting_stack_entity_type, const char *expecting_stack_entity_name)
 {
     if (!stackframe_back_expect(current_function, expecting_stack_entity_type, expecting_stack_entity_name))
     {
         return STACK_FRAME_ELEMENT_FLAG_ELEMENT_NOT_FOUND;
     }
 
-    char tmp_buf[200];
-    sprintf(tmp_buf, "pop %s", fmt);
-    va_list args;
-    va_start(args, expecting_stack_entity_name);
-    asm_push_args(tmp_buf, args);
-    va_end(args);
-
-    struct stack_frame_element *element = stackframe_back(current_function);
-    int flags = element->flags;
-    stackframe_pop_expecting(current_function, expecting_stack_entity_type, expecting_stack_entity_name);
-    return flags;
+    return asm_push_ins_pop(operand, expecting_stack_entity_type, expecting_stack_entity_name);
 }
 
 void codegen_data_section_add(const char *data, ...)
@@ -332,17 +380,26 @@ void codegen_data_section_add(const char *data, ...)
     vector_push(current_process->generator->custom_data_section, &new_data);
 }
 
+void codegen_rodata_section_add(const char *data, ...)
+{
+    va_list args;
+    va_start(args, data);
+    char* new_data= malloc(256);
+    vsprintf(new_data, data, args);
+    vector_push(current_process->generator->custom_rodata_section, &new_data);
+}
+
 
 void codegen_stack_add_no_compile_time_stack_frame_restore(size_t stack_size)
 {
     if (stack_size != 0)
     {
-        asm_push("add esp, %lld", stack_size);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg("esp"), asm_ir_imm(stack_size));
     }
 }
 void asm_pop_ebp_no_stack_frame_restore()
 {
-    asm_push("pop ebp");
+    asm_push_ins1(ASM_OP_POP, asm_ir_reg("ebp"));
 }
 
 void codegen_stack_sub_with_name(size_t stack_size, const char *name)
@@ -350,7 +407,7 @@ void codegen_stack_sub_with_name(size_t stack_size, const char *name)
     if (stack_size != 0)
     {
         stackframe_sub(current_function, STACK_FRAME_ELEMENT_TYPE_UNKNOWN, name, stack_size);
-        asm_push("sub esp, %lld", stack_size);
+        asm_push_ins2(ASM_OP_SUB, asm_ir_reg("esp"), asm_ir_imm(stack_size));
     }
 }
 void codegen_stack_sub(size_t stack_size)
@@ -363,7 +420,7 @@ void codegen_stack_add_with_name(size_t stack_size, const char *name)
     if (stack_size != 0)
     {
         stackframe_add(current_function, STACK_FRAME_ELEMENT_TYPE_UNKNOWN, name, stack_size);
-        asm_push("add esp, %lld", stack_size);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg("esp"), asm_ir_imm(stack_size));
     }
 }
 
@@ -377,24 +434,29 @@ struct resolver_entity *codegen_new_scope_entity(struct node *var_node, int offs
     return resolver_default_new_scope_entity(current_process->resolver, var_node, offset, flags);
 }
 
+unsigned int codegen_string_hash(const char *str)
+{
+    unsigned int hash = 5381;
+    while (*str)
+    {
+        hash = hash * 33 + (unsigned char)*str;
+        str++;
+    }
+    return hash & (CODEGEN_STRING_TABLE_BUCKETS - 1);
+}
+
 const char *codegen_get_label_for_string(const char *str)
 {
-    const char *result = NULL;
     struct code_generator *generator = current_process->generator;
-    vector_set_peek_pointer(generator->string_table, 0);
-    struct string_table_element *current = vector_peek_ptr(generator->string_table);
-    while (current)
+    for (struct string_table_element *current = generator->string_buckets[codegen_string_hash(str)]; current; current = current->next)
     {
         if (S_EQ(current->str, str))
         {
-            result = current->label;
-            break;
+            return current->label;
         }
-
-        current = vector_peek_ptr(generator->string_table);
     }
 
-    return result;
+    return NULL;
 }
 
 const char *codegen_register_string(const char *str)
@@ -410,7 +472,11 @@ const char *codegen_register_string(const char *str)
     int label_id = codegen_label_count();
     sprintf((char *)str_elem->label, "str_%i", label_id);
     str_elem->str = str;
+    str_elem->len = strlen(str);
     vector_push(current_process->generator->string_table, &str_elem);
+    unsigned int bucket = codegen_string_hash(str);
+    str_elem->next = current_process->generator->string_buckets[bucket];
+    current_process->generator->string_buckets[bucket] = str_elem;
     return str_elem->label;
 }
 
@@ -423,6 +489,11 @@ struct code_generator *codegenerator_new(struct compile_process *process)
     generator->responses = vector_create(sizeof(struct response *));
     generator->_switch.swtiches = vector_create(sizeof(struct generator_switch_stmt_entity));
     generator->custom_data_section = vector_create(sizeof(const char*));
+    generator->custom_rodata_section = vector_create(sizeof(const char*));
+    generator->ir = asm_ir_new();
+    generator->peephole_patterns = process->flags & COMPILE_PROCESS_NO_PEEPHOLE ? 0 : PEEPHOLE_PATTERN_ALL;
+    generator->line = buffer_create();
+    generator->output = buffer_create();
     return generator;
 }
 
@@ -442,9 +513,9 @@ struct codegen_exit_point *codegen_current_exit_point()
 
 int codegen_label_count()
 {
-    static int count = 0;
-    count++;
-    return count;
+    struct code_generator *generator = current_process->generator;
+    generator->label_count++;
+    return generator->label_count;
 }
 void codegen_begin_exit_point()
 {
@@ -457,7 +528,7 @@ void codegen_end_exit_point()
     struct code_generator *gen = current_process->generator;
     struct codegen_exit_point *exit_point = codegen_current_exit_point();
     assert(exit_point);
-    asm_push(".exit_point_%i:", exit_point->id);
+    asm_push_label(".exit_point_%i", exit_point->id);
     free(exit_point);
     vector_pop(gen->exit_points);
 }
@@ -466,14 +537,14 @@ void codegen_goto_exit_point(struct node *node)
 {
     struct code_generator *gen = current_process->generator;
     struct codegen_exit_point *exit_point = codegen_current_exit_point();
-    asm_push("jmp .exit_point_%i", exit_point->id);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol(".exit_point_%i", exit_point->id));
 }
 
 void codegen_goto_exit_point_maintain_stack(struct node *node)
 {
     struct code_generator *gen = current_process->generator;
     struct codegen_exit_point *exit_point = codegen_current_exit_point();
-    asm_push("jmp .exit_point_%i", exit_point->id);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol(".exit_point_%i", exit_point->id));
 }
 
 void codegen_register_entry_point(int entry_point_id)
@@ -494,7 +565,12 @@ void codegen_begin_entry_point()
 {
     int entry_point_id = codegen_label_count();
     codegen_register_entry_point(entry_point_id);
-    asm_push(".entry_point_%i:", entry_point_id);
+    asm_push_label(".entry_point_%i", entry_point_id);
+}
+
+void codegen_place_entry_point()
+{
+    asm_push_label(".entry_point_%i", codegen_current_entry_point()->id);
 }
 
 void codegen_end_entry_point()
@@ -510,7 +586,7 @@ void codegen_goto_entry_point(struct node *current_node)
 {
     struct code_generator *gen = current_process->generator;
     struct codegen_entry_point *entry_point = codegen_current_entry_point();
-    asm_push("jmp .entry_point_%i", entry_point->id);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol(".entry_point_%i", entry_point->id));
 }
 
 void codegen_begin_entry_exit_point()
@@ -519,6 +595,13 @@ void codegen_begin_entry_exit_point()
     codegen_begin_exit_point();
 }
 
+// Loops place their entry point where continue should land, just before the condition at the bottom
+void codegen_begin_loop_entry_exit_point()
+{
+    codegen_register_entry_point(codegen_label_count());
+    codegen_begin_exit_point();
+}
+
 void codegen_end_entry_exit_point()
 {
     codegen_end_entry_point();
@@ -532,7 +615,7 @@ void codegen_begin_switch_statement()
     vector_push(switch_stmt_data->swtiches, &switch_stmt_data->current);
     memset(&switch_stmt_data->current, 0, sizeof(struct generator_switch_stmt_entity));
     int switch_stmt_id = codegen_label_count();
-    asm_push(".switch_stmt_%i:", switch_stmt_id);
+    asm_push_label(".switch_stmt_%i", switch_stmt_id);
     switch_stmt_data->current.id = switch_stmt_id;
 }
 
@@ -540,7 +623,11 @@ void codegen_end_switch_statement()
 {
     struct code_generator *generator = current_process->generator;
     struct generator_switch_stmt *switch_stmt_data = &generator->_switch;
-    asm_push(".switch_stmt_%i_end:", switch_stmt_data->current.id);
+    asm_push_label(".switch_stmt_%i_end", switch_stmt_data->current.id);
+    if (switch_stmt_data->current.has_jump_table && !switch_stmt_data->current.has_default_case)
+    {
+        asm_push_label("..@switch_stmt_%i_default", switch_stmt_data->current.id);
+    }
     // Lets restore the older switch statement
     memcpy(&switch_stmt_data->current, vector_back(switch_stmt_data->swtiches), sizeof(struct generator_switch_stmt_entity));
     vector_pop(switch_stmt_data->swtiches);
@@ -557,7 +644,12 @@ void codegen_begin_case_statement(int index)
 {
     struct code_generator *generator = current_process->generator;
     struct generator_switch_stmt *switch_stmt_data = &generator->_switch;
-    asm_push(".switch_stmt_%i_case_%i:", switch_stmt_data->current.id, index);
+    asm_push_label(".switch_stmt_%i_case_%i", switch_stmt_data->current.id, index);
+    if (switch_stmt_data->current.has_jump_table)
+    {
+        // Jump tables live in .rodata where these local labels can't be reached, ..@ labels can
+        asm_push_label("..@switch_stmt_%i_case_%i", switch_stmt_data->current.id, index);
+    }
 }
 
 void codegen_end_case_statement()
@@ -601,16 +693,16 @@ void codegen_generate_global_variable_for_primitive(struct node *node)
         if (node->var.val->type == NODE_TYPE_STRING)
         {
             const char *label = codegen_register_string(node->var.val->sval);
-            asm_push("%s: %s %s", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf), label);
+            asm_push_directive("%s: %s %s", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf), label);
         }
         else
         {
-            asm_push("%s: %s %lld", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf), node->var.val->llnum);
+            asm_push_directive("%s: %s %lld", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf), node->var.val->llnum);
         }
     }
     else
     {
-        asm_push("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
+        asm_push_directive("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
     }
 }
 
@@ -623,7 +715,7 @@ void codegen_generate_global_variable_for_struct(struct node *node)
     }
 
     char tmp_buf[256];
-    asm_push("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
+    asm_push_directive("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
 }
 
 void codegen_generate_global_variable_for_union(struct node *node)
@@ -635,7 +727,7 @@ void codegen_generate_global_variable_for_union(struct node *node)
     }
 
     char tmp_buf[256];
-    asm_push("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
+    asm_push_directive("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
 }
 
 void codegen_generate_variable_for_array(struct node *node)
@@ -647,18 +739,23 @@ void codegen_generate_variable_for_array(struct node *node)
     }
 
     char tmp_buf[256];
-    asm_push("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
+    asm_push_directive("%s: %s 0", node->var.name, asm_keyword_for_size(variable_size(node), tmp_buf));
 }
 void codegen_generate_global_variable(struct node *node)
 {
-    asm_push("; %s %s", node->var.type.type_str, node->var.name);
-    if (node->var.type.flags & DATATYPE_FLAG_IS_ARRAY)
+    if (node->flags & NODE_FLAG_IS_UNREFERENCED)
+    {
+        return;
+    }
+
+    asm_push_comment("%s %s", node->var.type->type_str, node->var.name);
+    if (node->var.type->flags & DATATYPE_FLAG_IS_ARRAY)
     {
         codegen_generate_variable_for_array(node);
         codegen_new_scope_entity(node, 0, 0);
         return;
     }
-    switch (node->var.type.type)
+    switch (node->var.type->type)
     {
     case DATA_TYPE_VOID:
     case DATA_TYPE_CHAR:
@@ -737,7 +834,7 @@ void codegen_generate_data_section_part(struct node *node)
 }
 void codegen_generate_data_section()
 {
-    asm_push("section .data");
+    asm_push_directive("section .data");
     struct node *node = codegen_node_next();
     while (node)
     {
@@ -753,23 +850,127 @@ struct resolver_entity *codegen_register_function(struct node *func_node, int fl
 void codegen_generate_function_prototype(struct node *node)
 {
     codegen_register_function(node, 0);
-    asm_push("extern %s", node->func.name);
+    asm_push_directive("extern %s", node->func.name);
+}
+
+size_t codegen_function_locals_size(struct node *function)
+{
+    size_t stack_size = function_node_stack_size(function);
+    return target_is_x86_64() ? align_value(stack_size, DATA_SIZE_DDWORD) : stack_size;
+}
+
+// Places the arguments of the function up to index, gives where argument index goes
+int codegen_function_place_arguments(struct node *function, int index, struct x86_64_argument_placement *placement, size_t *stack_offset_out)
+{
+    struct vector *arguments = function_node_argument_vec(function);
+    x86_64_placement_start(placement, function->func.rtype);
+    int reg = -1;
+    for (int i = 0; i <= index && i < vector_count(arguments); i++)
+    {
+        struct node *argument = *(struct node **)vector_at(arguments, i);
+        reg = x86_64_place_argument(placement, argument->var.type, stack_offset_out);
+    }
+    return reg;
+}
+
+// Bytes of the registers a variadic function pushes in front of the stack arguments, see codegen_generate_register_save_area
+size_t codegen_function_register_save_area_size(struct node *function)
+{
+    if (!target_is_x86_64() || !(function->func.flags & FUNCTION_NODE_FLAG_IS_VARIADIC))
+    {
+        return 0;
+    }
+
+    return CODEGEN_X86_64_REGISTER_ARGUMENTS * DATA_SIZE_DDWORD;
+}
+
+int codegen_function_register_arguments(struct node *function)
+{
+    if (!target_is_x86_64() || codegen_function_register_save_area_size(function))
+    {
+        return 0;
+    }
+
+    struct x86_64_argument_placement placement;
+    size_t stack_offset;
+    codegen_function_place_arguments(function, vector_count(function_node_argument_vec(function)), &placement, &stack_offset);
+    return placement.registers;
+}
+
+// Register arguments are spilled in register order, so a structure in two registers is whole in memory
+int codegen_function_register_argument_offset(struct node *function, int reg)
+{
+    if (codegen_function_register_save_area_size(function))
+    {
+        return DATA_SIZE_DDWORD * 2 + reg * DATA_SIZE_DDWORD;
+    }
+
+    return -(int)(codegen_function_locals_size(function) + codegen_function_register_arguments(function) * DATA_SIZE_DDWORD) + reg * DATA_SIZE_DDWORD;
+}
+
+/**
+ * On x86-64 the register arguments are spilled below the locals followed by the callee saved registers,
+ * the others are where the caller put them.
+ */
+int codegen_function_argument_offset(struct node *function, struct node *argument, int index)
+{
+    if (!target_is_x86_64())
+    {
+        return argument->var.aoffset;
+    }
+
+    struct x86_64_argument_placement placement;
+    size_t stack_offset = 0;
+    int reg = codegen_function_place_arguments(function, index, &placement, &stack_offset);
+    if (reg != -1)
+    {
+        return codegen_function_register_argument_offset(function, reg);
+    }
+
+    return DATA_SIZE_DDWORD * 2 + codegen_function_register_save_area_size(function) + stack_offset;
+}
+
+int codegen_function_saved_register_offset(struct node *function, int index)
+{
+    return -(int)(codegen_function_locals_size(function) + codegen_function_register_arguments(function) * DATA_SIZE_DDWORD + (index + 1) * STACK_PUSH_SIZE);
+}
+
+size_t codegen_function_frame_size(struct node *function)
+{
+    size_t frame_size = -codegen_function_saved_register_offset(function, target_current()->total_callee_saved_registers - 1);
+    return C_ALIGN(frame_size);
 }
 
-void codegen_generate_function_arguments(struct vector *argument_vector)
+void codegen_generate_function_arguments(struct node *function)
 {
+    struct vector *argument_vector = function_node_argument_vec(function);
     vector_set_peek_pointer(argument_vector, 0);
     struct node *current = vector_peek_ptr(argument_vector);
+    int index = 0;
     while (current)
     {
-        codegen_new_scope_entity(current, current->var.aoffset, RESOLVER_DEFAULT_ENTITY_FLAG_IS_LOCAL_STACK);
+        codegen_new_scope_entity(current, codegen_function_argument_offset(function, current, index), RESOLVER_DEFAULT_ENTITY_FLAG_IS_LOCAL_STACK);
         current = vector_peek_ptr(argument_vector);
+        index++;
     }
 }
 
 void codegen_generate_number_node(struct node *node, struct history *history)
 {
-    asm_push_ins_push_with_data("dword %i", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_NUMERICAL, &(struct stack_frame_data){.dtype = datatype_for_numeric()}, node->llnum);
+    long long value = (long long)node->llnum;
+    if (target_is_x86_64() && (value < INT_MIN || value > INT_MAX))
+    {
+        // Too wide for an immediate, only mov takes a 64 bit one
+        struct datatype dtype = datatype_for_numeric();
+        dtype.type = DATA_TYPE_LONG;
+        dtype.type_str = "long";
+        dtype.size = DATA_SIZE_DDWORD;
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("rax"), asm_ir_imm(value));
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_NUMERICAL, datatype_intern(current_process, &dtype));
+        return;
+    }
+
+    asm_push_ins_push_with_data(asm_ir_sized(DATA_SIZE_DWORD, asm_ir_imm((int)node->llnum)), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_NUMERICAL, current_process->datatypes->numeric);
 }
 
 bool codegen_is_exp_root_for_flags(int flags)
@@ -784,26 +985,27 @@ bool codegen_is_exp_root(struct history *history)
 
 void codegen_reduce_register(const char *reg, size_t size, bool is_signed)
 {
-    if (size != DATA_SIZE_DWORD && size > 0)
+    if (size > 0 && size < DATA_SIZE_DWORD)
     {
-        const char *ins = "movsx";
+        int op = ASM_OP_MOVSX;
         if (!is_signed)
         {
-            ins = "movzx";
+            op = ASM_OP_MOVZX;
         }
-        asm_push("%s eax, %s", ins, codegen_sub_register("eax", size));
+        asm_push_ins2(op, asm_ir_reg("eax"), asm_ir_reg(codegen_sub_register("eax", size)));
     }
 }
 
 void codegen_gen_mem_access_get_address(struct node *node, int flags, struct resolver_entity *entity)
 {
-    asm_push("lea ebx, [%s]", codegen_entity_private(entity)->address);
-    asm_push_ins_push_with_flags("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS);
+    const char *reg = codegen_address_register("ebx");
+    asm_push_ins2(ASM_OP_LEA, asm_ir_reg(reg), asm_ir_mem(codegen_entity_private(entity)->address));
+    asm_push_ins_push_with_flags(asm_ir_reg(reg), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS);
 }
 
-void codegen_generate_structure_push_or_return(struct resolver_entity *entity, struct history *history, int start_pos)
+void codegen_generate_structure_push_or_return(struct resolver_entity *entity, struct history *history)
 {
-    codegen_generate_structure_push(entity, history, start_pos);
+    codegen_generate_structure_push(entity, history);
 }
 
 void codegen_gen_mem_access(struct node *node, int flags, struct resolver_entity *entity)
@@ -814,22 +1016,24 @@ void codegen_gen_mem_access(struct node *node, int flags, struct resolver_entity
         return;
     }
 
-    if (datatype_is_struct_or_union_non_pointer(&entity->dtype))
+    if (datatype_is_struct_or_union_non_pointer(entity->dtype))
     {
         codegen_gen_mem_access_get_address(node, 0, entity);
-        asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        codegen_generate_structure_push_or_return(entity, history_begin(0), 0);
+        asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        codegen_generate_structure_push_or_return(entity, history_begin(0));
     }
-    else if (datatype_element_size(&entity->dtype) != DATA_SIZE_DWORD)
+    else if (datatype_element_size(entity->dtype) != DATA_SIZE_DWORD && !codegen_datatype_is_wide(entity->dtype))
     {
-        asm_push("mov eax, [%s]", codegen_entity_private(entity)->address);
-        codegen_reduce_register("eax", datatype_element_size(&entity->dtype), entity->dtype.flags & DATATYPE_FLAG_IS_SIGNED);
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_mem(codegen_entity_private(entity)->address));
+        codegen_reduce_register("eax", datatype_element_size(entity->dtype), entity->dtype->flags & DATATYPE_FLAG_IS_SIGNED);
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
     }
     else
     {
         // We can push this straight to the stack
-        asm_push_ins_push_with_data("dword [%s]", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype}, codegen_entity_private(entity)->address);
+        struct asm_operand operand = codegen_entity_private(entity)->address;
+        operand.size = codegen_push_size(entity->dtype);
+        asm_push_ins_push_with_data(asm_ir_mem(operand), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
     }
 }
 void codegen_generate_variable_access_for_entity(struct node *node, struct resolver_entity *entity, struct history *history)
@@ -865,9 +1069,9 @@ void codegen_generate_unary_indirection(struct node *node, struct history *histo
     codegen_generate_expressionable(node->unary.operand, history_down(history, flags | EXPRESSION_GET_ADDRESS | EXPRESSION_INDIRECTION));
     struct response *res = codegen_response_pull();
     assert(codegen_response_has_entity(res));
-    struct datatype operand_datatype;
+    const struct datatype *operand_datatype;
     assert(asm_datatype_back(&operand_datatype));
-    asm_push_ins_pop(reg_to_use, STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg(reg_to_use), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
 
     int depth = node->unary.indirection.depth;
     int real_depth = depth;
@@ -876,16 +1080,31 @@ void codegen_generate_unary_indirection(struct node *node, struct history *histo
         depth++;
     }
 
+    // Every load but the one reading the final value reads a pointer
+    bool value_is_wide = real_depth < res->data.resolved_entity->dtype->pointer_depth || datatype_size_no_ptr(operand_datatype) == DATA_SIZE_DDWORD;
+    const char *value_reg = value_is_wide ? codegen_address_register(reg_to_use) : reg_to_use;
     for (int i = 0; i < depth; i++)
     {
-        asm_push("mov %s, [%s]", reg_to_use, reg_to_use);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(i == real_depth ? value_reg : codegen_address_register(reg_to_use)), asm_ir_mem((struct asm_operand){.base = reg_to_use}));
+    }
+
+    if (real_depth == res->data.resolved_entity->dtype->pointer_depth)
+    {
+        codegen_reduce_register(reg_to_use, datatype_size_no_ptr(operand_datatype), operand_datatype->flags & DATATYPE_FLAG_IS_SIGNED);
     }
 
-    if (real_depth == res->data.resolved_entity->dtype.pointer_depth)
+    const struct datatype *value_datatype = operand_datatype;
+    if (target_is_x86_64() && !(history->flags & EXPRESSION_GET_ADDRESS))
     {
-        codegen_reduce_register(reg_to_use, datatype_size_no_ptr(&operand_datatype), operand_datatype.flags & DATATYPE_FLAG_IS_SIGNED);
+        // Only as wide as what was pointed to
+        struct datatype pointed_datatype = *operand_datatype;
+        for (int i = 0; i < real_depth && pointed_datatype.pointer_depth > 0; i++)
+        {
+            datatype_decrement_pointer(&pointed_datatype);
+        }
+        value_datatype = datatype_intern(current_process, &pointed_datatype);
     }
-    asm_push_ins_push_with_data(reg_to_use, STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = operand_datatype});
+    asm_push_ins_push_with_data(asm_ir_reg(reg_to_use), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, value_datatype);
     codegen_response_acknowledge(&(struct response){.flags = RESPONSE_FLAG_RESOLVED_ENTITY, .data.resolved_entity = res->data.resolved_entity});
 }
 
@@ -893,19 +1112,20 @@ void codegen_generate_normal_unary(struct node *node, struct history *history)
 {
     codegen_generate_expressionable(node->unary.operand, history);
 
-    struct datatype last_dtype;
+    const struct datatype *last_dtype;
     assert(asm_datatype_back(&last_dtype));
 
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    const char *reg = codegen_register_for_datatype("eax", last_dtype);
     if (S_EQ(node->unary.op, "-"))
     {
-        asm_push("neg eax");
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+        asm_push_ins1(ASM_OP_NEG, asm_ir_reg(reg));
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
     }
     else if (S_EQ(node->unary.op, "~"))
     {
-        asm_push("not eax");
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+        asm_push_ins1(ASM_OP_NOT, asm_ir_reg(reg));
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
     }
     else if (S_EQ(node->unary.op, "*"))
     {
@@ -916,18 +1136,18 @@ void codegen_generate_normal_unary(struct node *node, struct history *history)
         if (node->unary.flags & UNARY_FLAG_IS_LEFT_OPERANDED_UNARY)
         {
             // a++
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
-            asm_push("inc eax");
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
+            asm_push_ins1(ASM_OP_INC, asm_ir_reg(reg));
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
             codegen_generate_assignment_part(node->unary.operand, "=", history);
         }
         else
         {
             // ++a
-            asm_push("inc eax");
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins1(ASM_OP_INC, asm_ir_reg(reg));
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
             codegen_generate_assignment_part(node->unary.operand, "=", history);
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
         }
     }
     else if (S_EQ(node->unary.op, "--"))
@@ -935,26 +1155,26 @@ void codegen_generate_normal_unary(struct node *node, struct history *history)
         if (node->unary.flags & UNARY_FLAG_IS_LEFT_OPERANDED_UNARY)
         {
             // a--
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
-            asm_push("dec eax");
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
+            asm_push_ins1(ASM_OP_DEC, asm_ir_reg(reg));
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
             codegen_generate_assignment_part(node->unary.operand, "=", history);
         }
         else
         {
             // --a
-            asm_push("dec eax");
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins1(ASM_OP_DEC, asm_ir_reg(reg));
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
             codegen_generate_assignment_part(node->unary.operand, "=", history);
-            asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+            asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
         }
     }
     else if(S_EQ(node->unary.op, "!"))
     {
-        asm_push("cmp eax, 0");
-        asm_push("sete al");
-        asm_push("movzx eax, al");
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype=last_dtype});
+        asm_push_ins2(ASM_OP_CMP, asm_ir_reg(reg), asm_ir_imm(0));
+        asm_push_ins1(ASM_OP_SETE, asm_ir_reg("al"));
+        asm_push_ins2(ASM_OP_MOVZX, asm_ir_reg("eax"), asm_ir_reg("al"));
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
         
 
     }
@@ -982,16 +1202,23 @@ void codegen_generate_unary(struct node *node, struct history *history)
     codegen_generate_normal_unary(node, history);
 }
 
-void codegen_gen_mov_for_value(const char *reg, const char *value, const char *datatype, int flags)
+void codegen_gen_mov_for_value(const char *reg, struct asm_ir_operand value, const char *datatype, int flags)
 {
-    asm_push("mov %s, %s", reg, value);
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), value);
 }
 
 void codegen_generate_string(struct node *node, struct history *history)
 {
     const char *label = codegen_register_string(node->sval);
-    codegen_gen_mov_for_value("eax", label, "dword", history->flags);
-    asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = datatype_for_string()});
+    if (target_is_x86_64())
+    {
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg("rax"), asm_ir_mem((struct asm_operand){.base = label}));
+    }
+    else
+    {
+        codegen_gen_mov_for_value("eax", asm_ir_symbol("%s", label), "dword", history->flags);
+    }
+    asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, current_process->datatypes->string);
 }
 
 void codegen_generate_exp_parenthesis_node(struct node *node, struct history *history)
@@ -1005,21 +1232,21 @@ void codegen_generate_tenary(struct node *node, struct history *history)
     int false_label_id = codegen_label_count();
     int tenary_end_label_id = codegen_label_count();
 
-    struct datatype last_dtype;
+    const struct datatype *last_dtype;
     assert(asm_datatype_back(&last_dtype));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("cmp eax, 0");
-    asm_push("je .tenary_false_%i", false_label_id);
-    asm_push(".tenary_true_%i:", true_label_id);
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(codegen_register_for_datatype("eax", last_dtype)), asm_ir_imm(0));
+    asm_push_ins1(ASM_OP_JE, asm_ir_symbol(".tenary_false_%i", false_label_id));
+    asm_push_label(".tenary_true_%i", true_label_id);
 
     codegen_generate_expressionable(node->tenary.true_node, history_down(history, 0));
-    asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("jmp .tenary_end_%i", tenary_end_label_id);
+    asm_push_ins_pop_or_ignore(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol(".tenary_end_%i", tenary_end_label_id));
 
-    asm_push(".tenary_false_%i:", false_label_id);
+    asm_push_label(".tenary_false_%i", false_label_id);
     codegen_generate_expressionable(node->tenary.false_node, history_down(history, 0));
-    asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push(".tenary_end_%i:", tenary_end_label_id);
+    asm_push_ins_pop_or_ignore(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_label(".tenary_end_%i", tenary_end_label_id);
 }
 
 void codegen_generate_cast(struct node *node, struct history *history)
@@ -1029,9 +1256,12 @@ void codegen_generate_cast(struct node *node, struct history *history)
         codegen_generate_expressionable(node->cast.operand, history);
     }
 
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    codegen_reduce_register("eax", datatype_size(&node->cast.dtype), node->cast.dtype.flags & DATATYPE_FLAG_IS_SIGNED);
-    asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = node->cast.dtype});
+    const struct datatype *operand_dtype = current_process->datatypes->numeric;
+    asm_datatype_back(&operand_dtype);
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    codegen_widen_register("eax", operand_dtype, node->cast.dtype);
+    codegen_reduce_register("eax", datatype_size(node->cast.dtype), node->cast.dtype->flags & DATATYPE_FLAG_IS_SIGNED);
+    asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, node->cast.dtype);
 }
 
 
@@ -1110,6 +1340,10 @@ const char *codegen_sub_register(const char *original_register, size_t size)
         {
             reg = "eax";
         }
+        else if (size == DATA_SIZE_DDWORD)
+        {
+            reg = "rax";
+        }
     }
     else if (S_EQ(original_register, "ebx"))
     {
@@ -1125,6 +1359,10 @@ const char *codegen_sub_register(const char *original_register, size_t size)
         {
             reg = "ebx";
         }
+        else if (size == DATA_SIZE_DDWORD)
+        {
+            reg = "rbx";
+        }
     }
     else if (S_EQ(original_register, "ecx"))
     {
@@ -1140,6 +1378,10 @@ const char *codegen_sub_register(const char *original_register, size_t size)
         {
             reg = "ecx";
         }
+        else if (size == DATA_SIZE_DDWORD)
+        {
+            reg = "rcx";
+        }
     }
     else if (S_EQ(original_register, "edx"))
     {
@@ -1155,99 +1397,165 @@ const char *codegen_sub_register(const char *original_register, size_t size)
         {
             reg = "edx";
         }
+        else if (size == DATA_SIZE_DDWORD)
+        {
+            reg = "rdx";
+        }
+    }
+    else if (S_EQ(original_register, "esi") || S_EQ(original_register, "edi"))
+    {
+        if (size == DATA_SIZE_DWORD)
+        {
+            reg = original_register;
+        }
+        else if (size == DATA_SIZE_DDWORD)
+        {
+            reg = S_EQ(original_register, "esi") ? "rsi" : "rdi";
+        }
     }
 
     return reg;
 }
-const char *codegen_byte_word_or_dword_or_ddword(size_t size, const char **reg_to_use)
+
+// Only on x86-64, the 32 bit registers hold anything that fits them
+bool codegen_datatype_is_wide(const struct datatype *dtype)
 {
-    const char *type = NULL;
-    const char *new_register = *reg_to_use;
-    if (size == DATA_SIZE_BYTE)
+    if (!target_is_x86_64() || datatype_is_struct_or_union_non_pointer(dtype))
     {
-        type = "byte";
-        new_register = codegen_sub_register(*reg_to_use, DATA_SIZE_BYTE);
+        return false;
+    }
+
+    if (dtype->flags & DATATYPE_FLAG_IS_POINTER && dtype->pointer_depth > 0)
+    {
+        return true;
+    }
+
+    if (dtype->flags & DATATYPE_FLAG_IS_ARRAY && dtype->array.size != dtype->size)
+    {
+        return true;
+    }
+
+    return dtype->size == DATA_SIZE_DDWORD;
+}
+
+size_t codegen_push_size(const struct datatype *dtype)
+{
+    return codegen_datatype_is_wide(dtype) ? DATA_SIZE_DDWORD : DATA_SIZE_DWORD;
+}
+
+const char *codegen_address_register(const char *reg)
+{
+    return target_is_x86_64() ? codegen_sub_register(reg, DATA_SIZE_DDWORD) : reg;
+}
+
+const char *codegen_register_for_datatype(const char *reg, const struct datatype *dtype)
+{
+    const char *wide_reg = codegen_datatype_is_wide(dtype) ? codegen_sub_register(reg, DATA_SIZE_DDWORD) : NULL;
+    return wide_reg ? wide_reg : reg;
+}
+
+/**
+ * Writing a 32 bit register clears the upper half of its 64 bit register,
+ * a signed value that is used at 64 bits has to be sign extended first.
+ */
+void codegen_extend_register(const char *reg64, const char *reg32, const struct datatype *from)
+{
+    if (!target_is_x86_64() || codegen_datatype_is_wide(from))
+    {
+        return;
     }
-    else if (size == DATA_SIZE_WORD)
+
+    if (from->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL))
     {
-        type = "word";
-        new_register = codegen_sub_register(*reg_to_use, DATA_SIZE_WORD);
+        asm_push_ins2(ASM_OP_MOVSXD, asm_ir_reg(reg64), asm_ir_reg(reg32));
+        return;
     }
-    else if (size == DATA_SIZE_DWORD)
+
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg32), asm_ir_reg(reg32));
+}
+
+void codegen_widen_register(const char *reg, const struct datatype *from, const struct datatype *to)
+{
+    if (codegen_datatype_is_wide(to))
     {
-        type = "dword";
-        new_register = codegen_sub_register(*reg_to_use, DATA_SIZE_DWORD);
+        codegen_extend_register(codegen_sub_register(reg, DATA_SIZE_DDWORD), reg, from);
     }
-    else if (size == DATA_SIZE_DDWORD)
+}
+// Picks the part of the register for a store of size bytes, returns the size for the destination operand
+int codegen_byte_word_or_dword_or_ddword(size_t size, const char **reg_to_use)
+{
+    int type = 0;
+    const char *new_register = *reg_to_use;
+    if (size == DATA_SIZE_BYTE || size == DATA_SIZE_WORD || size == DATA_SIZE_DWORD || size == DATA_SIZE_DDWORD)
     {
-        type = "ddword";
-        new_register = codegen_sub_register(*reg_to_use, DATA_SIZE_DDWORD);
+        type = size;
+        new_register = codegen_sub_register(*reg_to_use, size);
     }
     *reg_to_use = new_register;
     return type;
 }
 
-void codegen_generate_assignment_instruction_for_operator(const char *mov_type_keyword, const char *address, const char *reg_to_use, const char *op, bool is_signed)
+void codegen_generate_assignment_instruction_for_operator(int mov_size, struct asm_operand *operand, const char *reg_to_use, const char *op, bool is_signed)
 {
     assert(reg_to_use != "ecx");
+    struct asm_operand destination = *operand;
+    destination.size = mov_size;
+
+    // A qword destination works on the 64 bit registers
+    size_t size = mov_size == DATA_SIZE_DDWORD ? DATA_SIZE_DDWORD : DATA_SIZE_DWORD;
+    const char *eax = codegen_sub_register("eax", size);
+    const char *ecx = codegen_sub_register("ecx", size);
 
     if (S_EQ(op, "="))
     {
-        asm_push("mov %s [%s], %s", mov_type_keyword, address, reg_to_use);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(destination), asm_ir_reg(reg_to_use));
     }
     else if (S_EQ(op, "+="))
     {
-        asm_push("add %s [%s], %s", mov_type_keyword, address, reg_to_use);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_mem(destination), asm_ir_reg(reg_to_use));
     }
     else if (S_EQ(op, "-="))
     {
-        asm_push("sub %s [%s], %s", mov_type_keyword, address, reg_to_use);
+        asm_push_ins2(ASM_OP_SUB, asm_ir_mem(destination), asm_ir_reg(reg_to_use));
     }
     else if (S_EQ(op, "*="))
     {
-        asm_push("mov ecx, %s", reg_to_use);
-        asm_push("mov eax, [%s]", address);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(ecx), asm_ir_reg(reg_to_use));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(eax), asm_ir_mem(*operand));
         if (is_signed)
         {
-            asm_push("imul %s", reg_to_use);
+            asm_push_ins1(ASM_OP_IMUL, asm_ir_reg(reg_to_use));
         }
         else
         {
-            asm_push("mul %s", reg_to_use);
+            asm_push_ins1(ASM_OP_MUL, asm_ir_reg(reg_to_use));
         }
-        asm_push("mov %s [%s], eax", mov_type_keyword, address);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(destination), asm_ir_reg(eax));
     }
     else if (S_EQ(op, "/="))
     {
-        asm_push("mov ecx, eax");
-        asm_push("mov eax, [%s]", address);
-        asm_push("cdq");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(ecx), asm_ir_reg(eax));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(eax), asm_ir_mem(*operand));
+        asm_push_ins0(size == DATA_SIZE_DDWORD ? ASM_OP_CQO : ASM_OP_CDQ);
         if (is_signed)
         {
-            asm_push("idiv ecx");
+            asm_push_ins1(ASM_OP_IDIV, asm_ir_reg(ecx));
         }
         else
         {
-            asm_push("div ecx");
+            asm_push_ins1(ASM_OP_DIV, asm_ir_reg(ecx));
         }
-        asm_push("mov %s [%s], %s", mov_type_keyword, address, reg_to_use);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(destination), asm_ir_reg(reg_to_use));
     }
     else if (S_EQ(op, "<<="))
     {
-        asm_push("mov ecx, %s", reg_to_use);
-        asm_push("sal %s [%s], cl", mov_type_keyword, address);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(ecx), asm_ir_reg(reg_to_use));
+        asm_push_ins2(ASM_OP_SAL, asm_ir_mem(destination), asm_ir_reg("cl"));
     }
     else if (S_EQ(op, ">>="))
     {
-        asm_push("mov ecx, %s", reg_to_use);
-        if (is_signed)
-        {
-            asm_push("sar %s [%s], cl", mov_type_keyword, address);
-        }
-        else
-        {
-            asm_push("shr %s [%s], cl", mov_type_keyword, address);
-        }
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(ecx), asm_ir_reg(reg_to_use));
+        asm_push_ins2(is_signed ? ASM_OP_SAR : ASM_OP_SHR, asm_ir_mem(destination), asm_ir_reg("cl"));
     }
 }
 void codegen_generate_scope_variable(struct node *node)
@@ -1256,16 +1564,31 @@ void codegen_generate_scope_variable(struct node *node)
     if (node->var.val)
     {
         codegen_generate_expressionable(node->var.val, history_begin(EXPRESSION_IS_ASSIGNMENT | IS_RIGHT_OPERAND_OF_ASSIGNMENT));
+        const struct datatype *value_dtype = current_process->datatypes->numeric;
+        asm_datatype_back(&value_dtype);
         // pop eax
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        codegen_widen_register("eax", value_dtype, entity->dtype);
         const char *reg_to_use = "eax";
-        const char *mov_type = codegen_byte_word_or_dword_or_ddword(datatype_element_size(&entity->dtype), &reg_to_use);
-        codegen_generate_assignment_instruction_for_operator(mov_type, codegen_entity_private(entity)->address, reg_to_use, "=", entity->dtype.flags & DATATYPE_FLAG_IS_SIGNED);
+        int mov_type = codegen_byte_word_or_dword_or_ddword(datatype_element_size(entity->dtype), &reg_to_use);
+        codegen_generate_assignment_instruction_for_operator(mov_type, &codegen_entity_private(entity)->address, reg_to_use, "=", entity->dtype->flags & DATATYPE_FLAG_IS_SIGNED);
     }
 }
 
+bool codegen_entity_is_direct_call_target(struct resolver_entity *entity)
+{
+    struct resolver_entity *next = resolver_result_entity_next(entity);
+    return entity->type == RESOLVER_ENTITY_TYPE_FUNCTION && next && next->type == RESOLVER_ENTITY_TYPE_FUNCTION_CALL;
+}
+
 void codegen_generate_entity_access_start(struct resolver_result *result, struct resolver_entity *root_assignment_entity, struct history *history)
 {
+    if (codegen_entity_is_direct_call_target(root_assignment_entity))
+    {
+        // Called by name, the call instruction names the function itself
+        return;
+    }
+
     if (root_assignment_entity->type == RESOLVER_ENTITY_TYPE_UNSUPPORTED)
     {
         // Unsupported entity then process it.
@@ -1273,32 +1596,36 @@ void codegen_generate_entity_access_start(struct resolver_result *result, struct
     }
     else if (result->flags & RESOLVER_RESULT_FLAG_FIRST_ENTITY_PUSH_VALUE)
     {
-        asm_push_ins_push_with_data("dword [%s]", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = root_assignment_entity->dtype}, result->base.address);
+        struct asm_operand operand = result->base.address;
+        operand.size = codegen_push_size(root_assignment_entity->dtype);
+        asm_push_ins_push_with_data(asm_ir_mem(operand), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, root_assignment_entity->dtype);
     }
     else if (result->flags & RESOLVER_RESULT_FLAG_FIRST_ENTITY_LOAD_TO_EBX)
     {
+        const char *reg = codegen_address_register("ebx");
         if (root_assignment_entity->next && root_assignment_entity->next->flags & RESOLVER_ENTITY_FLAG_IS_POINTER_ARRAY_ENTITY)
         {
-            asm_push("mov ebx, [%s]", result->base.address);
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), asm_ir_mem(result->base.address));
         }
         else
         {
-            asm_push("lea ebx, [%s]", result->base.address);
+            asm_push_ins2(ASM_OP_LEA, asm_ir_reg(reg), asm_ir_mem(result->base.address));
         }
-        asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = root_assignment_entity->dtype});
+        asm_push_ins_push_with_data(asm_ir_reg(reg), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, root_assignment_entity->dtype);
     }
 }
 
 void codegen_generate_entity_access_for_variable_or_general(struct resolver_result *result, struct resolver_entity *entity)
 {
     // Restore the EBX register
-    asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    const char *reg = codegen_address_register("ebx");
     if (entity->flags & RESOLVER_ENTITY_FLAG_DO_INDIRECTION)
     {
-        asm_push("mov ebx, [ebx]");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), asm_ir_mem((struct asm_operand){.base = "ebx"}));
     }
-    asm_push("add ebx, %i", entity->offset);
-    asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+    asm_push_ins2(ASM_OP_ADD, asm_ir_reg(reg), asm_ir_imm(entity->offset));
+    asm_push_ins_push_with_data(asm_ir_reg(reg), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
 }
 
 int codegen_entity_rules(struct resolver_entity *last_entity, struct history *history)
@@ -1309,7 +1636,7 @@ int codegen_entity_rules(struct resolver_entity *last_entity, struct history *hi
         return 0;
     }
 
-    if (datatype_is_struct_or_union_non_pointer(&last_entity->dtype))
+    if (datatype_is_struct_or_union_non_pointer(last_entity->dtype))
     {
         rule_flags |= CODEGEN_ENTITY_RULE_IS_STRUCT_OR_UNION_NON_POINTER;
     }
@@ -1337,17 +1664,17 @@ void codegen_apply_unary_access(int depth)
 {
     for (int i = 0; i < depth; i++)
     {
-        asm_push("mov ebx, [ebx]");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_address_register("ebx")), asm_ir_mem((struct asm_operand){.base = "ebx"}));
     }
 }
 void codegen_generate_entity_access_for_unary_indirection_for_assignment_left_operand(struct resolver_result *result, struct resolver_entity *entity, struct history *history)
 {
-    asm_push("; INDIRECTION");
-    int flags = asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_comment("INDIRECTION");
+    int flags = asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     int gen_entity_rules = codegen_entity_rules(result->last_entity, history);
     int depth = entity->indirection.depth - 1;
     codegen_apply_unary_access(depth);
-    asm_push_ins_push_with_flags("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS);
+    asm_push_ins_push_with_flags(asm_ir_reg(codegen_address_register("ebx")), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS);
 }
 
 void codegen_generate_entity_access_for_unsupported(struct resolver_result *result, struct resolver_entity *entity)
@@ -1357,20 +1684,30 @@ void codegen_generate_entity_access_for_unsupported(struct resolver_result *resu
 
 void codegen_generate_entity_access_for_cast(struct resolver_result *result, struct resolver_entity *entity)
 {
-    asm_push("; CAST");
+    asm_push_comment("CAST");
+}
+
+// The index is added to a 64 bit address on x86-64, so it is extended to 64 bits first
+const char *codegen_pop_array_index()
+{
+    const struct datatype *index_dtype = current_process->datatypes->numeric;
+    asm_datatype_back(&index_dtype);
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    codegen_extend_register("rax", "eax", index_dtype);
+    return codegen_address_register("eax");
 }
 
 void codegen_generate_entity_access_array_bracket_pointer(struct resolver_result *result, struct resolver_entity *entity)
 {
-    asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     codegen_generate_expressionable(entity->array.array_index_node, history_begin(0));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    if (datatype_element_size(&entity->dtype) > DATA_SIZE_BYTE)
+    const char *index_reg = codegen_pop_array_index();
+    if (datatype_element_size(entity->dtype) > DATA_SIZE_BYTE)
     {
-        asm_push("imul eax, %i", datatype_size_for_array_access(&entity->dtype));
+        codegen_gen_multiply_by_constant(index_reg, datatype_size_for_array_access(entity->dtype));
     }
-    asm_push("add ebx, eax");
-    asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+    asm_push_ins2(ASM_OP_ADD, asm_ir_reg(codegen_address_register("ebx")), asm_ir_reg(index_reg));
+    asm_push_ins_push_with_data(asm_ir_reg(codegen_address_register("ebx")), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
 }
 void codegen_generate_entity_access_array_bracket(struct resolver_result *result, struct resolver_entity *entity)
 {
@@ -1380,21 +1717,22 @@ void codegen_generate_entity_access_array_bracket(struct resolver_result *result
         return;
     }
 
-    asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     codegen_generate_expressionable(entity->array.array_index_node, history_begin(0));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    const char *index_reg = codegen_pop_array_index();
+    const char *reg = codegen_address_register("ebx");
 
     if (entity->flags & RESOLVER_ENTITY_FLAG_JUST_USE_OFFSET)
     {
-        asm_push("add ebx, %i", entity->offset);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg(reg), asm_ir_imm(entity->offset));
     }
     else
     {
-        asm_push("imul eax, %i", entity->offset);
-        asm_push("add ebx, eax");
+        codegen_gen_multiply_by_constant(index_reg, entity->offset);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg(reg), asm_ir_reg(index_reg));
     }
 
-    asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+    asm_push_ins_push_with_data(asm_ir_reg(reg), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
 }
 void codegen_generate_entity_access_for_entity_for_assignment_left_operand(struct resolver_result *result, struct resolver_entity *entity, struct history *history)
 {
@@ -1444,121 +1782,502 @@ void codegen_generate_entity_access_for_assignment_left_operand(struct resolver_
     }
 }
 
-void codegen_generate_move_struct(struct datatype *dtype, const char *base_address, off_t offset)
+/**
+ * Structures move a stack slot at a time, so on x86-64 a qword. A structure that is not a multiple of a
+ * slot ends in a dword, its slot keeps the structure laid out as in memory.
+ */
+int codegen_structure_slots(size_t structure_size)
+{
+    return align_value(structure_size, STACK_PUSH_SIZE) / STACK_PUSH_SIZE;
+}
+
+size_t codegen_structure_chunk_size(size_t structure_size, int slot)
+{
+    return structure_size - slot * STACK_PUSH_SIZE < STACK_PUSH_SIZE ? DATA_SIZE_DWORD : STACK_PUSH_SIZE;
+}
+
+const char *codegen_structure_chunk_register(const char *reg, size_t chunk_size)
+{
+    return chunk_size == DATA_SIZE_DDWORD ? codegen_sub_register(reg, DATA_SIZE_DDWORD) : reg;
+}
+
+bool codegen_uses_block_copy(size_t structure_size)
+{
+    return structure_size >= CODEGEN_STRUCT_BLOCK_COPY_MIN_SIZE && !(current_process->flags & COMPILE_PROCESS_NO_BLOCK_COPY);
+}
+
+// rep movsd of a dword aligned structure from esi to edi
+void codegen_generate_block_copy(size_t structure_size)
+{
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ecx"), asm_ir_imm(structure_size / DATA_SIZE_DWORD));
+    asm_push_ins0(ASM_OP_REP_MOVSD);
+}
+
+void codegen_generate_move_struct(const struct datatype *dtype, struct asm_operand *base_operand, off_t offset)
 {
     size_t structure_size = align_value(datatype_size(dtype), DATA_SIZE_DWORD);
-    int pops = structure_size / DATA_SIZE_DWORD;
-    for (int i = 0; i < pops; i++)
+    int slots = codegen_structure_slots(structure_size);
+    if (codegen_uses_block_copy(structure_size))
+    {
+        // The first slot is on top of the stack, copy straight from there to the destination
+        struct asm_operand destination = *base_operand;
+        destination.displacement += offset;
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg(codegen_address_register("edi")), asm_ir_mem(destination));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_address_register("esi")), asm_ir_reg("esp"));
+        codegen_generate_block_copy(structure_size);
+        for (int i = 0; i < slots; i++)
+        {
+            stackframe_pop_expecting(current_function, STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        }
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg("esp"), asm_ir_imm(slots * STACK_PUSH_SIZE));
+        return;
+    }
+
+    for (int i = 0; i < slots; i++)
     {
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        char fmt[10];
-        int chunk_offset = offset + (i * DATA_SIZE_DWORD);
-        codegen_plus_or_minus_string_for_value(fmt, chunk_offset, sizeof(fmt));
-        asm_push("mov [%s%s], eax", base_address, fmt);
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        struct asm_operand chunk = *base_operand;
+        chunk.displacement += offset + i * STACK_PUSH_SIZE;
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(chunk), asm_ir_reg(codegen_structure_chunk_register("eax", codegen_structure_chunk_size(structure_size, i))));
     }
 }
 void codegen_generate_assignment_part(struct node *node, const char *op, struct history *history)
 {
-    struct datatype right_operand_dtype;
+    const struct datatype *right_operand_dtype = current_process->datatypes->numeric;
     struct resolver_result *result = resolver_follow(current_process->resolver, node);
     assert(resolver_result_ok(result));
     struct resolver_entity *root_assignment_entity = resolver_result_entity_root(result);
     const char *reg_to_use = "eax";
-    const char *mov_type = codegen_byte_word_or_dword_or_ddword(datatype_element_size(&result->last_entity->dtype), &reg_to_use);
+    int mov_type = codegen_byte_word_or_dword_or_ddword(datatype_element_size(result->last_entity->dtype), &reg_to_use);
     struct resolver_entity *next_entity = resolver_result_entity_next(root_assignment_entity);
     if (!next_entity)
     {
-        if (datatype_is_struct_or_union_non_pointer(&result->last_entity->dtype))
+        if (datatype_is_struct_or_union_non_pointer(result->last_entity->dtype))
         {
-            codegen_generate_move_struct(&result->last_entity->dtype, result->base.address, 0);
+            codegen_generate_move_struct(result->last_entity->dtype, &result->base.address, 0);
         }
         else
         {
-            asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-            codegen_generate_assignment_instruction_for_operator(mov_type, result->base.address, reg_to_use, op, result->last_entity->dtype.flags & DATATYPE_FLAG_IS_SIGNED);
+            asm_datatype_back(&right_operand_dtype);
+            asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+            codegen_widen_register("eax", right_operand_dtype, result->last_entity->dtype);
+            codegen_generate_assignment_instruction_for_operator(mov_type, &result->base.address, reg_to_use, op, result->last_entity->dtype->flags & DATATYPE_FLAG_IS_SIGNED);
         }
     }
     else
     {
         codegen_generate_entity_access_for_assignment_left_operand(result, root_assignment_entity, node, history);
-        asm_push_ins_pop("edx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        codegen_generate_assignment_instruction_for_operator(mov_type, "edx", reg_to_use, op, result->last_entity->flags & DATATYPE_FLAG_IS_SIGNED);
+        asm_push_ins_pop(asm_ir_reg("edx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_datatype_back(&right_operand_dtype);
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        codegen_widen_register("eax", right_operand_dtype, result->last_entity->dtype);
+        codegen_generate_assignment_instruction_for_operator(mov_type, &(struct asm_operand){.base = "edx"}, reg_to_use, op, result->last_entity->flags & DATATYPE_FLAG_IS_SIGNED);
     }
 }
-void codegen_generate_assignment_expression(struct node *node, struct history *history)
+bool codegen_resolves_to_structure_variable(struct node *node, struct resolver_result **result_out)
 {
-    codegen_generate_expressionable(node->exp.right, history_down(history, EXPRESSION_IS_ASSIGNMENT | IS_RIGHT_OPERAND_OF_ASSIGNMENT));
-    codegen_generate_assignment_part(node->exp.left, node->exp.op, history);
+    if (node->type != NODE_TYPE_IDENTIFIER)
+    {
+        return false;
+    }
+
+    struct resolver_result *result = resolver_follow(current_process->resolver, node);
+    if (!resolver_result_ok(result))
+    {
+        return false;
+    }
+
+    struct resolver_entity *root = resolver_result_entity_root(result);
+    *result_out = result;
+    return root->type == RESOLVER_ENTITY_TYPE_VARIABLE && !resolver_result_entity_next(root) &&
+           datatype_is_struct_or_union_non_pointer(result->last_entity->dtype);
 }
 
-void codegen_generate_entity_access_for_function_call(struct resolver_result *result, struct resolver_entity *entity)
+// a = b between two structure variables copies memory to memory, the value never goes through the stack
+bool codegen_generate_structure_assignment_copy(struct node *node)
 {
-    vector_set_flag(entity->func_call_data.arguments, VECTOR_FLAG_PEEK_DECREMENT);
-    vector_set_peek_pointer_end(entity->func_call_data.arguments);
-
-    struct node *node = vector_peek_ptr(entity->func_call_data.arguments);
-    int function_call_label_id= codegen_label_count();
-    codegen_data_section_add("function_call_%i: dd 0", function_call_label_id);
-    asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("mov dword [function_call_%i], ebx", function_call_label_id);
-    
-    if (datatype_is_struct_or_union_non_pointer(&entity->dtype))
+    struct resolver_result *left = NULL;
+    struct resolver_result *right = NULL;
+    if (current_process->flags & COMPILE_PROCESS_NO_BLOCK_COPY || !S_EQ(node->exp.op, "=") || !codegen_resolves_to_structure_variable(node->exp.left, &left) ||
+        !codegen_resolves_to_structure_variable(node->exp.right, &right))
     {
-        asm_push("; SUBTRACT ROOM FOR RETURNED STRUCTURE/UNION DATATYPE");
-        codegen_stack_sub_with_name(align_value(datatype_size(&entity->dtype), DATA_SIZE_DWORD), "result_value");
-        asm_push_ins_push("esp", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        return false;
     }
 
-    while (node)
+    size_t structure_size = align_value(datatype_size(left->last_entity->dtype), DATA_SIZE_DWORD);
+    if (codegen_uses_block_copy(structure_size))
     {
-        codegen_generate_expressionable(node, history_begin(EXPRESSION_IN_FUNCTION_CALL_ARGUMENTS));
-        node = vector_peek_ptr(entity->func_call_data.arguments);
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg(codegen_address_register("esi")), asm_ir_mem(right->base.address));
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg(codegen_address_register("edi")), asm_ir_mem(left->base.address));
+        codegen_generate_block_copy(structure_size);
+        return true;
     }
-    asm_push("call [function_call_%i]", function_call_label_id);
-    size_t stack_size = entity->func_call_data.stack_size;
-    if (datatype_is_struct_or_union_non_pointer(&entity->dtype))
+
+    for (int i = 0; i < codegen_structure_slots(structure_size); i++)
+    {
+        const char *reg = codegen_structure_chunk_register("eax", codegen_structure_chunk_size(structure_size, i));
+        struct asm_operand source = right->base.address;
+        struct asm_operand destination = left->base.address;
+        source.displacement += i * STACK_PUSH_SIZE;
+        destination.displacement += i * STACK_PUSH_SIZE;
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), asm_ir_mem(source));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(destination), asm_ir_reg(reg));
+    }
+    return true;
+}
+
+void codegen_generate_assignment_expression(struct node *node, struct history *history)
+{
+    if (codegen_generate_structure_assignment_copy(node))
+    {
+        return;
+    }
+
+    codegen_generate_expressionable(node->exp.right, history_down(history, EXPRESSION_IS_ASSIGNMENT | IS_RIGHT_OPERAND_OF_ASSIGNMENT));
+    codegen_generate_assignment_part(node->exp.left, node->exp.op, history);
+}
+
+// A returned pointer to a structure is where the next entity is accessed from
+void codegen_generate_function_call_result_for_next_entity(struct resolver_entity *entity)
+{
+    struct resolver_entity *next_entity = resolver_result_entity_next(entity);
+    if (next_entity && datatype_is_struct_or_union(entity->dtype))
+    {
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_address_register("ebx")), asm_ir_reg(codegen_address_register("eax")));
+        asm_push_ins_push(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    }
+}
+
+void codegen_generate_entity_access_for_function_call_x86_64(struct resolver_result *result, struct resolver_entity *entity);
+
+void codegen_generate_entity_access_for_function_call(struct resolver_result *result, struct resolver_entity *entity)
+{
+    if (target_is_x86_64())
+    {
+        codegen_generate_entity_access_for_function_call_x86_64(result, entity);
+        return;
+    }
+
+    vector_set_flag(entity->func_call_data.arguments, VECTOR_FLAG_PEEK_DECREMENT);
+    vector_set_peek_pointer_end(entity->func_call_data.arguments);
+
+    struct node *node = vector_peek_ptr(entity->func_call_data.arguments);
+    struct resolver_entity *callee = entity->prev;
+    bool is_direct_call = callee == resolver_result_entity_root(result) && codegen_entity_is_direct_call_target(callee);
+
+    // A function pointer stays on the stack under the arguments until we call through it
+    size_t callee_offset = entity->func_call_data.stack_size;
+    if (datatype_is_struct_or_union_non_pointer(entity->dtype))
+    {
+        asm_push_comment("SUBTRACT ROOM FOR RETURNED STRUCTURE/UNION DATATYPE");
+        size_t room = align_value(datatype_size(entity->dtype), DATA_SIZE_DWORD);
+        codegen_stack_sub_with_name(room, "result_value");
+        asm_push_ins_push(asm_ir_reg("esp"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        callee_offset += room + DATA_SIZE_DWORD;
+    }
+
+    while (node)
+    {
+        codegen_generate_expressionable(node, history_begin(EXPRESSION_IN_FUNCTION_CALL_ARGUMENTS));
+        node = vector_peek_ptr(entity->func_call_data.arguments);
+    }
+
+    size_t stack_size = entity->func_call_data.stack_size;
+    if (is_direct_call)
+    {
+        asm_push_ins1(ASM_OP_CALL, asm_ir_symbol("%s", callee->name));
+    }
+    else
+    {
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_mem((struct asm_operand){.base = "esp", .displacement = callee_offset}));
+        asm_push_ins1(ASM_OP_CALL, asm_ir_reg("eax"));
+    }
+
+    if (datatype_is_struct_or_union_non_pointer(entity->dtype))
+    {
+        // The pointer to the room, a function pointer below the room goes with the rest of the statement
+        stack_size += DATA_SIZE_DWORD;
+    }
+    else if (!is_direct_call)
     {
         stack_size += DATA_SIZE_DWORD;
     }
     codegen_stack_add(stack_size);
-    if (datatype_is_struct_or_union_non_pointer(&entity->dtype))
+    if (datatype_is_struct_or_union_non_pointer(entity->dtype))
     {
-        asm_push("mov ebx, eax");
-        codegen_generate_structure_push(entity, history_begin(0), 0);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ebx"), asm_ir_reg("eax"));
+        codegen_generate_structure_push(entity, history_begin(0));
     }
     else
     {
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
     }
 
-    struct resolver_entity *next_entity = resolver_result_entity_next(entity);
-    if (next_entity && datatype_is_struct_or_union(&entity->dtype))
+    codegen_generate_function_call_result_for_next_entity(entity);
+}
+
+static const char *codegen_x86_64_argument_registers[][2] = {{"edi", "rdi"}, {"esi", "rsi"}, {"edx", "rdx"}, {"ecx", "rcx"}, {"r8d", "r8"}, {"r9d", "r9"}};
+
+// Arguments are pushed from the last to the first
+const struct datatype *codegen_x86_64_argument_datatype(struct vector *dtypes, int index)
+{
+    return *(const struct datatype **)vector_at(dtypes, vector_count(dtypes) - 1 - index);
+}
+
+/**
+ * Loads the register arguments of a call that passes or returns a structure from where they were pushed,
+ * then moves the stack arguments down to the bottom in order, as one that misses the registers need not
+ * be the last. A result passed in memory goes to the room above the arguments. Gives the bytes to drop
+ * after the call.
+ */
+size_t codegen_generate_x86_64_structure_arguments(struct vector *dtypes, const struct datatype *rtype, size_t pushed_padding)
+{
+    int total = vector_count(dtypes);
+    size_t arguments_size = pushed_padding;
+    for (int i = 0; i < total; i++)
+    {
+        arguments_size += x86_64_stack_argument_size(codegen_x86_64_argument_datatype(dtypes, i));
+    }
+
+    size_t padding = 0;
+    if (-asm_stack_back()->offset_from_bp % C_STACK_ALIGNMENT)
+    {
+        padding = STACK_PUSH_SIZE;
+        codegen_stack_sub_with_name(padding, "call_alignment");
+    }
+
+    struct x86_64_argument_placement placement;
+    size_t stack_offset = 0;
+    x86_64_placement_start(&placement, rtype);
+    if (placement.registers)
+    {
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg("rdi"), asm_ir_mem((struct asm_operand){.base = "rsp", .displacement = padding + arguments_size}));
+    }
+
+    size_t position = padding;
+    for (int i = 0; i < total; i++)
+    {
+        const struct datatype *dtype = codegen_x86_64_argument_datatype(dtypes, i);
+        int reg = x86_64_place_argument(&placement, dtype, &stack_offset);
+        bool is_narrow = !datatype_is_struct_or_union_non_pointer(dtype) && !codegen_datatype_is_wide(dtype);
+        bool is_signed = dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL);
+        struct asm_operand low_dword = {.base = "rsp", .displacement = position, .size = DATA_SIZE_DWORD};
+        if (reg != -1 && is_narrow)
+        {
+            // Only the low dword of the slot was written
+            const char *reg32 = codegen_x86_64_argument_registers[reg][0];
+            const char *reg64 = codegen_x86_64_argument_registers[reg][1];
+            asm_push_ins2(is_signed ? ASM_OP_MOVSXD : ASM_OP_MOV, asm_ir_reg(is_signed ? reg64 : reg32), asm_ir_mem(low_dword));
+        }
+
+        for (int j = 0; reg != -1 && !is_narrow && j < x86_64_eightbytes(dtype); j++)
+        {
+            struct asm_operand eightbyte = {.base = "rsp", .displacement = position + j * DATA_SIZE_DDWORD};
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_x86_64_argument_registers[reg + j][1]), asm_ir_mem(eightbyte));
+        }
+        position += x86_64_stack_argument_size(dtype);
+    }
+
+    x86_64_placement_start(&placement, rtype);
+    position = padding;
+    for (int i = 0; i < total; i++)
+    {
+        const struct datatype *dtype = codegen_x86_64_argument_datatype(dtypes, i);
+        size_t size = x86_64_stack_argument_size(dtype);
+        if (x86_64_place_argument(&placement, dtype, &stack_offset) == -1)
+        {
+            bool is_narrow = !datatype_is_struct_or_union_non_pointer(dtype) && !codegen_datatype_is_wide(dtype);
+            bool is_signed = dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL);
+            for (int j = 0; j < size / DATA_SIZE_DDWORD; j++)
+            {
+                struct asm_operand source = {.base = "rsp", .displacement = position + j * DATA_SIZE_DDWORD, .size = is_narrow ? DATA_SIZE_DWORD : 0};
+                struct asm_operand destination = {.base = "rsp", .displacement = stack_offset + j * DATA_SIZE_DDWORD};
+                if (!is_narrow && source.displacement == destination.displacement)
+                {
+                    continue;
+                }
+                asm_push_ins2(is_narrow && is_signed ? ASM_OP_MOVSXD : ASM_OP_MOV, asm_ir_reg(is_narrow && !is_signed ? "r11d" : "r11"), asm_ir_mem(source));
+                asm_push_ins2(ASM_OP_MOV, asm_ir_mem(destination), asm_ir_reg("r11"));
+            }
+        }
+        position += size;
+    }
+
+    return padding + arguments_size;
+}
+
+/**
+ * SysV x86-64 call. The first six arguments go in rdi, rsi, rdx, rcx, r8 and r9, the rest stay on the
+ * stack where they were pushed, one eight byte slot each. rsp has to be 16 byte aligned at the call.
+ * Structures of up to two eightbytes take two registers, a structure result of that size comes back in
+ * rax and rdx and a larger one is written to room the caller reserves.
+ */
+void codegen_generate_entity_access_for_function_call_x86_64(struct resolver_result *result, struct resolver_entity *entity)
+{
+    struct vector *arguments = entity->func_call_data.arguments;
+    struct resolver_entity *callee = entity->prev;
+    bool is_direct_call = callee == resolver_result_entity_root(result) && codegen_entity_is_direct_call_target(callee);
+    bool returns_structure = datatype_is_struct_or_union_non_pointer(entity->dtype);
+    size_t room = 0;
+    if (returns_structure && !x86_64_eightbytes(entity->dtype))
+    {
+        // Where a pushed structure would be, once the arguments are gone it is the result
+        room = x86_64_stack_argument_size(entity->dtype);
+        asm_push_ins2(ASM_OP_SUB, asm_ir_reg("esp"), asm_ir_imm(room));
+        for (int i = 0; i < room / STACK_PUSH_SIZE; i++)
+        {
+            stackframe_push(current_function, &(struct stack_frame_element){.type = STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, .name = "result_value", .flags = STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE, .data.dtype = entity->dtype});
+        }
+    }
+
+    int total = vector_count(arguments);
+    int in_registers = total < CODEGEN_X86_64_REGISTER_ARGUMENTS ? total : CODEGEN_X86_64_REGISTER_ARGUMENTS;
+    int on_stack = total - in_registers;
+    size_t padding = 0;
+    if ((-asm_stack_back()->offset_from_bp + on_stack * STACK_PUSH_SIZE) % C_STACK_ALIGNMENT)
+    {
+        padding = STACK_PUSH_SIZE;
+        codegen_stack_sub_with_name(padding, "call_alignment");
+    }
+
+    struct vector *dtypes = vector_create(sizeof(const struct datatype *));
+    bool passes_structure = false;
+    vector_set_flag(arguments, VECTOR_FLAG_PEEK_DECREMENT);
+    vector_set_peek_pointer_end(arguments);
+    struct node *node = vector_peek_ptr(arguments);
+    while (node)
+    {
+        codegen_generate_expressionable(node, history_begin(EXPRESSION_IN_FUNCTION_CALL_ARGUMENTS));
+        const struct datatype *dtype = current_process->datatypes->numeric;
+        asm_datatype_back(&dtype);
+        passes_structure |= datatype_is_struct_or_union_non_pointer(dtype);
+        vector_push(dtypes, &dtype);
+        node = vector_peek_ptr(arguments);
+    }
+
+    size_t stack_size = on_stack * STACK_PUSH_SIZE + padding;
+    if (passes_structure || room)
+    {
+        stack_size = codegen_generate_x86_64_structure_arguments(dtypes, entity->dtype, padding);
+    }
+    else
+    {
+        for (int i = 0; i < in_registers; i++)
+        {
+            const struct datatype *dtype = codegen_x86_64_argument_datatype(dtypes, i);
+            const char *reg32 = codegen_x86_64_argument_registers[i][0];
+            const char *reg64 = codegen_x86_64_argument_registers[i][1];
+            asm_push_ins_pop(asm_ir_reg(codegen_datatype_is_wide(dtype) ? reg64 : reg32), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+            codegen_extend_register(reg64, reg32, dtype);
+        }
+
+        asm_stack_peek_start();
+        for (int i = 0; i < on_stack; i++)
+        {
+            struct stack_frame_element *element = asm_stack_peek();
+            if (!(element->flags & STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE) || codegen_datatype_is_wide(element->data.dtype))
+            {
+                continue;
+            }
+
+            // Only the low dword of the slot was written
+            bool is_signed = element->data.dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL);
+            struct asm_operand slot = {.base = "rsp", .displacement = i * STACK_PUSH_SIZE};
+            struct asm_operand low_dword = {.base = "rsp", .displacement = i * STACK_PUSH_SIZE, .size = DATA_SIZE_DWORD};
+            asm_push_ins2(is_signed ? ASM_OP_MOVSXD : ASM_OP_MOV, asm_ir_reg(is_signed ? "r11" : "r11d"), asm_ir_mem(low_dword));
+            asm_push_ins2(ASM_OP_MOV, asm_ir_mem(slot), asm_ir_reg("r11"));
+        }
+    }
+    vector_free(dtypes);
+
+    // al holds the number of vector registers used by a variadic call
+    asm_push_ins2(ASM_OP_XOR, asm_ir_reg("eax"), asm_ir_reg("eax"));
+    if (is_direct_call)
+    {
+        asm_push_ins1(ASM_OP_CALL, asm_ir_symbol(function_node_is_prototype(callee->node) ? "%s wrt ..plt" : "%s", callee->name));
+    }
+    else
+    {
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("r11"), asm_ir_mem((struct asm_operand){.base = "rsp", .displacement = stack_size + room}));
+        asm_push_ins1(ASM_OP_CALL, asm_ir_reg("r11"));
+        // A function pointer below the room goes with the rest of the statement
+        stack_size += room ? 0 : STACK_PUSH_SIZE;
+    }
+
+    codegen_stack_add(stack_size);
+    if (returns_structure)
+    {
+        if (!room && x86_64_eightbytes(entity->dtype) > 1)
+        {
+            asm_push_ins_push_with_data(asm_ir_reg("rdx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
+        }
+
+        if (!room)
+        {
+            asm_push_ins_push_with_data(asm_ir_reg("rax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
+        }
+        codegen_response_acknowledge(RESPONSE_SET(.flags = RESPONSE_FLAG_PUSHED_STRUCTURE));
+    }
+    else
+    {
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
+    }
+    codegen_generate_function_call_result_for_next_entity(entity);
+}
+
+/**
+ * The value is pushed with the type of the pointer it was read through, so whoever uses it takes
+ * all 64 bits. A value narrower than that is sign extended as it is loaded to keep those bits right.
+ */
+void codegen_generate_x86_64_indirection_value(const struct datatype *pointer_dtype, int depth)
+{
+    codegen_apply_unary_access(depth - 1);
+    struct datatype value_dtype = *pointer_dtype;
+    for (int i = 0; i < depth && value_dtype.pointer_depth > 0; i++)
+    {
+        datatype_decrement_pointer(&value_dtype);
+    }
+
+    if (codegen_datatype_is_wide(&value_dtype))
+    {
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("rbx"), asm_ir_mem((struct asm_operand){.base = "rbx"}));
+    }
+    else if (value_dtype.flags & DATATYPE_FLAG_IS_SIGNED)
+    {
+        asm_push_ins2(ASM_OP_MOVSXD, asm_ir_reg("rbx"), asm_ir_mem((struct asm_operand){.base = "rbx", .size = DATA_SIZE_DWORD}));
+    }
+    else
     {
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        asm_push("mov ebx, eax");
-        asm_push_ins_push("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ebx"), asm_ir_mem((struct asm_operand){.base = "rbx"}));
     }
 }
 
 void codegen_generate_entity_access_for_unary_indirection(struct resolver_result *result, struct resolver_entity *entity, struct history *history)
 {
-    asm_push("; INDIRECTION");
-    struct datatype operand_datatype;
+    asm_push_comment("INDIRECTION");
+    const struct datatype *operand_datatype;
     assert(asm_datatype_back(&operand_datatype));
 
-    int flags = asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    int flags = asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     int gen_entity_rules = codegen_entity_rules(result->last_entity, history);
     int depth = entity->indirection.depth;
-    codegen_apply_unary_access(depth);
-    asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS, &(struct stack_frame_data){.dtype = operand_datatype});
+    if (target_is_x86_64() && depth > 0)
+    {
+        codegen_generate_x86_64_indirection_value(operand_datatype, depth);
+    }
+    else
+    {
+        codegen_apply_unary_access(depth);
+    }
+    asm_push_ins_push_with_data(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", STACK_FRAME_ELEMENT_FLAG_IS_PUSHED_ADDRESS, operand_datatype);
 }
 
 void codegen_generate_entity_access_for_unary_get_address(struct resolver_result *result, struct resolver_entity *entity)
 {
-    asm_push_ins_pop("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("; PUSH ADDRESS &");
-    asm_push_ins_push_with_data("ebx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype});
+    asm_push_ins_pop(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_comment("PUSH ADDRESS &");
+    asm_push_ins_push_with_data(asm_ir_reg("ebx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
 }
 
 void codegen_generate_entity_access_for_entity(struct resolver_result *result, struct resolver_entity *entity, struct history *history)
@@ -1606,7 +2325,7 @@ void codegen_generate_entity_access(struct resolver_result *result, struct resol
         struct native_function* native_func = native_function_get(current_process, root_assignment_entity->name);
         if (native_func)
         {
-            asm_push("; NATIVE FUNCTION %s", root_assignment_entity->name);
+            asm_push_comment("NATIVE FUNCTION %s", root_assignment_entity->name);
             struct resolver_entity* func_call_entity = resolver_result_entity_next(root_assignment_entity);
             assert(func_call_entity && func_call_entity->type == RESOLVER_ENTITY_TYPE_FUNCTION_CALL);
             native_func->callbacks.call(&x86_codegen, native_func, func_call_entity->func_call_data.arguments);
@@ -1653,31 +2372,31 @@ bool codegen_resolve_node_for_value(struct node *node, struct history *history)
         return false;
     }
 
-    struct datatype dtype;
+    const struct datatype *dtype;
     assert(asm_datatype_back(&dtype));
     if (result->flags & RESOLVER_RESULT_FLAG_DOES_GET_ADDRESS)
     {
         // Do nothing
     }
     else if(result->last_entity->type == RESOLVER_ENTITY_TYPE_FUNCTION_CALL && 
-        datatype_is_struct_or_union_non_pointer(&result->last_entity->dtype))
+        datatype_is_struct_or_union_non_pointer(result->last_entity->dtype))
         {
             // Do nothing.
         }
-    else if (datatype_is_struct_or_union_non_pointer(&dtype))
+    else if (datatype_is_struct_or_union_non_pointer(dtype))
     {
-        codegen_generate_structure_push(result->last_entity, history, 0);
+        codegen_generate_structure_push(result->last_entity, history);
     }
-    else if (!(dtype.flags & DATATYPE_FLAG_IS_POINTER))
+    else if (!(dtype->flags & DATATYPE_FLAG_IS_POINTER))
     {
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
         if (result->flags & RESOLVER_RESULT_FLAG_FINAL_INDIRECTION_REQUIRED_FOR_VALUE)
         {
-            asm_push("mov eax, [eax]");
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_register_for_datatype("eax", dtype)), asm_ir_mem((struct asm_operand){.base = "eax"}));
         }
 
-        codegen_reduce_register("eax", datatype_element_size(&dtype), dtype.flags & DATATYPE_FLAG_IS_SIGNED);
-        asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = dtype});
+        codegen_reduce_register("eax", datatype_element_size(dtype), dtype->flags & DATATYPE_FLAG_IS_SIGNED);
+        asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, dtype);
     }
     return true;
 }
@@ -1787,7 +2506,7 @@ void asm_stack_peek_start()
     stackframe_peek_start(current_function);
 }
 
-bool asm_datatype_back(struct datatype *dtype_out)
+bool asm_datatype_back(const struct datatype **dtype_out)
 {
     struct stack_frame_element *last_stack_frame_element = asm_stack_back();
     if (!last_stack_frame_element)
@@ -1809,118 +2528,134 @@ bool codegen_can_gen_math(int flags)
     return flags & EXPRESSION_GEN_MATHABLE;
 }
 
-void codegen_gen_cmp(const char *value, const char *set_ins)
+void codegen_gen_cmp(const char *reg, const char *value, int set_op)
 {
-    asm_push("cmp eax, %s", value);
-    asm_push("%s al", set_ins);
-    asm_push("movzx eax, al");
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(reg), asm_ir_reg(value));
+    asm_push_ins1(set_op, asm_ir_reg("al"));
+    asm_push_ins2(ASM_OP_MOVZX, asm_ir_reg("eax"), asm_ir_reg("al"));
 }
 
-void codegen_gen_math_for_value(const char *reg, const char *value, int flags, bool is_signed)
+// reg and value are 32 bit registers, size picks the part of them the math works on
+void codegen_gen_math_for_value(const char *reg, const char *value, int flags, bool is_signed, size_t size)
 {
+    const char *shift_value = codegen_sub_register(value, DATA_SIZE_BYTE);
+    const char *counter = codegen_sub_register("ecx", size);
+    int extend = size == DATA_SIZE_DDWORD ? ASM_OP_CQO : ASM_OP_CDQ;
+    reg = codegen_sub_register(reg, size);
+    value = codegen_sub_register(value, size);
     if (flags & EXPRESSION_IS_ADDITION)
     {
-        asm_push("add %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_ADD, asm_ir_reg(reg), asm_ir_reg(value));
     }
     else if (flags & EXPRESSION_IS_SUBTRACTION)
     {
-        asm_push("sub %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_SUB, asm_ir_reg(reg), asm_ir_reg(value));
     }
     else if (flags & EXPRESSION_IS_MULTIPLICATION)
     {
-        asm_push("mov ecx, %s", value);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(counter), asm_ir_reg(value));
         if (is_signed)
         {
-            asm_push("imul ecx");
+            asm_push_ins1(ASM_OP_IMUL, asm_ir_reg(counter));
         }
         else
         {
-            asm_push("mul ecx");
+            asm_push_ins1(ASM_OP_MUL, asm_ir_reg(counter));
         }
     }
     else if (flags & EXPRESSION_IS_DIVISION)
     {
-        asm_push("mov ecx, %s", value);
-        asm_push("cdq");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(counter), asm_ir_reg(value));
         if (is_signed)
         {
-            asm_push("idiv ecx");
+            asm_push_ins0(extend);
+            asm_push_ins1(ASM_OP_IDIV, asm_ir_reg(counter));
         }
         else
         {
-            asm_push("div ecx");
+            // div takes edx:eax too, sign extending would make a dividend above INT_MAX overflow
+            asm_push_ins2(ASM_OP_XOR, asm_ir_reg("edx"), asm_ir_reg("edx"));
+            asm_push_ins1(ASM_OP_DIV, asm_ir_reg(counter));
         }
     }
     else if (flags & EXPRESSION_IS_MODULAS)
     {
-        asm_push("mov ecx, %s", value);
-        asm_push("cdq");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(counter), asm_ir_reg(value));
         if (is_signed)
         {
-            asm_push("idiv ecx");
+            asm_push_ins0(extend);
+            asm_push_ins1(ASM_OP_IDIV, asm_ir_reg(counter));
         }
         else
         {
-            asm_push("div ecx");
+            asm_push_ins2(ASM_OP_XOR, asm_ir_reg("edx"), asm_ir_reg("edx"));
+            asm_push_ins1(ASM_OP_DIV, asm_ir_reg(counter));
         }
 
-        asm_push("mov eax, edx");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), asm_ir_reg(codegen_sub_register("edx", size)));
     }
     else if (flags & EXPRESSION_IS_ABOVE)
     {
-        codegen_gen_cmp(value, "setg");
+        codegen_gen_cmp(reg, value, is_signed ? ASM_OP_SETG : ASM_OP_SETA);
     }
     else if (flags & EXPRESSION_IS_BELOW)
     {
-        codegen_gen_cmp(value, "setl");
+        codegen_gen_cmp(reg, value, is_signed ? ASM_OP_SETL : ASM_OP_SETB);
     }
     else if (flags & EXPRESSION_IS_EQUAL)
     {
-        codegen_gen_cmp(value, "sete");
+        codegen_gen_cmp(reg, value, ASM_OP_SETE);
     }
     else if (flags & EXPRESSION_IS_ABOVE_OR_EQUAL)
     {
-        codegen_gen_cmp(value, "setge");
+        codegen_gen_cmp(reg, value, is_signed ? ASM_OP_SETGE : ASM_OP_SETAE);
     }
     else if (flags & EXPRESSION_IS_BELOW_OR_EQUAL)
     {
-        codegen_gen_cmp(value, "setle");
+        codegen_gen_cmp(reg, value, is_signed ? ASM_OP_SETLE : ASM_OP_SETBE);
     }
     else if (flags & EXPRESSION_IS_NOT_EQUAL)
     {
-        codegen_gen_cmp(value, "setne");
+        codegen_gen_cmp(reg, value, ASM_OP_SETNE);
     }
     else if (flags & EXPRESSION_IS_BITSHIFT_LEFT)
     {
-        value = codegen_sub_register(value, DATA_SIZE_BYTE);
-        asm_push("sal %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_SAL, asm_ir_reg(reg), asm_ir_reg(shift_value));
     }
     else if (flags & EXPRESSION_IS_BITSHIFT_RIGHT)
     {
-        value = codegen_sub_register(value, DATA_SIZE_BYTE);
         if (is_signed)
         {
-            asm_push("sar %s, %s", reg, value);
+            asm_push_ins2(ASM_OP_SAR, asm_ir_reg(reg), asm_ir_reg(shift_value));
         }
         else
         {
-            asm_push("shr %s, %s", reg, value);
+            asm_push_ins2(ASM_OP_SHR, asm_ir_reg(reg), asm_ir_reg(shift_value));
         }
     }
     else if (flags & EXPRESSION_IS_BITWISE_AND)
     {
-        asm_push("and %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_AND, asm_ir_reg(reg), asm_ir_reg(value));
     }
     else if (flags & EXPRESSION_IS_BITWISE_OR)
     {
-        asm_push("or %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_OR, asm_ir_reg(reg), asm_ir_reg(value));
     }
     else if (flags & EXPRESSION_IS_BITWISE_XOR)
     {
-        asm_push("xor %s, %s", reg, value);
+        asm_push_ins2(ASM_OP_XOR, asm_ir_reg(reg), asm_ir_reg(value));
     }
 }
 
+// Pops a value that is tested against zero, returns the register that holds all of it
+const char *codegen_pop_condition()
+{
+    const struct datatype *dtype = current_process->datatypes->numeric;
+    asm_datatype_back(&dtype);
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    return codegen_register_for_datatype("eax", dtype);
+}
+
 void codegen_setup_new_logical_expression(struct history *history, struct node *node)
 {
     int label_index = codegen_label_count();
@@ -1932,45 +2667,45 @@ void codegen_setup_new_logical_expression(struct history *history, struct node *
 
 void codegen_generate_logical_cmp_and(const char *reg, const char *fail_label)
 {
-    asm_push("cmp %s, 0", reg);
-    asm_push("je %s", fail_label);
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(reg), asm_ir_imm(0));
+    asm_push_ins1(ASM_OP_JE, asm_ir_symbol("%s", fail_label));
 }
 
 void codegen_generate_logical_cmp_or(const char *reg, const char *equal_label)
 {
-    asm_push("cmp %s, 0", reg);
-    asm_push("jg %s", equal_label);
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(reg), asm_ir_imm(0));
+    asm_push_ins1(ASM_OP_JG, asm_ir_symbol("%s", equal_label));
 }
 
-void codegen_generate_logical_cmp(const char *op, const char *fail_label, const char *equal_label)
+void codegen_generate_logical_cmp(const char *reg, const char *op, const char *fail_label, const char *equal_label)
 {
     if (S_EQ(op, "&&"))
     {
-        codegen_generate_logical_cmp_and("eax", fail_label);
+        codegen_generate_logical_cmp_and(reg, fail_label);
     }
     else if (S_EQ(op, "||"))
     {
-        codegen_generate_logical_cmp_or("eax", equal_label);
+        codegen_generate_logical_cmp_or(reg, equal_label);
     }
 }
 void codegen_generate_end_labels_for_logical_expression(const char *op, const char *end_label, const char *end_label_positive)
 {
     if (S_EQ(op, "&&"))
     {
-        asm_push("; && END CLAUSE");
-        asm_push("mov eax, 1");
-        asm_push("jmp %s", end_label_positive);
-        asm_push("%s:", end_label);
-        asm_push("xor eax, eax");
-        asm_push("%s:", end_label_positive);
+        asm_push_comment("&& END CLAUSE");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_imm(1));
+        asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", end_label_positive));
+        asm_push_label("%s", end_label);
+        asm_push_ins2(ASM_OP_XOR, asm_ir_reg("eax"), asm_ir_reg("eax"));
+        asm_push_label("%s", end_label_positive);
     }
     else if (S_EQ(op, "||"))
     {
-        asm_push("; || END CLAUSE");
-        asm_push("jmp %s", end_label);
-        asm_push("%s:", end_label_positive);
-        asm_push("mov eax, 1");
-        asm_push("%s:", end_label);
+        asm_push_comment("|| END CLAUSE");
+        asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", end_label));
+        asm_push_label("%s", end_label_positive);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_imm(1));
+        asm_push_label("%s", end_label);
     }
 }
 void codegen_generate_exp_node_for_logical_arithmetic(struct node *node, struct history *history)
@@ -1981,16 +2716,220 @@ void codegen_generate_exp_node_for_logical_arithmetic(struct node *node, struct
         codegen_setup_new_logical_expression(history, node);
     }
     codegen_generate_expressionable(node->exp.left, history_down(history, history->flags | EXPRESSION_IN_LOGICAL_EXPRESSION));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    codegen_generate_logical_cmp(node->exp.op, history->exp.logical_end_label, history->exp.logical_end_label_positive);
+    codegen_generate_logical_cmp(codegen_pop_condition(), node->exp.op, history->exp.logical_end_label, history->exp.logical_end_label_positive);
     codegen_generate_expressionable(node->exp.right, history_down(history, history->flags | EXPRESSION_IN_LOGICAL_EXPRESSION));
     if (!is_logical_node(node->exp.right))
     {
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        codegen_generate_logical_cmp(node->exp.op, history->exp.logical_end_label, history->exp.logical_end_label_positive);
+        codegen_generate_logical_cmp(codegen_pop_condition(), node->exp.op, history->exp.logical_end_label, history->exp.logical_end_label_positive);
         codegen_generate_end_labels_for_logical_expression(node->exp.op, history->exp.logical_end_label, history->exp.logical_end_label_positive);
-        asm_push_ins_push("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins_push(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    }
+}
+
+int codegen_power_of_two_shift(unsigned int value)
+{
+    if (value == 0 || (value & (value - 1)))
+    {
+        return -1;
+    }
+
+    int shift = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+void codegen_gen_multiply_by_constant(const char *reg, int value)
+{
+    int shift = codegen_power_of_two_shift((unsigned int)value);
+    if (value == 0)
+    {
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(reg), asm_ir_imm(0));
+    }
+    else if (value == -1)
+    {
+        asm_push_ins1(ASM_OP_NEG, asm_ir_reg(reg));
+    }
+    else if (shift > 0)
+    {
+        asm_push_ins2(ASM_OP_SHL, asm_ir_reg(reg), asm_ir_imm(shift));
+    }
+    else if (value == 3 || value == 5 || value == 9)
+    {
+        asm_push_ins2(ASM_OP_LEA, asm_ir_reg(reg), asm_ir_mem((struct asm_operand){.base = reg, .index = reg, .scale = value - 1}));
+    }
+    else if (value != 1)
+    {
+        asm_push_ins2(ASM_OP_IMUL, asm_ir_reg(reg), asm_ir_imm(value));
+    }
+}
+
+/**
+ * Divides eax by a constant without idiv/div, the quotient or the remainder is left in eax.
+ * ecx and edx are clobbered. Returns false when the divisor has no cheaper sequence.
+ */
+bool codegen_gen_division_by_constant(int divisor, bool is_signed, bool is_modulo)
+{
+    if (divisor == 1 || (is_signed && divisor == -1))
+    {
+        if (is_modulo)
+        {
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_imm(0));
+        }
+        else if (divisor == -1)
+        {
+            asm_push_ins1(ASM_OP_NEG, asm_ir_reg("eax"));
+        }
+        return true;
+    }
+
+    if (!is_signed)
+    {
+        // Divisors above INT_MAX give a quotient of 0 or 1, div is fine for those
+        if (divisor <= 0)
+        {
+            return false;
+        }
+
+        int shift = codegen_power_of_two_shift(divisor);
+        if (shift != -1)
+        {
+            if (is_modulo)
+            {
+                asm_push_ins2(ASM_OP_AND, asm_ir_reg("eax"), asm_ir_imm(divisor - 1));
+            }
+            else
+            {
+                asm_push_ins2(ASM_OP_SHR, asm_ir_reg("eax"), asm_ir_imm(shift));
+            }
+            return true;
+        }
+
+        unsigned int multiplier = 0;
+        bool add = false;
+        division_magic_unsigned(divisor, &multiplier, &shift, &add);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ecx"), asm_ir_reg("eax"));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_imm(multiplier));
+        asm_push_ins1(ASM_OP_MUL, asm_ir_reg("ecx"));
+        if (add)
+        {
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_reg("ecx"));
+            asm_push_ins2(ASM_OP_SUB, asm_ir_reg("eax"), asm_ir_reg("edx"));
+            asm_push_ins2(ASM_OP_SHR, asm_ir_reg("eax"), asm_ir_imm(1));
+            asm_push_ins2(ASM_OP_ADD, asm_ir_reg("eax"), asm_ir_reg("edx"));
+            if (shift > 1)
+            {
+                asm_push_ins2(ASM_OP_SHR, asm_ir_reg("eax"), asm_ir_imm(shift - 1));
+            }
+        }
+        else
+        {
+            if (shift > 0)
+            {
+                asm_push_ins2(ASM_OP_SHR, asm_ir_reg("edx"), asm_ir_imm(shift));
+            }
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_reg("edx"));
+        }
+    }
+    else
+    {
+        // Truncating division rounds towards zero, so the quotient for -d is the negated quotient for d
+        // and the remainder takes the sign of the dividend only
+        unsigned int abs_divisor = divisor < 0 ? 0u - (unsigned int)divisor : (unsigned int)divisor;
+        int shift = codegen_power_of_two_shift(abs_divisor);
+        if (shift != -1)
+        {
+            // Negative dividends are biased by 2^shift - 1 so the arithmetic shift rounds towards zero
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("edx"), asm_ir_reg("eax"));
+            if (shift > 1)
+            {
+                asm_push_ins2(ASM_OP_SAR, asm_ir_reg("edx"), asm_ir_imm(31));
+            }
+            asm_push_ins2(ASM_OP_SHR, asm_ir_reg("edx"), asm_ir_imm(32 - shift));
+            asm_push_ins2(ASM_OP_ADD, asm_ir_reg("eax"), asm_ir_reg("edx"));
+            if (is_modulo)
+            {
+                asm_push_ins2(ASM_OP_AND, asm_ir_reg("eax"), asm_ir_imm(abs_divisor - 1));
+                asm_push_ins2(ASM_OP_SUB, asm_ir_reg("eax"), asm_ir_reg("edx"));
+                return true;
+            }
+
+            asm_push_ins2(ASM_OP_SAR, asm_ir_reg("eax"), asm_ir_imm(shift));
+        }
+        else
+        {
+            int multiplier = 0;
+            division_magic_signed(abs_divisor, &multiplier, &shift);
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ecx"), asm_ir_reg("eax"));
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_imm(multiplier));
+            asm_push_ins1(ASM_OP_IMUL, asm_ir_reg("ecx"));
+            if (multiplier < 0)
+            {
+                asm_push_ins2(ASM_OP_ADD, asm_ir_reg("edx"), asm_ir_reg("ecx"));
+            }
+            if (shift > 0)
+            {
+                asm_push_ins2(ASM_OP_SAR, asm_ir_reg("edx"), asm_ir_imm(shift));
+            }
+            asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_reg("edx"));
+            asm_push_ins2(ASM_OP_SHR, asm_ir_reg("eax"), asm_ir_imm(31));
+            asm_push_ins2(ASM_OP_ADD, asm_ir_reg("eax"), asm_ir_reg("edx"));
+        }
+
+        if (divisor < 0 && !is_modulo)
+        {
+            asm_push_ins1(ASM_OP_NEG, asm_ir_reg("eax"));
+        }
+        divisor = abs_divisor;
     }
+
+    if (is_modulo)
+    {
+        asm_push_ins2(ASM_OP_IMUL, asm_ir_reg("eax"), asm_ir_imm(divisor));
+        asm_push_ins2(ASM_OP_SUB, asm_ir_reg("ecx"), asm_ir_reg("eax"));
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_reg("ecx"));
+    }
+    return true;
+}
+
+bool codegen_generate_exp_node_for_constant_math(struct node *node, struct history *history, int op_flags)
+{
+    struct node *right_node = node->exp.right;
+    if (!(op_flags & (EXPRESSION_IS_MULTIPLICATION | EXPRESSION_IS_DIVISION | EXPRESSION_IS_MODULAS)) ||
+        right_node->type != NODE_TYPE_NUMBER)
+    {
+        return false;
+    }
+
+    long long llvalue = (long long)right_node->llnum;
+    if (llvalue < INT_MIN || llvalue > INT_MAX || (llvalue == 0 && !(op_flags & EXPRESSION_IS_MULTIPLICATION)))
+    {
+        return false;
+    }
+
+    int value = (int)llvalue;
+    codegen_generate_expressionable(node->exp.left, history_down(history, history->flags));
+    const struct datatype *left_dtype = current_process->datatypes->numeric;
+    asm_datatype_back(&left_dtype);
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+
+    bool is_signed = left_dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL);
+    size_t size = codegen_push_size(left_dtype);
+    if (op_flags & EXPRESSION_IS_MULTIPLICATION)
+    {
+        codegen_gen_multiply_by_constant(codegen_sub_register("eax", size), value);
+    }
+    else if (size == DATA_SIZE_DDWORD || !codegen_gen_division_by_constant(value, is_signed, op_flags & EXPRESSION_IS_MODULAS))
+    {
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_sub_register("ecx", size)), asm_ir_imm(value));
+        codegen_gen_math_for_value("eax", "ecx", op_flags, is_signed, size);
+    }
+
+    asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, left_dtype);
+    return true;
 }
 
 void codegen_generate_exp_node_for_arithmetic(struct node *node, struct history *history)
@@ -2007,38 +2946,58 @@ void codegen_generate_exp_node_for_arithmetic(struct node *node, struct history
     struct node *left_node = node->exp.left;
     struct node *right_node = node->exp.right;
     int op_flags = codegen_set_flag_for_operator(node->exp.op);
+    if (codegen_generate_exp_node_for_constant_math(node, history, op_flags))
+    {
+        return;
+    }
+
     codegen_generate_expressionable(left_node, history_down(history, flags));
     codegen_generate_expressionable(right_node, history_down(history, flags));
-    struct datatype last_dtype = datatype_for_numeric();
+    const struct datatype *last_dtype = current_process->datatypes->numeric;
     asm_datatype_back(&last_dtype);
     if (codegen_can_gen_math(op_flags))
     {
-        struct datatype right_dtype = datatype_for_numeric();
+        const struct datatype *right_dtype = current_process->datatypes->numeric;
         asm_datatype_back(&right_dtype);
-        asm_push_ins_pop("ecx", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        if (last_dtype.flags & DATATYPE_FLAG_IS_LITERAL)
+        asm_push_ins_pop(asm_ir_reg("ecx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        if (last_dtype->flags & DATATYPE_FLAG_IS_LITERAL)
         {
             asm_datatype_back(&last_dtype);
         }
 
-        struct datatype left_dtype = datatype_for_numeric();
+        const struct datatype *left_dtype = current_process->datatypes->numeric;
         asm_datatype_back(&left_dtype);
-        asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        struct datatype *pointer_datatype = datatype_thats_a_pointer(&left_dtype, &right_dtype);
+        asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        size_t size = DATA_SIZE_DWORD;
+        if (codegen_datatype_is_wide(left_dtype) || codegen_datatype_is_wide(right_dtype))
+        {
+            // The narrow side is extended, the result is as wide as the wide side
+            size = DATA_SIZE_DDWORD;
+            codegen_extend_register("rax", "eax", left_dtype);
+            codegen_extend_register("rcx", "ecx", right_dtype);
+            if (!codegen_datatype_is_wide(last_dtype))
+            {
+                last_dtype = codegen_datatype_is_wide(left_dtype) ? left_dtype : right_dtype;
+            }
+        }
+
+        const struct datatype *pointer_datatype = datatype_thats_a_pointer(left_dtype, right_dtype);
         if (pointer_datatype && datatype_size(datatype_pointer_reduce(pointer_datatype, 1)) > DATA_SIZE_BYTE)
         {
             const char *reg = "ecx";
-            if (pointer_datatype == &right_dtype)
+            // Both sides can be the same interned datatype, only the left one is returned then
+            if (pointer_datatype != left_dtype)
             {
                 reg = "eax";
             }
-            asm_push("imul %s, %i", reg, datatype_size(datatype_pointer_reduce(pointer_datatype, 1)));
+            codegen_gen_multiply_by_constant(codegen_sub_register(reg, size), datatype_size(datatype_pointer_reduce(pointer_datatype, 1)));
         }
 
-        codegen_gen_math_for_value("eax", "ecx", op_flags, last_dtype.flags & DATATYPE_FLAG_IS_SIGNED);
+        // Numbers are ints, an operation is only unsigned when the operand deciding it has an unsigned type
+        codegen_gen_math_for_value("eax", "ecx", op_flags, last_dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL), size);
     }
 
-    asm_push_ins_push_with_data("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = last_dtype});
+    asm_push_ins_push_with_data(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, last_dtype);
 }
 
 int codegen_remove_uninheritable_flags(int flags)
@@ -2076,69 +3035,269 @@ void codegen_discard_unused_stack()
             break;
         }
 
-        stack_adjustment += DATA_SIZE_DWORD;
+        stack_adjustment += STACK_PUSH_SIZE;
         element = asm_stack_peek();
     }
 
     codegen_stack_add(stack_adjustment);
 }
 
-void codegen_plus_or_minus_string_for_value(char *out, int val, size_t len)
+void codegen_generate_structure_block_push(struct resolver_entity *entity, size_t structure_size)
 {
-    memset(out, 0, len);
-    if (val < 0)
+    // Same layout the pushes would leave, the first slot ends up on top
+    int slots = codegen_structure_slots(structure_size);
+    asm_push_ins2(ASM_OP_SUB, asm_ir_reg("esp"), asm_ir_imm(slots * STACK_PUSH_SIZE));
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_address_register("esi")), asm_ir_reg(codegen_address_register("ebx")));
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg(codegen_address_register("edi")), asm_ir_reg("esp"));
+    codegen_generate_block_copy(structure_size);
+    for (int i = 0; i < slots; i++)
     {
-        sprintf(out, "%i", val);
+        stackframe_push(current_function, &(struct stack_frame_element){.type = STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, .name = "result_value", .flags = STACK_FRAME_ELEMENT_FLAG_HAS_DATATYPE, .data.dtype = entity->dtype});
+    }
+}
+
+void codegen_generate_structure_push(struct resolver_entity *entity, struct history *history)
+{
+    asm_push_comment("STRUCTURE PUSH");
+    size_t structure_size = align_value(entity->dtype->size, DATA_SIZE_DWORD);
+    if (codegen_uses_block_copy(structure_size))
+    {
+        codegen_generate_structure_block_push(entity, structure_size);
     }
     else
     {
-        sprintf(out, "+%i", val);
+        // A push from memory writes the slot straight from the source, below the threshold nothing copies faster
+        for (int i = codegen_structure_slots(structure_size) - 1; i >= 0; i--)
+        {
+            struct asm_operand chunk = {.base = "ebx", .displacement = i * STACK_PUSH_SIZE, .size = codegen_structure_chunk_size(structure_size, i)};
+            asm_push_ins_push_with_data(asm_ir_mem(chunk), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, entity->dtype);
+        }
     }
+    asm_push_comment("END STRUCTURE PUSH");
+    codegen_response_acknowledge(RESPONSE_SET(.flags = RESPONSE_FLAG_PUSHED_STRUCTURE));
 }
 
-void codegen_generate_structure_push(struct resolver_entity *entity, struct history *history, int start_pos)
+/**
+ * A SysV structure result of up to two eightbytes goes back in rax and rdx. A larger one is copied to where
+ * the hidden pointer the caller passed in the first register points, and the pointer goes back in rax.
+ */
+void codegen_generate_statement_return_structure_x86_64(const struct datatype *dtype)
 {
-    asm_push("; STRUCTURE PUSH");
-    size_t structure_size = align_value(entity->dtype.size, DATA_SIZE_DWORD);
-    int pushes = structure_size / DATA_SIZE_DWORD;
-    for (int i = pushes - 1; i >= start_pos; i--)
+    int eightbytes = x86_64_eightbytes(dtype);
+    if (eightbytes)
     {
-        char fmt[10];
-        int chunk_offset = (i * DATA_SIZE_DWORD);
-        codegen_plus_or_minus_string_for_value(fmt, chunk_offset, sizeof(fmt));
-        asm_push_ins_push_with_data("dword [%s%s]", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value", 0, &(struct stack_frame_data){.dtype = entity->dtype}, "ebx", fmt);
+        asm_push_ins_pop(asm_ir_reg("rax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        if (eightbytes > 1)
+        {
+            asm_push_ins_pop(asm_ir_reg("rdx"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        }
+        return;
     }
-    asm_push("; END STRUCTURE PUSH");
-    codegen_response_acknowledge(RESPONSE_SET(.flags = RESPONSE_FLAG_PUSHED_STRUCTURE));
+
+    struct asm_operand result_pointer = {.base = "rbp", .displacement = codegen_function_register_argument_offset(current_function, 0)};
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg("rdx"), asm_ir_mem(result_pointer));
+    codegen_generate_move_struct(dtype, &(struct asm_operand){.base = "rdx"}, 0);
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg("rax"), asm_ir_mem(result_pointer));
 }
 
 void codegen_generate_statement_return_exp(struct node *node)
 {
     codegen_response_expect();
     codegen_generate_expressionable(node->stmt.return_stmt.exp, history_begin(IS_STATEMENT_RETURN));
-    struct datatype dtype;
+    const struct datatype *dtype;
     assert(asm_datatype_back(&dtype));
-    if (datatype_is_struct_or_union_non_pointer(&dtype))
+    if (datatype_is_struct_or_union_non_pointer(dtype) && target_is_x86_64())
+    {
+        codegen_generate_statement_return_structure_x86_64(dtype);
+        return;
+    }
+
+    if (datatype_is_struct_or_union_non_pointer(dtype))
     {
-        asm_push("mov edx, [ebp+8]");
-        codegen_generate_move_struct(&dtype, "edx", 0);
-        asm_push("mov eax, [ebp+8]");
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("edx"), asm_ir_mem((struct asm_operand){.base = "ebp", .displacement = 8}));
+        codegen_generate_move_struct(dtype, &(struct asm_operand){.base = "edx"}, 0);
+        asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_mem((struct asm_operand){.base = "ebp", .displacement = 8}));
         return;
     }
 
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    asm_push_ins_pop(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    codegen_widen_register("eax", dtype, node->binded.function->func.rtype);
+}
+
+size_t codegen_function_argument_size(struct node *function)
+{
+    size_t size = 0;
+    struct vector *arguments = function_node_argument_vec(function);
+    for (int i = 0; i < vector_count(arguments); i++)
+    {
+        struct node *argument = *(struct node **)vector_at(arguments, i);
+        size += align_value(datatype_size(argument->var.type), DATA_SIZE_DWORD);
+    }
+    return size;
+}
+
+/**
+ * True when an address into the stack frame may be taken: the & operator, arrays and structures that
+ * are accessed through their address, or native functions such as va_start that point into our arguments.
+ */
+bool codegen_frame_may_escape(struct node *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        if (S_EQ(node->exp.op, "()") && node->exp.left->type == NODE_TYPE_IDENTIFIER &&
+            symresolver_get_symbol_for_native_function(current_process, node->exp.left->sval))
+        {
+            return true;
+        }
+        return codegen_frame_may_escape(node->exp.left) || codegen_frame_may_escape(node->exp.right);
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        return codegen_frame_may_escape(node->parenthesis.exp);
+
+    case NODE_TYPE_UNARY:
+        return S_EQ(node->unary.op, "&") || codegen_frame_may_escape(node->unary.operand);
+
+    case NODE_TYPE_TENARY:
+        return codegen_frame_may_escape(node->tenary.true_node) || codegen_frame_may_escape(node->tenary.false_node);
+
+    case NODE_TYPE_CAST:
+        return codegen_frame_may_escape(node->cast.operand);
+
+    case NODE_TYPE_BRACKET:
+        return codegen_frame_may_escape(node->bracket.inner);
+
+    case NODE_TYPE_VARIABLE:
+        return node->var.type->flags & DATATYPE_FLAG_IS_ARRAY || datatype_is_struct_or_union_non_pointer(node->var.type) ||
+               codegen_frame_may_escape(node->var.val);
+
+    case NODE_TYPE_VARIABLE_LIST:
+    case NODE_TYPE_BODY:
+    {
+        struct vector *nodes = node->type == NODE_TYPE_BODY ? node->body.statements : node->var_list.list;
+        for (int i = 0; i < vector_count(nodes); i++)
+        {
+            if (codegen_frame_may_escape(*(struct node **)vector_at(nodes, i)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    case NODE_TYPE_STRUCT:
+    case NODE_TYPE_UNION:
+        return true;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        return codegen_frame_may_escape(node->stmt.return_stmt.exp);
+
+    case NODE_TYPE_STATEMENT_IF:
+        return codegen_frame_may_escape(node->stmt.if_stmt.cond_node) || codegen_frame_may_escape(node->stmt.if_stmt.body_node) ||
+               codegen_frame_may_escape(node->stmt.if_stmt.next);
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        return codegen_frame_may_escape(node->stmt.else_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        return codegen_frame_may_escape(node->stmt.while_stmt.exp_node) || codegen_frame_may_escape(node->stmt.while_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        return codegen_frame_may_escape(node->stmt.do_while_stmt.exp_node) || codegen_frame_may_escape(node->stmt.do_while_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_FOR:
+        return codegen_frame_may_escape(node->stmt.for_stmt.init_node) || codegen_frame_may_escape(node->stmt.for_stmt.cond_node) ||
+               codegen_frame_may_escape(node->stmt.for_stmt.loop_node) || codegen_frame_may_escape(node->stmt.for_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        return codegen_frame_may_escape(node->stmt.switch_stmt.exp) || codegen_frame_may_escape(node->stmt.switch_stmt.body);
+    }
+    return false;
+}
+
+/**
+ * return f(a, b); becomes a jump to f. The arguments are evaluated, then written over our own
+ * arguments, and f returns straight to our caller who removes as many arguments as it pushed for us.
+ */
+bool codegen_generate_tail_call(struct node *node)
+{
+    struct node *function = node->binded.function;
+    struct node *exp = node->stmt.return_stmt.exp;
+    // On x86-64 the arguments are passed in registers, there are no argument slots of ours to reuse
+    if (target_is_x86_64() || current_function_frame_escapes || !exp || !node_is_expression(exp, "()") || datatype_is_struct_or_union_non_pointer(function->func.rtype))
+    {
+        return false;
+    }
+
+    struct resolver_result *result = resolver_follow(current_process->resolver, exp);
+    if (!resolver_result_ok(result))
+    {
+        return false;
+    }
+
+    struct resolver_entity *callee = resolver_result_entity_root(result);
+    if (!codegen_entity_is_direct_call_target(callee))
+    {
+        return false;
+    }
+
+    struct resolver_entity *call = resolver_result_entity_next(callee);
+    struct vector *arguments = call->func_call_data.arguments;
+    size_t stack_size = call->func_call_data.stack_size;
+    if (resolver_result_entity_next(call) || datatype_is_struct_or_union_non_pointer(call->dtype) ||
+        stack_size != vector_count(arguments) * DATA_SIZE_DWORD || stack_size > codegen_function_argument_size(function))
+    {
+        return false;
+    }
+
+    asm_push_comment("TAIL CALL %s", callee->name);
+    vector_set_flag(arguments, VECTOR_FLAG_PEEK_DECREMENT);
+    vector_set_peek_pointer_end(arguments);
+    struct node *argument = vector_peek_ptr(arguments);
+    while (argument)
+    {
+        codegen_generate_expressionable(argument, history_begin(EXPRESSION_IN_FUNCTION_CALL_ARGUMENTS));
+        argument = vector_peek_ptr(arguments);
+    }
+
+    // Only now that every argument is computed can ours be overwritten
+    size_t offset = function_node_argument_stack_addition(function);
+    for (int i = 0; i < vector_count(arguments); i++)
+    {
+        asm_push_ins1(ASM_OP_POP, asm_ir_reg("eax"));
+        stackframe_pop(current_function);
+        struct asm_operand argument_slot = {.base = "ebp", .displacement = offset + i * DATA_SIZE_DWORD, .size = DATA_SIZE_DWORD};
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(argument_slot), asm_ir_reg("eax"));
+    }
+
+    codegen_restore_callee_saved_registers(function);
+    codegen_stack_add_no_compile_time_stack_frame_restore(codegen_function_frame_size(function));
+    asm_pop_ebp_no_stack_frame_restore();
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", callee->name));
+    return true;
 }
 
 void codegen_generate_statement_return(struct node *node)
 {
+    if (codegen_generate_tail_call(node))
+    {
+        return;
+    }
+
     if (node->stmt.return_stmt.exp)
     {
         codegen_generate_statement_return_exp(node);
     }
 
-    codegen_stack_add_no_compile_time_stack_frame_restore(C_ALIGN(function_node_stack_size(node->binded.function)));
+    codegen_restore_callee_saved_registers(node->binded.function);
+    codegen_stack_add_no_compile_time_stack_frame_restore(codegen_function_frame_size(node->binded.function));
     asm_pop_ebp_no_stack_frame_restore();
-    asm_push("ret");
+    codegen_generate_ret(node->binded.function);
 }
 void _codegen_generate_if_stmt(struct node *node, int end_label_id);
 
@@ -2162,16 +3321,52 @@ void codegen_generate_else_or_else_if(struct node *node, int end_label_id)
         compiler_error(current_process, "Unexpected keyword compiler bug");
     }
 }
+bool codegen_generate_constant_if_stmt(struct node *node, int end_label_id)
+{
+    struct node *cond_node = node->stmt.if_stmt.cond_node;
+    if (cond_node->type != NODE_TYPE_NUMBER)
+    {
+        return false;
+    }
+
+    if (cond_node->llnum)
+    {
+        if (node_has_jump_target(node->stmt.if_stmt.next))
+        {
+            return false;
+        }
+
+        codegen_generate_body(node->stmt.if_stmt.body_node, history_begin(IS_ALONE_STATEMENT));
+        return true;
+    }
+
+    if (node_has_jump_target(node->stmt.if_stmt.body_node))
+    {
+        return false;
+    }
+
+    if (node->stmt.if_stmt.next)
+    {
+        codegen_generate_else_or_else_if(node->stmt.if_stmt.next, end_label_id);
+    }
+    return true;
+}
+
 void _codegen_generate_if_stmt(struct node *node, int end_label_id)
 {
+    // Folded to a constant, only the branch taken is generated
+    if (codegen_generate_constant_if_stmt(node, end_label_id))
+    {
+        return;
+    }
+
     int if_label_id = codegen_label_count();
     codegen_generate_expressionable(node->stmt.if_stmt.cond_node, history_begin(0));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("cmp eax, 0");
-    asm_push("je .if_%i", if_label_id);
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(codegen_pop_condition()), asm_ir_imm(0));
+    asm_push_ins1(ASM_OP_JE, asm_ir_symbol(".if_%i", if_label_id));
     codegen_generate_body(node->stmt.if_stmt.body_node, history_begin(IS_ALONE_STATEMENT));
-    asm_push("jmp .if_end_%i", end_label_id);
-    asm_push(".if_%i:", if_label_id);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol(".if_end_%i", end_label_id));
+    asm_push_label(".if_%i", if_label_id);
 
     if (node->stmt.if_stmt.next)
     {
@@ -2183,35 +3378,98 @@ void codegen_generate_if_stmt(struct node *node)
 {
     int end_label_id = codegen_label_count();
     _codegen_generate_if_stmt(node, end_label_id);
-    asm_push(".if_end_%i:", end_label_id);
+    asm_push_label(".if_end_%i", end_label_id);
+}
+
+void codegen_generate_loop_condition_jump(struct node *cond_node, bool jump_if_true, const char *label)
+{
+    // No condition or a constant one needs no test
+    if (!cond_node || cond_node->type == NODE_TYPE_NUMBER)
+    {
+        bool is_true = !cond_node || cond_node->llnum;
+        if (is_true == jump_if_true)
+        {
+            asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", label));
+        }
+        return;
+    }
+
+    codegen_generate_expressionable(cond_node, history_begin(0));
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg(codegen_pop_condition()), asm_ir_imm(0));
+    asm_push_ins1(jump_if_true ? ASM_OP_JNE : ASM_OP_JE, asm_ir_symbol("%s", label));
+}
+
+bool codegen_rotates_loops()
+{
+    return !(current_process->flags & COMPILE_PROCESS_NO_LOOP_ROTATION);
+}
+
+/**
+ * Loops are rotated, the condition is tested once on the way in and then at the bottom of every
+ * iteration so each iteration takes a single branch. The loop head is aligned for the back edge.
+ * With norotate the condition is tested at the top and the bottom jumps back to it.
+ */
+void codegen_generate_loop_head(struct node *cond_node, const char *start_label, const char *end_label)
+{
+    if (!codegen_rotates_loops())
+    {
+        asm_push_label("%s", start_label);
+        codegen_generate_loop_condition_jump(cond_node, false, end_label);
+        return;
+    }
+
+    codegen_generate_loop_condition_jump(cond_node, false, end_label);
+    asm_push_ins1(ASM_OP_ALIGN, asm_ir_imm(16));
+    asm_push_label("%s", start_label);
+}
+
+void codegen_generate_loop_back_edge(struct node *cond_node, const char *start_label)
+{
+    if (!codegen_rotates_loops())
+    {
+        asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", start_label));
+        return;
+    }
+
+    codegen_generate_loop_condition_jump(cond_node, true, start_label);
 }
 
 void codegen_generate_while_stmt(struct node *node)
 {
-    codegen_begin_entry_exit_point();
+    struct node *exp_node = node->stmt.while_stmt.exp_node;
+    if (exp_node->type == NODE_TYPE_NUMBER && !exp_node->llnum && !node_has_jump_target(node->stmt.while_stmt.body_node))
+    {
+        return;
+    }
+
+    codegen_begin_loop_entry_exit_point();
     int while_start_id = codegen_label_count();
     int while_end_id = codegen_label_count();
-    asm_push(".while_start_%i:", while_start_id);
-    codegen_generate_expressionable(node->stmt.while_stmt.exp_node, history_begin(0));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("cmp eax, 0");
-    asm_push("je .while_end_%i", while_end_id);
+    char start_label[32];
+    char end_label[32];
+    sprintf(start_label, ".while_start_%i", while_start_id);
+    sprintf(end_label, ".while_end_%i", while_end_id);
+
+    codegen_generate_loop_head(exp_node, start_label, end_label);
     codegen_generate_body(node->stmt.while_stmt.body_node, history_begin(IS_ALONE_STATEMENT));
-    asm_push("jmp .while_start_%i", while_start_id);
-    asm_push(".while_end_%i:", while_end_id);
+    codegen_place_entry_point();
+    codegen_generate_loop_back_edge(exp_node, start_label);
+    asm_push_label("%s", end_label);
     codegen_end_entry_exit_point();
 }
 
 void codegen_generate_do_while_stmt(struct node *node)
 {
-    codegen_begin_entry_exit_point();
+    codegen_begin_loop_entry_exit_point();
     int do_while_start_id = codegen_label_count();
-    asm_push(".do_while_start_%i:", do_while_start_id);
+    char start_label[32];
+    sprintf(start_label, ".do_while_start_%i", do_while_start_id);
+
+    asm_push_ins1(ASM_OP_ALIGN, asm_ir_imm(16));
+    asm_push_label("%s", start_label);
     codegen_generate_body(node->stmt.do_while_stmt.body_node, history_begin(IS_ALONE_STATEMENT));
-    codegen_generate_expressionable(node->stmt.do_while_stmt.exp_node, history_begin(0));
-    asm_push_ins_pop("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    asm_push("cmp eax, 0");
-    asm_push("jne .do_while_start_%i", do_while_start_id);
+    codegen_place_entry_point();
+    codegen_generate_loop_condition_jump(node->stmt.do_while_stmt.exp_node, true, start_label);
     codegen_end_entry_exit_point();
 }
 
@@ -2220,81 +3478,226 @@ void codegen_generate_for_stmt(struct node *node)
     struct for_stmt *for_stmt = &node->stmt.for_stmt;
     int for_loop_start_id = codegen_label_count();
     int for_loop_end_id = codegen_label_count();
+    char start_label[32];
+    char end_label[32];
+    sprintf(start_label, ".for_loop%i", for_loop_start_id);
+    sprintf(end_label, ".for_loop_end%i", for_loop_end_id);
     if (for_stmt->init_node)
     {
         codegen_generate_expressionable(for_stmt->init_node, history_begin(0));
-        asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    }
-
-    asm_push("jmp .for_loop%i", for_loop_start_id);
-    codegen_begin_entry_exit_point();
-    if (for_stmt->loop_node)
-    {
-        codegen_generate_expressionable(for_stmt->loop_node, history_begin(0));
-        asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-    }
-    asm_push(".for_loop%i:", for_loop_start_id);
-    if (for_stmt->cond_node)
-    {
-        codegen_generate_expressionable(for_stmt->cond_node, history_begin(0));
-        asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
-        asm_push("cmp eax, 0");
-        asm_push("je .for_loop_end%i", for_loop_end_id);
+        asm_push_ins_pop_or_ignore(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     }
 
+    codegen_begin_loop_entry_exit_point();
+    codegen_generate_loop_head(for_stmt->cond_node, start_label, end_label);
     if (for_stmt->body_node)
     {
         codegen_generate_body(for_stmt->body_node, history_begin(IS_ALONE_STATEMENT));
     }
 
+    codegen_place_entry_point();
     if (for_stmt->loop_node)
     {
         codegen_generate_expressionable(for_stmt->loop_node, history_begin(0));
-        asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+        asm_push_ins_pop_or_ignore(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
     }
 
-    asm_push("jmp .for_loop%i", for_loop_start_id);
-    asm_push(".for_loop_end%i:", for_loop_end_id);
-
+    codegen_generate_loop_back_edge(for_stmt->cond_node, start_label);
+    asm_push_label("%s", end_label);
     codegen_end_entry_exit_point();
 }
 
 void codegen_generate_switch_default_stmt(struct node *node)
 {
-    asm_push("; DEFAULT CASE");
+    asm_push_comment("DEFAULT CASE");
     struct code_generator *generator = current_process->generator;
     struct generator_switch_stmt *switch_stmt_data = &generator->_switch;
-    asm_push(".switch_stmt_%i_case_default:", switch_stmt_data->current.id);
+    asm_push_label(".switch_stmt_%i_case_default", switch_stmt_data->current.id);
+    if (switch_stmt_data->current.has_jump_table)
+    {
+        asm_push_label("..@switch_stmt_%i_default", switch_stmt_data->current.id);
+    }
+}
+
+int codegen_switch_case_compare_signed(const void *a, const void *b)
+{
+    int left = *(const int *)a;
+    int right = *(const int *)b;
+    return (left > right) - (left < right);
+}
+
+int codegen_switch_case_compare_unsigned(const void *a, const void *b)
+{
+    unsigned int left = *(const unsigned int *)a;
+    unsigned int right = *(const unsigned int *)b;
+    return (left > right) - (left < right);
+}
+
+bool codegen_switch_cases_are_dense(int *cases, int total)
+{
+    // Distance between the lowest and highest case, unsigned so it can't overflow
+    unsigned int range = (unsigned int)cases[total - 1] - (unsigned int)cases[0];
+    return total >= CODEGEN_SWITCH_TABLE_MIN_CASES && range < CODEGEN_SWITCH_TABLE_MAX_RANGE &&
+           total * 100 >= ((long long)range + 1) * CODEGEN_SWITCH_TABLE_MIN_DENSITY;
+}
+
+/**
+ * Position independent code can not hold absolute addresses, the x86-64 table holds the distance of
+ * every case from the table instead and lives in .text right after the jump, next to the cases.
+ */
+void codegen_generate_switch_relative_jump_table(int *cases, int total, int table_id)
+{
+    struct generator_switch_stmt_entity *current = &current_process->generator->_switch.current;
+    unsigned int range = (unsigned int)cases[total - 1] - (unsigned int)cases[0];
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg("eax"), asm_ir_reg("eax"));
+    char table[ASM_LINE_MAX_LENGTH];
+    sprintf(table, ".switch_table_%i", table_id);
+    asm_push_ins2(ASM_OP_LEA, asm_ir_reg("rcx"), asm_ir_mem((struct asm_operand){.base = table}));
+    asm_push_ins2(ASM_OP_MOVSXD, asm_ir_reg("rax"), asm_ir_mem((struct asm_operand){.base = "rcx", .index = "rax", .scale = 4, .size = DATA_SIZE_DWORD}));
+    asm_push_ins2(ASM_OP_ADD, asm_ir_reg("rax"), asm_ir_reg("rcx"));
+    asm_push_ins1(ASM_OP_JMP, asm_ir_reg("rax"));
+    asm_push_label(".switch_table_%i", table_id);
+    int index = 0;
+    for (unsigned int value = 0; value <= range; value++)
+    {
+        if ((unsigned int)cases[index] - (unsigned int)cases[0] == value)
+        {
+            asm_push_directive("dd ..@switch_stmt_%i_case_%i - .switch_table_%i", current->id, cases[index], table_id);
+            index++;
+            continue;
+        }
+
+        asm_push_directive("dd ..@switch_stmt_%i_default - .switch_table_%i", current->id, table_id);
+    }
+    current->has_jump_table = true;
+}
+
+void codegen_generate_switch_jump_table(int *cases, int total, const char *default_label)
+{
+    struct generator_switch_stmt_entity *current = &current_process->generator->_switch.current;
+    int table_id = codegen_label_count();
+    unsigned int range = (unsigned int)cases[total - 1] - (unsigned int)cases[0];
+    if (cases[0] != 0)
+    {
+        asm_push_ins2(ASM_OP_SUB, asm_ir_reg("eax"), asm_ir_imm(cases[0]));
+    }
+
+    // Anything below the lowest case wraps around and fails the unsigned check as well
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg("eax"), asm_ir_imm(range));
+    asm_push_ins1(ASM_OP_JA, asm_ir_symbol("%s", default_label));
+    if (target_is_x86_64())
+    {
+        codegen_generate_switch_relative_jump_table(cases, total, table_id);
+        return;
+    }
+
+    char table[ASM_LINE_MAX_LENGTH];
+    sprintf(table, "switch_table_%i", table_id);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_mem((struct asm_operand){.base = table, .index = "eax", .scale = 4}));
+
+    codegen_rodata_section_add("switch_table_%i:", table_id);
+    int index = 0;
+    for (unsigned int value = 0; value <= range; value++)
+    {
+        if ((unsigned int)cases[index] - (unsigned int)cases[0] == value)
+        {
+            codegen_rodata_section_add("dd ..@switch_stmt_%i_case_%i", current->id, cases[index]);
+            index++;
+            continue;
+        }
+
+        codegen_rodata_section_add("dd ..@switch_stmt_%i_default", current->id);
+    }
+    current->has_jump_table = true;
 }
 
-void codegen_generate_switch_stmt_case_jumps(struct node *node)
+void codegen_generate_switch_case_search(int *cases, int total, bool is_signed, const char *default_label)
 {
-    vector_set_peek_pointer(node->stmt.switch_stmt.cases, 0);
-    struct parsed_switch_case *switch_case = vector_peek(node->stmt.switch_stmt.cases);
-    while (switch_case)
+    if (codegen_switch_cases_are_dense(cases, total))
     {
-        asm_push("cmp eax, %i", switch_case->index);
-        asm_push("je .switch_stmt_%i_case_%i", codegen_switch_id(), switch_case->index);
-        switch_case = vector_peek(node->stmt.switch_stmt.cases);
+        codegen_generate_switch_jump_table(cases, total, default_label);
+        return;
     }
 
-    if (node->stmt.switch_stmt.has_default_case)
+    if (total < CODEGEN_SWITCH_SEARCH_MIN_CASES)
     {
-        asm_push("jmp .switch_stmt_%i_case_default", codegen_switch_id());
+        for (int i = 0; i < total; i++)
+        {
+            asm_push_ins2(ASM_OP_CMP, asm_ir_reg("eax"), asm_ir_imm(cases[i]));
+            asm_push_ins1(ASM_OP_JE, asm_ir_symbol(".switch_stmt_%i_case_%i", codegen_switch_id(), cases[i]));
+        }
+        asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", default_label));
         return;
     }
 
-    codegen_goto_exit_point_maintain_stack(node);
+    // Sparse cases, split them in half and search each side on its own
+    int middle = total / 2;
+    int upper_half_id = codegen_label_count();
+    asm_push_ins2(ASM_OP_CMP, asm_ir_reg("eax"), asm_ir_imm(cases[middle]));
+    asm_push_ins1(is_signed ? ASM_OP_JGE : ASM_OP_JAE, asm_ir_symbol(".switch_stmt_%i_search_%i", codegen_switch_id(), upper_half_id));
+    codegen_generate_switch_case_search(cases, middle, is_signed, default_label);
+    asm_push_label(".switch_stmt_%i_search_%i", codegen_switch_id(), upper_half_id);
+    codegen_generate_switch_case_search(cases + middle, total - middle, is_signed, default_label);
 }
+
+void codegen_generate_switch_stmt_case_jumps(struct node *node, bool is_signed)
+{
+    struct generator_switch_stmt_entity *current = &current_process->generator->_switch.current;
+    current->has_default_case = node->stmt.switch_stmt.has_default_case;
+
+    char default_label[64];
+    if (current->has_default_case)
+    {
+        sprintf(default_label, ".switch_stmt_%i_case_default", current->id);
+    }
+    else
+    {
+        sprintf(default_label, ".exit_point_%i", codegen_current_exit_point()->id);
+    }
+
+    struct vector *case_vec = node->stmt.switch_stmt.cases;
+    int total = 0;
+    int *cases = malloc(sizeof(int) * (vector_count(case_vec) + 1));
+    for (int i = 0; i < vector_count(case_vec); i++)
+    {
+        cases[total++] = ((struct parsed_switch_case *)vector_at(case_vec, i))->index;
+    }
+    qsort(cases, total, sizeof(int), is_signed ? codegen_switch_case_compare_signed : codegen_switch_case_compare_unsigned);
+
+    // A repeated case would leave a hole in the jump table
+    int unique = 0;
+    for (int i = 0; i < total; i++)
+    {
+        if (unique == 0 || cases[unique - 1] != cases[i])
+        {
+            cases[unique++] = cases[i];
+        }
+    }
+
+    if (unique == 0)
+    {
+        asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("%s", default_label));
+    }
+    else
+    {
+        codegen_generate_switch_case_search(cases, unique, is_signed, default_label);
+    }
+    free(cases);
+}
+
 void codegen_generate_switch_stmt(struct node *node)
 {
     codegen_begin_entry_exit_point();
     codegen_begin_switch_statement();
 
     codegen_generate_expressionable(node->stmt.switch_stmt.exp, history_begin(0));
-    asm_push_ins_pop_or_ignore("eax", STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
+    const struct datatype *dtype = current_process->datatypes->numeric;
+    asm_datatype_back(&dtype);
+    // Integer constants are ints, the literal datatype just doesn't carry the flag
+    bool is_signed = dtype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_LITERAL);
+    asm_push_ins_pop_or_ignore(asm_ir_reg("eax"), STACK_FRAME_ELEMENT_TYPE_PUSHED_VALUE, "result_value");
 
-    codegen_generate_switch_stmt_case_jumps(node);
+    codegen_generate_switch_stmt_case_jumps(node, is_signed);
 
     codegen_generate_body(node->stmt.switch_stmt.body, history_begin(IS_ALONE_STATEMENT));
     codegen_end_switch_statement();
@@ -2306,7 +3709,7 @@ void codegen_generate_switch_case_stmt(struct node *node)
     struct node *case_stmt_exp = node->stmt._case.exp;
     assert(case_stmt_exp->type == NODE_TYPE_NUMBER);
     codegen_begin_case_statement(case_stmt_exp->llnum);
-    asm_push("; CASE %i", case_stmt_exp->llnum);
+    asm_push_comment("CASE %i", case_stmt_exp->llnum);
     codegen_end_case_statement();
 }
 
@@ -2322,12 +3725,12 @@ void codegen_generate_continue_stmt(struct node *node)
 
 void codegen_generate_goto_stmt(struct node *node)
 {
-    asm_push("jmp label_%s", node->stmt._goto.label->sval);
+    asm_push_ins1(ASM_OP_JMP, asm_ir_symbol("label_%s", node->stmt._goto.label->sval));
 }
 
 void codegen_generate_label(struct node *node)
 {
-    asm_push("label_%s:", node->label.name->sval);
+    asm_push_label("label_%s", node->label.name->sval);
 }
 
 void codegen_generate_scope_variable_for_list(struct node *var_list_node)
@@ -2343,6 +3746,7 @@ void codegen_generate_scope_variable_for_list(struct node *var_list_node)
 }
 void codegen_generate_statement(struct node *node, struct history *history)
 {
+    resolver_begin_statement(current_process->resolver);
     switch (node->type)
     {
     case NODE_TYPE_EXPRESSION:
@@ -2409,6 +3813,7 @@ void codegen_generate_statement(struct node *node, struct history *history)
     }
 
     codegen_discard_unused_stack();
+    resolver_finish_statement(current_process->resolver);
 }
 void codegen_generate_scope_no_new_scope(struct vector *statements, struct history *history)
 {
@@ -2431,29 +3836,124 @@ void codegen_generate_body(struct node *node, struct history *history)
 {
     codegen_generate_stack_scope(node->body.statements, node->body.size, history);
 }
+void codegen_push_callee_saved_move(struct asm_ir_operand destination, struct asm_ir_operand source)
+{
+    struct asm_ir_instruction *ins = asm_ir_instruction_new(ASM_OP_MOV, NULL);
+    ins->flags |= ASM_IR_INSTRUCTION_FLAG_CALLEE_SAVED;
+    ins->operands[ins->total_operands++] = destination;
+    ins->operands[ins->total_operands++] = source;
+    asm_ir_push(current_process->generator->ir, ins);
+}
+
+/**
+ * Every function stores the callee saved registers of the target below its locals, regalloc_callee_saved
+ * drops the ones the function turns out not to write. x86-64 functions also take their first arguments
+ * in registers, they are stored where codegen_function_argument_offset expects them.
+ */
+void codegen_save_callee_saved_registers(struct node *function)
+{
+    struct compile_target *target = target_current();
+    for (int i = 0; i < target->total_callee_saved_registers; i++)
+    {
+        struct asm_operand slot = {.base = "ebp", .displacement = codegen_function_saved_register_offset(function, i)};
+        codegen_push_callee_saved_move(asm_ir_mem(slot), asm_ir_reg(target->callee_saved_registers[i]));
+    }
+
+    for (int i = 0; i < codegen_function_register_arguments(function); i++)
+    {
+        struct asm_operand argument_slot = {.base = "rbp", .displacement = codegen_function_register_argument_offset(function, i)};
+        asm_push_ins2(ASM_OP_MOV, asm_ir_mem(argument_slot), asm_ir_reg(codegen_x86_64_argument_registers[i][1]));
+    }
+}
+
+void codegen_restore_callee_saved_registers(struct node *function)
+{
+    struct compile_target *target = target_current();
+    for (int i = 0; i < target->total_callee_saved_registers; i++)
+    {
+        struct asm_operand slot = {.base = "ebp", .displacement = codegen_function_saved_register_offset(function, i)};
+        codegen_push_callee_saved_move(asm_ir_reg(target->callee_saved_registers[i]), asm_ir_mem(slot));
+    }
+}
+
+/**
+ * va_list is a single pointer that steps through the arguments, so a variadic function on x86-64 pushes the
+ * argument registers in front of the stack arguments of its caller, with the return address moved below them.
+ * Named and variable arguments are then in one row, the function returns with ret popping the registers.
+ */
+void codegen_generate_register_save_area(struct node *function)
+{
+    if (!codegen_function_register_save_area_size(function))
+    {
+        return;
+    }
+
+    struct x86_64_argument_placement placement;
+    size_t stack_offset;
+    codegen_function_place_arguments(function, vector_count(function_node_argument_vec(function)), &placement, &stack_offset);
+    if (placement.stack_size && placement.registers < CODEGEN_X86_64_REGISTER_ARGUMENTS)
+    {
+        compiler_error(current_process, "The variadic function %s passes a named argument on the stack while argument registers are left, va_arg cannot step over it on x86-64\n", function->func.name);
+    }
+
+    asm_push_ins1(ASM_OP_POP, asm_ir_reg("r11"));
+    for (int i = CODEGEN_X86_64_REGISTER_ARGUMENTS - 1; i >= 0; i--)
+    {
+        asm_push_ins1(ASM_OP_PUSH, asm_ir_reg(codegen_x86_64_argument_registers[i][1]));
+    }
+    asm_push_ins1(ASM_OP_PUSH, asm_ir_reg("r11"));
+}
+
+void codegen_generate_ret(struct node *function)
+{
+    size_t save_area_size = codegen_function_register_save_area_size(function);
+    if (save_area_size)
+    {
+        asm_push_ins1(ASM_OP_RET, asm_ir_imm(save_area_size));
+        return;
+    }
+
+    asm_push_ins0(ASM_OP_RET);
+}
+
 void codegen_generate_function_with_body(struct node *node)
 {
     codegen_register_function(node, 0);
-    asm_push("global %s", node->func.name);
-    asm_push("; %s function", node->func.name);
-    asm_push("%s:", node->func.name);
+    current_function_frame_escapes = codegen_frame_may_escape(node->func.body_n);
+    for (int i = 0; i < vector_count(function_node_argument_vec(node)); i++)
+    {
+        current_function_frame_escapes |= codegen_frame_may_escape(*(struct node **)vector_at(function_node_argument_vec(node), i));
+    }
+
+    asm_push_directive("global %s", node->func.name);
+    asm_push_comment("%s function", node->func.name);
+    asm_push_label("%s", node->func.name);
 
+    codegen_generate_register_save_area(node);
     asm_push_ebp();
-    asm_push("mov ebp, esp");
-    codegen_stack_sub(C_ALIGN(function_node_stack_size(node)));
+    asm_push_ins2(ASM_OP_MOV, asm_ir_reg("ebp"), asm_ir_reg("esp"));
+    codegen_stack_sub(codegen_function_frame_size(node));
+    codegen_save_callee_saved_registers(node);
     codegen_new_scope(RESOLVER_DEFAULT_ENTITY_FLAG_IS_LOCAL_STACK);
-    codegen_generate_function_arguments(function_node_argument_vec(node));
+    codegen_generate_function_arguments(node);
 
     codegen_generate_body(node->func.body_n, history_begin(IS_ALONE_STATEMENT));
     codegen_finish_scope();
-    codegen_stack_add(C_ALIGN(function_node_stack_size(node)));
+    codegen_restore_callee_saved_registers(node);
+    codegen_stack_add(codegen_function_frame_size(node));
     asm_pop_ebp();
     stackframe_assert_empty(current_function);
-    asm_push("ret");
+    codegen_generate_ret(node);
+    codegen_flush_ir(false);
 }
 void codegen_generate_function(struct node *node)
 {
     current_function = node;
+    if (node->flags & NODE_FLAG_IS_UNREFERENCED)
+    {
+        return;
+    }
+
     if (function_node_is_prototype(node))
     {
         codegen_generate_function_prototype(node);
@@ -2479,7 +3979,7 @@ void codegen_generate_root_node(struct node *node)
 
 void codegen_generate_root()
 {
-    asm_push("section .text");
+    asm_push_directive("section .text");
     struct node *node = NULL;
     while ((node = codegen_node_next()) != NULL)
     {
@@ -2487,71 +3987,143 @@ void codegen_generate_root()
     }
 }
 
-bool codegen_write_string_char_escaped(char c)
+void codegen_write_string_text(struct buffer *line, const char *text)
 {
-    const char *c_out = NULL;
-    switch (c)
+    while (*text)
     {
-    case '\n':
-        c_out = "10";
-        break;
+        buffer_write(line, *text);
+        text++;
+    }
+}
 
-    case '\t':
-        c_out = "9";
-        break;
+// Printable characters go out in quoted runs, the rest and the quote itself as numbers
+void codegen_write_string_bytes(const char *str, size_t len)
+{
+    struct buffer *line = current_process->generator->line;
+    bool in_quotes = false;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = str[i];
+        bool printable = c >= ' ' && c < 127 && c != '"';
+        if (printable && !in_quotes)
+        {
+            codegen_write_string_text(line, i == 0 ? "\"" : ", \"");
+            in_quotes = true;
+        }
+        else if (!printable)
+        {
+            char number[8];
+            sprintf(number, i == 0 ? "%i" : ", %i", c);
+            codegen_write_string_text(line, in_quotes ? "\"" : "");
+            codegen_write_string_text(line, number);
+            in_quotes = false;
+            continue;
+        }
+
+        buffer_write(line, c);
     }
 
-    if (c_out)
+    if (in_quotes)
     {
-        asm_push_no_nl("%s, ", c_out);
+        buffer_write(line, '"');
     }
-    return c_out != NULL;
 }
-void codegen_write_string(struct string_table_element *element)
+
+/**
+ * Writes elements[end] with the strings that are its tail, elements[start..end - 1], labelled inside of it.
+ */
+void codegen_write_string_with_tails(struct string_table_element **elements, int start, int end)
 {
-    asm_push_no_nl("%s: db ", element->label);
-    size_t len = strlen(element->str);
-    for (int i = 0; i < len; i++)
+    struct string_table_element *str = elements[end];
+    for (int i = end; i >= start; i--)
     {
-        char c = element->str[i];
-        bool handled = codegen_write_string_char_escaped(c);
-        if (handled)
+        size_t from = str->len - elements[i]->len;
+        asm_push_no_nl("%s: db ", elements[i]->label);
+        if (i == start)
         {
-            continue;
+            codegen_write_string_bytes(str->str + from, str->len - from);
+            asm_push_directive(from == str->len ? "0" : ", 0");
+            break;
+        }
+
+        size_t to = str->len - elements[i - 1]->len;
+        codegen_write_string_bytes(str->str + from, to - from);
+        asm_push_directive("");
+    }
+}
+
+// Orders strings by their characters read back to front, a string sorts right before the strings it is the tail of
+int codegen_string_tail_compare(const void *a, const void *b)
+{
+    const struct string_table_element *left = *(const struct string_table_element **)a;
+    const struct string_table_element *right = *(const struct string_table_element **)b;
+    for (size_t i = 0; i < left->len && i < right->len; i++)
+    {
+        unsigned char left_c = left->str[left->len - 1 - i];
+        unsigned char right_c = right->str[right->len - 1 - i];
+        if (left_c != right_c)
+        {
+            return left_c - right_c;
         }
-        asm_push_no_nl("'%c', ", c);
     }
 
-    asm_push_no_nl("0");
-    asm_push("");
+    return (left->len > right->len) - (left->len < right->len);
+}
+
+bool codegen_string_is_tail_of(struct string_table_element *tail, struct string_table_element *str)
+{
+    return tail->len <= str->len && memcmp(str->str + str->len - tail->len, tail->str, tail->len) == 0;
 }
 
 void codegen_write_strings()
 {
     struct code_generator *generator = current_process->generator;
-    vector_set_peek_pointer(generator->string_table, 0);
-    struct string_table_element *element = vector_peek_ptr(generator->string_table);
-    while (element)
+    int total = vector_count(generator->string_table);
+    if (total == 0)
+    {
+        return;
+    }
+
+    struct string_table_element **elements = malloc(total * sizeof(struct string_table_element *));
+    memcpy(elements, vector_data_ptr(generator->string_table), total * sizeof(struct string_table_element *));
+    qsort(elements, total, sizeof(struct string_table_element *), codegen_string_tail_compare);
+
+    // A run of strings that are each the tail of the next shares the memory of the last one
+    int end = total - 1;
+    for (int i = total - 2; i >= -1; i--)
     {
-        codegen_write_string(element);
-        element = vector_peek_ptr(generator->string_table);
+        if (i >= 0 && codegen_string_is_tail_of(elements[i], elements[i + 1]))
+        {
+            continue;
+        }
+
+        codegen_write_string_with_tails(elements, i + 1, end);
+        end = i;
     }
+    free(elements);
 }
 
 void codegen_generate_rod()
 {
-    asm_push("section .rodata");
+    asm_push_directive("section .rodata");
+    vector_set_peek_pointer(current_process->generator->custom_rodata_section, 0);
+    const char* str = vector_peek_ptr(current_process->generator->custom_rodata_section);
+    while(str)
+    {
+        asm_push_directive("%s", str);
+        str = vector_peek_ptr(current_process->generator->custom_rodata_section);
+    }
     codegen_write_strings();
 }
 
 void codegen_generate_data_section_add_ons()
 {
-    asm_push("section .data");
+    asm_push_directive("section .data");
     vector_set_peek_pointer(current_process->generator->custom_data_section, 0);
     const char* str = vector_peek_ptr(current_process->generator->custom_data_section);
     while(str)
     {
-        asm_push(str);
+        asm_push_directive("%s", str);
         str = vector_peek_ptr(current_process->generator->custom_data_section);
     }
 }
@@ -2560,9 +4132,16 @@ int codegen(struct compile_process *process)
 {
     current_process = process;
     x86_codegen.compiler = current_process;
+    x86_codegen.private = &_x86_generator_private;
     scope_create_root(process);
+    reachability_mark_unreferenced(process);
     vector_set_peek_pointer(process->node_tree_vec, 0);
     codegen_new_scope(0);
+    if (target_is_x86_64())
+    {
+        // Globals are addressed relative to rip, the output is position independent
+        asm_push_directive("default rel");
+    }
     codegen_generate_data_section();
     vector_set_peek_pointer(process->node_tree_vec, 0);
     codegen_generate_root();
@@ -2573,5 +4152,15 @@ int codegen(struct compile_process *process)
     // Generate read only data
     codegen_generate_rod();
 
+    codegen_flush_ir(true);
+    if (process->flags & COMPILE_PROCESS_PEEPHOLE_STATS)
+    {
+        peephole_stats_print(&process->generator->peephole_stats, stdout);
+    }
+
+    if (process->flags & COMPILE_PROCESS_RESOLVER_STATS)
+    {
+        resolver_follow_stats_print(process->resolver, stdout);
+    }
     return 0;
 }
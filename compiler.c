@@ -38,32 +38,36 @@ void compiler_warning(struct compile_process* compiler, const char* msg, ...)
     fprintf(stderr, " on line %i, col %i in file %s\n", compiler->pos.line, compiler->pos.col, compiler->pos.filename);
 }
 
-struct compile_process* compile_include_for_include_dir(const char* include_dir, const char* filename, struct compile_process* parent_process)
+struct compile_process* compile_include_for_path(const char* filename, struct compile_process* parent_process)
 {
-    char tmp_filename[512];
-    sprintf(tmp_filename, "%s/%s", include_dir, filename);
-    if (file_exists(tmp_filename))
-    {
-        filename = tmp_filename;
-    }
     struct compile_process* process = compile_process_create(filename, NULL, parent_process->flags, parent_process);
     if (!process)
     {
         return NULL;
     }
 
-    struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
-    if (!lex_process)
+    if (header_cache_preprocessed(process))
     {
-        return NULL;
+        return process;
     }
 
-    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    process->token_vec_original = header_cache_tokens(process->cfile.abs_path);
+    if (!process->token_vec_original)
     {
-        return NULL;
+        struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+        if (!lex_process)
+        {
+            return NULL;
+        }
+
+        if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+        {
+            return NULL;
+        }
+
+        process->token_vec_original = lex_process_tokens(lex_process);
     }
 
-    process->token_vec_original = lex_process_tokens(lex_process);
     if (preprocessor_run(process) < 0)
     {
         return NULL;
@@ -71,6 +75,19 @@ struct compile_process* compile_include_for_include_dir(const char* include_dir,
 
     return process;
 }
+
+struct compile_process* compile_include_for_include_dir(const char* include_dir, const char* filename, struct compile_process* parent_process)
+{
+    char tmp_filename[512];
+    sprintf(tmp_filename, "%s/%s", include_dir, filename);
+    if (file_exists(tmp_filename))
+    {
+        filename = tmp_filename;
+    }
+
+    return compile_include_for_path(filename, parent_process);
+}
+
 /**
  * @brief Includes a file to be compiled, returns a new compile process that represents the file to be compiled
  * 
@@ -83,6 +100,12 @@ struct compile_process* compile_include_for_include_dir(const char* include_dir,
 
 struct compile_process* compile_include(const char* filename, struct compile_process* parent_process)
 {
+    const char* cached_path = header_cache_include_path(filename);
+    if (cached_path)
+    {
+        return compile_include_for_path(cached_path, parent_process);
+    }
+
     struct compile_process* new_process = NULL;
     const char* include_dir = compiler_include_dir_begin(parent_process);
     while(include_dir && !new_process)
@@ -91,6 +114,11 @@ struct compile_process* compile_include(const char* filename, struct compile_pro
         include_dir = compiler_include_dir_next(parent_process);
     }
 
+    if (new_process)
+    {
+        header_cache_record_miss(filename, new_process->cfile.abs_path);
+    }
+
     return new_process;
 }
 
@@ -129,6 +157,18 @@ int compile_file(const char* filename, const char* out_filename, int flags)
         return COMPILER_FAILED_WITH_ERRORS;
     }
 
+    fold_constants(process);
+    inline_functions(process);
+    // Again for the constant arguments of inlined calls
+    fold_constants(process);
+
+    if (flags & COMPILE_PROCESS_EMIT_AST)
+    {
+        ast_write(process, process->ofile);
+        fclose(process->ofile);
+        return COMPILER_FILE_COMPILED_OK;
+    }
+
     if (codegen(process) != CODEGEN_ALL_OK)
     {
         return COMPILER_FAILED_WITH_ERRORS;
@@ -138,4 +178,25 @@ int compile_file(const char* filename, const char* out_filename, int flags)
 
     fclose(process->ofile);
     return COMPILER_FILE_COMPILED_OK;
-}
\ No newline at end of file
+}
+
+int compile_ast_file(const char* filename, const char* out_filename, int flags)
+{
+    struct compile_process* process = compile_process_create(filename, out_filename, flags, NULL);
+    if (!process)
+        return COMPILER_FAILED_WITH_ERRORS;
+
+    if (ast_load(process, filename) < 0)
+    {
+        fprintf(stderr, "%s is not a valid AST file\n", filename);
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    if (codegen(process) != CODEGEN_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    fclose(process->ofile);
+    return COMPILER_FILE_COMPILED_OK;
+}
@@ -9,6 +9,10 @@
 
 #define FAIL_ERR(message) assert(0 == 1 && message)
 
+// File scope state of the compiler stages is kept per thread so that separate
+// translation units can be compiled concurrently within one process.
+#define COMPILER_THREAD_LOCAL _Thread_local
+
 #define S_EQ(str, str2) \
     (str && str2 && (strcmp(str, str2) == 0))
 
@@ -21,7 +25,7 @@ struct pos
 
 // In C We have a stack alignment of 16 bytes.
 #define C_STACK_ALIGNMENT 16
-#define STACK_PUSH_SIZE 4
+#define STACK_PUSH_SIZE (target_current()->stack_push_size)
 #define C_ALIGN(size) (size % C_STACK_ALIGNMENT) ? size + (C_STACK_ALIGNMENT - (size % C_STACK_ALIGNMENT)) : size
 
 #define NUMERIC_CASE \
@@ -169,8 +173,71 @@ enum
 {
     COMPILE_PROCESS_EXECUTE_NASM = 0b00000001,
     COMPILE_PROCESS_EXPORT_AS_OBJECT = 0b00000010,
+    // Write the validated tree as a binary AST file instead of assembly
+    COMPILE_PROCESS_EMIT_AST = 0b00000100,
+    // Also echo the generated assembly to stdout, for debugging
+    COMPILE_PROCESS_ECHO_ASM = 0b00001000,
+    COMPILE_PROCESS_NO_PEEPHOLE = 0b00010000,
+    // Print what the peephole optimizer removed once code generation is done
+    COMPILE_PROCESS_PEEPHOLE_STATS = 0b00100000,
+    // Generate x86-64 SysV code instead of 32 bit x86
+    COMPILE_PROCESS_TARGET_X86_64 = 0b01000000,
+    // Copy structures a stack slot at a time through the stack even when they are large, for comparing
+    COMPILE_PROCESS_NO_BLOCK_COPY = 0b10000000,
+    // Test loop conditions at the top and jump back to them, for comparing
+    COMPILE_PROCESS_NO_LOOP_ROTATION = 0b100000000,
+    // Print how often resolver_follow was answered from its cache once code generation is done
+    COMPILE_PROCESS_RESOLVER_STATS = 0b1000000000,
+};
+
+enum
+{
+    COMPILE_TARGET_X86,
+    COMPILE_TARGET_X86_64
+};
+
+#define TARGET_MAX_CALLEE_SAVED_REGISTERS 3
+
+struct compile_target
+{
+    int type;
+    const char *name;
+    size_t pointer_size;
+    size_t long_size;
+    // Bytes a push or pop moves the stack pointer by
+    size_t stack_push_size;
+    // Passed to nasm -f and to gcc when linking
+    const char *nasm_format;
+    const char *link_flags;
+    // Registers a function has to hand back to its caller unchanged
+    const char *callee_saved_registers[TARGET_MAX_CALLEE_SAVED_REGISTERS];
+    int total_callee_saved_registers;
+    // Codegen pads the stack to C_STACK_ALIGNMENT at every call, counting what it pushed before
+    bool aligned_calls;
+};
+
+struct compile_target *target_for_flags(int flags);
+/**
+ * Makes the target chosen by the compile flags current for this thread.
+ */
+void target_select(int flags);
+struct compile_target *target_current();
+bool target_is_x86_64();
+
+// Exit codes of a driver worker process
+enum
+{
+    DRIVER_JOB_OK,
+    DRIVER_JOB_COMPILE_FAILED,
+    DRIVER_JOB_ASSEMBLE_FAILED
 };
 
+/**
+ * Compiles and assembles every source file with at most max_workers worker processes,
+ * then links all the objects into output_file. Returns zero on success. flags picks the target.
+ */
+int driver_build(const char *output_file, const char **sources, int total_sources, int max_workers, int flags);
+
 struct scope
 {
     int flags;
@@ -219,6 +286,36 @@ struct string_table_element
     // This is the assembly label that points to the memory
     // where the string can be found.
     const char label[50];
+
+    size_t len;
+    // Next element in the same string_buckets bucket
+    struct string_table_element *next;
+};
+
+// Must be a power of two
+#define CODEGEN_STRING_TABLE_BUCKETS 1024
+
+enum
+{
+    PEEPHOLE_PATTERN_PUSH_POP = 0b00000001,
+    PEEPHOLE_PATTERN_SELF_MOVE = 0b00000010,
+    PEEPHOLE_PATTERN_MOVE_BACK = 0b00000100,
+    PEEPHOLE_PATTERN_SETCC_BRANCH = 0b00001000,
+    PEEPHOLE_PATTERN_ZERO_STACK_ADJUST = 0b00010000,
+    PEEPHOLE_PATTERN_JUMP_TO_NEXT = 0b00100000,
+    PEEPHOLE_PATTERN_UNREACHABLE = 0b01000000,
+    PEEPHOLE_PATTERN_IMMEDIATE_OPERAND = 0b10000000,
+    PEEPHOLE_PATTERN_ALL = 0b11111111
+};
+
+#define PEEPHOLE_TOTAL_PATTERNS 8
+
+struct peephole_stats
+{
+    // Matches of each pattern, in the order of the pattern table
+    int hits[PEEPHOLE_TOTAL_PATTERNS];
+    int instructions_before;
+    int instructions_after;
 };
 
 struct code_generator
@@ -229,6 +326,10 @@ struct code_generator
         struct generator_switch_stmt_entity
         {
             int id;
+
+            // Cases are dispatched through a jump table, they need labels the table can name
+            bool has_jump_table;
+            bool has_default_case;
         } current;
 
         // Vector of generatr_switch_stmt_entity
@@ -237,6 +338,8 @@ struct code_generator
 
     // A vector of struct string_table_element*
     struct vector *string_table;
+    // The same elements hash chained by their string
+    struct string_table_element *string_buckets[CODEGEN_STRING_TABLE_BUCKETS];
 
     // vector of struct codegen_entry_point*
     struct vector *entry_points;
@@ -246,31 +349,92 @@ struct code_generator
     // Vector of const char* that will go in the data section
     struct vector* custom_data_section;
 
+    // Vector of const char* that will go in the read only data section
+    struct vector* custom_rodata_section;
+
     // vector of struct response*
     struct vector *responses;
+
+    // The last label index handed out by codegen_label_count
+    int label_count;
+
+    // Instructions of the function being generated, printed into output once it is done.
+    struct asm_ir* ir;
+
+    // PEEPHOLE_PATTERN_* flags run over ir before it is printed
+    int peephole_patterns;
+    struct peephole_stats peephole_stats;
+
+    // The line asm_push_no_nl is building
+    struct buffer* line;
+
+    // Generated assembly waiting to be written, flushed in large writes.
+    struct buffer* output;
 };
 
+// Flush the generated assembly to the output file once this much is pending
+#define CODEGEN_OUTPUT_FLUSH_SIZE (1024 * 1024)
+
+// Switch dispatch, runs of at least this many cases filling this percentage of their range use a jump table
+#define CODEGEN_SWITCH_TABLE_MIN_CASES 4
+#define CODEGEN_SWITCH_TABLE_MIN_DENSITY 40
+#define CODEGEN_SWITCH_TABLE_MAX_RANGE 4096
+// Sparse runs of at least this many cases are split in a binary search, shorter ones compared one by one
+#define CODEGEN_SWITCH_SEARCH_MIN_CASES 4
+
+// Structures of at least this many bytes are copied with rep movsd instead of pushed and popped a dword at a time
+#define CODEGEN_STRUCT_BLOCK_COPY_MIN_SIZE 128
+
+// Arguments the x86-64 SysV calling convention passes in registers, the rest go on the stack
+#define CODEGEN_X86_64_REGISTER_ARGUMENTS 6
+
+// Largest structure the x86-64 SysV calling convention passes or returns in registers, two eightbytes
+#define CODEGEN_X86_64_REGISTER_STRUCTURE_MAX_SIZE 16
+
+// Largest function body, counted in nodes, that inline_functions copies into its callers
+#define INLINE_MAX_COST 24
+
 struct resolver_process;
 
 struct generator;
 struct native_function;
+struct asm_ir_operand;
 struct node;
 struct resolver_entity;
 struct datatype;
 
+/**
+ * A memory operand [base + index * scale + displacement], kept structured through the resolver
+ * and code generator and only turned into text when the instruction using it is written.
+ */
+struct asm_operand
+{
+    // Register or symbol the address is relative to, NULL for an absolute displacement.
+    const char* base;
+    // Index register, NULL when there is none
+    const char* index;
+    int scale;
+    int displacement;
+    // Size of the access in bytes, zero when the instruction already implies it.
+    int size;
+};
+
+// Enough for a label, a symbol operand or a comment
+#define ASM_LINE_MAX_LENGTH 160
+
 struct generator_entity_address
 {
     bool is_stack;
     long offset;
-    const char* address;
-    const char* base_address;
+    struct asm_operand address;
 };
 
 #define GENERATOR_BEGIN_EXPRESSION(gen)
 #define GENERATOR_END_EXPRESSION(gen) gen->end_exp(gen)
 
 
-typedef void(*ASM_PUSH_PROTOTYPE)(const char* ins, ...);
+typedef void(*ASM_PUSH_INSTRUCTION_PROTOTYPE)(int op, struct asm_ir_operand destination, struct asm_ir_operand source);
+typedef void(*ASM_PUSH_COMMENT_PROTOTYPE)(const char* fmt, ...);
 typedef void (*NATIVE_FUNCTION_CALL)(struct generator* generator, struct native_function* func, struct vector* arguments);
 typedef void(*GENERATOR_GENERATE_EXPRESSION)(struct generator* generator, struct node* node, int flags);
 typedef void (*GENERATOR_ENTITY_ADDRESS)(
@@ -278,11 +442,12 @@ typedef void (*GENERATOR_ENTITY_ADDRESS)(
     struct generator_entity_address* address_out);
 typedef void(*GENERATOR_END_EXPRESSION)(struct generator* generator);
 
-typedef void(*GENERATOR_FUNCTION_RETURN)(struct datatype* dtype, const char* fmt, ...);
+typedef void(*GENERATOR_FUNCTION_RETURN)(const struct datatype* dtype, struct asm_ir_operand value);
 
 struct generator
 {
-    ASM_PUSH_PROTOTYPE asm_push;
+    ASM_PUSH_INSTRUCTION_PROTOTYPE asm_push_ins2;
+    ASM_PUSH_COMMENT_PROTOTYPE asm_push_comment;
     GENERATOR_GENERATE_EXPRESSION gen_exp;
     GENERATOR_END_EXPRESSION end_exp;
     GENERATOR_ENTITY_ADDRESS entity_address;
@@ -384,6 +549,29 @@ struct preprocessor_included_file
     char filename[PATH_MAX];
 };
 
+struct preprocessor_header_lookup
+{
+    const char* name;
+    // Whether the name was defined when the header looked it up
+    bool defined;
+};
+
+/**
+ * What a header depended on while the header cache preprocessed it on its own, so the
+ * preprocessed tokens can stand in for it in any file whose definitions look the same.
+ */
+struct preprocessor_header_record
+{
+    // The definitions the preprocessor was created with, vector of struct preprocessor_definition*
+    struct vector* builtins;
+
+    // Names looked up that the header did not define itself, vector of struct preprocessor_header_lookup
+    struct vector* lookups;
+
+    // The header did something a replay cannot repeat, i.e. an #undef or a static include
+    bool uncacheable;
+};
+
 
 // Function pointers
 typedef void(*PREPROCESSOR_STATIC_INCLUDE_HANDLER_POST_CREATION)(struct preprocessor* preprocessor, struct preprocessor_included_file* included_file);
@@ -402,10 +590,14 @@ struct preprocessor
 
     // A vector of included files struct preprocessor_included_file*
     struct vector* includes;
+
+    // Set while the header cache preprocesses a header, NULL otherwise
+    struct preprocessor_header_record* record;
 };
 
 struct preprocessor* preprocessor_create(struct compile_process* compiler);
 int preprocessor_run(struct compile_process* compiler);
+void preprocessor_create_static_include(struct preprocessor *preprocessor, const char *filename, PREPROCESSOR_STATIC_INCLUDE_HANDLER_POST_CREATION creation_handler);
 
 
 struct compile_process
@@ -453,6 +645,12 @@ struct compile_process
     // A vector of const char* that represents include directories.
     struct vector* include_dirs;
     struct preprocessor* preprocessor;
+
+    // Interned datatypes, shared with included files.
+    struct datatype_table* datatypes;
+
+    // The last index used to name an anonymous structure or union.
+    int anonymous_type_index;
 };
 
 enum
@@ -511,7 +709,9 @@ enum
 {
     NODE_FLAG_INSIDE_EXPRESSION = 0b00000001,
     NODE_FLAG_IS_FORWARD_DECLARATION = 0b00000010,
-    NODE_FLAG_HAS_VARIABLE_COMBINED = 0b00000100
+    NODE_FLAG_HAS_VARIABLE_COMBINED = 0b00000100,
+    // Static function or global, or prototype, nothing reachable refers to. Not emitted.
+    NODE_FLAG_IS_UNREFERENCED = 0b00001000
 };
 
 struct array_brackets
@@ -528,7 +728,7 @@ struct datatype
     int type;
 
     // i.e long int. int being the secondary.
-    struct datatype *secondary;
+    const struct datatype *secondary;
     // long
     const char *type_str;
     // The sizeof the datatype.
@@ -561,9 +761,35 @@ struct parsed_switch_case
 struct stack_frame_data
 {
     /*
-     * The datatype that was pushed to the stack
+     * The datatype that was pushed to the stack, interned in the compile process datatype table.
      */
+    const struct datatype *dtype;
+};
+
+// Must be a power of two
+#define DATATYPE_TABLE_BUCKETS 256
+
+struct datatype_table_entry
+{
+    // The canonical datatype, never modified once interned.
     struct datatype dtype;
+
+    unsigned int hash;
+    struct datatype_table_entry *next;
+};
+
+struct datatype_table
+{
+    // Hash chained buckets of struct datatype_table_entry*
+    struct datatype_table_entry **buckets;
+    size_t total_buckets;
+    size_t count;
+
+    // The interned datatype with every field zero, held by anything that has no type of its own
+    const struct datatype *empty;
+    // Interned datatype_for_numeric and datatype_for_string, the types of literals
+    const struct datatype *numeric;
+    const struct datatype *string;
 };
 
 struct stack_frame_element
@@ -583,7 +809,6 @@ struct stack_frame_element
     struct stack_frame_data data;
 };
 
-#define STACK_PUSH_SIZE 4
 enum
 {
     STACK_FRAME_ELEMENT_TYPE_LOCAL_VARIABLE,
@@ -667,7 +892,8 @@ struct node
 
         struct var
         {
-            struct datatype type;
+            // Interned in the compile process datatype table
+            const struct datatype *type;
             int padding;
             // Aligned offset
             int aoffset;
@@ -742,14 +968,18 @@ struct node
 
             // A pointer to the largest variable node in the statements vector.
             struct node *largest_var_node;
+
+            // Field layout of this body when it belongs to a structure or union. The parser builds it once the
+            // body is finished, a body read back from an AST file gets it on first access.
+            struct struct_layout *layout;
         } body;
 
         struct function
         {
             // Special flags
             int flags;
-            // Return type i.e void, int, long ect...
-            struct datatype rtype;
+            // Return type i.e void, int, long ect... interned like every node datatype
+            const struct datatype *rtype;
 
             // I.e function name "main"
             const char *name;
@@ -846,7 +1076,7 @@ struct node
 
         struct cast
         {
-            struct datatype dtype;
+            const struct datatype *dtype;
             struct node *operand;
         } cast;
 
@@ -918,6 +1148,39 @@ struct resolver_callbacks
 };
 
 struct compile_process;
+// Must be a power of two
+#define RESOLVER_FOLLOW_CACHE_BUCKETS 1024
+#define RESOLVER_POOL_CHUNK_SIZE 65536
+
+struct resolver_pool_chunk
+{
+    struct resolver_pool_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// Bump allocator for everything a resolution creates, released in bulk with resolver_pool_reset.
+struct resolver_pool
+{
+    struct resolver_pool_chunk *chunks;
+
+    // Chunks released by a reset, reused before allocating new ones.
+    struct resolver_pool_chunk *free_chunks;
+
+    // Vectors handed out with resolver_pool_vector, vector of struct vector*, freed by a reset.
+    struct vector *vectors;
+};
+
+struct resolver_follow_cache_entry
+{
+    struct node *node;
+    struct resolver_scope *scope;
+    int generation;
+    struct resolver_result *result;
+    struct resolver_follow_cache_entry *next;
+};
+
 struct resolver_process
 {
     struct resolver_scopes
@@ -928,6 +1191,26 @@ struct resolver_process
 
     struct compile_process *compiler;
     struct resolver_callbacks callbacks;
+
+    // Results of resolver_follow, only valid while the scopes and their entities stay unchanged.
+    struct resolver_follow_cache
+    {
+        struct resolver_follow_cache_entry *buckets[RESOLVER_FOLLOW_CACHE_BUCKETS];
+
+        // Bumped whenever a scope is entered or left or an entity is registered.
+        int generation;
+
+        // Calls to resolver_follow, those answered from the cache and those that missed on a node followed before
+        int follows;
+        int hits;
+        int stale;
+    } follow_cache;
+
+    // Results and their entities, reset after each top level statement and whenever we return to the root scope.
+    struct resolver_pool pool;
+
+    // Statements begun and not yet finished, the pool is only reset when it drops to zero.
+    int statement_depth;
 };
 struct resolver_array_data
 {
@@ -957,9 +1240,7 @@ struct resolver_default_entity_data
     // i.e variable, function, structure
     int type;
     // This is the address [ebp-4], [var_name+4]
-    char address[60];
-    // ebp, var_name
-    char base_address[60];
+    struct asm_operand address;
     // -4
     int offset;
     // Flags relating to the entity data
@@ -985,6 +1266,9 @@ enum
 
 struct resolver_result
 {
+    // The resolver whose pool this result and its entities are allocated from.
+    struct resolver_process *resolver;
+
     // This is the first entity in our resolver result
     struct resolver_entity *first_entity_const;
 
@@ -1007,11 +1291,7 @@ struct resolver_result
     struct resolver_result_base
     {
         // [ebp-4], [name+4]
-        char address[60];
-        // EBP, global_variable_name
-        char base_address[60];
-        // -4
-        int offset;
+        struct asm_operand address;
     } base;
 };
 struct resolver_scope
@@ -1045,10 +1325,10 @@ struct resolver_entity
     {
         struct resolver_entity_var_data
         {
-            struct datatype dtype;
+            const struct datatype *dtype;
             struct resolver_array_runtime_
             {
-                struct datatype dtype;
+                const struct datatype *dtype;
                 struct node *index_node;
                 int multiplier;
             } array_runtime;
@@ -1056,7 +1336,7 @@ struct resolver_entity
 
         struct resolver_array
         {
-            struct datatype dtype;
+            const struct datatype *dtype;
             struct node *array_index_node;
             int index;
         } array;
@@ -1100,8 +1380,8 @@ struct resolver_entity
         struct node *referencing_node;
     } last_resolve;
 
-    // The datatype of the resolver entity
-    struct datatype dtype;
+    // The datatype of the resolver entity, interned
+    const struct datatype *dtype;
 
     // The scope that this entity belongs to
     struct resolver_scope *scope;
@@ -1234,19 +1514,20 @@ enum
       EXPRESSION_IS_BITSHIFT_LEFT | EXPRESSION_IS_BITSHIFT_RIGHT | \
       EXPRESSION_IS_BITWISE_OR | EXPRESSION_IS_BITWISE_AND | EXPRESSION_IS_BITWISE_XOR | EXPRESSION_IS_ASSIGNMENT | IS_ALONE_STATEMENT)
 
-enum
-{
-    STRUCT_ACCESS_BACKWARDS = 0b00000001,
-    STRUCT_STOP_AT_POINTER_ACCESS = 0b00000010
-};
-
 enum
 {
     // The flag is set for native functions.
     FUNCTION_NODE_FLAG_IS_NATIVE = 0b00000001,
+    // The function takes ... after its named arguments.
+    FUNCTION_NODE_FLAG_IS_VARIADIC = 0b00000010,
 };
 
 int compile_file(const char *filename, const char *out_filename, int flags);
+
+/**
+ * Generates code for a binary AST file written earlier with COMPILE_PROCESS_EMIT_AST, without lexing or parsing.
+ */
+int compile_ast_file(const char *filename, const char *out_filename, int flags);
 struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags, struct compile_process* parent_process);
 const char* compiler_include_dir_begin(struct compile_process* process);
 const char* compiler_include_dir_next(struct compile_process* process);
@@ -1269,6 +1550,7 @@ struct vector *lex_process_tokens(struct lex_process *process);
 int lex(struct lex_process *process);
 int parse(struct compile_process *process);
 int codegen(struct compile_process *process);
+
 struct code_generator *codegenerator_new(struct compile_process *process);
 
 
@@ -1276,6 +1558,22 @@ struct code_generator *codegenerator_new(struct compile_process *process);
 
 int validate(struct compile_process* process);
 
+/**
+ * Replaces every constant expression in the tree with the number it evaluates to.
+ */
+void fold_constants(struct compile_process *process);
+
+/**
+ * Inlines calls to small straight line functions defined earlier in the file.
+ */
+void inline_functions(struct compile_process *process);
+
+/**
+ * Flags the static functions, static globals and prototypes that no exported function or global reaches
+ * with NODE_FLAG_IS_UNREFERENCED.
+ */
+void reachability_mark_unreferenced(struct compile_process *process);
+
 /**
  * @brief Builds tokens for the input string.
  *
@@ -1294,19 +1592,33 @@ bool token_is_nl_or_comment_or_newline_seperator(struct token *token);
 bool keyword_is_datatype(const char *str);
 bool token_is_primitive_keyword(struct token *token);
 
-bool datatype_is_void_no_ptr(struct datatype* dtype);
+bool datatype_is_void_no_ptr(const struct datatype *dtype);
 void datatype_set_void(struct datatype* dtype);
 bool datatype_is_struct_or_union_for_name(const char *name);
-size_t datatype_size_for_array_access(struct datatype *dtype);
-size_t datatype_element_size(struct datatype *dtype);
-size_t datatype_size_no_ptr(struct datatype *dtype);
-size_t datatype_size(struct datatype *dtype);
-bool datatype_is_primitive(struct datatype *dtype);
-bool datatype_is_struct_or_union_non_pointer(struct datatype *dtype);
+size_t datatype_size_for_array_access(const struct datatype *dtype);
+size_t datatype_element_size(const struct datatype *dtype);
+size_t datatype_size_no_ptr(const struct datatype *dtype);
+size_t datatype_size(const struct datatype *dtype);
+
+/**
+ * Alignment of the type as a structure member under the SysV ABI of the current target.
+ */
+size_t datatype_align(const struct datatype *dtype);
+bool datatype_is_primitive(const struct datatype *dtype);
+bool datatype_is_struct_or_union_non_pointer(const struct datatype *dtype);
+struct datatype_table *datatype_table_new();
+struct datatype_table_entry *datatype_table_intern(struct datatype_table *table, const struct datatype *dtype);
+
+/**
+ * Returns the canonical copy of the given datatype. Nodes, resolver entities and stack frame
+ * elements only hold interned datatypes, two of them describe the same type if and only if
+ * their pointers are equal.
+ */
+const struct datatype *datatype_intern(struct compile_process *process, const struct datatype *dtype);
 struct datatype datatype_for_numeric();
 struct datatype datatype_for_string();
-struct datatype* datatype_thats_a_pointer(struct datatype* d1, struct datatype* d2);
-struct datatype* datatype_pointer_reduce(struct datatype* datatype, int by);
+const struct datatype* datatype_thats_a_pointer(const struct datatype* d1, const struct datatype* d2);
+struct datatype* datatype_pointer_reduce(const struct datatype* datatype, int by);
 bool is_logical_operator(const char* op);
 bool is_logical_node(struct node* node);
 
@@ -1322,6 +1634,11 @@ bool node_is_expression(struct node *node, const char *op);
 bool node_is_struct_or_union(struct node *node);
 bool is_array_node(struct node *node);
 bool is_node_assignment(struct node *node);
+/**
+ * True if a label, case or default sits somewhere inside the statement, code under it can be
+ * reached without passing through the statement itself.
+ */
+bool node_has_jump_target(struct node *node);
 bool is_unary_operator(const char *op);
 bool op_is_indirection(const char *op);
 bool op_is_address(const char *op);
@@ -1339,7 +1656,7 @@ void make_label_node(struct node *name_node);
 void make_continue_node();
 void make_break_node();
 
-void make_cast_node(struct datatype *dtype, struct node *operand_node);
+void make_cast_node(const struct datatype *dtype, struct node *operand_node);
 void make_exp_node(struct node *left_node, struct node *right_node, const char *op);
 void make_exp_parentheses_node(struct node *exp_node);
 
@@ -1348,7 +1665,7 @@ void make_body_node(struct vector *body_vec, size_t size, bool padded, struct no
 void make_struct_node(const char *name, struct node *body_node);
 void make_union_node(const char *name, struct node *body_node);
 void make_switch_node(struct node *exp_node, struct node *body_node, struct vector *cases, bool has_default_case);
-void make_function_node(struct datatype *ret_type, const char *name, struct vector *arguments, struct node *body_node);
+void make_function_node(const struct datatype *ret_type, const char *name, struct vector *arguments, struct node *body_node);
 void make_while_node(struct node *exp_node, struct node *body_node);
 void make_do_while_node(struct node *body_node, struct node *exp_node);
 void make_for_node(struct node *init_node, struct node *cond_node, struct node *loop_node, struct node *body_node);
@@ -1375,7 +1692,7 @@ bool is_access_node_with_op(struct node *node, const char *op);
 bool is_argument_operator(const char *op);
 bool is_argument_node(struct node *node);
 void datatype_decrement_pointer(struct datatype *dtype);
-size_t array_brackets_count(struct datatype *dtype);
+size_t array_brackets_count(const struct datatype *dtype);
 
 bool node_is_expressionable(struct node *node);
 bool node_valid(struct node *node);
@@ -1387,21 +1704,38 @@ struct array_brackets *array_brackets_new();
 void array_brackets_free(struct array_brackets *brackets);
 void array_brackets_add(struct array_brackets *brackets, struct node *bracket_node);
 struct vector *array_brackets_node_vector(struct array_brackets *brackets);
-size_t array_brackets_calculate_size_from_index(struct datatype *dtype, struct array_brackets *brackets, int index);
-size_t array_brackets_calculate_size(struct datatype *dtype, struct array_brackets *brackets);
-int array_total_indexes(struct datatype *dtype);
-bool datatype_is_struct_or_union(struct datatype *dtype);
+size_t array_brackets_calculate_size_from_index(const struct datatype *dtype, struct array_brackets *brackets, int index);
+size_t array_brackets_calculate_size(const struct datatype *dtype, struct array_brackets *brackets);
+int array_total_indexes(const struct datatype *dtype);
+bool datatype_is_struct_or_union(const struct datatype *dtype);
 struct node *variable_struct_or_union_body_node(struct node *node);
 struct node *variable_node_or_list(struct node *node);
 
-int array_multiplier(struct datatype *dtype, int index, int index_value);
-int array_offset(struct datatype *dtype, int index, int index_value);
-int struct_offset(struct compile_process *compile_proc, const char *struct_name, const char *var_name, struct node **var_node_out, int last_pos, int flags);
+int array_multiplier(const struct datatype *dtype, int index, int index_value);
+int array_offset(const struct datatype *dtype, int index, int index_value);
 struct node *variable_struct_or_union_largest_variable_node(struct node *var_node);
 struct node *body_largest_variable_node(struct node *body_node);
 
-struct resolver_entity *resolver_make_entity(struct resolver_process *process, struct resolver_result *result, struct datatype *custom_dtype, struct node *node, struct resolver_entity *guided_entity, struct resolver_scope *scope);
+struct resolver_entity *resolver_make_entity(struct resolver_process *process, struct resolver_result *result, const struct datatype *custom_dtype, struct node *node, struct resolver_entity *guided_entity, struct resolver_scope *scope);
 struct resolver_process *resolver_new_process(struct compile_process *compiler, struct resolver_callbacks *callbacks);
+void *resolver_pool_alloc(struct resolver_pool *pool, size_t size);
+struct vector *resolver_pool_vector(struct resolver_pool *pool, size_t esize);
+void resolver_pool_reset(struct resolver_pool *pool);
+
+/**
+ * Zeroed memory that lives as long as the result, or until the program ends when result is NULL.
+ */
+void *resolver_result_alloc(struct resolver_result *result, size_t size);
+struct vector *resolver_result_vector(struct resolver_result *result, size_t esize);
+
+/**
+ * Brackets every statement that is validated or generated. Statements nest, an if body is inside its if,
+ * so only finishing a statement at the top of a function body releases every result followed since the
+ * last one. Nothing may hold on to them afterwards.
+ */
+void resolver_follow_stats_print(struct resolver_process *resolver, FILE *out);
+void resolver_begin_statement(struct resolver_process *resolver);
+void resolver_finish_statement(struct resolver_process *resolver);
 struct resolver_entity *resolver_new_entity_for_var_node(struct resolver_process *process, struct node *var_node, void *private, int offset);
 struct resolver_entity *resolver_register_function(struct resolver_process *process, struct node *func_node, void *private);
 struct resolver_scope *resolver_new_scope(struct resolver_process *resolver, void *private, int flags);
@@ -1420,15 +1754,15 @@ struct vector *function_node_argument_vec(struct node *node);
 
 struct resolver_default_entity_data *resolver_default_entity_private(struct resolver_entity *entity);
 struct resolver_default_scope_data *resolver_default_scope_private(struct resolver_scope *scope);
-char *resolver_default_stack_asm_address(int stack_offset, char *out);
-struct resolver_default_entity_data *resolver_default_new_entity_data();
-void resolver_default_global_asm_address(const char *name, int offset, char *address_out);
+struct asm_operand resolver_default_stack_asm_address(int stack_offset);
+struct resolver_default_entity_data *resolver_default_new_entity_data(struct resolver_result *result);
+struct asm_operand resolver_default_global_asm_address(const char *name, int offset);
 
 void resolver_default_entity_data_set_address(struct resolver_default_entity_data *entity_data, struct node *var_node, int offset, int flags);
 void *resolver_default_make_private(struct resolver_entity *entity, struct node *node, int offset, struct resolver_scope *scope);
 void resolver_default_set_result_base(struct resolver_result *result, struct resolver_entity *base_entity);
 struct resolver_default_entity_data *resolver_default_new_entity_data_for_var_node(struct node *var_node, int offset, int flags);
-struct resolver_default_entity_data *resolver_default_new_entity_data_for_array_bracket(struct node *breacket_node);
+struct resolver_default_entity_data *resolver_default_new_entity_data_for_array_bracket(struct resolver_result *result, struct node *breacket_node);
 struct resolver_default_entity_data *resolver_default_new_entity_data_for_function(struct node *func_node, int flags);
 struct resolver_entity *resolver_default_new_scope_entity(struct resolver_process *resolver, struct node *var_node, int offset, int flags);
 
@@ -1470,10 +1804,14 @@ int compute_sum_padding(struct vector *vec);
 void preprocessor_create_definitions(struct preprocessor* preprocessor);
 struct token *preprocessor_previous_token(struct compile_process *compiler);
 struct vector *preprocessor_build_value_vector_for_integer(int value);
+struct preprocessor_definition *preprocessor_definition_create(const char *name, struct vector *value_vec, struct vector *arguments, struct preprocessor *preprocessor);
 struct preprocessor_definition *preprocessor_definition_create_native(const char *name,
                                                                       PREPROCESSOR_DEFINITION_NATIVE_CALL_EVALUATE evaluate,
                                                                       PREPROCESSOR_DEFINITION_NATIVE_CALL_VALUE value,
                                                                       struct preprocessor *preprocessor);
+struct preprocessor_definition *preprocessor_get_definition(struct preprocessor *preprocessor, const char *name);
+void preprocessor_definition_remove(struct preprocessor *preprocessor, const char *name);
+struct preprocessor_included_file *preprocessor_add_included_file(struct preprocessor *preprocessor, const char *filename);
 
 
 struct scope *scope_new(struct compile_process *process, int flags);
@@ -1544,6 +1882,8 @@ void expressionable_parse(struct expressionable *expressionable);
 
 size_t function_node_argument_stack_addition(struct node *node);
 long arithmetic(struct compile_process* compiler, long left_operand, long right_operand, const char* op, bool* success);
+void division_magic_signed(int divisor, int* multiplier, int* shift);
+void division_magic_unsigned(unsigned int divisor, unsigned int* multiplier, int* shift, bool* add);
 
 #define TOTAL_OPERATOR_GROUPS 14
 #define MAX_OPERATORS_IN_GROUP 12
@@ -1657,12 +1997,34 @@ struct fixup_config
     FIXUP_FIX fix;
     FIXUP_END end;
     void *private;
+
+    // The symbol name this fixup is waiting on, NULL if it can only be attempted by fixups_resolve.
+    const char *waiting_on;
+};
+
+// Must be a power of two
+#define FIXUP_DEPENDENCY_BUCKETS 64
+
+struct fixup_dependency
+{
+    // The symbol name waited on
+    const char *name;
+
+    // Vector of struct fixup* waiting for the symbol to be defined.
+    struct vector *fixups;
+    struct fixup_dependency *next;
 };
 
 struct fixup_system
 {
-    // A vector of fixups.
+    // A vector of struct fixup* in registration order.
     struct vector *fixups;
+
+    // Hash chained buckets of struct fixup_dependency*, keyed on the name they wait for.
+    struct fixup_dependency *dependencies[FIXUP_DEPENDENCY_BUCKETS];
+
+    // Total fixups not yet resolved.
+    int unresolved;
 };
 
 enum
@@ -1692,7 +2054,368 @@ bool fixup_resolve(struct fixup *fixup);
 void *fixup_private(struct fixup *fixup);
 bool fixups_resolve(struct fixup_system *system);
 
+/**
+ * Resolves only the fixups waiting on the given symbol name, call this once the symbol is defined.
+ */
+void fixup_sys_symbol_defined(struct fixup_system *system, const char *name);
+
+
+struct struct_layout_field
+{
+    const char *name;
+    // The NODE_TYPE_VARIABLE node for this field.
+    struct node *var_node;
+    // Offset from the start of the structure, always zero for unions.
+    int offset;
+    size_t size;
+};
+
+// Structures with more fields than this get a hashed name lookup.
+#define STRUCT_LAYOUT_HASH_THRESHOLD 8
+
+struct struct_layout
+{
+    // Vector of struct struct_layout_field in declaration order.
+    struct vector *fields;
+
+    // Open addressed table of indexes into fields, NULL for narrow structures.
+    int *table;
+    size_t table_size;
+
+    // Size including the tail padding and the alignment of the most aligned field.
+    size_t size;
+    size_t align;
+};
+
+struct struct_layout *struct_layout_build(struct node *body_node, bool is_union);
+struct struct_layout *struct_layout_for_node(struct node *struct_or_union_node);
+struct struct_layout_field *struct_layout_field_get(struct struct_layout *layout, const char *name);
+struct struct_layout_field *struct_layout_field_for_name(struct compile_process *compile_proc, const char *struct_name, const char *field_name);
+
+// Must be a power of two
+#define HEADER_CACHE_BUCKETS 256
+
+extern struct lex_process_functions compiler_lex_functions;
+
+void header_cache_enable();
+bool header_cache_enabled();
+
+/**
+ * Returns the absolute path an include name resolved to earlier from the current directory, or NULL.
+ */
+const char *header_cache_include_path(const char *include_name);
+
+/**
+ * Returns a fresh copy of the lexed tokens of the header, or NULL if it is not cached or has changed on disk.
+ */
+struct vector *header_cache_tokens(const char *abs_path);
+
+/**
+ * Gives the include process the tokens and definitions its header produced when the cache preprocessed it,
+ * returns false if the header was never preprocessed, has changed on disk or depends on definitions that differ.
+ */
+bool header_cache_preprocessed(struct compile_process *process);
+void header_cache_record_miss(const char *include_name, const char *abs_path);
+void header_cache_add(const char *include_name, const char *abs_path);
+void header_cache_write_misses(FILE *fp);
+void header_cache_read_misses(FILE *fp);
+
+#define COMPILE_SERVER_DEFAULT_SOCKET "/tmp/peachcompiler.sock"
+#define COMPILE_SERVER_MAX_WORKERS 32
+int compile_server_run(const char *socket_path);
+
+/**
+ * Sends a compile job to the server, diagnostics are written to stderr.
+ * Returns the compile_file result of the job or -1 if the server could not be reached.
+ */
+int compile_client_run(const char *socket_path, const char *input_file, const char *output_file, int flags);
+
+#define AST_FILE_MAGIC "PEACHAST"
+#define AST_FILE_VERSION 3
+// Must be a power of two
+#define AST_MAP_BUCKETS 4096
+
+int ast_write(struct compile_process *process, FILE *fp);
+
+/**
+ * Maps the AST file and rebuilds its tree into process->node_tree_vec, symbols and static includes
+ * are registered again. Returns -1 if the file can not be read, is not a valid AST file or was
+ * written for another target.
+ */
+int ast_load(struct compile_process *process, const char *filename);
+bool ast_file_is_ast(const char *filename);
+
+enum
+{
+    // Section, symbol and data directives, printed verbatim
+    ASM_OP_DIRECTIVE,
+    ASM_OP_LABEL,
+    ASM_OP_COMMENT,
+    ASM_OP_MOV,
+    ASM_OP_MOVZX,
+    ASM_OP_MOVSX,
+    ASM_OP_MOVSXD,
+    ASM_OP_LEA,
+    ASM_OP_PUSH,
+    ASM_OP_POP,
+    ASM_OP_ADD,
+    ASM_OP_SUB,
+    ASM_OP_IMUL,
+    ASM_OP_MUL,
+    ASM_OP_IDIV,
+    ASM_OP_DIV,
+    ASM_OP_CDQ,
+    ASM_OP_CQO,
+    ASM_OP_INC,
+    ASM_OP_DEC,
+    ASM_OP_NEG,
+    ASM_OP_NOT,
+    ASM_OP_AND,
+    ASM_OP_OR,
+    ASM_OP_XOR,
+    ASM_OP_SAL,
+    ASM_OP_SHL,
+    ASM_OP_SAR,
+    ASM_OP_SHR,
+    ASM_OP_CMP,
+    ASM_OP_TEST,
+    ASM_OP_SETE,
+    ASM_OP_SETNE,
+    ASM_OP_SETG,
+    ASM_OP_SETGE,
+    ASM_OP_SETL,
+    ASM_OP_SETLE,
+    ASM_OP_SETA,
+    ASM_OP_SETAE,
+    ASM_OP_SETB,
+    ASM_OP_SETBE,
+    // Jumps stay together, unconditional first
+    ASM_OP_JMP,
+    ASM_OP_JE,
+    ASM_OP_JNE,
+    ASM_OP_JG,
+    ASM_OP_JGE,
+    ASM_OP_JL,
+    ASM_OP_JLE,
+    ASM_OP_JA,
+    ASM_OP_JAE,
+    ASM_OP_JB,
+    ASM_OP_JBE,
+    ASM_OP_CALL,
+    ASM_OP_RET,
+    ASM_OP_LEAVE,
+    ASM_OP_NOP,
+    // align 16 in front of loop heads, only pads the code
+    ASM_OP_ALIGN,
+    // Structure copies, ecx dwords from [esi] to [edi]
+    ASM_OP_REP_MOVSD,
+    ASM_OP_TOTAL
+};
+
+enum
+{
+    ASM_IR_OPERAND_NONE,
+    ASM_IR_OPERAND_REGISTER,
+    ASM_IR_OPERAND_IMMEDIATE,
+    ASM_IR_OPERAND_MEMORY,
+    // Labels and other names
+    ASM_IR_OPERAND_SYMBOL
+};
+
+struct asm_ir_operand
+{
+    int type;
+    union
+    {
+        // Canonical string from asm_ir_register, compare by address
+        const char *reg;
+        long long imm;
+        struct asm_operand mem;
+        const char *symbol;
+    };
+
+    // Size keyword written in front of a register, immediate or symbol, memory keeps its own in mem.size
+    int size;
+
+    // True when mem.base is a symbol allocated for this operand
+    bool owns_base;
+};
+
+#define ASM_IR_MAX_OPERANDS 2
+
+// Full registers in the order of the register table, sub registers map onto these
+enum
+{
+    ASM_IR_REG_EAX,
+    ASM_IR_REG_EBX,
+    ASM_IR_REG_ECX,
+    ASM_IR_REG_EDX,
+    ASM_IR_REG_ESI,
+    ASM_IR_REG_EDI,
+    ASM_IR_REG_EBP,
+    ASM_IR_REG_ESP,
+    // Only x86-64 codegen uses these, never allocated
+    ASM_IR_REG_R8,
+    ASM_IR_REG_R9,
+    ASM_IR_REG_R10,
+    ASM_IR_REG_R11,
+    ASM_IR_REG_R12,
+    ASM_IR_REG_R13,
+    ASM_IR_REG_R14,
+    ASM_IR_REG_R15,
+    ASM_IR_REG_TOTAL
+};
+
+enum
+{
+    // Removed by a pass, skipped when printing and dropped by asm_ir_compact
+    ASM_IR_INSTRUCTION_FLAG_DELETED = 0b00000001,
+    // Saves or restores a callee saved register, regalloc_callee_saved drops it if the function never writes the register
+    ASM_IR_INSTRUCTION_FLAG_CALLEE_SAVED = 0b00000010
+};
+
+struct asm_ir_instruction
+{
+    int op;
+    int flags;
+    int total_operands;
+    struct asm_ir_operand operands[ASM_IR_MAX_OPERANDS];
+
+    // The label name, the comment or the verbatim line of a directive
+    char *text;
+};
+
+struct asm_ir
+{
+    // Vector of struct asm_ir_instruction*
+    struct vector *instructions;
+};
+
+// Instructions [start, end) of an asm_ir
+struct asm_ir_block
+{
+    int start;
+    int end;
+};
+
+struct asm_ir *asm_ir_new();
+struct asm_ir_instruction *asm_ir_instruction_new(int op, const char *text);
+void asm_ir_instruction_free(struct asm_ir_instruction *ins);
+struct asm_ir_instruction *asm_ir_at(struct asm_ir *ir, int index);
+void asm_ir_push(struct asm_ir *ir, struct asm_ir_instruction *ins);
+
+// Operands for building instructions, reg takes any register name and stores the canonical string
+struct asm_ir_operand asm_ir_reg(const char *reg);
+struct asm_ir_operand asm_ir_imm(long long value);
+// Writes a size keyword in front of a register, immediate or symbol, "push dword 5"
+struct asm_ir_operand asm_ir_sized(int size, struct asm_ir_operand operand);
+// A symbol base is copied and owned by the operand
+struct asm_ir_operand asm_ir_mem(struct asm_operand mem);
+struct asm_ir_operand asm_ir_symbol(const char *fmt, ...);
+void asm_ir_print_instruction(struct asm_ir_instruction *ins, struct buffer *out);
+void asm_ir_print(struct asm_ir *ir, struct buffer *out);
+void asm_ir_clear(struct asm_ir *ir);
+
+/**
+ * Frees and removes every instruction flagged ASM_IR_INSTRUCTION_FLAG_DELETED.
+ */
+void asm_ir_compact(struct asm_ir *ir);
 
+/**
+ * Splits the IR at labels and after jumps and returns, returns a vector of struct asm_ir_block.
+ */
+struct vector *asm_ir_basic_blocks(struct asm_ir *ir);
+const char *asm_ir_opcode_name(int op);
+const char *asm_ir_register(const char *name, size_t len);
+bool asm_ir_is_jump(int op);
+bool asm_ir_is_conditional_jump(int op);
+bool asm_ir_ends_block(int op);
+int asm_ir_register_id(const char *reg);
+const char *asm_ir_register_name(int id);
+int asm_ir_register_size(const char *reg);
+// The 64 bit register a canonical register string is part of
+const char *asm_ir_register_64(const char *reg);
+
+// Four bytes on the stack when pushed or popped
+bool asm_ir_operand_is_dword(struct asm_ir_operand *operand);
+// Exactly one stack slot of the target when pushed or popped, the IR has to be lowered already
+bool asm_ir_operand_is_stack_slot(struct asm_ir_operand *operand);
+bool asm_ir_operand_equal(struct asm_ir_operand *a, struct asm_ir_operand *b);
+// ASM_IR_REG_MASK of the callee saved registers of the current target
+int asm_ir_callee_saved_registers();
+
+#define ASM_IR_REG_MASK(reg) (1 << (reg))
+#define ASM_IR_REG_ALL ((1 << ASM_IR_REG_TOTAL) - 1)
+#define ASM_IR_REG_ALLOCATABLE ((ASM_IR_REG_MASK(ASM_IR_REG_R8) - 1) & ~(ASM_IR_REG_MASK(ASM_IR_REG_EBP) | ASM_IR_REG_MASK(ASM_IR_REG_ESP)))
+
+// Masks of ASM_IR_REG_MASK registers
+struct asm_ir_effects
+{
+    int reads;
+    int writes;
+
+    // Uses esp in a way the matching of pushes and pops can not follow
+    bool stack_barrier;
+};
+
+void asm_ir_instruction_effects(struct asm_ir_instruction *ins, struct asm_ir_effects *effects);
+
+/**
+ * Works out which registers are live after each instruction, live_after needs room for every instruction.
+ */
+void asm_ir_liveness(struct asm_ir *ir, int *live_after);
+
+/**
+ * Moves expression temporaries that codegen pushed and popped within a basic block into free registers.
+ */
+void regalloc_temporaries(struct asm_ir *ir);
+
+/**
+ * Drops the saves and restores of callee saved registers the function in the IR never writes.
+ */
+void regalloc_callee_saved(struct asm_ir *ir);
+
+/**
+ * Runs the enabled PEEPHOLE_PATTERN_* patterns over the IR until nothing more matches.
+ */
+void peephole_optimize(struct asm_ir *ir, int patterns, struct peephole_stats *stats);
+void peephole_stats_print(struct peephole_stats *stats, FILE *out);
+
+/**
+ * Widens stack, address, push and pop registers of the IR to 64 bits for the x86-64 target.
+ */
+void x86_64_lower(struct asm_ir *ir);
+
+/**
+ * Integer registers a SysV argument or result of the type takes, zero when it is passed in memory.
+ */
+int x86_64_eightbytes(const struct datatype *dtype);
+
+// Where the arguments of one call go, filled in an argument at a time from left to right
+struct x86_64_argument_placement
+{
+    // Argument registers taken so far
+    int registers;
+
+    // Bytes of the arguments that are passed on the stack so far
+    size_t stack_size;
+};
+
+/**
+ * Starts placing the arguments of a call returning rtype, a result passed in memory takes the first
+ * register for the hidden pointer to it.
+ */
+void x86_64_placement_start(struct x86_64_argument_placement *placement, const struct datatype *rtype);
+
+/**
+ * Places the next argument, returns its first register or -1 when it goes on the stack at *stack_offset_out.
+ */
+int x86_64_place_argument(struct x86_64_argument_placement *placement, const struct datatype *dtype, size_t *stack_offset_out);
+
+/**
+ * Bytes an argument of the type takes on the stack, a whole number of eight byte slots.
+ */
+size_t x86_64_stack_argument_size(const struct datatype *dtype);
 
 // Helpers
 bool file_exists(const char* filename);
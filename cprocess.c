@@ -45,6 +45,8 @@ struct compile_process *compile_process_create(const char *filename, const char
         }
     }
 
+    // Datatype sizes are decided while parsing, the target has to be known before that
+    target_select(flags);
     struct compile_process* process = calloc(1, sizeof(struct compile_process));
     process->token_vec = vector_create(sizeof(struct token));
     process->token_vec_original = vector_create(sizeof(struct token));
@@ -64,11 +66,13 @@ struct compile_process *compile_process_create(const char *filename, const char
     {
         process->preprocessor = parent_process->preprocessor;
         process->include_dirs = parent_process->include_dirs;
+        process->datatypes = parent_process->datatypes;
     }
     else
     {
         process->preprocessor = preprocessor_create(process);
         process->include_dirs = vector_create(sizeof(const char*));
+        process->datatypes = datatype_table_new();
         // Load the default include directories
         compiler_setup_default_include_directories(process->include_dirs);
     }
@@ -1,6 +1,8 @@
 #include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
 
-bool datatype_is_struct_or_union(struct datatype* dtype)
+bool datatype_is_struct_or_union(const struct datatype* dtype)
 {
     return dtype->type == DATA_TYPE_STRUCT || dtype->type == DATA_TYPE_UNION;
 }
@@ -10,7 +12,7 @@ bool datatype_is_struct_or_union_for_name(const char* name)
     return S_EQ(name,"union") || S_EQ(name, "struct");
 }
 
-size_t datatype_size_for_array_access(struct datatype* dtype)
+size_t datatype_size_for_array_access(const struct datatype* dtype)
 {
     if (datatype_is_struct_or_union(dtype) && dtype->flags & DATATYPE_FLAG_IS_POINTER && 
         dtype->pointer_depth == 1)
@@ -22,28 +24,27 @@ size_t datatype_size_for_array_access(struct datatype* dtype)
     return datatype_size(dtype);
 }
 
-bool datatype_is_void_no_ptr(struct datatype* dtype)
+bool datatype_is_void_no_ptr(const struct datatype* dtype)
 {
-    return S_EQ(dtype->type_str, "void") && !(dtype->flags & DATATYPE_FLAG_IS_POINTER);
+    return dtype->type == DATA_TYPE_VOID && !(dtype->flags & DATATYPE_FLAG_IS_POINTER);
 }
 
 void datatype_set_void(struct datatype* dtype)
 {
-    dtype->type = DATA_TYPE_VOID;
-    dtype->type_str = "void";
-    dtype->size = 0;
+    // Callers pass uninitialized stack datatypes, anything left over would be read when interned
+    *dtype = (struct datatype){.type = DATA_TYPE_VOID, .type_str = "void"};
 }
-size_t datatype_element_size(struct datatype* dtype)
+size_t datatype_element_size(const struct datatype* dtype)
 {
     if (dtype->flags & DATATYPE_FLAG_IS_POINTER)
     {
-        return DATA_SIZE_DWORD;
+        return target_current()->pointer_size;
     }
 
     return dtype->size;
 }
 
-size_t datatype_size_no_ptr(struct datatype* dtype)
+size_t datatype_size_no_ptr(const struct datatype* dtype)
 {
     if (dtype->flags & DATATYPE_FLAG_IS_ARRAY)
     {
@@ -53,11 +54,11 @@ size_t datatype_size_no_ptr(struct datatype* dtype)
     return dtype->size;
 }
 
-size_t datatype_size(struct datatype* dtype)
+size_t datatype_size(const struct datatype* dtype)
 {
     if (dtype->flags & DATATYPE_FLAG_IS_POINTER && dtype->pointer_depth > 0)
     {
-        return DATA_SIZE_DWORD;
+        return target_current()->pointer_size;
     }
 
     if (dtype->flags & DATATYPE_FLAG_IS_ARRAY)
@@ -68,12 +69,187 @@ size_t datatype_size(struct datatype* dtype)
     return dtype->size;
 }
 
-bool datatype_is_primitive(struct datatype* dtype)
+size_t datatype_align(const struct datatype* dtype)
+{
+    size_t pointer_size = target_current()->pointer_size;
+    if (dtype->flags & DATATYPE_FLAG_IS_POINTER && dtype->pointer_depth > 0)
+    {
+        return pointer_size;
+    }
+
+    if (datatype_is_struct_or_union(dtype))
+    {
+        struct node *node = dtype->struct_node;
+        if (!node || node->flags & NODE_FLAG_IS_FORWARD_DECLARATION)
+        {
+            return 1;
+        }
+        return struct_layout_for_node(node)->align;
+    }
+
+    // 32 bit x86 aligns eight byte scalars to four bytes
+    if (dtype->size > pointer_size)
+    {
+        return pointer_size;
+    }
+    return dtype->size ? dtype->size : 1;
+}
+
+bool datatype_is_primitive(const struct datatype* dtype)
 {
     return !datatype_is_struct_or_union(dtype);
 }
 
-bool datatype_is_struct_or_union_non_pointer(struct datatype* dtype)
+bool datatype_is_struct_or_union_non_pointer(const struct datatype* dtype)
 {
     return dtype->type != DATA_TYPE_UNKNOWN && !datatype_is_primitive(dtype) && !(dtype->flags & DATATYPE_FLAG_IS_POINTER);  
 }
+
+static unsigned int datatype_hash_combine(unsigned int hash, size_t value)
+{
+    // FNV-1a over the bytes of value
+    for (int i = 0; i < sizeof(value); i++)
+    {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t datatype_bracket_identity(struct node* bracket_node)
+{
+    struct node* inner = bracket_node->bracket.inner;
+    if (inner && inner->type == NODE_TYPE_NUMBER)
+    {
+        return inner->llnum;
+    }
+
+    return (size_t)inner;
+}
+
+static unsigned int datatype_hash(const struct datatype* dtype, const struct datatype* secondary)
+{
+    unsigned int hash = 2166136261u;
+    hash = datatype_hash_combine(hash, dtype->flags);
+    hash = datatype_hash_combine(hash, dtype->type);
+    hash = datatype_hash_combine(hash, dtype->size);
+    hash = datatype_hash_combine(hash, dtype->pointer_depth);
+    hash = datatype_hash_combine(hash, (size_t)dtype->struct_node);
+    hash = datatype_hash_combine(hash, (size_t)secondary);
+    hash = datatype_hash_combine(hash, dtype->array.size);
+    if (dtype->type_str)
+    {
+        for (const char* c = dtype->type_str; *c; c++)
+        {
+            hash = datatype_hash_combine(hash, *c);
+        }
+    }
+
+    if (dtype->flags & DATATYPE_FLAG_IS_ARRAY && dtype->array.brackets)
+    {
+        struct vector* bracket_vec = array_brackets_node_vector(dtype->array.brackets);
+        for (int i = 0; i < vector_count(bracket_vec); i++)
+        {
+            hash = datatype_hash_combine(hash, datatype_bracket_identity(vector_peek_ptr_at(bracket_vec, i)));
+        }
+    }
+
+    return hash;
+}
+
+static bool datatype_brackets_equal(const struct datatype* dtype, const struct datatype* other)
+{
+    if (!(dtype->flags & DATATYPE_FLAG_IS_ARRAY))
+    {
+        return true;
+    }
+
+    if (!dtype->array.brackets || !other->array.brackets)
+    {
+        return dtype->array.brackets == other->array.brackets;
+    }
+
+    struct vector* bracket_vec = array_brackets_node_vector(dtype->array.brackets);
+    struct vector* other_bracket_vec = array_brackets_node_vector(other->array.brackets);
+    if (vector_count(bracket_vec) != vector_count(other_bracket_vec))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < vector_count(bracket_vec); i++)
+    {
+        if (datatype_bracket_identity(vector_peek_ptr_at(bracket_vec, i)) != datatype_bracket_identity(vector_peek_ptr_at(other_bracket_vec, i)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool datatype_table_entry_matches(struct datatype_table_entry* entry, const struct datatype* dtype, const struct datatype* secondary)
+{
+    const struct datatype* canonical = &entry->dtype;
+    if (canonical->flags != dtype->flags || canonical->type != dtype->type ||
+        canonical->size != dtype->size || canonical->pointer_depth != dtype->pointer_depth ||
+        canonical->struct_node != dtype->struct_node || canonical->secondary != secondary ||
+        canonical->array.size != dtype->array.size)
+    {
+        return false;
+    }
+
+    if (canonical->type_str != dtype->type_str &&
+        (!canonical->type_str || !dtype->type_str || !S_EQ(canonical->type_str, dtype->type_str)))
+    {
+        return false;
+    }
+
+    return datatype_brackets_equal(canonical, dtype);
+}
+
+struct datatype_table* datatype_table_new()
+{
+    struct datatype_table* table = calloc(1, sizeof(struct datatype_table));
+    table->total_buckets = DATATYPE_TABLE_BUCKETS;
+    table->buckets = calloc(table->total_buckets, sizeof(struct datatype_table_entry*));
+    table->empty = &datatype_table_intern(table, &(struct datatype){})->dtype;
+    struct datatype numeric = datatype_for_numeric();
+    table->numeric = &datatype_table_intern(table, &numeric)->dtype;
+    struct datatype string = datatype_for_string();
+    table->string = &datatype_table_intern(table, &string)->dtype;
+    return table;
+}
+
+struct datatype_table_entry* datatype_table_intern(struct datatype_table* table, const struct datatype* dtype)
+{
+    // Secondary types are interned first so the canonical entry can compare them by pointer.
+    const struct datatype* secondary = NULL;
+    if (dtype->secondary)
+    {
+        secondary = &datatype_table_intern(table, dtype->secondary)->dtype;
+    }
+
+    unsigned int hash = datatype_hash(dtype, secondary);
+    struct datatype_table_entry** bucket = &table->buckets[hash & (table->total_buckets - 1)];
+    for (struct datatype_table_entry* entry = *bucket; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && datatype_table_entry_matches(entry, dtype, secondary))
+        {
+            return entry;
+        }
+    }
+
+    struct datatype_table_entry* entry = calloc(1, sizeof(struct datatype_table_entry));
+    entry->dtype = *dtype;
+    entry->dtype.secondary = secondary;
+    entry->hash = hash;
+    entry->next = *bucket;
+    *bucket = entry;
+    table->count++;
+    return entry;
+}
+
+const struct datatype* datatype_intern(struct compile_process* process, const struct datatype* dtype)
+{
+    return &datatype_table_intern(process->datatypes, dtype)->dtype;
+}
@@ -0,0 +1,206 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+struct driver_job
+{
+    const char *source;
+    int flags;
+    char asm_file[PATH_MAX];
+    char object_file[PATH_MAX];
+    pid_t pid;
+    int status;
+    double start;
+    double end;
+};
+
+static double driver_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Runs inside the worker process, compiles and assembles a single translation unit.
+ */
+static int driver_job_run(struct driver_job *job)
+{
+    if (compile_file(job->source, job->asm_file, job->flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        return DRIVER_JOB_COMPILE_FAILED;
+    }
+
+    char nasm_cmd[PATH_MAX * 2 + 32];
+    sprintf(nasm_cmd, "nasm -f %s %s -o %s", target_for_flags(job->flags)->nasm_format, job->asm_file, job->object_file);
+    if (system(nasm_cmd) != 0)
+    {
+        return DRIVER_JOB_ASSEMBLE_FAILED;
+    }
+
+    return DRIVER_JOB_OK;
+}
+
+static void driver_job_start(struct driver_job *job)
+{
+    fflush(stdout);
+    job->start = driver_now();
+    job->pid = fork();
+    if (job->pid < 0)
+    {
+        job->status = DRIVER_JOB_COMPILE_FAILED;
+        job->end = driver_now();
+        return;
+    }
+
+    if (job->pid == 0)
+    {
+        // Worker processes never echo the generated assembly, it would interleave.
+        freopen("/dev/null", "w", stdout);
+        _exit(driver_job_run(job));
+    }
+}
+
+static struct driver_job *driver_job_for_pid(struct driver_job *jobs, int total_jobs, pid_t pid)
+{
+    for (int i = 0; i < total_jobs; i++)
+    {
+        if (jobs[i].pid == pid)
+        {
+            return &jobs[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void driver_wait_one(struct driver_job *jobs, int total_jobs)
+{
+    int status = 0;
+    pid_t pid = wait(&status);
+    struct driver_job *job = driver_job_for_pid(jobs, total_jobs, pid);
+    if (!job)
+    {
+        return;
+    }
+
+    job->end = driver_now();
+    job->status = WIFEXITED(status) ? WEXITSTATUS(status) : DRIVER_JOB_COMPILE_FAILED;
+    printf("[%6.3fs] %s %s\n", job->end - job->start, job->source, job->status == DRIVER_JOB_OK ? "ok" : job->status == DRIVER_JOB_ASSEMBLE_FAILED ? "assembly failed" : "compile failed");
+}
+
+static int driver_link(struct driver_job *jobs, int total_jobs, const char *output_file, int flags)
+{
+    size_t cmd_len = strlen(output_file) + 32;
+    for (int i = 0; i < total_jobs; i++)
+    {
+        cmd_len += strlen(jobs[i].object_file) + 1;
+    }
+
+    char *link_cmd = calloc(1, cmd_len);
+    sprintf(link_cmd, "gcc %s", target_for_flags(flags)->link_flags);
+    for (int i = 0; i < total_jobs; i++)
+    {
+        strcat(link_cmd, " ");
+        strcat(link_cmd, jobs[i].object_file);
+    }
+    strcat(link_cmd, " -o ");
+    strcat(link_cmd, output_file);
+
+    int res = system(link_cmd);
+    free(link_cmd);
+    return res;
+}
+
+/**
+ * Removes the assembly and object files of a successful build together with their directory.
+ */
+static void driver_remove_build_dir(struct driver_job *jobs, int total_jobs, const char *build_dir)
+{
+    for (int i = 0; i < total_jobs; i++)
+    {
+        unlink(jobs[i].asm_file);
+        unlink(jobs[i].object_file);
+    }
+
+    rmdir(build_dir);
+}
+
+int driver_build(const char *output_file, const char **sources, int total_sources, int max_workers, int flags)
+{
+    if (max_workers < 1)
+    {
+        max_workers = 1;
+    }
+
+    // Intermediate files never go next to the sources, those may well be in a read only tree
+    char build_dir[PATH_MAX];
+    strcpy(build_dir, "/tmp/peachcc-build-XXXXXX");
+    if (!mkdtemp(build_dir))
+    {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    double build_start = driver_now();
+    struct driver_job *jobs = calloc(total_sources, sizeof(struct driver_job));
+    int running = 0;
+    for (int i = 0; i < total_sources; i++)
+    {
+        // Prefixed with the index as two sources may share a file name
+        const char *name = strrchr(sources[i], '/') ? strrchr(sources[i], '/') + 1 : sources[i];
+        jobs[i].source = sources[i];
+        jobs[i].flags = flags;
+        snprintf(jobs[i].asm_file, sizeof(jobs[i].asm_file), "%s/%i_%s.asm", build_dir, i, name);
+        snprintf(jobs[i].object_file, sizeof(jobs[i].object_file), "%s/%i_%s.o", build_dir, i, name);
+
+        if (running == max_workers)
+        {
+            driver_wait_one(jobs, total_sources);
+            running--;
+        }
+
+        driver_job_start(&jobs[i]);
+        if (jobs[i].pid > 0)
+        {
+            running++;
+        }
+    }
+
+    while (running > 0)
+    {
+        driver_wait_one(jobs, total_sources);
+        running--;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < total_sources; i++)
+    {
+        if (jobs[i].status != DRIVER_JOB_OK)
+        {
+            failed++;
+        }
+    }
+
+    int res = 0;
+    if (failed)
+    {
+        printf("%i of %i files failed, not linking, intermediate files are in %s\n", failed, total_sources, build_dir);
+        res = -1;
+    }
+    else
+    {
+        double link_start = driver_now();
+        res = driver_link(jobs, total_sources, output_file, flags);
+        printf("[%6.3fs] link %s%s\n", driver_now() - link_start, output_file, res == 0 ? "" : " failed");
+        driver_remove_build_dir(jobs, total_sources, build_dir);
+    }
+
+    printf("[%6.3fs] total for %i files with %i workers\n", driver_now() - build_start, total_sources, max_workers);
+    free(jobs);
+    return res;
+}
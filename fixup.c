@@ -5,7 +5,7 @@
 struct fixup_system* fixup_sys_new()
 {
     struct fixup_system* system = calloc(1, sizeof(struct fixup_system));
-    system->fixups = vector_create(sizeof(struct fixup));
+    system->fixups = vector_create(sizeof(struct fixup*));
     return system;
 }
 
@@ -30,14 +30,67 @@ struct fixup* fixup_next(struct fixup_system* system)
     return vector_peek_ptr(system->fixups);
 }
 
+static unsigned int fixup_dependency_hash(const char* name)
+{
+    unsigned int hash = 5381;
+    while (*name)
+    {
+        hash = hash * 33 + (unsigned char)*name;
+        name++;
+    }
+    return hash & (FIXUP_DEPENDENCY_BUCKETS - 1);
+}
+
+static struct fixup_dependency* fixup_dependency_get(struct fixup_system* system, const char* name, bool create)
+{
+    struct fixup_dependency** bucket = &system->dependencies[fixup_dependency_hash(name)];
+    for (struct fixup_dependency* dependency = *bucket; dependency; dependency = dependency->next)
+    {
+        if (S_EQ(dependency->name, name))
+        {
+            return dependency;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    struct fixup_dependency* dependency = calloc(1, sizeof(struct fixup_dependency));
+    dependency->name = name;
+    dependency->fixups = vector_create(sizeof(struct fixup*));
+    dependency->next = *bucket;
+    *bucket = dependency;
+    return dependency;
+}
+
+static void fixup_dependency_remove(struct fixup_system* system, struct fixup_dependency* dependency)
+{
+    struct fixup_dependency** current = &system->dependencies[fixup_dependency_hash(dependency->name)];
+    while (*current != dependency)
+    {
+        current = &(*current)->next;
+    }
+
+    *current = dependency->next;
+    vector_free(dependency->fixups);
+    free(dependency);
+}
+
 void fixup_sys_fixups_free(struct fixup_system* system)
 {
-    fixup_start_iteration(system);
-    struct fixup* fixup = fixup_next(system);
-    while(fixup)
+    for (int i = 0; i < vector_count(system->fixups); i++)
+    {
+        fixup_free(vector_peek_ptr_at(system->fixups, i));
+    }
+
+    for (int i = 0; i < FIXUP_DEPENDENCY_BUCKETS; i++)
     {
-        fixup_free(fixup);
-        fixup = fixup_next(system);
+        while (system->dependencies[i])
+        {
+            fixup_dependency_remove(system, system->dependencies[i]);
+        }
     }
 }
 
@@ -50,21 +103,7 @@ void fixup_sys_free(struct fixup_system* system)
 
 int fixup_sys_unresolved_fixups_count(struct fixup_system* system)
 {
-    size_t c = 0;
-    fixup_start_iteration(system);
-    struct fixup* fixup = fixup_next(system);
-    while(fixup)
-    {
-        if (fixup->flags & FIXUP_FLAG_RESOLVED)
-        {
-            fixup = fixup_next(system);
-            continue;
-        }
-        c++;
-        fixup = fixup_next(system);
-    }
-
-    return c;
+    return system->unresolved;
 }
 
 struct fixup* fixup_register(struct fixup_system* system, struct fixup_config* config)
@@ -72,15 +111,27 @@ struct fixup* fixup_register(struct fixup_system* system, struct fixup_config* c
     struct fixup* fixup = calloc(1, sizeof(struct fixup));
     memcpy(&fixup->config, config, sizeof(struct fixup_config));
     fixup->system = system;
-    vector_push(system->fixups, fixup);
+    vector_push(system->fixups, &fixup);
+    system->unresolved++;
+    if (config->waiting_on)
+    {
+        struct fixup_dependency* dependency = fixup_dependency_get(system, config->waiting_on, true);
+        vector_push(dependency->fixups, &fixup);
+    }
     return fixup;
 }
 
 bool fixup_resolve(struct fixup* fixup)
 {
+    if (fixup->flags & FIXUP_FLAG_RESOLVED)
+    {
+        return true;
+    }
+
     if (fixup_config(fixup)->fix(fixup))
     {
         fixup->flags |= FIXUP_FLAG_RESOLVED;
+        fixup->system->unresolved--;
         return true;
     }
 
@@ -92,19 +143,34 @@ void* fixup_private(struct fixup* fixup)
     return fixup_config(fixup)->private;
 }
 
+void fixup_sys_symbol_defined(struct fixup_system* system, const char* name)
+{
+    struct fixup_dependency* dependency = fixup_dependency_get(system, name, false);
+    if (!dependency)
+    {
+        return;
+    }
+
+    for (int i = 0; i < vector_count(dependency->fixups); i++)
+    {
+        fixup_resolve(vector_peek_ptr_at(dependency->fixups, i));
+    }
+
+    // Anything that still failed stays in system->fixups for fixups_resolve to retry.
+    fixup_dependency_remove(system, dependency);
+}
+
 bool fixups_resolve(struct fixup_system* system)
 {
-    fixup_start_iteration(system);
-    struct fixup* fixup = fixup_next(system);
-    while(fixup)
+    if (system->unresolved == 0)
     {
-        if (fixup->flags & FIXUP_FLAG_RESOLVED)
-        {
-            continue;
-        }
-        fixup_resolve(fixup);
-        fixup = fixup_next(system);
+        return true;
+    }
+
+    for (int i = 0; i < vector_count(system->fixups); i++)
+    {
+        fixup_resolve(vector_peek_ptr_at(system->fixups, i));
     }
 
     return fixup_sys_unresolved_fixups_count(system) == 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,285 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <limits.h>
+
+/**
+ * Constant folding.
+ *
+ * Runs once the tree is parsed and validated and turns every expression whose operands are known at
+ * compile time into the number it evaluates to. Operands are promoted to int and the result is an int
+ * as C would have it, a cast to a narrower type truncates and then sign or zero extends. Anything whose
+ * result is not an int, such as a cast to a 64 bit long under -m64, or that is undefined in C, is left
+ * for codegen.
+ */
+
+static void fold_node(struct node *node);
+
+static bool fold_constant(struct node *node, int *value_out)
+{
+    while (node && node->type == NODE_TYPE_EXPRESSION_PARENTHESES)
+    {
+        node = node->parenthesis.exp;
+    }
+
+    if (!node || node->type != NODE_TYPE_NUMBER)
+    {
+        return false;
+    }
+
+    long long value = (long long)node->llnum;
+    if (value < INT_MIN || value > INT_MAX)
+    {
+        return false;
+    }
+
+    *value_out = (int)value;
+    return true;
+}
+
+static void fold_to_number(struct node *node, int value)
+{
+    node->type = NODE_TYPE_NUMBER;
+    node->llnum = (long long)value;
+}
+
+static bool fold_is_foldable_operator(const char *op)
+{
+    static const char *operators[] = {"*", "/", "%", "+", "-", "<<", ">>", "<", ">", "<=", ">=", "==", "!=", "&", "|", "^", "&&", "||"};
+    for (int i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if (S_EQ(op, operators[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fold_tenary(struct node *node)
+{
+    int cond;
+    if (!fold_constant(node->exp.left, &cond))
+    {
+        return;
+    }
+
+    struct node *tenary_node = node->exp.right;
+    struct node *chosen = cond ? tenary_node->tenary.true_node : tenary_node->tenary.false_node;
+    int flags = node->flags;
+    *node = *chosen;
+    node->flags = flags;
+}
+
+static void fold_expression(struct node *node)
+{
+    fold_node(node->exp.left);
+    fold_node(node->exp.right);
+    if (S_EQ(node->exp.op, "?"))
+    {
+        fold_tenary(node);
+        return;
+    }
+
+    if (!fold_is_foldable_operator(node->exp.op))
+    {
+        return;
+    }
+
+    int left;
+    int right;
+    bool left_constant = fold_constant(node->exp.left, &left);
+
+    // The right operand is never evaluated, whatever it is
+    if (left_constant && ((S_EQ(node->exp.op, "&&") && !left) || (S_EQ(node->exp.op, "||") && left)))
+    {
+        fold_to_number(node, S_EQ(node->exp.op, "||"));
+        return;
+    }
+
+    if (!left_constant || !fold_constant(node->exp.right, &right))
+    {
+        return;
+    }
+
+    if ((S_EQ(node->exp.op, "/") || S_EQ(node->exp.op, "%")) && (right == 0 || (left == INT_MIN && right == -1)))
+    {
+        return;
+    }
+
+    if ((S_EQ(node->exp.op, "<<") || S_EQ(node->exp.op, ">>")) && (right < 0 || right >= DATA_SIZE_DWORD * 8))
+    {
+        return;
+    }
+
+    bool success = false;
+    int result = arithmetic(NULL, left, right, node->exp.op, &success);
+    if (success)
+    {
+        fold_to_number(node, result);
+    }
+}
+
+static void fold_unary(struct node *node)
+{
+    fold_node(node->unary.operand);
+    int value;
+    if (!fold_constant(node->unary.operand, &value))
+    {
+        return;
+    }
+
+    if (S_EQ(node->unary.op, "-"))
+    {
+        fold_to_number(node, (int)(0u - (unsigned int)value));
+    }
+    else if (S_EQ(node->unary.op, "~"))
+    {
+        fold_to_number(node, ~value);
+    }
+    else if (S_EQ(node->unary.op, "!"))
+    {
+        fold_to_number(node, !value);
+    }
+}
+
+static void fold_cast(struct node *node)
+{
+    fold_node(node->cast.operand);
+    const struct datatype *dtype = node->cast.dtype;
+    int value;
+    if (!fold_constant(node->cast.operand, &value) || dtype->flags & (DATATYPE_FLAG_IS_POINTER | DATATYPE_FLAG_IS_ARRAY))
+    {
+        return;
+    }
+
+    bool is_signed = dtype->flags & DATATYPE_FLAG_IS_SIGNED;
+    switch (dtype->type)
+    {
+    case DATA_TYPE_CHAR:
+        fold_to_number(node, is_signed ? (int)(signed char)value : (int)(unsigned char)value);
+        break;
+
+    case DATA_TYPE_SHORT:
+        fold_to_number(node, is_signed ? (int)(short)value : (int)(unsigned short)value);
+        break;
+
+    case DATA_TYPE_INTEGER:
+    case DATA_TYPE_LONG:
+        // An unsigned int is no longer an int, comparisons and division on it must stay unsigned.
+        // A 64 bit long is wider than the int everything here is folded in.
+        if (is_signed && dtype->size == DATA_SIZE_DWORD)
+        {
+            fold_to_number(node, value);
+        }
+        break;
+    }
+}
+
+static void fold_body(struct node *node)
+{
+    struct vector *statements = node->body.statements;
+    for (int i = 0; i < vector_count(statements); i++)
+    {
+        fold_node(*(struct node **)vector_at(statements, i));
+    }
+}
+
+static void fold_node(struct node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        fold_expression(node);
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        fold_node(node->parenthesis.exp);
+        break;
+
+    case NODE_TYPE_UNARY:
+        fold_unary(node);
+        break;
+
+    case NODE_TYPE_TENARY:
+        fold_node(node->tenary.true_node);
+        fold_node(node->tenary.false_node);
+        break;
+
+    case NODE_TYPE_CAST:
+        fold_cast(node);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        fold_node(node->bracket.inner);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        fold_node(node->var.val);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        for (int i = 0; i < vector_count(node->var_list.list); i++)
+        {
+            fold_node(*(struct node **)vector_at(node->var_list.list, i));
+        }
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        fold_node(node->func.body_n);
+        break;
+
+    case NODE_TYPE_BODY:
+        fold_body(node);
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        fold_node(node->stmt.return_stmt.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        fold_node(node->stmt.if_stmt.cond_node);
+        fold_node(node->stmt.if_stmt.body_node);
+        fold_node(node->stmt.if_stmt.next);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        fold_node(node->stmt.else_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        fold_node(node->stmt.while_stmt.exp_node);
+        fold_node(node->stmt.while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        fold_node(node->stmt.do_while_stmt.exp_node);
+        fold_node(node->stmt.do_while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        fold_node(node->stmt.for_stmt.init_node);
+        fold_node(node->stmt.for_stmt.cond_node);
+        fold_node(node->stmt.for_stmt.loop_node);
+        fold_node(node->stmt.for_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        fold_node(node->stmt.switch_stmt.exp);
+        fold_node(node->stmt.switch_stmt.body);
+        break;
+    }
+}
+
+void fold_constants(struct compile_process *process)
+{
+    struct vector *tree = process->node_tree_vec;
+    for (int i = 0; i < vector_count(tree); i++)
+    {
+        fold_node(*(struct node **)vector_at(tree, i));
+    }
+}
@@ -0,0 +1,401 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/**
+ * Lexed and preprocessed headers and include path lookups kept warm by the compile server.
+ *
+ * The cache is process wide and only ever filled by the server process. Jobs run in
+ * forked workers that read the cache copy on write, so workers never race on it.
+ */
+
+struct header_cache_file
+{
+    char *path;
+    time_t mtime;
+};
+
+struct header_cache_entry
+{
+    // cwd and include name joined by a newline, or the absolute path for token entries
+    char *key;
+
+    // Absolute path this include name resolved to
+    char *abs_path;
+
+    // Lexed tokens of abs_path, NULL for include lookup entries.
+    struct vector *tokens;
+
+    // Modification time of abs_path when it was lexed or the include name was resolved
+    time_t mtime;
+
+    // Tokens of abs_path preprocessed on its own, NULL if that could not be done or replayed.
+    struct vector *preprocessed;
+
+    // Vector of struct preprocessor_definition* the header left behind
+    struct vector *definitions;
+
+    // Vector of struct preprocessor_header_lookup, what the preprocessed tokens depend on
+    struct vector *lookups;
+
+    // Vector of struct header_cache_file, the header and everything it included
+    struct vector *files;
+
+    struct header_cache_entry *next;
+};
+
+static struct header_cache
+{
+    bool enabled;
+    struct header_cache_entry *lookups[HEADER_CACHE_BUCKETS];
+    struct header_cache_entry *headers[HEADER_CACHE_BUCKETS];
+
+    // Vector of char* "include_name\tabs_path" that were resolved without the cache.
+    struct vector *misses;
+
+    // Set while the server preprocesses a header, its own include lookups are not misses of a job
+    bool warming;
+} header_cache;
+
+static unsigned int header_cache_hash(const char *key)
+{
+    unsigned int hash = 5381;
+    while (*key)
+    {
+        hash = hash * 33 + (unsigned char)*key;
+        key++;
+    }
+    return hash & (HEADER_CACHE_BUCKETS - 1);
+}
+
+static struct header_cache_entry *header_cache_find(struct header_cache_entry **buckets, const char *key)
+{
+    for (struct header_cache_entry *entry = buckets[header_cache_hash(key)]; entry; entry = entry->next)
+    {
+        if (S_EQ(entry->key, key))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct header_cache_entry *header_cache_insert(struct header_cache_entry **buckets, const char *key)
+{
+    struct header_cache_entry *entry = header_cache_find(buckets, key);
+    if (entry)
+    {
+        return entry;
+    }
+
+    entry = calloc(1, sizeof(struct header_cache_entry));
+    entry->key = strdup(key);
+    unsigned int bucket = header_cache_hash(key);
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    return entry;
+}
+
+static void header_cache_lookup_key(char *out, size_t size, const char *include_name)
+{
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        cwd[0] = 0;
+    }
+    snprintf(out, size, "%s\n%s", cwd, include_name);
+}
+
+static time_t header_cache_mtime(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+
+    return st.st_mtime;
+}
+
+void header_cache_enable()
+{
+    header_cache.enabled = true;
+    header_cache.misses = vector_create(sizeof(char *));
+}
+
+bool header_cache_enabled()
+{
+    return header_cache.enabled;
+}
+
+const char *header_cache_include_path(const char *include_name)
+{
+    if (!header_cache.enabled)
+    {
+        return NULL;
+    }
+
+    char key[PATH_MAX * 2];
+    header_cache_lookup_key(key, sizeof(key), include_name);
+    struct header_cache_entry *entry = header_cache_find(header_cache.lookups, key);
+    if (!entry || entry->mtime != header_cache_mtime(entry->abs_path))
+    {
+        return NULL;
+    }
+
+    return entry->abs_path;
+}
+
+static struct vector *header_cache_copy_tokens(struct vector *src)
+{
+    struct vector *tokens = vector_create(sizeof(struct token));
+    for (int i = 0; i < vector_count(src); i++)
+    {
+        vector_push(tokens, vector_at(src, i));
+    }
+    return tokens;
+}
+
+struct vector *header_cache_tokens(const char *abs_path)
+{
+    if (!header_cache.enabled)
+    {
+        return NULL;
+    }
+
+    struct header_cache_entry *entry = header_cache_find(header_cache.headers, abs_path);
+    if (!entry || entry->mtime != header_cache_mtime(abs_path))
+    {
+        return NULL;
+    }
+
+    // The preprocessor consumes the vector it is given, hand out a copy.
+    return header_cache_copy_tokens(entry->tokens);
+}
+
+static bool header_cache_files_unchanged(struct header_cache_entry *entry)
+{
+    for (int i = 0; i < vector_count(entry->files); i++)
+    {
+        struct header_cache_file *file = vector_at(entry->files, i);
+        if (file->mtime != header_cache_mtime(file->path))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool header_cache_preprocessed(struct compile_process *process)
+{
+    if (!header_cache.enabled)
+    {
+        return false;
+    }
+
+    struct header_cache_entry *entry = header_cache_find(header_cache.headers, process->cfile.abs_path);
+    if (!entry || !entry->preprocessed || !header_cache_files_unchanged(entry))
+    {
+        return false;
+    }
+
+    struct preprocessor *preprocessor = process->preprocessor;
+    for (int i = 0; i < vector_count(entry->lookups); i++)
+    {
+        struct preprocessor_header_lookup *lookup = vector_at(entry->lookups, i);
+        if ((preprocessor_get_definition(preprocessor, lookup->name) != NULL) != lookup->defined)
+        {
+            return false;
+        }
+    }
+
+    // Same as the header defining them again, only typedefs do not replace an earlier definition
+    for (int i = 0; i < vector_count(entry->definitions); i++)
+    {
+        struct preprocessor_definition *definition = malloc(sizeof(struct preprocessor_definition));
+        memcpy(definition, vector_peek_ptr_at(entry->definitions, i), sizeof(struct preprocessor_definition));
+        definition->preprocessor = preprocessor;
+        if (definition->type != PREPROCESSOR_DEFINITION_TYPEDEF)
+        {
+            preprocessor_definition_remove(preprocessor, definition->name);
+        }
+        vector_push(preprocessor->definitions, &definition);
+    }
+
+    for (int i = 0; i < vector_count(entry->files); i++)
+    {
+        struct header_cache_file *file = vector_at(entry->files, i);
+        preprocessor_add_included_file(preprocessor, file->path);
+    }
+
+    process->token_vec = header_cache_copy_tokens(entry->preprocessed);
+    return true;
+}
+
+void header_cache_record_miss(const char *include_name, const char *abs_path)
+{
+    if (!header_cache.enabled || header_cache.warming)
+    {
+        return;
+    }
+
+    char *record = malloc(strlen(include_name) + strlen(abs_path) + 2);
+    sprintf(record, "%s\t%s", include_name, abs_path);
+    vector_push(header_cache.misses, &record);
+}
+
+static struct compile_process *header_cache_preprocess_run(struct header_cache_entry *entry, struct preprocessor_header_record *record)
+{
+    struct compile_process *process = compile_process_create(entry->abs_path, NULL, 0, NULL);
+    if (!process)
+    {
+        return NULL;
+    }
+
+    struct vector *definitions = process->preprocessor->definitions;
+    record->builtins = vector_create(sizeof(struct preprocessor_definition *));
+    for (int i = 0; i < vector_count(definitions); i++)
+    {
+        vector_push(record->builtins, vector_at(definitions, i));
+    }
+    record->lookups = vector_create(sizeof(struct preprocessor_header_lookup));
+
+    process->token_vec_original = header_cache_copy_tokens(entry->tokens);
+    process->preprocessor->record = record;
+    header_cache.warming = true;
+    preprocessor_run(process);
+    header_cache.warming = false;
+    process->preprocessor->record = NULL;
+    return process;
+}
+
+/**
+ * Preprocesses the header with nothing defined but the builtins and keeps the result with
+ * the names it depended on, so jobs can take the tokens instead of preprocessing it again.
+ */
+static void header_cache_preprocess(struct header_cache_entry *entry)
+{
+    entry->preprocessed = NULL;
+
+    // A header that does not preprocess on its own ends in a compiler error, which exits.
+    // Try it in a child first so only the child goes down.
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        freopen("/dev/null", "w", stderr);
+        struct preprocessor_header_record record = {};
+        _exit(header_cache_preprocess_run(entry, &record) ? 0 : 1);
+    }
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return;
+    }
+
+    struct preprocessor_header_record record = {};
+    struct compile_process *process = header_cache_preprocess_run(entry, &record);
+    if (!process || record.uncacheable)
+    {
+        return;
+    }
+
+    struct preprocessor *preprocessor = process->preprocessor;
+    entry->definitions = vector_create(sizeof(struct preprocessor_definition *));
+    for (int i = 0; i < vector_count(preprocessor->definitions); i++)
+    {
+        struct preprocessor_definition *definition = vector_peek_ptr_at(preprocessor->definitions, i);
+        bool builtin = false;
+        for (int k = 0; k < vector_count(record.builtins) && !builtin; k++)
+        {
+            builtin = vector_peek_ptr_at(record.builtins, k) == definition;
+        }
+
+        if (!builtin)
+        {
+            vector_push(entry->definitions, &definition);
+        }
+    }
+
+    entry->files = vector_create(sizeof(struct header_cache_file));
+    for (int i = 0; i < vector_count(preprocessor->includes); i++)
+    {
+        struct preprocessor_included_file *included_file = vector_peek_ptr_at(preprocessor->includes, i);
+        struct header_cache_file file = {.path = strdup(included_file->filename), .mtime = header_cache_mtime(included_file->filename)};
+        vector_push(entry->files, &file);
+    }
+
+    entry->lookups = record.lookups;
+    entry->preprocessed = process->token_vec;
+}
+
+void header_cache_add(const char *include_name, const char *abs_path)
+{
+    char key[PATH_MAX * 2];
+    header_cache_lookup_key(key, sizeof(key), include_name);
+    struct header_cache_entry *lookup = header_cache_insert(header_cache.lookups, key);
+    time_t mtime = header_cache_mtime(abs_path);
+    if (!lookup->abs_path || !S_EQ(lookup->abs_path, abs_path) || lookup->mtime != mtime)
+    {
+        free(lookup->abs_path);
+        lookup->abs_path = strdup(abs_path);
+        lookup->mtime = mtime;
+    }
+
+    struct header_cache_entry *header = header_cache_insert(header_cache.headers, abs_path);
+    if (header->tokens && header->mtime == mtime)
+    {
+        return;
+    }
+
+    struct compile_process *process = compile_process_create(abs_path, NULL, 0, NULL);
+    if (!process)
+    {
+        return;
+    }
+
+    struct lex_process *lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+    if (!lex_process || lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        return;
+    }
+
+    header->abs_path = header->key;
+    header->tokens = lex_process_tokens(lex_process);
+    header->mtime = mtime;
+    header_cache_preprocess(header);
+}
+
+void header_cache_write_misses(FILE *fp)
+{
+    for (int i = 0; i < vector_count(header_cache.misses); i++)
+    {
+        fprintf(fp, "%s\n", (char *)vector_peek_ptr_at(header_cache.misses, i));
+    }
+    fflush(fp);
+}
+
+void header_cache_read_misses(FILE *fp)
+{
+    char line[PATH_MAX * 2];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = 0;
+        char *abs_path = strchr(line, '\t');
+        if (!abs_path)
+        {
+            continue;
+        }
+
+        *abs_path = 0;
+        abs_path++;
+        header_cache_add(line, abs_path);
+    }
+}
@@ -4,10 +4,10 @@
 size_t variable_size(struct node *var_node)
 {
     assert(var_node->type == NODE_TYPE_VARIABLE);
-    return datatype_size(&var_node->var.type);
+    return datatype_size(var_node->var.type);
 }
 
-struct datatype* datatype_thats_a_pointer(struct datatype* d1, struct datatype* d2)
+const struct datatype* datatype_thats_a_pointer(const struct datatype* d1, const struct datatype* d2)
 {
     if (d1->flags & DATATYPE_FLAG_IS_POINTER)
     {
@@ -32,7 +32,7 @@ bool is_logical_node(struct node* node)
     return node->type == NODE_TYPE_EXPRESSION && is_logical_operator(node->exp.op);
 }
 
-struct datatype* datatype_pointer_reduce(struct datatype* datatype, int by)
+struct datatype* datatype_pointer_reduce(const struct datatype* datatype, int by)
 {
     struct datatype* new_datatype = calloc(1, sizeof(struct datatype));
     memcpy(new_datatype, datatype, sizeof(struct datatype));
@@ -68,15 +68,15 @@ struct node *variable_struct_or_union_body_node(struct node *node)
         return NULL;
     }
 
-    if (node->var.type.type == DATA_TYPE_STRUCT)
+    if (node->var.type->type == DATA_TYPE_STRUCT)
     {
-        return node->var.type.struct_node->_struct.body_n;
+        return node->var.type->struct_node->_struct.body_n;
     }
 
     // return the union body.
-    if (node->var.type.type == DATA_TYPE_UNION)
+    if (node->var.type->type == DATA_TYPE_UNION)
     {
-        return node->var.type.union_node->_union.body_n;
+        return node->var.type->union_node->_union.body_n;
     }
     return NULL;
 }
@@ -132,7 +132,7 @@ int compute_sum_padding(struct vector *vec)
         }
 
         padding += cur_node->var.padding;
-        last_type = cur_node->var.type.type;
+        last_type = cur_node->var.type->type;
         last_node = cur_node;
         cur_node = vector_peek_ptr(vec);
     }
@@ -140,7 +140,7 @@ int compute_sum_padding(struct vector *vec)
     return padding;
 }
 
-int array_multiplier(struct datatype *dtype, int index, int index_value)
+int array_multiplier(const struct datatype *dtype, int index, int index_value)
 {
     if (!(dtype->flags & DATATYPE_FLAG_IS_ARRAY))
     {
@@ -162,7 +162,7 @@ int array_multiplier(struct datatype *dtype, int index, int index_value)
     return size_sum;
 }
 
-int array_offset(struct datatype *dtype, int index, int index_value)
+int array_offset(const struct datatype *dtype, int index, int index_value)
 {
     if (!(dtype->flags & DATATYPE_FLAG_IS_ARRAY) ||
         (index == vector_count(dtype->array.brackets->n_brackets) - 1))
@@ -194,55 +194,6 @@ struct node* variable_struct_or_union_largest_variable_node(struct node* var_nod
     return body_largest_variable_node(variable_struct_or_union_body_node(var_node));
 }
 
-int struct_offset(struct compile_process* compile_proc, const char* struct_name, const char* var_name, struct node** var_node_out, int last_pos, int flags)
-{
-    struct symbol* struct_sym = symresolver_get_symbol(compile_proc, struct_name);
-    assert(struct_sym && struct_sym->type == SYMBOL_TYPE_NODE);
-    struct node* node = struct_sym->data;
-    assert(node_is_struct_or_union(node));
-
-    struct vector* struct_vars_vec = node->_struct.body_n->body.statements;
-    vector_set_peek_pointer(struct_vars_vec, 0);
-    if (flags & STRUCT_ACCESS_BACKWARDS)
-    {
-        vector_set_peek_pointer_end(struct_vars_vec);
-        vector_set_flag(struct_vars_vec, VECTOR_FLAG_PEEK_DECREMENT);
-    }
-
-    struct node* var_node_cur = variable_node(vector_peek_ptr(struct_vars_vec));
-    struct node* var_node_last = NULL;
-    int position = last_pos;
-    *var_node_out = NULL;
-    while(var_node_cur)
-    {
-        *var_node_out = var_node_cur;
-        if (var_node_last)
-        {
-            position += variable_size(var_node_last);
-            if (variable_node_is_primitive(var_node_cur))
-            {
-                position = align_value_treat_positive(position, var_node_cur->var.type.size);
-            }
-            else
-            {
-                position = align_value_treat_positive(position, variable_struct_or_union_largest_variable_node(var_node_cur)->var.type.size);
-            }
-        }
-
-        // Have we found the variable? then we are done
-        if (S_EQ(var_node_cur->var.name, var_name))
-        {
-            break;
-        }
-
-        var_node_last = var_node_cur;
-        var_node_cur = variable_node(vector_peek_ptr(struct_vars_vec));
-    }
-
-    vector_unset_flag(struct_vars_vec, VECTOR_FLAG_PEEK_DECREMENT);
-    return position;
-}
-
 bool is_access_operator(const char* op)
 {
     return S_EQ(op, "->") || S_EQ(op, ".");
@@ -405,6 +356,22 @@ long arithmetic(struct compile_process* compiler, long left_operand, long right_
     {
         result = left_operand <= right_operand;
     }
+    else if(S_EQ(op, "%"))
+    {
+        result = left_operand % right_operand;
+    }
+    else if(S_EQ(op, "&"))
+    {
+        result = left_operand & right_operand;
+    }
+    else if(S_EQ(op, "|"))
+    {
+        result = left_operand | right_operand;
+    }
+    else if(S_EQ(op, "^"))
+    {
+        result = left_operand ^ right_operand;
+    }
     else if(S_EQ(op, "<<"))
     {
         result = left_operand << right_operand;
@@ -427,4 +394,96 @@ long arithmetic(struct compile_process* compiler, long left_operand, long right_
     }
 
     return result;
-}
\ No newline at end of file
+}
+/**
+ * Computes the multiplier and shift that replace a signed division by a constant divisor >= 2
+ * with a multiply high, see Hacker's Delight 10-1.
+ */
+void division_magic_signed(int divisor, int* multiplier, int* shift)
+{
+    const unsigned int two31 = 0x80000000u;
+    unsigned int ad = divisor;
+    unsigned int anc = two31 - 1 - two31 % ad;
+    unsigned int q1 = two31 / anc;
+    unsigned int r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / ad;
+    unsigned int r2 = two31 - q2 * ad;
+    unsigned int delta = 0;
+    int p = 31;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *multiplier = (int)(q2 + 1);
+    *shift = p - 32;
+}
+
+/**
+ * The unsigned counterpart, see Hacker's Delight 10-10. When add is set the multiplier needs 33 bits
+ * and the quotient is ((n - hi) >> 1) + hi) >> (shift - 1)
+ */
+void division_magic_unsigned(unsigned int divisor, unsigned int* multiplier, int* shift, bool* add)
+{
+    unsigned int d = divisor;
+    unsigned int nc = -1 - (-d) % d;
+    unsigned int q1 = 0x80000000u / nc;
+    unsigned int r1 = 0x80000000u - q1 * nc;
+    unsigned int q2 = 0x7FFFFFFFu / d;
+    unsigned int r2 = 0x7FFFFFFFu - q2 * d;
+    unsigned int delta = 0;
+    int p = 31;
+    *add = false;
+    do
+    {
+        p++;
+        if (r1 >= nc - r1)
+        {
+            q1 = 2 * q1 + 1;
+            r1 = 2 * r1 - nc;
+        }
+        else
+        {
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+        }
+
+        if (r2 + 1 >= d - r2)
+        {
+            if (q2 >= 0x7FFFFFFFu)
+            {
+                *add = true;
+            }
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - d;
+        }
+        else
+        {
+            if (q2 >= 0x80000000u)
+            {
+                *add = true;
+            }
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while (p < 64 && (q1 < delta || (q1 == delta && r1 == 0)));
+
+    *multiplier = q2 + 1;
+    *shift = p - 32;
+}
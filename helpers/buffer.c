@@ -54,6 +54,22 @@ void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...)
     va_end(args);
 }
 
+void buffer_vprintf(struct buffer* buffer, const char* fmt, va_list args)
+{
+    va_list args2;
+    va_copy(args2, args);
+    int available = buffer->msize - buffer->len;
+    int actual_len = vsnprintf(&buffer->data[buffer->len], available, fmt, args);
+    if (actual_len >= available)
+    {
+        // vsnprintf needs room for its terminator as well
+        buffer_need(buffer, actual_len + 1);
+        vsnprintf(&buffer->data[buffer->len], actual_len + 1, fmt, args2);
+    }
+    va_end(args2);
+    buffer->len += actual_len;
+}
+
 void buffer_write(struct buffer* buffer, char c)
 {
     buffer_need(buffer, sizeof(char));
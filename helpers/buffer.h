@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdarg.h>
 
 #define BUFFER_REALLOC_AMOUNT 2000
 struct buffer
@@ -22,6 +23,8 @@ char buffer_peek(struct buffer* buffer);
 void buffer_extend(struct buffer* buffer, size_t size);
 void buffer_printf(struct buffer* buffer, const char* fmt, ...);
 void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...);
+// Appends the formatted text without a terminator, growing the buffer only when needed.
+void buffer_vprintf(struct buffer* buffer, const char* fmt, va_list args);
 void buffer_write(struct buffer* buffer, char c);
 void* buffer_ptr(struct buffer* buffer);
 void buffer_free(struct buffer* buffer);
@@ -0,0 +1,1089 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Function inlining.
+ *
+ * Runs once the tree is validated and folded, constants are folded once more afterwards so that constant
+ * arguments fold into the inlined code. A function can be inlined when its body is straight line code, local declarations and
+ * expression statements with at most a return at the end, costs no more than INLINE_MAX_COST nodes, never
+ * names itself and never takes the address of one of its parameters. Only functions defined above the
+ * caller are inlined, everything they use is then already known at the call.
+ *
+ * A call that is a statement of its own, the value of an assignment, of a declaration or of a return is
+ * expanded in place. The parameters and locals of the callee become locals in the caller's stack frame
+ * declared just before the statement, and the call is replaced by the returned expression. A number or an
+ * unmodified local passed for an unmodified parameter is used directly instead. Calls anywhere else, i.e.
+ * inside a condition, are only inlined when the callee returns an expression without side effects and every
+ * argument is a number or a variable.
+ */
+
+struct inline_candidate
+{
+    struct node *function;
+
+    // The body is a single return of an expression without side effects
+    bool is_pure_return;
+};
+
+struct inline_binding
+{
+    const char *name;
+
+    // Cloned for every identifier with the name
+    struct node *replacement;
+};
+
+struct inline_process
+{
+    struct compile_process *compiler;
+
+    // Vector of struct inline_candidate, functions above the one being processed that can be inlined
+    struct vector *candidates;
+
+    // Vector of struct node*, all global variables
+    struct vector *globals;
+
+    // Inlined calls so far, keeps the names of the locals we create apart
+    int total_inlined;
+};
+
+struct inline_caller
+{
+    struct node *function;
+
+    // Vector of struct node*, parameters and locals of the function
+    struct vector *declarations;
+
+    // Vector of const char*, variables whose address is taken in the function
+    struct vector *address_taken;
+};
+
+static void inline_node(struct inline_process *process, struct inline_caller *caller, struct node *node);
+
+static bool inline_is_member_access(struct node *node)
+{
+    // The right operand names a field, not a variable
+    return node->type == NODE_TYPE_EXPRESSION && (S_EQ(node->exp.op, ".") || S_EQ(node->exp.op, "->"));
+}
+
+static bool inline_is_call(struct node *node)
+{
+    return node && node->type == NODE_TYPE_EXPRESSION && S_EQ(node->exp.op, "()") && node->exp.left->type == NODE_TYPE_IDENTIFIER;
+}
+
+static bool inline_is_assignment_operator(const char *op)
+{
+    size_t len = strlen(op);
+    return op[len - 1] == '=' && !S_EQ(op, "==") && !S_EQ(op, "!=") && !S_EQ(op, "<=") && !S_EQ(op, ">=");
+}
+
+static bool inline_is_increment(struct node *node)
+{
+    return node->type == NODE_TYPE_UNARY && (S_EQ(node->unary.op, "++") || S_EQ(node->unary.op, "--"));
+}
+
+static bool inline_is_plain_int(const struct datatype *dtype)
+{
+    return !(dtype->flags & (DATATYPE_FLAG_IS_POINTER | DATATYPE_FLAG_IS_ARRAY)) && dtype->flags & DATATYPE_FLAG_IS_SIGNED &&
+           (dtype->type == DATA_TYPE_INTEGER || dtype->type == DATA_TYPE_LONG);
+}
+
+// The datatype without storage qualifiers, so a static local and a parameter of the same type compare equal
+static const struct datatype *inline_unqualified_datatype(struct inline_process *process, const struct datatype *dtype)
+{
+    struct datatype unqualified = *dtype;
+    unqualified.flags &= ~(DATATYPE_FLAG_IS_STATIC | DATATYPE_FLAG_IS_EXTERN | DATATYPE_FLAG_IS_CONST | DATATYPE_FLAG_IS_RESTRICT);
+    return datatype_intern(process->compiler, &unqualified);
+}
+
+static bool inline_datatype_matches(struct inline_process *process, const struct datatype *a, const struct datatype *b)
+{
+    return a == b || inline_unqualified_datatype(process, a) == inline_unqualified_datatype(process, b);
+}
+
+// Variables we can move into the caller's stack frame or substitute, one dword at most
+static bool inline_variable_qualifies(struct node *var_node)
+{
+    const struct datatype *dtype = var_node->var.type;
+    return !(dtype->flags & (DATATYPE_FLAG_IS_ARRAY | DATATYPE_FLAG_IS_STATIC)) && !datatype_is_struct_or_union_non_pointer(dtype) &&
+           (dtype->type != DATA_TYPE_VOID || dtype->flags & DATATYPE_FLAG_IS_POINTER) && datatype_size(dtype) <= DATA_SIZE_DWORD;
+}
+
+static struct node *inline_find_variable(struct vector *variables, const char *name, int *total_out)
+{
+    struct node *found = NULL;
+    *total_out = 0;
+    for (int i = 0; i < vector_count(variables); i++)
+    {
+        struct node *var_node = *(struct node **)vector_at(variables, i);
+        if (var_node->var.name && S_EQ(var_node->var.name, name))
+        {
+            found = var_node;
+            (*total_out)++;
+        }
+    }
+    return found;
+}
+
+static bool inline_caller_declares(struct inline_caller *caller, const char *name)
+{
+    int total = 0;
+    inline_find_variable(caller->declarations, name, &total);
+    return total > 0;
+}
+
+static bool inline_caller_takes_address(struct inline_caller *caller, const char *name)
+{
+    for (int i = 0; i < vector_count(caller->address_taken); i++)
+    {
+        if (S_EQ(*(const char **)vector_at(caller->address_taken, i), name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void inline_collect_variables(struct vector *variables, struct node *node)
+{
+    if (node->type == NODE_TYPE_VARIABLE)
+    {
+        vector_push(variables, &node);
+    }
+    else if (node->type == NODE_TYPE_VARIABLE_LIST)
+    {
+        for (int i = 0; i < vector_count(node->var_list.list); i++)
+        {
+            vector_push(variables, vector_at(node->var_list.list, i));
+        }
+    }
+}
+
+/**
+ * Records every local and every variable whose address is taken in the function.
+ */
+static void inline_collect_caller(struct inline_caller *caller, struct node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        inline_collect_caller(caller, node->exp.left);
+        if (!inline_is_member_access(node))
+        {
+            inline_collect_caller(caller, node->exp.right);
+        }
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        inline_collect_caller(caller, node->parenthesis.exp);
+        break;
+
+    case NODE_TYPE_UNARY:
+        if (S_EQ(node->unary.op, "&") && node->unary.operand->type == NODE_TYPE_IDENTIFIER)
+        {
+            vector_push(caller->address_taken, &node->unary.operand->sval);
+        }
+        inline_collect_caller(caller, node->unary.operand);
+        break;
+
+    case NODE_TYPE_TENARY:
+        inline_collect_caller(caller, node->tenary.true_node);
+        inline_collect_caller(caller, node->tenary.false_node);
+        break;
+
+    case NODE_TYPE_CAST:
+        inline_collect_caller(caller, node->cast.operand);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        inline_collect_caller(caller, node->bracket.inner);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        vector_push(caller->declarations, &node);
+        inline_collect_caller(caller, node->var.val);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        for (int i = 0; i < vector_count(node->var_list.list); i++)
+        {
+            inline_collect_caller(caller, *(struct node **)vector_at(node->var_list.list, i));
+        }
+        break;
+
+    case NODE_TYPE_BODY:
+        for (int i = 0; i < vector_count(node->body.statements); i++)
+        {
+            inline_collect_caller(caller, *(struct node **)vector_at(node->body.statements, i));
+        }
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        inline_collect_caller(caller, node->stmt.return_stmt.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        inline_collect_caller(caller, node->stmt.if_stmt.cond_node);
+        inline_collect_caller(caller, node->stmt.if_stmt.body_node);
+        inline_collect_caller(caller, node->stmt.if_stmt.next);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        inline_collect_caller(caller, node->stmt.else_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        inline_collect_caller(caller, node->stmt.while_stmt.exp_node);
+        inline_collect_caller(caller, node->stmt.while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        inline_collect_caller(caller, node->stmt.do_while_stmt.exp_node);
+        inline_collect_caller(caller, node->stmt.do_while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        inline_collect_caller(caller, node->stmt.for_stmt.init_node);
+        inline_collect_caller(caller, node->stmt.for_stmt.cond_node);
+        inline_collect_caller(caller, node->stmt.for_stmt.loop_node);
+        inline_collect_caller(caller, node->stmt.for_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        inline_collect_caller(caller, node->stmt.switch_stmt.exp);
+        inline_collect_caller(caller, node->stmt.switch_stmt.body);
+        break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+        inline_collect_caller(caller, node->stmt._case.exp);
+        break;
+    }
+}
+
+static bool inline_has_side_effects(struct node *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        if (S_EQ(node->exp.op, "()") || inline_is_assignment_operator(node->exp.op))
+        {
+            return true;
+        }
+        return inline_has_side_effects(node->exp.left) || (!inline_is_member_access(node) && inline_has_side_effects(node->exp.right));
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        return inline_has_side_effects(node->parenthesis.exp);
+
+    case NODE_TYPE_UNARY:
+        return inline_is_increment(node) || inline_has_side_effects(node->unary.operand);
+
+    case NODE_TYPE_TENARY:
+        return inline_has_side_effects(node->tenary.true_node) || inline_has_side_effects(node->tenary.false_node);
+
+    case NODE_TYPE_CAST:
+        return inline_has_side_effects(node->cast.operand);
+
+    case NODE_TYPE_BRACKET:
+        return inline_has_side_effects(node->bracket.inner);
+
+    case NODE_TYPE_VARIABLE:
+        return inline_has_side_effects(node->var.val);
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        return inline_has_side_effects(node->stmt.return_stmt.exp);
+    }
+    return false;
+}
+
+// Assigns to or increments the variable called name
+static bool inline_modifies(struct node *node, const char *name)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        if (inline_is_assignment_operator(node->exp.op) && node->exp.left->type == NODE_TYPE_IDENTIFIER && S_EQ(node->exp.left->sval, name))
+        {
+            return true;
+        }
+        return inline_modifies(node->exp.left, name) || (!inline_is_member_access(node) && inline_modifies(node->exp.right, name));
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        return inline_modifies(node->parenthesis.exp, name);
+
+    case NODE_TYPE_UNARY:
+        if (inline_is_increment(node) && node->unary.operand->type == NODE_TYPE_IDENTIFIER && S_EQ(node->unary.operand->sval, name))
+        {
+            return true;
+        }
+        return inline_modifies(node->unary.operand, name);
+
+    case NODE_TYPE_TENARY:
+        return inline_modifies(node->tenary.true_node, name) || inline_modifies(node->tenary.false_node, name);
+
+    case NODE_TYPE_CAST:
+        return inline_modifies(node->cast.operand, name);
+
+    case NODE_TYPE_BRACKET:
+        return inline_modifies(node->bracket.inner, name);
+
+    case NODE_TYPE_VARIABLE:
+        return inline_modifies(node->var.val, name);
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        return inline_modifies(node->stmt.return_stmt.exp, name);
+
+    case NODE_TYPE_BODY:
+        for (int i = 0; i < vector_count(node->body.statements); i++)
+        {
+            if (inline_modifies(*(struct node **)vector_at(node->body.statements, i), name))
+            {
+                return true;
+            }
+        }
+        break;
+    }
+    return false;
+}
+
+static int inline_parameter_count(struct node *function)
+{
+    struct vector *params = function->func.args.vector;
+    if (vector_count(params) == 1)
+    {
+        // f(void)
+        struct node *param = *(struct node **)vector_at(params, 0);
+        if (param->var.type->type == DATA_TYPE_VOID && !(param->var.type->flags & DATATYPE_FLAG_IS_POINTER))
+        {
+            return 0;
+        }
+    }
+    return vector_count(params);
+}
+
+static bool inline_is_parameter(struct node *function, const char *name)
+{
+    int total = 0;
+    inline_find_variable(function->func.args.vector, name, &total);
+    return total > 0;
+}
+
+/**
+ * Checks one expression of a function we might inline and adds its size to the cost.
+ */
+static bool inline_expression_qualifies(struct inline_process *process, struct node *function, struct node *node, int *cost)
+{
+    if (!node)
+    {
+        return true;
+    }
+
+    (*cost)++;
+    switch (node->type)
+    {
+    case NODE_TYPE_NUMBER:
+    case NODE_TYPE_STRING:
+        return true;
+
+    case NODE_TYPE_IDENTIFIER:
+        return !S_EQ(node->sval, function->func.name);
+
+    case NODE_TYPE_EXPRESSION:
+        if (inline_is_member_access(node))
+        {
+            return inline_expression_qualifies(process, function, node->exp.left, cost);
+        }
+
+        if (inline_is_call(node) && symresolver_get_symbol_for_native_function(process->compiler, node->exp.left->sval))
+        {
+            // Native functions generate code against the caller's arguments
+            return false;
+        }
+        return inline_expression_qualifies(process, function, node->exp.left, cost) && inline_expression_qualifies(process, function, node->exp.right, cost);
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        return inline_expression_qualifies(process, function, node->parenthesis.exp, cost);
+
+    case NODE_TYPE_UNARY:
+        if (S_EQ(node->unary.op, "&") && node->unary.operand->type == NODE_TYPE_IDENTIFIER && inline_is_parameter(function, node->unary.operand->sval))
+        {
+            return false;
+        }
+        return inline_expression_qualifies(process, function, node->unary.operand, cost);
+
+    case NODE_TYPE_TENARY:
+        return inline_expression_qualifies(process, function, node->tenary.true_node, cost) && inline_expression_qualifies(process, function, node->tenary.false_node, cost);
+
+    case NODE_TYPE_CAST:
+        return inline_expression_qualifies(process, function, node->cast.operand, cost);
+
+    case NODE_TYPE_BRACKET:
+        return inline_expression_qualifies(process, function, node->bracket.inner, cost);
+    }
+    return false;
+}
+
+static bool inline_function_qualifies(struct inline_process *process, struct node *function, bool *is_pure_return)
+{
+    // va_start needs the arguments where the caller put them
+    if (function->func.flags & (FUNCTION_NODE_FLAG_IS_NATIVE | FUNCTION_NODE_FLAG_IS_VARIADIC) || datatype_is_struct_or_union_non_pointer(function->func.rtype))
+    {
+        return false;
+    }
+
+    int total_params = inline_parameter_count(function);
+    for (int i = 0; i < total_params; i++)
+    {
+        if (!inline_variable_qualifies(*(struct node **)vector_at(function->func.args.vector, i)))
+        {
+            return false;
+        }
+    }
+
+    int cost = 0;
+    struct vector *statements = function->func.body_n->body.statements;
+    for (int i = 0; i < vector_count(statements); i++)
+    {
+        struct node *statement = *(struct node **)vector_at(statements, i);
+        switch (statement->type)
+        {
+        case NODE_TYPE_VARIABLE:
+            if (!inline_variable_qualifies(statement) || !inline_expression_qualifies(process, function, statement->var.val, &cost))
+            {
+                return false;
+            }
+            break;
+
+        case NODE_TYPE_EXPRESSION:
+        case NODE_TYPE_UNARY:
+            if (!inline_expression_qualifies(process, function, statement, &cost))
+            {
+                return false;
+            }
+            break;
+
+        case NODE_TYPE_STATEMENT_RETURN:
+            if (i != vector_count(statements) - 1 || !inline_expression_qualifies(process, function, statement->stmt.return_stmt.exp, &cost))
+            {
+                return false;
+            }
+
+            // A pointer returned from a call may be a void pointer we cannot cast back
+            if (function->func.rtype->flags & DATATYPE_FLAG_IS_POINTER && inline_is_call(statement->stmt.return_stmt.exp))
+            {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    if (cost > INLINE_MAX_COST)
+    {
+        return false;
+    }
+
+    struct node *last = vector_count(statements) == 1 ? *(struct node **)vector_at(statements, 0) : NULL;
+    *is_pure_return = last && last->type == NODE_TYPE_STATEMENT_RETURN && last->stmt.return_stmt.exp && !inline_has_side_effects(last->stmt.return_stmt.exp);
+    return true;
+}
+
+static bool inline_callee_declares(struct node *callee, const char *name)
+{
+    if (inline_is_parameter(callee, name))
+    {
+        return true;
+    }
+
+    int total = 0;
+    struct vector *variables = vector_create(sizeof(struct node *));
+    struct vector *statements = callee->func.body_n->body.statements;
+    for (int i = 0; i < vector_count(statements); i++)
+    {
+        inline_collect_variables(variables, *(struct node **)vector_at(statements, i));
+    }
+    inline_find_variable(variables, name, &total);
+    vector_free(variables);
+    return total > 0;
+}
+
+/**
+ * A global or function named by the callee would be hidden by a local of the caller with the same name.
+ */
+static bool inline_names_hidden(struct inline_caller *caller, struct node *callee, struct node *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+        return inline_caller_declares(caller, node->sval) && !inline_callee_declares(callee, node->sval);
+
+    case NODE_TYPE_EXPRESSION:
+        return inline_names_hidden(caller, callee, node->exp.left) || (!inline_is_member_access(node) && inline_names_hidden(caller, callee, node->exp.right));
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        return inline_names_hidden(caller, callee, node->parenthesis.exp);
+
+    case NODE_TYPE_UNARY:
+        return inline_names_hidden(caller, callee, node->unary.operand);
+
+    case NODE_TYPE_TENARY:
+        return inline_names_hidden(caller, callee, node->tenary.true_node) || inline_names_hidden(caller, callee, node->tenary.false_node);
+
+    case NODE_TYPE_CAST:
+        return inline_names_hidden(caller, callee, node->cast.operand);
+
+    case NODE_TYPE_BRACKET:
+        return inline_names_hidden(caller, callee, node->bracket.inner);
+
+    case NODE_TYPE_VARIABLE:
+        return inline_names_hidden(caller, callee, node->var.val);
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        return inline_names_hidden(caller, callee, node->stmt.return_stmt.exp);
+
+    case NODE_TYPE_BODY:
+        for (int i = 0; i < vector_count(node->body.statements); i++)
+        {
+            if (inline_names_hidden(caller, callee, *(struct node **)vector_at(node->body.statements, i)))
+            {
+                return true;
+            }
+        }
+        break;
+    }
+    return false;
+}
+
+static void inline_call_arguments(struct node *node, struct vector *arguments)
+{
+    if (!node_valid(node))
+    {
+        return;
+    }
+
+    if (node->type == NODE_TYPE_EXPRESSION && S_EQ(node->exp.op, ","))
+    {
+        inline_call_arguments(node->exp.left, arguments);
+        inline_call_arguments(node->exp.right, arguments);
+        return;
+    }
+
+    if (node->type == NODE_TYPE_EXPRESSION_PARENTHESES)
+    {
+        inline_call_arguments(node->parenthesis.exp, arguments);
+        return;
+    }
+
+    vector_push(arguments, &node);
+}
+
+static struct inline_candidate *inline_candidate_for_call(struct inline_process *process, struct inline_caller *caller, struct node *call, struct vector *arguments)
+{
+    if (!inline_is_call(call) || inline_caller_declares(caller, call->exp.left->sval))
+    {
+        return NULL;
+    }
+
+    struct inline_candidate *candidate = NULL;
+    for (int i = vector_count(process->candidates) - 1; i >= 0 && !candidate; i--)
+    {
+        struct inline_candidate *current = vector_at(process->candidates, i);
+        if (S_EQ(current->function->func.name, call->exp.left->sval))
+        {
+            candidate = current;
+        }
+    }
+
+    if (!candidate)
+    {
+        return NULL;
+    }
+
+    inline_call_arguments(call->exp.right, arguments);
+    if (vector_count(arguments) != inline_parameter_count(candidate->function) ||
+        inline_names_hidden(caller, candidate->function, candidate->function->func.body_n))
+    {
+        return NULL;
+    }
+
+    return candidate;
+}
+
+static struct node *inline_node_copy(struct node *node)
+{
+    struct node *copy = malloc(sizeof(struct node));
+    *copy = *node;
+    return copy;
+}
+
+static struct node *inline_cast(struct inline_process *process, const struct datatype *dtype, struct node *operand)
+{
+    struct datatype cast_dtype = *dtype;
+    cast_dtype.flags &= ~(DATATYPE_FLAG_IS_STATIC | DATATYPE_FLAG_IS_EXTERN);
+    struct node *cast_node = inline_node_copy(operand);
+    cast_node->type = NODE_TYPE_CAST;
+    cast_node->cast.dtype = datatype_intern(process->compiler, &cast_dtype);
+    cast_node->cast.operand = operand;
+    return cast_node;
+}
+
+/**
+ * Returns what can stand in for the parameter wherever the callee uses it, NULL when the argument
+ * has to be evaluated into a local first.
+ */
+static struct node *inline_substitute_argument(struct inline_process *process, struct inline_caller *caller, struct node *argument, struct node *param, bool locals_only)
+{
+    const struct datatype *param_dtype = param->var.type;
+    if (argument->type == NODE_TYPE_NUMBER)
+    {
+        if (param_dtype->flags & DATATYPE_FLAG_IS_POINTER)
+        {
+            return NULL;
+        }
+        return inline_is_plain_int(param_dtype) ? argument : inline_cast(process, param_dtype, argument);
+    }
+
+    if (argument->type != NODE_TYPE_IDENTIFIER)
+    {
+        return NULL;
+    }
+
+    int total = 0;
+    struct node *var_node = inline_find_variable(caller->declarations, argument->sval, &total);
+    if (total == 0 && !locals_only)
+    {
+        var_node = inline_find_variable(process->globals, argument->sval, &total);
+    }
+
+    if (total != 1 || inline_caller_takes_address(caller, argument->sval) || !inline_variable_qualifies(var_node) ||
+        !inline_datatype_matches(process, var_node->var.type, param_dtype))
+    {
+        return NULL;
+    }
+
+    return argument;
+}
+
+static struct node *inline_clone(struct node *node, struct vector *bindings)
+{
+    if (!node)
+    {
+        return NULL;
+    }
+
+    if (node->type == NODE_TYPE_IDENTIFIER && bindings)
+    {
+        for (int i = 0; i < vector_count(bindings); i++)
+        {
+            struct inline_binding *binding = vector_at(bindings, i);
+            if (S_EQ(binding->name, node->sval))
+            {
+                return inline_clone(binding->replacement, NULL);
+            }
+        }
+    }
+
+    struct node *copy = inline_node_copy(node);
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        copy->exp.left = inline_clone(node->exp.left, bindings);
+        copy->exp.right = inline_clone(node->exp.right, inline_is_member_access(node) ? NULL : bindings);
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        copy->parenthesis.exp = inline_clone(node->parenthesis.exp, bindings);
+        break;
+
+    case NODE_TYPE_UNARY:
+        copy->unary.operand = inline_clone(node->unary.operand, bindings);
+        break;
+
+    case NODE_TYPE_TENARY:
+        copy->tenary.true_node = inline_clone(node->tenary.true_node, bindings);
+        copy->tenary.false_node = inline_clone(node->tenary.false_node, bindings);
+        break;
+
+    case NODE_TYPE_CAST:
+        copy->cast.operand = inline_clone(node->cast.operand, bindings);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        copy->bracket.inner = inline_clone(node->bracket.inner, bindings);
+        break;
+    }
+    return copy;
+}
+
+static void inline_bind(struct vector *bindings, const char *name, struct node *replacement)
+{
+    vector_push(bindings, &(struct inline_binding){.name = name, .replacement = replacement});
+}
+
+// The callee's value converted to its return type as the return statement would
+static struct node *inline_returned_value(struct inline_process *process, struct node *callee, struct node *value)
+{
+    const struct datatype *rtype = callee->func.rtype;
+    if (rtype->flags & DATATYPE_FLAG_IS_POINTER || inline_is_plain_int(rtype))
+    {
+        return value;
+    }
+    return inline_cast(process, rtype, value);
+}
+
+/**
+ * Declares a new local in the caller's stack frame shaped like the given parameter or local of the callee.
+ */
+static struct node *inline_new_local(struct inline_process *process, struct inline_caller *caller, struct node *body, struct node *var_template, struct node *value)
+{
+    char name[256];
+    snprintf(name, sizeof(name), "__inline%i_%s", process->total_inlined, var_template->var.name);
+
+    struct node *function = caller->function;
+    function->func.stack_size = align_value(function->func.stack_size, DATA_SIZE_DWORD) + DATA_SIZE_DWORD;
+
+    struct node *var_node = inline_node_copy(var_template);
+    var_node->var.name = strdup(name);
+    var_node->var.val = value;
+    var_node->var.padding = 0;
+    var_node->var.aoffset = -(int)function->func.stack_size;
+    var_node->binded.owner = body;
+    var_node->binded.function = function;
+    vector_push(caller->declarations, &var_node);
+    return var_node;
+}
+
+static struct node *inline_identifier(struct node *var_node)
+{
+    struct node *identifier = inline_node_copy(var_node);
+    identifier->type = NODE_TYPE_IDENTIFIER;
+    identifier->sval = var_node->var.name;
+    return identifier;
+}
+
+/**
+ * Expands a call that is a statement of its own or whose value is assigned, declared or returned. The
+ * callee's statements are pushed to the caller's statements, its returned value to value_out.
+ */
+static bool inline_expand(struct inline_process *process, struct inline_caller *caller, struct node *body, struct vector *statements, struct node *call, struct node **value_out)
+{
+    struct vector *arguments = vector_create(sizeof(struct node *));
+    struct inline_candidate *candidate = inline_candidate_for_call(process, caller, call, arguments);
+    struct node *callee = candidate ? candidate->function : NULL;
+    struct vector *callee_statements = callee ? callee->func.body_n->body.statements : NULL;
+    struct node *last = callee && vector_count(callee_statements) > 0 ? vector_back_ptr(callee_statements) : NULL;
+    struct node *returned = last && last->type == NODE_TYPE_STATEMENT_RETURN ? last->stmt.return_stmt.exp : NULL;
+    if (!callee || (value_out && !returned) || (!value_out && inline_has_side_effects(returned)))
+    {
+        vector_free(arguments);
+        return false;
+    }
+
+    process->total_inlined++;
+    struct vector *bindings = vector_create(sizeof(struct inline_binding));
+    for (int i = 0; i < vector_count(arguments); i++)
+    {
+        struct node *param = *(struct node **)vector_at(callee->func.args.vector, i);
+        struct node *argument = *(struct node **)vector_at(arguments, i);
+        struct node *replacement = NULL;
+        if (!inline_modifies(callee->func.body_n, param->var.name))
+        {
+            replacement = inline_substitute_argument(process, caller, argument, param, true);
+        }
+
+        if (!replacement)
+        {
+            struct node *local = inline_new_local(process, caller, body, param, argument);
+            vector_push(statements, &local);
+            replacement = inline_identifier(local);
+        }
+        inline_bind(bindings, param->var.name, replacement);
+    }
+
+    for (int i = 0; i < vector_count(callee_statements); i++)
+    {
+        struct node *statement = *(struct node **)vector_at(callee_statements, i);
+        if (statement->type == NODE_TYPE_STATEMENT_RETURN)
+        {
+            break;
+        }
+
+        if (statement->type == NODE_TYPE_VARIABLE)
+        {
+            struct node *local = inline_new_local(process, caller, body, statement, inline_clone(statement->var.val, bindings));
+            vector_push(statements, &local);
+            inline_bind(bindings, statement->var.name, inline_identifier(local));
+            continue;
+        }
+
+        struct node *clone = inline_clone(statement, bindings);
+        vector_push(statements, &clone);
+    }
+
+    if (value_out)
+    {
+        *value_out = inline_returned_value(process, callee, inline_clone(returned, bindings));
+    }
+
+    vector_free(bindings);
+    vector_free(arguments);
+    return true;
+}
+
+/**
+ * Replaces a call to a function that returns an expression without side effects with that expression.
+ */
+static void inline_call_in_place(struct inline_process *process, struct inline_caller *caller, struct node *call)
+{
+    struct vector *arguments = vector_create(sizeof(struct node *));
+    struct inline_candidate *candidate = inline_candidate_for_call(process, caller, call, arguments);
+    if (!candidate || !candidate->is_pure_return)
+    {
+        vector_free(arguments);
+        return;
+    }
+
+    struct node *callee = candidate->function;
+    struct vector *bindings = vector_create(sizeof(struct inline_binding));
+    bool substituted = true;
+    for (int i = 0; i < vector_count(arguments) && substituted; i++)
+    {
+        struct node *param = *(struct node **)vector_at(callee->func.args.vector, i);
+        struct node *replacement = inline_substitute_argument(process, caller, *(struct node **)vector_at(arguments, i), param, false);
+        substituted = replacement != NULL;
+        if (substituted)
+        {
+            inline_bind(bindings, param->var.name, replacement);
+        }
+    }
+
+    if (substituted)
+    {
+        struct node *returned = ((struct node *)vector_back_ptr(callee->func.body_n->body.statements))->stmt.return_stmt.exp;
+        struct node *value = inline_returned_value(process, callee, inline_clone(returned, bindings));
+        value->binded = call->binded;
+        value->flags = call->flags;
+        *call = *value;
+        process->total_inlined++;
+    }
+
+    vector_free(bindings);
+    vector_free(arguments);
+}
+
+// Where a statement keeps the call we can expand in place of the statement
+static struct node **inline_statement_call(struct node *statement)
+{
+    struct node **call = NULL;
+    switch (statement->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        call = inline_is_assignment_operator(statement->exp.op) ? &statement->exp.right : NULL;
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        call = &statement->var.val;
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        call = &statement->stmt.return_stmt.exp;
+        break;
+    }
+
+    return call && inline_is_call(*call) ? call : NULL;
+}
+
+static void inline_body(struct inline_process *process, struct inline_caller *caller, struct node *body)
+{
+    struct vector *statements = body->body.statements;
+    struct vector *expanded = vector_create(sizeof(struct node *));
+    bool changed = false;
+    for (int i = 0; i < vector_count(statements); i++)
+    {
+        struct node *statement = *(struct node **)vector_at(statements, i);
+        int start = vector_count(expanded);
+        struct node **call = inline_statement_call(statement);
+        if (inline_is_call(statement) && inline_expand(process, caller, body, expanded, statement, NULL))
+        {
+            changed = true;
+        }
+        else
+        {
+            changed |= call && inline_expand(process, caller, body, expanded, *call, call);
+            vector_push(expanded, &statement);
+        }
+
+        for (int j = start; j < vector_count(expanded); j++)
+        {
+            inline_node(process, caller, *(struct node **)vector_at(expanded, j));
+        }
+    }
+
+    if (changed)
+    {
+        body->body.statements = expanded;
+        vector_free(statements);
+        return;
+    }
+
+    vector_free(expanded);
+}
+
+static void inline_node(struct inline_process *process, struct inline_caller *caller, struct node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        inline_node(process, caller, node->exp.left);
+        if (!inline_is_member_access(node))
+        {
+            inline_node(process, caller, node->exp.right);
+        }
+
+        if (inline_is_call(node))
+        {
+            inline_call_in_place(process, caller, node);
+        }
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        inline_node(process, caller, node->parenthesis.exp);
+        break;
+
+    case NODE_TYPE_UNARY:
+        inline_node(process, caller, node->unary.operand);
+        break;
+
+    case NODE_TYPE_TENARY:
+        inline_node(process, caller, node->tenary.true_node);
+        inline_node(process, caller, node->tenary.false_node);
+        break;
+
+    case NODE_TYPE_CAST:
+        inline_node(process, caller, node->cast.operand);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        inline_node(process, caller, node->bracket.inner);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        inline_node(process, caller, node->var.val);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        for (int i = 0; i < vector_count(node->var_list.list); i++)
+        {
+            inline_node(process, caller, *(struct node **)vector_at(node->var_list.list, i));
+        }
+        break;
+
+    case NODE_TYPE_BODY:
+        inline_body(process, caller, node);
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        inline_node(process, caller, node->stmt.return_stmt.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        inline_node(process, caller, node->stmt.if_stmt.cond_node);
+        inline_node(process, caller, node->stmt.if_stmt.body_node);
+        inline_node(process, caller, node->stmt.if_stmt.next);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        inline_node(process, caller, node->stmt.else_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        inline_node(process, caller, node->stmt.while_stmt.exp_node);
+        inline_node(process, caller, node->stmt.while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        inline_node(process, caller, node->stmt.do_while_stmt.exp_node);
+        inline_node(process, caller, node->stmt.do_while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        inline_node(process, caller, node->stmt.for_stmt.init_node);
+        inline_node(process, caller, node->stmt.for_stmt.cond_node);
+        inline_node(process, caller, node->stmt.for_stmt.loop_node);
+        inline_node(process, caller, node->stmt.for_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        inline_node(process, caller, node->stmt.switch_stmt.exp);
+        inline_node(process, caller, node->stmt.switch_stmt.body);
+        break;
+    }
+}
+
+void inline_functions(struct compile_process *compiler)
+{
+    struct inline_process process = {.compiler = compiler, .candidates = vector_create(sizeof(struct inline_candidate)), .globals = vector_create(sizeof(struct node *))};
+    struct vector *tree = compiler->node_tree_vec;
+    for (int i = 0; i < vector_count(tree); i++)
+    {
+        inline_collect_variables(process.globals, *(struct node **)vector_at(tree, i));
+    }
+
+    for (int i = 0; i < vector_count(tree); i++)
+    {
+        struct node *function = *(struct node **)vector_at(tree, i);
+        if (function->type != NODE_TYPE_FUNCTION || function_node_is_prototype(function))
+        {
+            continue;
+        }
+
+        struct inline_caller caller = {.function = function, .declarations = vector_create(sizeof(struct node *)), .address_taken = vector_create(sizeof(const char *))};
+        for (int j = 0; j < vector_count(function->func.args.vector); j++)
+        {
+            inline_collect_caller(&caller, *(struct node **)vector_at(function->func.args.vector, j));
+        }
+        inline_collect_caller(&caller, function->func.body_n);
+        inline_node(&process, &caller, function->func.body_n);
+        vector_free(caller.declarations);
+        vector_free(caller.address_taken);
+
+        struct inline_candidate candidate = {.function = function};
+        if (inline_function_qualifies(&process, function, &candidate.is_pure_return))
+        {
+            vector_push(process.candidates, &candidate);
+        }
+    }
+
+    vector_free(process.candidates);
+    vector_free(process.globals);
+}
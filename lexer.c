@@ -15,8 +15,8 @@
 struct token *read_next_token();
 bool lex_is_in_expression();
 
-static struct lex_process *lex_process;
-static struct token tmp_token;
+static COMPILER_THREAD_LOCAL struct lex_process *lex_process;
+static COMPILER_THREAD_LOCAL struct token tmp_token;
 
 char lex_get_escaped_char(char c);
 
@@ -0,0 +1,335 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <memory.h>
+#include <assert.h>
+
+/**
+ * Which registers IR instructions read and write, and which registers are live between them.
+ */
+
+struct liveness_block
+{
+    int start;
+    int end;
+    int use;
+    int def;
+    int live_in;
+    int live_out;
+    int successors[2];
+    int total_successors;
+
+    // Control leaves to somewhere we can not see, everything is live
+    bool unknown_successor;
+
+    // Jumps through a table, it can land on any label of the function
+    bool indirect_successor;
+};
+
+struct liveness_label
+{
+    const char *name;
+    int block;
+};
+
+static void liveness_operand_effects(struct asm_ir_operand *operand, bool read, bool write, struct asm_ir_effects *effects)
+{
+    int id = -1;
+    switch (operand->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+        id = asm_ir_register_id(operand->reg);
+        // Writing al or ax keeps the rest of the register
+        if (read || asm_ir_register_size(operand->reg) < DATA_SIZE_DWORD)
+        {
+            effects->reads |= ASM_IR_REG_MASK(id);
+        }
+
+        if (write)
+        {
+            effects->writes |= ASM_IR_REG_MASK(id);
+        }
+        effects->stack_barrier |= id == ASM_IR_REG_ESP;
+        break;
+
+    case ASM_IR_OPERAND_MEMORY:
+        id = asm_ir_register_id(operand->mem.base);
+        if (id != -1)
+        {
+            effects->reads |= ASM_IR_REG_MASK(id);
+            effects->stack_barrier |= id == ASM_IR_REG_ESP;
+        }
+
+        id = asm_ir_register_id(operand->mem.index);
+        if (id != -1)
+        {
+            effects->reads |= ASM_IR_REG_MASK(id);
+            effects->stack_barrier |= id == ASM_IR_REG_ESP;
+        }
+        break;
+    }
+}
+
+void asm_ir_instruction_effects(struct asm_ir_instruction *ins, struct asm_ir_effects *effects)
+{
+    memset(effects, 0, sizeof(struct asm_ir_effects));
+    if (ins->flags & ASM_IR_INSTRUCTION_FLAG_DELETED)
+    {
+        return;
+    }
+
+    bool dst_read = true;
+    bool dst_write = false;
+    switch (ins->op)
+    {
+    case ASM_OP_DIRECTIVE:
+    case ASM_OP_LABEL:
+    case ASM_OP_COMMENT:
+    case ASM_OP_NOP:
+    case ASM_OP_ALIGN:
+        return;
+
+    case ASM_OP_MOV:
+    case ASM_OP_MOVZX:
+    case ASM_OP_MOVSX:
+    case ASM_OP_MOVSXD:
+    case ASM_OP_LEA:
+    case ASM_OP_POP:
+    case ASM_OP_SETE:
+    case ASM_OP_SETNE:
+    case ASM_OP_SETG:
+    case ASM_OP_SETGE:
+    case ASM_OP_SETL:
+    case ASM_OP_SETLE:
+    case ASM_OP_SETA:
+    case ASM_OP_SETAE:
+    case ASM_OP_SETB:
+    case ASM_OP_SETBE:
+        dst_read = false;
+        dst_write = true;
+        break;
+
+    case ASM_OP_IMUL:
+        if (ins->total_operands == 2)
+        {
+            dst_write = true;
+            break;
+        }
+
+        // One operand imul multiplies eax by its operand into edx:eax
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EAX);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_EAX) | ASM_IR_REG_MASK(ASM_IR_REG_EDX);
+        break;
+
+    case ASM_OP_MUL:
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EAX);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_EAX) | ASM_IR_REG_MASK(ASM_IR_REG_EDX);
+        break;
+
+    case ASM_OP_IDIV:
+    case ASM_OP_DIV:
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EAX) | ASM_IR_REG_MASK(ASM_IR_REG_EDX);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_EAX) | ASM_IR_REG_MASK(ASM_IR_REG_EDX);
+        break;
+
+    case ASM_OP_CDQ:
+    case ASM_OP_CQO:
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EAX);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_EDX);
+        break;
+
+    case ASM_OP_ADD:
+    case ASM_OP_SUB:
+    case ASM_OP_INC:
+    case ASM_OP_DEC:
+    case ASM_OP_NEG:
+    case ASM_OP_NOT:
+    case ASM_OP_AND:
+    case ASM_OP_OR:
+    case ASM_OP_XOR:
+    case ASM_OP_SAL:
+    case ASM_OP_SHL:
+    case ASM_OP_SAR:
+    case ASM_OP_SHR:
+        dst_write = true;
+        break;
+
+    case ASM_OP_PUSH:
+    case ASM_OP_CMP:
+    case ASM_OP_TEST:
+        break;
+
+    case ASM_OP_REP_MOVSD:
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_ECX) | ASM_IR_REG_MASK(ASM_IR_REG_ESI) | ASM_IR_REG_MASK(ASM_IR_REG_EDI);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_ECX) | ASM_IR_REG_MASK(ASM_IR_REG_ESI) | ASM_IR_REG_MASK(ASM_IR_REG_EDI);
+        // Copies to or from the stack behind the back of push and pop matching
+        effects->stack_barrier = true;
+        break;
+
+    case ASM_OP_CALL:
+        effects->writes |= ASM_IR_REG_ALLOCATABLE & ~asm_ir_callee_saved_registers();
+        break;
+
+    case ASM_OP_RET:
+        // The caller gets the callee saved registers back as well as the result
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EAX) | ASM_IR_REG_MASK(ASM_IR_REG_EDX) | asm_ir_callee_saved_registers();
+        break;
+
+    case ASM_OP_LEAVE:
+        effects->reads |= ASM_IR_REG_MASK(ASM_IR_REG_EBP);
+        effects->writes |= ASM_IR_REG_MASK(ASM_IR_REG_EBP) | ASM_IR_REG_MASK(ASM_IR_REG_ESP);
+        effects->stack_barrier = true;
+        break;
+
+    default:
+        // Jumps only read their target
+        assert(asm_ir_is_jump(ins->op));
+        break;
+    }
+
+    for (int i = 0; i < ins->total_operands; i++)
+    {
+        liveness_operand_effects(&ins->operands[i], i == 0 ? dst_read : true, i == 0 && dst_write, effects);
+    }
+}
+
+static int liveness_label_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct liveness_label *)a)->name, ((const struct liveness_label *)b)->name);
+}
+
+static int liveness_block_for_label(struct liveness_label *labels, int total_labels, const char *name)
+{
+    struct liveness_label key = {.name = name};
+    struct liveness_label *label = bsearch(&key, labels, total_labels, sizeof(struct liveness_label), liveness_label_compare);
+    return label ? label->block : -1;
+}
+
+static void liveness_block_successors(struct asm_ir *ir, struct liveness_block *blocks, int index, int total_blocks, struct liveness_label *labels, int total_labels)
+{
+    struct liveness_block *block = &blocks[index];
+    struct asm_ir_instruction *last = asm_ir_at(ir, block->end - 1);
+    if (last->op == ASM_OP_RET)
+    {
+        return;
+    }
+
+    if (asm_ir_is_jump(last->op))
+    {
+        int target = -1;
+        if (last->total_operands == 1 && last->operands[0].type == ASM_IR_OPERAND_SYMBOL)
+        {
+            target = liveness_block_for_label(labels, total_labels, last->operands[0].symbol);
+        }
+
+        if (last->op == ASM_OP_JMP && last->total_operands == 1 && last->operands[0].type == ASM_IR_OPERAND_MEMORY)
+        {
+            block->indirect_successor = true;
+        }
+        else if (target == -1)
+        {
+            block->unknown_successor = true;
+        }
+        else
+        {
+            block->successors[block->total_successors++] = target;
+        }
+
+        if (last->op == ASM_OP_JMP)
+        {
+            return;
+        }
+    }
+
+    if (index + 1 < total_blocks)
+    {
+        block->successors[block->total_successors++] = index + 1;
+    }
+    else
+    {
+        block->unknown_successor = true;
+    }
+}
+
+void asm_ir_liveness(struct asm_ir *ir, int *live_after)
+{
+    struct vector *block_vec = asm_ir_basic_blocks(ir);
+    int total_blocks = vector_count(block_vec);
+    struct liveness_block *blocks = calloc(total_blocks, sizeof(struct liveness_block));
+    struct liveness_label *labels = calloc(total_blocks, sizeof(struct liveness_label));
+    int total_labels = 0;
+    for (int i = 0; i < total_blocks; i++)
+    {
+        struct asm_ir_block *ir_block = vector_at(block_vec, i);
+        blocks[i].start = ir_block->start;
+        blocks[i].end = ir_block->end;
+        struct asm_ir_instruction *first = asm_ir_at(ir, ir_block->start);
+        if (first->op == ASM_OP_LABEL)
+        {
+            labels[total_labels++] = (struct liveness_label){.name = first->text, .block = i};
+        }
+    }
+    qsort(labels, total_labels, sizeof(struct liveness_label), liveness_label_compare);
+
+    for (int i = 0; i < total_blocks; i++)
+    {
+        struct liveness_block *block = &blocks[i];
+        liveness_block_successors(ir, blocks, i, total_blocks, labels, total_labels);
+        for (int k = block->end - 1; k >= block->start; k--)
+        {
+            struct asm_ir_effects effects;
+            asm_ir_instruction_effects(asm_ir_at(ir, k), &effects);
+            block->use = (block->use & ~effects.writes) | effects.reads;
+            block->def |= effects.writes;
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        int label_live_in = 0;
+        for (int i = 0; i < total_labels; i++)
+        {
+            label_live_in |= blocks[labels[i].block].live_in;
+        }
+
+        for (int i = total_blocks - 1; i >= 0; i--)
+        {
+            struct liveness_block *block = &blocks[i];
+            int live_out = block->unknown_successor ? ASM_IR_REG_ALL : 0;
+            if (block->indirect_successor)
+            {
+                live_out |= label_live_in;
+            }
+            for (int k = 0; k < block->total_successors; k++)
+            {
+                live_out |= blocks[block->successors[k]].live_in;
+            }
+
+            int live_in = block->use | (live_out & ~block->def);
+            if (live_out != block->live_out || live_in != block->live_in)
+            {
+                block->live_out = live_out;
+                block->live_in = live_in;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < total_blocks; i++)
+    {
+        int live = blocks[i].live_out;
+        for (int k = blocks[i].end - 1; k >= blocks[i].start; k--)
+        {
+            live_after[k] = live;
+            struct asm_ir_effects effects;
+            asm_ir_instruction_effects(asm_ir_at(ir, k), &effects);
+            live = (live & ~effects.writes) | effects.reads;
+        }
+    }
+
+    free(labels);
+    free(blocks);
+    vector_free(block_vec);
+}
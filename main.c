@@ -1,8 +1,146 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "helpers/vector.h"
 #include "compiler.h"
+
+/**
+ * Takes -m32 and -m64 out of the arguments wherever they appear and returns the target flag they select,
+ * the last one given wins. Without either we generate 32 bit code.
+ */
+int main_target_flags(int* argc, char** argv)
+{
+    int flags = 0;
+    int total = 0;
+    for (int i = 0; i < *argc; i++)
+    {
+        if (S_EQ(argv[i], "-m64"))
+        {
+            flags = COMPILE_PROCESS_TARGET_X86_64;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "-m32"))
+        {
+            flags = 0;
+            continue;
+        }
+
+        argv[total++] = argv[i];
+    }
+
+    *argc = total;
+    return flags;
+}
+
+/**
+ * Takes the options that combine with any output kind out of the arguments wherever they appear
+ * and returns their compile flags.
+ */
+int main_option_flags(int* argc, char** argv)
+{
+    int flags = 0;
+    int total = 0;
+    for (int i = 0; i < *argc; i++)
+    {
+        if (S_EQ(argv[i], "ast"))
+        {
+            flags |= COMPILE_PROCESS_EMIT_AST;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "echo"))
+        {
+            // Print the generated assembly as well, the compiler used to always do this
+            flags |= COMPILE_PROCESS_ECHO_ASM;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "nopeephole"))
+        {
+            flags |= COMPILE_PROCESS_NO_PEEPHOLE;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "noblockcopy"))
+        {
+            flags |= COMPILE_PROCESS_NO_BLOCK_COPY;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "norotate"))
+        {
+            flags |= COMPILE_PROCESS_NO_LOOP_ROTATION;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "peephole-stats"))
+        {
+            flags |= COMPILE_PROCESS_PEEPHOLE_STATS;
+            continue;
+        }
+
+        if (S_EQ(argv[i], "resolver-stats"))
+        {
+            flags |= COMPILE_PROCESS_RESOLVER_STATS;
+            continue;
+        }
+
+        argv[total++] = argv[i];
+    }
+
+    *argc = total;
+    return flags;
+}
+
+/**
+ * ./main build <output> [-j<workers>] [-m32|-m64] [nopeephole] [noblockcopy] [norotate] <file.c> <file.c> ...
+ */
+int main_build(int argc, char** argv, int flags)
+{
+    int first_source = 3;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > first_source && strncmp(argv[first_source], "-j", 2) == 0)
+    {
+        workers = atoi(argv[first_source] + 2);
+        first_source++;
+    }
+
+    if (argc <= first_source)
+    {
+        printf("Usage: %s build <output> [-j<workers>] [-m32|-m64] [nopeephole] [noblockcopy] [norotate] <file.c>...\n", argv[0]);
+        return -1;
+    }
+
+    const char* output_file = argv[2];
+
+    return driver_build(output_file, (const char**) &argv[first_source], argc - first_source, workers, flags);
+}
+
 int main(int argc, char** argv)
 {
+    int target_flags = main_target_flags(&argc, argv);
+    int option_flags = main_option_flags(&argc, argv);
+    if (argc > 1 && S_EQ(argv[1], "build"))
+    {
+        return main_build(argc, argv, target_flags | option_flags);
+    }
+
+    if (argc > 1 && S_EQ(argv[1], "server"))
+    {
+        return compile_server_run(argc > 2 ? argv[2] : COMPILE_SERVER_DEFAULT_SOCKET);
+    }
+
+    // ./main client <input> <output> <exec|object> <socket> compiles through a running server
+    const char* server_socket = NULL;
+    if (argc > 1 && S_EQ(argv[1], "client"))
+    {
+        server_socket = argc > 5 ? argv[5] : COMPILE_SERVER_DEFAULT_SOCKET;
+        argc = argc > 5 ? 5 : argc;
+        argc--;
+        argv++;
+    }
+
     const char* input_file = "./test.c";
     const char* output_file = "./test";
     const char* option = "exec";
@@ -21,12 +159,31 @@ int main(int argc, char** argv)
     {
         option = argv[3];
     }
-    int compile_flags = COMPILE_PROCESS_EXECUTE_NASM;
+    int compile_flags = COMPILE_PROCESS_EXECUTE_NASM | target_flags | option_flags;
     if (S_EQ(option, "object"))
     {
         compile_flags |= COMPILE_PROCESS_EXPORT_AS_OBJECT;
     }
-    int res = compile_file(input_file, output_file, compile_flags);
+
+    if (compile_flags & COMPILE_PROCESS_EMIT_AST)
+    {
+        // Nothing to assemble, the output is the binary tree
+        compile_flags &= ~(COMPILE_PROCESS_EXECUTE_NASM | COMPILE_PROCESS_EXPORT_AS_OBJECT);
+    }
+    int res = -1;
+    if (server_socket)
+    {
+        res = compile_client_run(server_socket, input_file, output_file, compile_flags);
+    }
+
+    if (res < 0 && ast_file_is_ast(input_file))
+    {
+        res = compile_ast_file(input_file, output_file, compile_flags);
+    }
+    else if (res < 0)
+    {
+        res = compile_file(input_file, output_file, compile_flags);
+    }
     if (res == COMPILER_FILE_COMPILED_OK)
     {
         printf("everything compiled file\n");
@@ -34,6 +191,11 @@ int main(int argc, char** argv)
     else if(res == COMPILER_FAILED_WITH_ERRORS)
     {
         printf("Compile failed\n");
+        if (server_socket)
+        {
+            // A local compile would have exited on the error already.
+            return -1;
+        }
     }
     else
     {
@@ -42,16 +204,17 @@ int main(int argc, char** argv)
 
     if (compile_flags & COMPILE_PROCESS_EXECUTE_NASM)
     {
+        struct compile_target* target = target_for_flags(compile_flags);
         char nasm_output_file[40];
         char nasm_cmd[512];
         sprintf(nasm_output_file, "%s.o", output_file);
         if (compile_flags & COMPILE_PROCESS_EXPORT_AS_OBJECT)
         {
-            sprintf(nasm_cmd, "nasm -f elf32 %s -o %s", output_file, nasm_output_file);
+            sprintf(nasm_cmd, "nasm -f %s %s -o %s", target->nasm_format, output_file, nasm_output_file);
         }
         else
         {
-            sprintf(nasm_cmd, "nasm -f elf32 %s -o %s && gcc -m32 %s -o %s", output_file, nasm_output_file, nasm_output_file, output_file);
+            sprintf(nasm_cmd, "nasm -f %s %s -o %s && gcc %s %s -o %s", target->nasm_format, output_file, nasm_output_file, target->link_flags, nasm_output_file, output_file);
         }
 
         printf("%s", nasm_cmd);
@@ -2,11 +2,11 @@
 #include "helpers/vector.h"
 #include <assert.h>
 
-struct vector *node_vector = NULL;
-struct vector *node_vector_root = NULL;
+COMPILER_THREAD_LOCAL struct vector *node_vector = NULL;
+COMPILER_THREAD_LOCAL struct vector *node_vector_root = NULL;
 
-struct node *parser_current_body = NULL;
-struct node *parser_current_function = NULL;
+COMPILER_THREAD_LOCAL struct node *parser_current_body = NULL;
+COMPILER_THREAD_LOCAL struct node *parser_current_function = NULL;
 
 void node_set_vector(struct vector *vec, struct vector *root_vec)
 {
@@ -59,9 +59,9 @@ void make_default_node()
 {
     node_create(&(struct node){.type=NODE_TYPE_STATEMENT_DEFAULT});
 }
-void make_cast_node(struct datatype *dtype, struct node *operand_node)
+void make_cast_node(const struct datatype *dtype, struct node *operand_node)
 {
-    node_create(&(struct node){.type = NODE_TYPE_CAST, .cast.dtype = *dtype, .cast.operand = operand_node});
+    node_create(&(struct node){.type = NODE_TYPE_CAST, .cast.dtype = dtype, .cast.operand = operand_node});
 }
 
 void make_tenary_node(struct node *true_node, struct node *false_node)
@@ -137,9 +137,9 @@ void make_union_node(const char *name, struct node *body_node)
     node_create(&(struct node){.type = NODE_TYPE_UNION, ._union.body_n = body_node, ._union.name = name, .flags = flags});
 }
 
-void make_function_node(struct datatype *ret_type, const char *name, struct vector *arguments, struct node *body_node)
+void make_function_node(const struct datatype *ret_type, const char *name, struct vector *arguments, struct node *body_node)
 {
-    struct node* function_node = node_create(&(struct node){.type = NODE_TYPE_FUNCTION, .func.name = name, .func.args.vector = arguments, .func.body_n = body_node, .func.rtype = *ret_type, .func.args.stack_addition = DATA_SIZE_DDWORD});
+    struct node* function_node = node_create(&(struct node){.type = NODE_TYPE_FUNCTION, .func.name = name, .func.args.vector = arguments, .func.body_n = body_node, .func.rtype = ret_type, .func.args.stack_addition = DATA_SIZE_DDWORD});
     function_node->func.frame.elements = vector_create(sizeof(struct stack_frame_element));
 }
 
@@ -249,7 +249,7 @@ bool node_is_struct_or_union_variable(struct node *node)
         return false;
     }
 
-    return datatype_is_struct_or_union(&node->var.type);
+    return datatype_is_struct_or_union(node->var.type);
 }
 
 struct node *variable_node(struct node *node)
@@ -277,7 +277,7 @@ struct node *variable_node(struct node *node)
 bool variable_node_is_primitive(struct node *node)
 {
     assert(node->type == NODE_TYPE_VARIABLE);
-    return datatype_is_primitive(&node->var.type);
+    return datatype_is_primitive(node->var.type);
 }
 
 struct node *variable_node_or_list(struct node *node)
@@ -344,4 +344,49 @@ bool is_node_assignment(struct node *node)
 bool node_valid(struct node* node)
 {
     return node && node->type != NODE_TYPE_BLANK;
-}
\ No newline at end of file
+}
+bool node_has_jump_target(struct node *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_LABEL:
+    case NODE_TYPE_STATEMENT_CASE:
+    case NODE_TYPE_STATEMENT_DEFAULT:
+        return true;
+
+    case NODE_TYPE_BODY:
+        for (int i = 0; i < vector_count(node->body.statements); i++)
+        {
+            if (node_has_jump_target(*(struct node **)vector_at(node->body.statements, i)))
+            {
+                return true;
+            }
+        }
+        return false;
+
+    case NODE_TYPE_STATEMENT_IF:
+        return node_has_jump_target(node->stmt.if_stmt.body_node) || node_has_jump_target(node->stmt.if_stmt.next);
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        return node_has_jump_target(node->stmt.else_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        return node_has_jump_target(node->stmt.while_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        return node_has_jump_target(node->stmt.do_while_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_FOR:
+        return node_has_jump_target(node->stmt.for_stmt.body_node);
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        return node_has_jump_target(node->stmt.switch_stmt.body);
+    }
+
+    return false;
+}
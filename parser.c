@@ -2,15 +2,15 @@
 #include "helpers/vector.h"
 #include <assert.h>
 
-static struct compile_process *current_process;
-static struct fixup_system *parser_fixup_sys;
-static struct token *parser_last_token;
+static COMPILER_THREAD_LOCAL struct compile_process *current_process;
+static COMPILER_THREAD_LOCAL struct fixup_system *parser_fixup_sys;
+static COMPILER_THREAD_LOCAL struct token *parser_last_token;
 
-extern struct node *parser_current_body;
-extern struct node *parser_current_function;
+extern COMPILER_THREAD_LOCAL struct node *parser_current_body;
+extern COMPILER_THREAD_LOCAL struct node *parser_current_function;
 
 // NODE_TYPE_BLANK
-struct node *parser_blank_node;
+COMPILER_THREAD_LOCAL struct node *parser_blank_node;
 
 extern struct expressionable_op_precedence_group op_precedence[TOTAL_OPERATOR_GROUPS];
 
@@ -547,7 +547,7 @@ void parse_for_cast()
 
     parse_expressionable(history_begin(0));
     struct node *operand_node = node_pop();
-    make_cast_node(&dtype, operand_node);
+    make_cast_node(datatype_intern(current_process, &dtype), operand_node);
 }
 int parse_exp(struct history *history)
 {
@@ -664,9 +664,8 @@ int parser_datatype_expected_for_type_string(const char *str)
 
 int parser_get_random_type_index()
 {
-    static int x = 0;
-    x++;
-    return x;
+    current_process->anonymous_type_index++;
+    return current_process->anonymous_type_index;
 }
 
 struct token *parser_build_random_type_name()
@@ -747,7 +746,7 @@ void parser_datatype_init_type_and_size_for_primitive(struct token *datatype_tok
     else if (S_EQ(datatype_token->sval, "long"))
     {
         datatype_out->type = DATA_TYPE_LONG;
-        datatype_out->size = DATA_SIZE_DWORD;
+        datatype_out->size = target_current()->long_size;
     }
     else if (S_EQ(datatype_token->sval, "float"))
     {
@@ -837,8 +836,11 @@ void parser_datatype_init(struct token *datatype_token, struct token *datatype_s
 
     if (S_EQ(datatype_token->sval, "long") && datatype_secondary_token && S_EQ(datatype_secondary_token->sval, "long"))
     {
-        compiler_warning(current_process, "Our compiler does not support 64 bit longs, therefore your long long is defaulting to 32 bits\n");
-        datatype_out->size = DATA_SIZE_DWORD;
+        if (!target_is_x86_64())
+        {
+            compiler_warning(current_process, "Our compiler does not support 64 bit longs on 32 bit x86, therefore your long long is defaulting to 32 bits\n");
+        }
+        datatype_out->size = target_current()->long_size;
     }
 }
 void parse_datatype_type(struct datatype *dtype)
@@ -917,15 +919,17 @@ struct datatype_struct_node_fix_private
 bool datatype_struct_node_fix(struct fixup *fixup)
 {
     struct datatype_struct_node_fix_private *private = fixup_private(fixup);
-    struct datatype *dtype = &private->node->var.type;
-    dtype->type = DATA_TYPE_STRUCT;
-    dtype->size = size_of_struct(dtype->type_str);
-    dtype->struct_node = struct_node_for_name(current_process, dtype->type_str);
-    if (!dtype->struct_node)
+    struct datatype dtype = *private->node->var.type;
+    dtype.type = DATA_TYPE_STRUCT;
+    dtype.size = size_of_struct(dtype.type_str);
+    dtype.struct_node = struct_node_for_name(current_process, dtype.type_str);
+    if (!dtype.struct_node)
     {
         return false;
     }
 
+    // Interned datatypes never change, the variable gets the datatype of the now known structure
+    private->node->var.type = datatype_intern(current_process, &dtype);
     return true;
 }
 
@@ -934,6 +938,16 @@ void datatype_struct_node_end(struct fixup *fixup)
     free(fixup_private(fixup));
 }
 
+void parser_build_symbol_for_node(struct node *node)
+{
+    symresolver_build_for_node(current_process, node);
+    if (node_is_struct_or_union(node) && !(node->flags & NODE_FLAG_IS_FORWARD_DECLARATION))
+    {
+        // Only the variables waiting on this structure need fixing now.
+        fixup_sys_symbol_defined(parser_fixup_sys, node->_struct.name);
+    }
+}
+
 void make_variable_node(struct datatype *dtype, struct token *name_token, struct node *value_node)
 {
     const char *name_str = NULL;
@@ -942,14 +956,14 @@ void make_variable_node(struct datatype *dtype, struct token *name_token, struct
         name_str = name_token->sval;
     }
 
-    node_create(&(struct node){.type = NODE_TYPE_VARIABLE, .var.name = name_str, .var.type = *dtype, .var.val = value_node});
+    node_create(&(struct node){.type = NODE_TYPE_VARIABLE, .var.name = name_str, .var.type = datatype_intern(current_process, dtype), .var.val = value_node});
     struct node *var_node = node_peek_or_null();
-    if (var_node->var.type.type == DATA_TYPE_STRUCT && !var_node->var.type.struct_node)
+    if (var_node->var.type->type == DATA_TYPE_STRUCT && !var_node->var.type->struct_node)
     {
         struct datatype_struct_node_fix_private *private = calloc(1, sizeof(struct datatype_struct_node_fix_private));
         private
             ->node = var_node;
-        fixup_register(parser_fixup_sys, &(struct fixup_config){.fix = datatype_struct_node_fix, .end = datatype_struct_node_end, .private = private});
+        fixup_register(parser_fixup_sys, &(struct fixup_config){.fix = datatype_struct_node_fix, .end = datatype_struct_node_end, .private = private, .waiting_on = var_node->var.type->type_str});
     }
 }
 
@@ -964,7 +978,7 @@ void parser_scope_offset_for_stack(struct node *node, struct history *history)
         offset = stack_addition;
         if (last_entity)
         {
-            offset = datatype_size(&variable_node(last_entity->node)->var.type);
+            offset = datatype_size(variable_node(last_entity->node)->var.type);
         }
     }
 
@@ -973,7 +987,7 @@ void parser_scope_offset_for_stack(struct node *node, struct history *history)
         offset += variable_node(last_entity->node)->var.aoffset;
         if (variable_node_is_primitive(node))
         {
-            variable_node(node)->var.padding = padding(upward_stack ? offset : -offset, node->var.type.size);
+            variable_node(node)->var.padding = padding(upward_stack ? offset : -offset, node->var.type->size);
         }
     }
 
@@ -995,12 +1009,8 @@ void parser_scope_offset_for_structure(struct node *node, struct history *histor
     struct parser_scope_entity *last_entity = parser_scope_last_entity();
     if (last_entity)
     {
-        offset += last_entity->stack_offset + last_entity->node->var.type.size;
-        if (variable_node_is_primitive(node))
-        {
-            node->var.padding = padding(offset, node->var.type.size);
-        }
-
+        offset += last_entity->stack_offset + variable_size(last_entity->node);
+        node->var.padding = padding(offset, datatype_align(node->var.type));
         node->var.aoffset = offset + node->var.padding;
     }
 }
@@ -1030,7 +1040,7 @@ void make_variable_node_and_register(struct history *history, struct datatype *d
     // Calculate the scope offset
     parser_scope_offset(var_node, history);
     // Push the variable node to the scope
-    parser_scope_push(parser_new_scope_entity(var_node, var_node->var.aoffset, 0), var_node->var.type.size);
+    parser_scope_push(parser_new_scope_entity(var_node, var_node->var.aoffset, 0), var_node->var.type->size);
 
     resolver_default_new_scope_entity(current_process->resolver, var_node, var_node->var.aoffset, 0);
     node_push(var_node);
@@ -1103,7 +1113,7 @@ void parse_function(struct datatype *ret_type, struct token *name_token, struct
     struct vector *arguments_vector = NULL;
     parser_scope_new();
     resolver_default_new_scope(current_process->resolver, 0);
-    make_function_node(ret_type, name_token->sval, NULL, NULL);
+    make_function_node(datatype_intern(current_process, ret_type), name_token->sval, NULL, NULL);
     struct node *function_node = node_peek();
     parser_current_function = function_node;
     if (datatype_is_struct_or_union(ret_type))
@@ -1179,7 +1189,7 @@ void parse_statement(struct history *history)
 void parser_append_size_for_node_struct_union(struct history *history, size_t *_variable_size, struct node *node)
 {
     *_variable_size += variable_size(node);
-    if (node->var.type.flags & DATATYPE_FLAG_IS_POINTER)
+    if (node->var.type->flags & DATATYPE_FLAG_IS_POINTER)
     {
         return;
     }
@@ -1187,7 +1197,7 @@ void parser_append_size_for_node_struct_union(struct history *history, size_t *_
     struct node *largest_var_node = variable_struct_or_union_body_node(node)->body.largest_var_node;
     if (largest_var_node)
     {
-        *_variable_size += align_value(*_variable_size, largest_var_node->var.type.size);
+        *_variable_size += align_value(*_variable_size, largest_var_node->var.type->size);
     }
 }
 
@@ -1241,14 +1251,19 @@ void parser_finalize_body(struct history *history, struct node *body_node, struc
 
     if (largest_align_eligible_var_node)
     {
-        *_variable_size = align_value(*_variable_size, largest_align_eligible_var_node->var.type.size);
+        *_variable_size = align_value(*_variable_size, largest_align_eligible_var_node->var.type->size);
     }
 
     bool padded = padding != 0;
     body_node->body.largest_var_node = largest_align_eligible_var_node;
     body_node->body.padded = padded;
-    body_node->body.size = *_variable_size;
     body_node->body.statements = body_vec;
+    if (history->flags & (HISTORY_FLAG_INSIDE_STRUCTURE | HISTORY_FLAG_INSIDE_UNION))
+    {
+        body_node->body.layout = struct_layout_build(body_node, history->flags & HISTORY_FLAG_INSIDE_UNION);
+        *_variable_size = body_node->body.layout->size;
+    }
+    body_node->body.size = *_variable_size;
 }
 
 void parse_body_single_statement(size_t *variable_size, struct vector *body_vec, struct history *history)
@@ -1298,7 +1313,7 @@ void parse_body_multiple_statements(size_t *variable_size, struct vector *body_v
         if (stmt_node->type == NODE_TYPE_VARIABLE)
         {
             if (!largest_possible_var_node ||
-                (largest_possible_var_node->var.type.size <= stmt_node->var.type.size))
+                (largest_possible_var_node->var.type->size <= stmt_node->var.type->size))
             {
                 largest_possible_var_node = stmt_node;
             }
@@ -1306,7 +1321,7 @@ void parse_body_multiple_statements(size_t *variable_size, struct vector *body_v
             if (variable_node_is_primitive(stmt_node))
             {
                 if (!largest_align_eligible_var_node ||
-                    (largest_align_eligible_var_node->var.type.size <= stmt_node->var.type.size))
+                    (largest_align_eligible_var_node->var.type->size <= stmt_node->var.type->size))
                 {
                     largest_align_eligible_var_node = stmt_node;
                 }
@@ -1518,6 +1533,7 @@ struct vector *parse_function_arguments(struct history *history)
         if (token_next_is_operator("."))
         {
             token_read_dots(3);
+            parser_current_function->func.flags |= FUNCTION_NODE_FLAG_IS_VARIADIC;
             parser_scope_finish();
             return arguments_vec;
         }
@@ -1554,7 +1570,7 @@ void parse_variable_function_or_struct_union(struct history *history)
         parse_struct_or_union(&dtype);
 
         struct node *su_node = node_pop();
-        symresolver_build_for_node(current_process, su_node);
+        parser_build_symbol_for_node(su_node);
         node_push(su_node);
         return;
     }
@@ -1993,7 +2009,7 @@ void parse_keyword_for_global()
     case NODE_TYPE_FUNCTION:
     case NODE_TYPE_STRUCT:
     case NODE_TYPE_UNION:
-        symresolver_build_for_node(current_process, node);
+        parser_build_symbol_for_node(node);
         break;
     }
     node_push(node);
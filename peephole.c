@@ -0,0 +1,404 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+
+/**
+ * Peephole optimizer over the instruction IR of a function.
+ *
+ * Every pattern looks at the instruction at an index and the few that follow it, comments are
+ * skipped while matching. The table below is the whole optimizer, a pattern only runs when its
+ * PEEPHOLE_PATTERN_* flag is enabled.
+ */
+
+// Passes stop once nothing changes, or after this many
+#define PEEPHOLE_MAX_PASSES 8
+
+struct peephole_context
+{
+    struct asm_ir *ir;
+    int total;
+
+    // Registers live after each instruction at the start of the pass
+    int *live_after;
+};
+
+struct peephole_pattern
+{
+    int flag;
+    const char *name;
+
+    // Rewrites the IR starting at index, returns true if it matched
+    bool (*apply)(struct peephole_context *context, int index);
+};
+
+static struct asm_ir_instruction *peephole_at(struct peephole_context *context, int index)
+{
+    return index == -1 ? NULL : asm_ir_at(context->ir, index);
+}
+
+static int peephole_next(struct peephole_context *context, int index)
+{
+    for (int i = index + 1; i < context->total; i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(context->ir, i);
+        if (!(ins->flags & ASM_IR_INSTRUCTION_FLAG_DELETED) && ins->op != ASM_OP_COMMENT)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void peephole_delete(struct asm_ir_instruction *ins)
+{
+    ins->flags |= ASM_IR_INSTRUCTION_FLAG_DELETED;
+}
+
+static bool peephole_is(struct asm_ir_instruction *ins, int op, int total_operands)
+{
+    return ins && ins->op == op && ins->total_operands == total_operands;
+}
+
+static bool peephole_uses_register(struct asm_ir_operand *operand, int reg)
+{
+    struct asm_ir_instruction ins = {.op = ASM_OP_PUSH, .total_operands = 1, .operands = {*operand}};
+    struct asm_ir_effects effects;
+    asm_ir_instruction_effects(&ins, &effects);
+    return effects.reads & ASM_IR_REG_MASK(reg);
+}
+
+static void peephole_set_mov_source(struct asm_ir_instruction *ins, struct asm_ir_operand *source)
+{
+    ins->operands[1] = *source;
+    ins->operands[1].size = 0;
+    if (source->type == ASM_IR_OPERAND_MEMORY)
+    {
+        ins->operands[1].mem.size = 0;
+    }
+
+    // The strings belong to the new owner now
+    source->type = ASM_IR_OPERAND_NONE;
+    source->owns_base = false;
+}
+
+// push eax / pop eax, push dword [ebp-4] / pop ecx, push rbx / pop rbx on x86-64
+static bool peephole_push_pop(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *push = peephole_at(context, index);
+    int pop_index = peephole_next(context, index);
+    struct asm_ir_instruction *pop = peephole_at(context, pop_index);
+    if (!peephole_is(push, ASM_OP_PUSH, 1) || !peephole_is(pop, ASM_OP_POP, 1))
+    {
+        return false;
+    }
+
+    struct asm_ir_effects push_effects;
+    struct asm_ir_effects pop_effects;
+    asm_ir_instruction_effects(push, &push_effects);
+    asm_ir_instruction_effects(pop, &pop_effects);
+    struct asm_ir_operand *value = &push->operands[0];
+    struct asm_ir_operand *target = &pop->operands[0];
+    if (push_effects.stack_barrier || pop_effects.stack_barrier || !asm_ir_operand_is_stack_slot(value) || !asm_ir_operand_is_stack_slot(target))
+    {
+        return false;
+    }
+
+    if (asm_ir_operand_equal(value, target))
+    {
+        peephole_delete(push);
+        peephole_delete(pop);
+        return true;
+    }
+
+    // mov can not take two memory operands, and an immediate needs the size from its target
+    if ((value->type == ASM_IR_OPERAND_MEMORY && target->type == ASM_IR_OPERAND_MEMORY) ||
+        (target->type == ASM_IR_OPERAND_MEMORY && target->mem.size == 0))
+    {
+        return false;
+    }
+
+    pop->op = ASM_OP_MOV;
+    pop->total_operands = 2;
+    peephole_set_mov_source(pop, value);
+    push->total_operands = 0;
+    peephole_delete(push);
+    return true;
+}
+
+// mov ecx, ecx
+static bool peephole_self_move(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *ins = peephole_at(context, index);
+    if (!peephole_is(ins, ASM_OP_MOV, 2) || ins->operands[0].type != ASM_IR_OPERAND_REGISTER ||
+        !asm_ir_operand_equal(&ins->operands[0], &ins->operands[1]))
+    {
+        return false;
+    }
+
+    // On x86-64 this is how codegen clears the upper half of the register
+    if (target_is_x86_64() && asm_ir_register_size(ins->operands[0].reg) == DATA_SIZE_DWORD)
+    {
+        return false;
+    }
+
+    peephole_delete(ins);
+    return true;
+}
+
+// mov ebx, eax / mov eax, ebx, the second move changes nothing
+static bool peephole_move_back(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *first = peephole_at(context, index);
+    struct asm_ir_instruction *second = peephole_at(context, peephole_next(context, index));
+    if (!peephole_is(first, ASM_OP_MOV, 2) || !peephole_is(second, ASM_OP_MOV, 2) ||
+        !asm_ir_operand_equal(&first->operands[0], &second->operands[1]) ||
+        !asm_ir_operand_equal(&first->operands[1], &second->operands[0]))
+    {
+        return false;
+    }
+
+    // mov eax, [eax] / mov [eax], eax stores somewhere else
+    struct asm_ir_operand *target = &first->operands[0];
+    if (target->type == ASM_IR_OPERAND_REGISTER && peephole_uses_register(&first->operands[1], asm_ir_register_id(target->reg)))
+    {
+        return false;
+    }
+
+    peephole_delete(second);
+    return true;
+}
+
+static int peephole_jump_for_set(int set_op)
+{
+    return ASM_OP_JE + (set_op - ASM_OP_SETE);
+}
+
+static int peephole_inverse_jump(int jump_op)
+{
+    // Conditions come in pairs, je/jne, jg/jge, ...
+    static const int inverse[] = {
+        [ASM_OP_JE - ASM_OP_JE] = ASM_OP_JNE,
+        [ASM_OP_JNE - ASM_OP_JE] = ASM_OP_JE,
+        [ASM_OP_JG - ASM_OP_JE] = ASM_OP_JLE,
+        [ASM_OP_JGE - ASM_OP_JE] = ASM_OP_JL,
+        [ASM_OP_JL - ASM_OP_JE] = ASM_OP_JGE,
+        [ASM_OP_JLE - ASM_OP_JE] = ASM_OP_JG,
+        [ASM_OP_JA - ASM_OP_JE] = ASM_OP_JBE,
+        [ASM_OP_JAE - ASM_OP_JE] = ASM_OP_JB,
+        [ASM_OP_JB - ASM_OP_JE] = ASM_OP_JAE,
+        [ASM_OP_JBE - ASM_OP_JE] = ASM_OP_JA,
+    };
+    return inverse[jump_op - ASM_OP_JE];
+}
+
+// setg al / movzx eax, al / cmp eax, 0 / je .end becomes jle .end
+static bool peephole_setcc_branch(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *set = peephole_at(context, index);
+    int movzx_index = peephole_next(context, index);
+    int cmp_index = peephole_next(context, movzx_index);
+    int jump_index = peephole_next(context, cmp_index);
+    struct asm_ir_instruction *movzx = peephole_at(context, movzx_index);
+    struct asm_ir_instruction *cmp = peephole_at(context, cmp_index);
+    struct asm_ir_instruction *jump = peephole_at(context, jump_index);
+    if (!set || set->op < ASM_OP_SETE || set->op > ASM_OP_SETBE || !jump ||
+        !(jump->op == ASM_OP_JE || jump->op == ASM_OP_JNE || jump->op == ASM_OP_JG))
+    {
+        return false;
+    }
+
+    const char *al = asm_ir_register("al", 2);
+    const char *eax = asm_ir_register("eax", 3);
+    if (set->operands[0].type != ASM_IR_OPERAND_REGISTER || set->operands[0].reg != al ||
+        !peephole_is(movzx, ASM_OP_MOVZX, 2) || movzx->operands[0].type != ASM_IR_OPERAND_REGISTER || movzx->operands[0].reg != eax ||
+        movzx->operands[1].type != ASM_IR_OPERAND_REGISTER || movzx->operands[1].reg != al ||
+        !peephole_is(cmp, ASM_OP_CMP, 2) || cmp->operands[0].type != ASM_IR_OPERAND_REGISTER || cmp->operands[0].reg != eax ||
+        cmp->operands[1].type != ASM_IR_OPERAND_IMMEDIATE || cmp->operands[1].imm != 0 ||
+        (context->live_after[jump_index] & ASM_IR_REG_MASK(ASM_IR_REG_EAX)))
+    {
+        return false;
+    }
+
+    // The flags still hold the comparison setcc looked at. je jumps when it was false, jne and jg when it was true
+    int jump_op = peephole_jump_for_set(set->op);
+    jump->op = jump->op == ASM_OP_JE ? peephole_inverse_jump(jump_op) : jump_op;
+    peephole_delete(set);
+    peephole_delete(movzx);
+    peephole_delete(cmp);
+    return true;
+}
+
+// add esp, 0
+static bool peephole_zero_stack_adjust(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *ins = peephole_at(context, index);
+    if ((!peephole_is(ins, ASM_OP_ADD, 2) && !peephole_is(ins, ASM_OP_SUB, 2)) ||
+        ins->operands[0].type != ASM_IR_OPERAND_REGISTER || asm_ir_register_id(ins->operands[0].reg) != ASM_IR_REG_ESP ||
+        ins->operands[1].type != ASM_IR_OPERAND_IMMEDIATE || ins->operands[1].imm != 0)
+    {
+        return false;
+    }
+
+    peephole_delete(ins);
+    return true;
+}
+
+// jmp .if_end_2 / .if_3: / .if_end_2:
+static bool peephole_jump_to_next(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *jump = peephole_at(context, index);
+    if (!peephole_is(jump, ASM_OP_JMP, 1) || jump->operands[0].type != ASM_IR_OPERAND_SYMBOL)
+    {
+        return false;
+    }
+
+    struct asm_ir_instruction *ins = NULL;
+    for (int i = peephole_next(context, index); (ins = peephole_at(context, i)) && ins->op == ASM_OP_LABEL; i = peephole_next(context, i))
+    {
+        if (S_EQ(ins->text, jump->operands[0].symbol))
+        {
+            peephole_delete(jump);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Instructions after a jmp or ret that no label leads to
+static bool peephole_unreachable(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *ins = peephole_at(context, index);
+    if (ins->op != ASM_OP_JMP && ins->op != ASM_OP_RET)
+    {
+        return false;
+    }
+
+    bool removed = false;
+    // Directives, like the entries of a jump table, stop it as well as labels
+    for (int i = peephole_next(context, index); (ins = peephole_at(context, i)) && ins->op > ASM_OP_COMMENT; i = peephole_next(context, i))
+    {
+        peephole_delete(ins);
+        removed = true;
+    }
+    return removed;
+}
+
+// mov ecx, 10 / cmp eax, ecx becomes cmp eax, 10 when ecx is not needed afterwards
+static bool peephole_immediate_operand(struct peephole_context *context, int index)
+{
+    struct asm_ir_instruction *mov = peephole_at(context, index);
+    int use_index = peephole_next(context, index);
+    struct asm_ir_instruction *use = peephole_at(context, use_index);
+    if (!peephole_is(mov, ASM_OP_MOV, 2) || mov->operands[0].type != ASM_IR_OPERAND_REGISTER ||
+        mov->operands[1].type != ASM_IR_OPERAND_IMMEDIATE || !use || use->total_operands != 2)
+    {
+        return false;
+    }
+
+    // Only mov to a register takes a full 64 bit immediate, everything else sign extends 32 bits
+    long long value = mov->operands[1].imm;
+    if (asm_ir_register_size(mov->operands[0].reg) == DATA_SIZE_DDWORD && value != (int)value)
+    {
+        return false;
+    }
+
+    switch (use->op)
+    {
+    case ASM_OP_MOV:
+    case ASM_OP_ADD:
+    case ASM_OP_SUB:
+    case ASM_OP_AND:
+    case ASM_OP_OR:
+    case ASM_OP_XOR:
+    case ASM_OP_CMP:
+        break;
+
+    default:
+        return false;
+    }
+
+    const char *reg = mov->operands[0].reg;
+    int reg_id = asm_ir_register_id(reg);
+    struct asm_ir_operand *target = &use->operands[0];
+    if (use->operands[1].type != ASM_IR_OPERAND_REGISTER || use->operands[1].reg != reg ||
+        peephole_uses_register(target, reg_id) ||
+        (target->type == ASM_IR_OPERAND_MEMORY && target->mem.size == 0) ||
+        (context->live_after[use_index] & ASM_IR_REG_MASK(reg_id)))
+    {
+        return false;
+    }
+
+    peephole_set_mov_source(use, &mov->operands[1]);
+    mov->total_operands = 1;
+    peephole_delete(mov);
+    return true;
+}
+
+static struct peephole_pattern peephole_patterns[PEEPHOLE_TOTAL_PATTERNS] = {
+    {PEEPHOLE_PATTERN_PUSH_POP, "push-pop", peephole_push_pop},
+    {PEEPHOLE_PATTERN_SELF_MOVE, "self-move", peephole_self_move},
+    {PEEPHOLE_PATTERN_MOVE_BACK, "move-back", peephole_move_back},
+    {PEEPHOLE_PATTERN_SETCC_BRANCH, "setcc-branch", peephole_setcc_branch},
+    {PEEPHOLE_PATTERN_ZERO_STACK_ADJUST, "zero-stack-adjust", peephole_zero_stack_adjust},
+    {PEEPHOLE_PATTERN_JUMP_TO_NEXT, "jump-to-next", peephole_jump_to_next},
+    {PEEPHOLE_PATTERN_UNREACHABLE, "unreachable", peephole_unreachable},
+    {PEEPHOLE_PATTERN_IMMEDIATE_OPERAND, "immediate-operand", peephole_immediate_operand},
+};
+
+static int peephole_count_instructions(struct asm_ir *ir)
+{
+    int total = 0;
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        if (ins->op != ASM_OP_LABEL && ins->op != ASM_OP_COMMENT && !(ins->flags & ASM_IR_INSTRUCTION_FLAG_DELETED))
+        {
+            total++;
+        }
+    }
+    return total;
+}
+
+void peephole_optimize(struct asm_ir *ir, int patterns, struct peephole_stats *stats)
+{
+    stats->instructions_before += peephole_count_instructions(ir);
+    bool changed = patterns != 0;
+    for (int pass = 0; changed && pass < PEEPHOLE_MAX_PASSES; pass++)
+    {
+        changed = false;
+        struct peephole_context context = {.ir = ir, .total = vector_count(ir->instructions)};
+        context.live_after = calloc(context.total + 1, sizeof(int));
+        asm_ir_liveness(ir, context.live_after);
+        for (int i = 0; i < context.total; i++)
+        {
+            if (asm_ir_at(ir, i)->flags & ASM_IR_INSTRUCTION_FLAG_DELETED)
+            {
+                continue;
+            }
+
+            for (int k = 0; k < PEEPHOLE_TOTAL_PATTERNS; k++)
+            {
+                struct peephole_pattern *pattern = &peephole_patterns[k];
+                if ((patterns & pattern->flag) && pattern->apply(&context, i))
+                {
+                    stats->hits[k]++;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+
+        free(context.live_after);
+        asm_ir_compact(ir);
+    }
+    stats->instructions_after += peephole_count_instructions(ir);
+}
+
+void peephole_stats_print(struct peephole_stats *stats, FILE *out)
+{
+    for (int i = 0; i < PEEPHOLE_TOTAL_PATTERNS; i++)
+    {
+        fprintf(out, "peephole %s: %i\n", peephole_patterns[i].name, stats->hits[i]);
+    }
+    fprintf(out, "peephole removed %i of %i instructions\n", stats->instructions_before - stats->instructions_after, stats->instructions_before);
+}
@@ -31,6 +31,10 @@ struct vector* preprocessor_line_macro_value(struct preprocessor_definition* def
 void preprocessor_create_definitions(struct preprocessor* preprocessor)
 {
     preprocessor_definition_create_native("__LINE__", preprocessor_line_macro_evaluate, preprocessor_line_macro_value, preprocessor);   
+    if (target_is_x86_64())
+    {
+        preprocessor_definition_create("__x86_64__", preprocessor_build_value_vector_for_integer(1), NULL, preprocessor);
+    }
 }
 
 struct symbol* native_create_function(struct compile_process* compiler, const char* name,
@@ -123,6 +123,12 @@ struct preprocessor_included_file *preprocessor_add_included_file(struct preproc
 
 void preprocessor_create_static_include(struct preprocessor *preprocessor, const char *filename, PREPROCESSOR_STATIC_INCLUDE_HANDLER_POST_CREATION creation_handler)
 {
+    // Static includes register native functions with the compile process, not only definitions
+    if (preprocessor->record)
+    {
+        preprocessor->record->uncacheable = true;
+    }
+
     struct preprocessor_included_file *included_file = preprocessor_add_included_file(preprocessor, filename);
     creation_handler(preprocessor, included_file);
 }
@@ -666,6 +672,33 @@ struct preprocessor_definition *preprocessor_definition_create_typedef(const cha
     return definition;
 }
 
+static void preprocessor_record_lookup(struct preprocessor_header_record *record, const char *name, struct preprocessor_definition *definition)
+{
+    bool builtin = false;
+    for (int i = 0; i < vector_count(record->builtins) && definition && !builtin; i++)
+    {
+        builtin = vector_peek_ptr_at(record->builtins, i) == definition;
+    }
+
+    // Definitions the header made itself come along with the cached tokens
+    if (definition && !builtin)
+    {
+        return;
+    }
+
+    for (int i = 0; i < vector_count(record->lookups); i++)
+    {
+        struct preprocessor_header_lookup *lookup = vector_at(record->lookups, i);
+        if (S_EQ(lookup->name, name))
+        {
+            return;
+        }
+    }
+
+    struct preprocessor_header_lookup lookup = {.name = name, .defined = definition != NULL};
+    vector_push(record->lookups, &lookup);
+}
+
 struct preprocessor_definition *preprocessor_get_definition(struct preprocessor *preprocessor, const char *name)
 {
     vector_set_peek_pointer(preprocessor->definitions, 0);
@@ -680,6 +713,11 @@ struct preprocessor_definition *preprocessor_get_definition(struct preprocessor
         definition = vector_peek_ptr(preprocessor->definitions);
     }
 
+    if (preprocessor->record)
+    {
+        preprocessor_record_lookup(preprocessor->record, name, definition);
+    }
+
     return definition;
 }
 
@@ -835,6 +873,10 @@ void preprocessor_handle_definition_token(struct compile_process *compiler)
 void preprocessor_handle_undef_token(struct compile_process *compiler)
 {
     struct token *name_token = preprocessor_next_token(compiler);
+    if (compiler->preprocessor->record)
+    {
+        compiler->preprocessor->record->uncacheable = true;
+    }
     preprocessor_definition_remove(compiler->preprocessor, name_token->sval);
 }
 void preprocessor_handle_warning_token(struct compile_process *compiler)
@@ -16,21 +16,35 @@ void native_va_start(struct generator* generator, struct native_function* func,
     {
         compiler_error(compiler, "Expecting a valid stack argument for va_start");
     }
-    generator->asm_push("; va_start on variable %s", stack_arg->sval);
+    generator->asm_push_comment("va_start on variable %s", stack_arg->sval);
     vector_set_peek_pointer(arguments, 0);
     generator->gen_exp(generator, stack_arg, EXPRESSION_GET_ADDRESS);
+    const char* address_reg = target_is_x86_64() ? "rbx" : "ebx";
+    if (target_is_x86_64())
+    {
+        // The list points at the last eight byte slot of the final argument, va_arg steps over it first
+        struct resolver_result* stack_arg_result = resolver_follow(compiler->resolver, stack_arg);
+        assert(resolver_result_ok(stack_arg_result));
+        size_t stack_arg_size = x86_64_stack_argument_size(resolver_result_entity_root(stack_arg_result)->dtype);
+        if (stack_arg_size > DATA_SIZE_DDWORD)
+        {
+            generator->asm_push_ins2(ASM_OP_ADD, asm_ir_reg(address_reg), asm_ir_imm(stack_arg_size - DATA_SIZE_DDWORD));
+        }
+    }
     
     struct resolver_result* result = resolver_follow(compiler->resolver, list_arg);
     assert(resolver_result_ok(result));
     struct resolver_entity* list_arg_entity = resolver_result_entity_root(result);
     struct generator_entity_address address_out;
     generator->entity_address(generator, list_arg_entity, &address_out);
-    generator->asm_push("mov dword [%s], ebx", address_out.address);
-    generator->asm_push("; va_start end for variable %s", stack_arg->sval);
+    struct asm_operand list = address_out.address;
+    list.size = target_current()->pointer_size;
+    generator->asm_push_ins2(ASM_OP_MOV, asm_ir_mem(list), asm_ir_reg(address_reg));
+    generator->asm_push_comment("va_start end for variable %s", stack_arg->sval);
 
     struct datatype void_datatype;
     datatype_set_void(&void_datatype);
-    generator->ret(&void_datatype, "0");
+    generator->ret(&void_datatype, asm_ir_imm(0));
 }
 
 // __builtin_va_arg(list, 4);
@@ -42,7 +56,7 @@ void native__builtin_va_arg(struct generator* generator, struct native_function*
         compiler_error(compiler, "va_arg expects two arguments, %i provided", vector_count(arguments));
     }
 
-    generator->asm_push("; native__builtin_va_arg start");
+    generator->asm_push_comment("native__builtin_va_arg start");
     vector_set_peek_pointer(arguments, 0);
     struct node* list_arg = vector_peek_ptr(arguments);
     generator->gen_exp(generator, list_arg, EXPRESSION_GET_ADDRESS);
@@ -52,21 +66,26 @@ void native__builtin_va_arg(struct generator* generator, struct native_function*
         compiler_error(compiler, "native__builtin_va_arg expects a second argument to be numeric size of variable argument. Use the macro va_arg for automation");
     }
 
-    generator->asm_push("add dword [ebx], %i", size_argument->llnum);
-    generator->asm_push("mov dword eax, [ebx]");
+    // Every argument takes a whole eight byte slot on x86-64
+    int size = (int)size_argument->llnum;
+    int step = target_is_x86_64() ? align_value(size, DATA_SIZE_DDWORD) : size;
+    int value_size = target_is_x86_64() && size > DATA_SIZE_DWORD ? DATA_SIZE_DDWORD : DATA_SIZE_DWORD;
+    int list_size = target_current()->pointer_size;
+    generator->asm_push_ins2(ASM_OP_ADD, asm_ir_mem((struct asm_operand){.base = "ebx", .size = list_size}), asm_ir_imm(step));
+    generator->asm_push_ins2(ASM_OP_MOV, asm_ir_sized(list_size, asm_ir_reg(target_is_x86_64() ? "rax" : "eax")), asm_ir_mem((struct asm_operand){.base = "ebx"}));
     struct datatype void_dtype;
     datatype_set_void(&void_dtype);
     void_dtype.pointer_depth++;
     void_dtype.flags |= DATATYPE_FLAG_IS_POINTER;
-    generator->ret(&void_dtype, "dword [eax]");
-    generator->asm_push("; native__builtin_va_arg end");
+    generator->ret(&void_dtype, asm_ir_mem((struct asm_operand){.base = "eax", .size = value_size}));
+    generator->asm_push_comment("native__builtin_va_arg end");
 }
 
 void native_va_end(struct generator* generator, struct native_function* func, struct vector* arguments)
 {
     struct datatype void_datatype;
     datatype_set_void(&void_datatype);
-    generator->ret(&void_datatype, "0");
+    generator->ret(&void_datatype, asm_ir_imm(0));
 }
 
 void preprocessor_stdarg_internal_include(struct preprocessor* preprocessor, struct preprocessor_included_file* file)
@@ -12,33 +12,20 @@ struct resolver_default_scope_data* resolver_default_scope_private(struct resolv
     return scope->private;
 }
 
-char* resolver_default_stack_asm_address(int stack_offset, char* out)
+struct asm_operand resolver_default_stack_asm_address(int stack_offset)
 {
-    if (stack_offset < 0)
-    {
-        sprintf(out, "ebp%i", stack_offset);
-        return out;
-    }
-
-    sprintf(out, "ebp+%i", stack_offset);
-    return out;
+    return (struct asm_operand){.base = "ebp", .displacement = stack_offset};
 }
 
-struct resolver_default_entity_data* resolver_default_new_entity_data()
+struct resolver_default_entity_data* resolver_default_new_entity_data(struct resolver_result* result)
 {
-    struct resolver_default_entity_data* entity_data = calloc(sizeof(struct resolver_default_entity_data), 1);
+    struct resolver_default_entity_data* entity_data = resolver_result_alloc(result, sizeof(struct resolver_default_entity_data));
     return entity_data;
 }
 
-void resolver_default_global_asm_address(const char* name, int offset, char* address_out)
+struct asm_operand resolver_default_global_asm_address(const char* name, int offset)
 {
-    if (offset == 0)
-    {
-        sprintf(address_out, "%s", name);
-        return;
-    }
-
-    sprintf(address_out, "%s+%i", name, offset);
+    return (struct asm_operand){.base = name, .displacement = offset};
 }
 
 void resolver_default_entity_data_set_address(struct resolver_default_entity_data* entity_data, struct node* var_node, int offset, int flags)
@@ -55,19 +42,17 @@ void resolver_default_entity_data_set_address(struct resolver_default_entity_dat
     entity_data->offset = offset;
     if (flags & RESOLVER_DEFAULT_ENTITY_FLAG_IS_LOCAL_STACK)
     {
-        resolver_default_stack_asm_address(offset, entity_data->address);
-        sprintf(entity_data->base_address, "ebp");
+        entity_data->address = resolver_default_stack_asm_address(offset);
     }
     else
     {
-        resolver_default_global_asm_address(variable_node(var_node)->var.name, offset, entity_data->address);
-        sprintf(entity_data->base_address, "%s", variable_node(var_node)->var.name);
+        entity_data->address = resolver_default_global_asm_address(variable_node(var_node)->var.name, offset);
     }
 }
 
 void* resolver_default_make_private(struct resolver_entity* entity, struct node* node, int offset, struct resolver_scope* scope)
 {
-    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data();
+    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data(entity->result);
     int entity_flags = 0x00;
     if (entity->flags & RESOLVER_ENTITY_FLAG_IS_STACK)
     {
@@ -92,14 +77,12 @@ void resolver_default_set_result_base(struct resolver_result* result, struct res
         return;
     }
 
-    strncpy(result->base.base_address, data->base_address, sizeof(result->base.base_address));
-    strncpy(result->base.address, data->address, sizeof(result->base.address));
-    result->base.offset = data->offset;
+    result->base.address = data->address;
 }
 
 struct resolver_default_entity_data* resolver_default_new_entity_data_for_var_node(struct node* var_node, int offset, int flags)
 {
-    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data();
+    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data(NULL);
     assert(variable_node(var_node));
     entity_data->offset = offset;
     entity_data->flags = flags;
@@ -108,19 +91,19 @@ struct resolver_default_entity_data* resolver_default_new_entity_data_for_var_no
     return entity_data;
 }
 
-struct resolver_default_entity_data* resolver_default_new_entity_data_for_array_bracket(struct node* breacket_node)
+struct resolver_default_entity_data* resolver_default_new_entity_data_for_array_bracket(struct resolver_result* result, struct node* breacket_node)
 {
-    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data();
+    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data(result);
     entity_data->type = RESOLVER_DEFAULT_ENTITY_DATA_TYPE_ARRAY_BRACKET;
     return entity_data;
 }
 
 struct resolver_default_entity_data* resolver_default_new_entity_data_for_function(struct node* func_node, int flags)
 {
-    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data();
+    struct resolver_default_entity_data* entity_data = resolver_default_new_entity_data(NULL);
     entity_data->flags = flags;
     entity_data->type = RESOLVER_DEFAULT_ENTITY_DATA_TYPE_FUNCTION;
-    resolver_default_global_asm_address(func_node->func.name, 0, entity_data->address);
+    entity_data->address = resolver_default_global_asm_address(func_node->func.name, 0);
     return entity_data;
 }
 
@@ -151,7 +134,7 @@ void resolver_default_finish_scope(struct resolver_process* resolver)
 
 void* resolver_default_new_array_entity(struct resolver_result* result, struct node* array_entity_node)
 {
-    return resolver_default_new_entity_data_for_array_bracket(array_entity_node);
+    return resolver_default_new_entity_data_for_array_bracket(result, array_entity_node);
 }
 
 void resolver_default_delete_entity(struct resolver_entity*  entity)
@@ -174,7 +157,7 @@ static void resolver_default_merge_array_calculate_out_offset(struct datatype* d
 struct resolver_entity* resolver_default_merge_entities(struct resolver_process* process, struct resolver_result* result, struct resolver_entity* left_entity, struct resolver_entity* right_entity)
 {
     int new_pos = left_entity->offset + right_entity->offset;
-    return resolver_make_entity(process, result, &right_entity->dtype, left_entity->node, &(struct resolver_entity){.type=right_entity->type, .flags=left_entity->flags,.offset=new_pos,.array=right_entity->array}, left_entity->scope);
+    return resolver_make_entity(process, result, right_entity->dtype, left_entity->node, &(struct resolver_entity){.type=right_entity->type, .flags=left_entity->flags,.offset=new_pos,.array=right_entity->array}, left_entity->scope);
 }
 
 struct resolver_process* resolver_default_new_process(struct compile_process* compiler)
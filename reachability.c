@@ -0,0 +1,286 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+
+/**
+ * Reachability of functions and globals.
+ *
+ * Runs before codegen. Every function with a body and every global that is not static can be used from
+ * another file, those are where we start. From there we follow the identifiers named by function bodies and
+ * global initializers. Static definitions and prototypes that are never reached get NODE_FLAG_IS_UNREFERENCED
+ * and codegen leaves them out. Identifiers are matched by name only, a local shadowing a global keeps the
+ * global alive which costs nothing but a few bytes.
+ */
+
+struct reachability_declaration
+{
+    const char *name;
+    struct node *node;
+    bool reached;
+};
+
+struct reachability
+{
+    // Sorted by name, a function can be declared more than once
+    struct reachability_declaration *declarations;
+    int total;
+
+    // Vector of struct node*, reached declarations whose body is still to be followed
+    struct vector *pending;
+};
+
+static void reachability_visit(struct reachability *reachability, struct node *node);
+
+static int reachability_declaration_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct reachability_declaration *)a)->name, ((const struct reachability_declaration *)b)->name);
+}
+
+static void reachability_add_declaration(struct reachability *reachability, const char *name, struct node *node)
+{
+    reachability->declarations = realloc(reachability->declarations, (reachability->total + 1) * sizeof(struct reachability_declaration));
+    reachability->declarations[reachability->total++] = (struct reachability_declaration){.name = name, .node = node};
+}
+
+static void reachability_collect(struct reachability *reachability, struct node *node)
+{
+    switch (node->type)
+    {
+    case NODE_TYPE_FUNCTION:
+        reachability_add_declaration(reachability, node->func.name, node);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        reachability_add_declaration(reachability, node->var.name, node);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        for (int i = 0; i < vector_count(node->var_list.list); i++)
+        {
+            reachability_collect(reachability, *(struct node **)vector_at(node->var_list.list, i));
+        }
+        break;
+
+    case NODE_TYPE_STRUCT:
+        if (node->flags & NODE_FLAG_HAS_VARIABLE_COMBINED)
+        {
+            reachability_collect(reachability, node->_struct.var);
+        }
+        break;
+
+    case NODE_TYPE_UNION:
+        if (node->flags & NODE_FLAG_HAS_VARIABLE_COMBINED)
+        {
+            reachability_collect(reachability, node->_union.var);
+        }
+        break;
+    }
+}
+
+static void reachability_reach(struct reachability *reachability, const char *name)
+{
+    // Lowest index holding the name
+    int low = 0;
+    int high = reachability->total;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (strcmp(reachability->declarations[middle].name, name) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (int i = low; i < reachability->total && S_EQ(reachability->declarations[i].name, name); i++)
+    {
+        struct reachability_declaration *declaration = &reachability->declarations[i];
+        if (!declaration->reached)
+        {
+            declaration->reached = true;
+            vector_push(reachability->pending, &declaration->node);
+        }
+    }
+}
+
+static void reachability_visit_vector(struct reachability *reachability, struct vector *nodes)
+{
+    for (int i = 0; i < vector_count(nodes); i++)
+    {
+        reachability_visit(reachability, *(struct node **)vector_at(nodes, i));
+    }
+}
+
+static void reachability_visit(struct reachability *reachability, struct node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+        reachability_reach(reachability, node->sval);
+        break;
+
+    case NODE_TYPE_EXPRESSION:
+        reachability_visit(reachability, node->exp.left);
+        reachability_visit(reachability, node->exp.right);
+        break;
+
+    case NODE_TYPE_EXPRESSION_PARENTHESES:
+        reachability_visit(reachability, node->parenthesis.exp);
+        break;
+
+    case NODE_TYPE_UNARY:
+        reachability_visit(reachability, node->unary.operand);
+        break;
+
+    case NODE_TYPE_TENARY:
+        reachability_visit(reachability, node->tenary.true_node);
+        reachability_visit(reachability, node->tenary.false_node);
+        break;
+
+    case NODE_TYPE_CAST:
+        reachability_visit(reachability, node->cast.operand);
+        break;
+
+    case NODE_TYPE_BRACKET:
+        reachability_visit(reachability, node->bracket.inner);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        reachability_visit(reachability, node->var.val);
+        break;
+
+    case NODE_TYPE_VARIABLE_LIST:
+        reachability_visit_vector(reachability, node->var_list.list);
+        break;
+
+    case NODE_TYPE_STRUCT:
+        if (node->flags & NODE_FLAG_HAS_VARIABLE_COMBINED)
+        {
+            reachability_visit(reachability, node->_struct.var);
+        }
+        break;
+
+    case NODE_TYPE_UNION:
+        if (node->flags & NODE_FLAG_HAS_VARIABLE_COMBINED)
+        {
+            reachability_visit(reachability, node->_union.var);
+        }
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        reachability_visit(reachability, node->func.body_n);
+        break;
+
+    case NODE_TYPE_BODY:
+        reachability_visit_vector(reachability, node->body.statements);
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        reachability_visit(reachability, node->stmt.return_stmt.exp);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        reachability_visit(reachability, node->stmt.if_stmt.cond_node);
+        reachability_visit(reachability, node->stmt.if_stmt.body_node);
+        reachability_visit(reachability, node->stmt.if_stmt.next);
+        break;
+
+    case NODE_TYPE_STATEMENT_ELSE:
+        reachability_visit(reachability, node->stmt.else_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        reachability_visit(reachability, node->stmt.while_stmt.exp_node);
+        reachability_visit(reachability, node->stmt.while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        reachability_visit(reachability, node->stmt.do_while_stmt.exp_node);
+        reachability_visit(reachability, node->stmt.do_while_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        reachability_visit(reachability, node->stmt.for_stmt.init_node);
+        reachability_visit(reachability, node->stmt.for_stmt.cond_node);
+        reachability_visit(reachability, node->stmt.for_stmt.loop_node);
+        reachability_visit(reachability, node->stmt.for_stmt.body_node);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        reachability_visit(reachability, node->stmt.switch_stmt.exp);
+        reachability_visit(reachability, node->stmt.switch_stmt.body);
+        break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+        reachability_visit(reachability, node->stmt._case.exp);
+        break;
+    }
+}
+
+static bool reachability_is_root(struct node *node)
+{
+    if (node->type == NODE_TYPE_FUNCTION)
+    {
+        return !function_node_is_prototype(node) && !(node->func.rtype->flags & DATATYPE_FLAG_IS_STATIC);
+    }
+
+    return !(node->var.type->flags & DATATYPE_FLAG_IS_STATIC);
+}
+
+// Only prototypes and static definitions can go, anything else is visible to other files
+static bool reachability_can_remove(struct node *node)
+{
+    if (node->type == NODE_TYPE_FUNCTION)
+    {
+        return function_node_is_prototype(node) || node->func.rtype->flags & DATATYPE_FLAG_IS_STATIC;
+    }
+
+    return node->var.type->flags & DATATYPE_FLAG_IS_STATIC;
+}
+
+void reachability_mark_unreferenced(struct compile_process *process)
+{
+    struct reachability reachability = {.pending = vector_create(sizeof(struct node *))};
+    struct vector *tree = process->node_tree_vec;
+    for (int i = 0; i < vector_count(tree); i++)
+    {
+        reachability_collect(&reachability, *(struct node **)vector_at(tree, i));
+    }
+
+    qsort(reachability.declarations, reachability.total, sizeof(struct reachability_declaration), reachability_declaration_compare);
+    for (int i = 0; i < reachability.total; i++)
+    {
+        struct reachability_declaration *declaration = &reachability.declarations[i];
+        if (reachability_is_root(declaration->node))
+        {
+            reachability_reach(&reachability, declaration->name);
+        }
+    }
+
+    while (vector_count(reachability.pending) > 0)
+    {
+        struct node *node = vector_back_ptr(reachability.pending);
+        vector_pop(reachability.pending);
+        reachability_visit(&reachability, node);
+    }
+
+    for (int i = 0; i < reachability.total; i++)
+    {
+        struct reachability_declaration *declaration = &reachability.declarations[i];
+        if (!declaration->reached && reachability_can_remove(declaration->node))
+        {
+            declaration->node->flags |= NODE_FLAG_IS_UNREFERENCED;
+        }
+    }
+
+    vector_free(reachability.pending);
+    free(reachability.declarations);
+}
@@ -0,0 +1,249 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <memory.h>
+
+/**
+ * Register allocation for expression temporaries.
+ *
+ * Codegen evaluates expressions as a stack machine, every intermediate value is pushed and later
+ * popped back into a register. Each push and the pop that takes the same value off the stack inside
+ * one basic block is the live range of a temporary. We hand that temporary a register nobody touches
+ * over the range and that is dead afterwards, the push and pop become moves. Temporaries with no free
+ * register stay on the stack, that is our spill.
+ *
+ * Codegen keeps tracking everything it pushed in the stack frame as before, only the emitted
+ * instructions change.
+ */
+
+// Deeper than this a sub esp is not followed slot by slot
+#define REGALLOC_MAX_TRACKED_SLOTS 1024
+
+static const int regalloc_preference[] = {ASM_IR_REG_EAX, ASM_IR_REG_ECX, ASM_IR_REG_EDX, ASM_IR_REG_EBX, ASM_IR_REG_ESI, ASM_IR_REG_EDI};
+
+static bool regalloc_is_esp_adjust(struct asm_ir_instruction *ins)
+{
+    return (ins->op == ASM_OP_ADD || ins->op == ASM_OP_SUB) && ins->total_operands == 2 &&
+           ins->operands[0].type == ASM_IR_OPERAND_REGISTER && asm_ir_register_id(ins->operands[0].reg) == ASM_IR_REG_ESP &&
+           ins->operands[1].type == ASM_IR_OPERAND_IMMEDIATE && ins->operands[1].imm >= 0 && ins->operands[1].imm % STACK_PUSH_SIZE == 0;
+}
+
+/**
+ * Follows the stack through one block and pairs every push with the pop that takes its value off again.
+ * Pairs come out ordered by their pop, so an inner pair always comes before the pair around it.
+ */
+static void regalloc_match_pushes(struct asm_ir *ir, int start, int end, struct vector *pending, struct vector *pairs)
+{
+    vector_clear(pending);
+    for (int i = start; i < end; i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        struct asm_ir_effects effects;
+        asm_ir_instruction_effects(ins, &effects);
+        if (regalloc_is_esp_adjust(ins))
+        {
+            int slots = ins->operands[1].imm / STACK_PUSH_SIZE;
+            if (ins->op == ASM_OP_ADD)
+            {
+                while (slots-- > 0 && vector_count(pending) > 0)
+                {
+                    vector_pop(pending);
+                }
+                continue;
+            }
+
+            if (slots > REGALLOC_MAX_TRACKED_SLOTS)
+            {
+                vector_clear(pending);
+                continue;
+            }
+
+            // Room made on the stack, nothing we can pair with
+            int unpaired = -1;
+            while (slots-- > 0)
+            {
+                vector_push(pending, &unpaired);
+            }
+            continue;
+        }
+
+        if ((ins->op == ASM_OP_PUSH || ins->op == ASM_OP_POP) && !effects.stack_barrier && asm_ir_operand_is_dword(&ins->operands[0]))
+        {
+            if (ins->op == ASM_OP_PUSH)
+            {
+                vector_push(pending, &i);
+                continue;
+            }
+
+            if (vector_count(pending) > 0)
+            {
+                int push_index = *(int *)vector_back(pending);
+                vector_pop(pending);
+                if (push_index != -1)
+                {
+                    int pair[2] = {push_index, i};
+                    vector_push(pairs, pair);
+                }
+            }
+            continue;
+        }
+
+        if (effects.stack_barrier || ins->op == ASM_OP_PUSH || ins->op == ASM_OP_POP)
+        {
+            vector_clear(pending);
+        }
+
+        // The padding before the call counted these slots, as moves they would leave the call misaligned
+        if (ins->op == ASM_OP_CALL && target_current()->aligned_calls)
+        {
+            for (int k = 0; k < vector_count(pending); k++)
+            {
+                *(int *)vector_at(pending, k) = -1;
+            }
+        }
+    }
+}
+
+static void regalloc_assign(struct asm_ir_instruction *push, struct asm_ir_instruction *pop, int reg)
+{
+    const char *reg_name = asm_ir_register_name(reg);
+    struct asm_ir_operand *value = &push->operands[0];
+    if (value->type == ASM_IR_OPERAND_REGISTER && value->reg == reg_name)
+    {
+        push->flags |= ASM_IR_INSTRUCTION_FLAG_DELETED;
+    }
+    else
+    {
+        // The source keeps its strings, they move over with the operand
+        push->operands[1] = *value;
+        push->operands[1].size = 0;
+        if (value->type == ASM_IR_OPERAND_MEMORY)
+        {
+            push->operands[1].mem.size = 0;
+        }
+        push->operands[0] = (struct asm_ir_operand){.type = ASM_IR_OPERAND_REGISTER, .reg = reg_name};
+        push->op = ASM_OP_MOV;
+        push->total_operands = 2;
+    }
+
+    struct asm_ir_operand *target = &pop->operands[0];
+    if (target->type == ASM_IR_OPERAND_REGISTER && target->reg == reg_name)
+    {
+        pop->flags |= ASM_IR_INSTRUCTION_FLAG_DELETED;
+        return;
+    }
+
+    pop->operands[1] = (struct asm_ir_operand){.type = ASM_IR_OPERAND_REGISTER, .reg = reg_name};
+    pop->op = ASM_OP_MOV;
+    pop->total_operands = 2;
+}
+
+static int regalloc_choose_register(struct asm_ir *ir, int push_index, int pop_index, int *live_after)
+{
+    int busy = 0;
+    for (int i = push_index + 1; i < pop_index; i++)
+    {
+        struct asm_ir_effects effects;
+        asm_ir_instruction_effects(asm_ir_at(ir, i), &effects);
+        busy |= effects.reads | effects.writes;
+    }
+
+    // Popping into a register that is free over the range, the temporary can live there from the start
+    struct asm_ir_operand *target = &asm_ir_at(ir, pop_index)->operands[0];
+    if (target->type == ASM_IR_OPERAND_REGISTER)
+    {
+        int id = asm_ir_register_id(target->reg);
+        if ((ASM_IR_REG_MASK(id) & ASM_IR_REG_ALLOCATABLE) && !(ASM_IR_REG_MASK(id) & busy))
+        {
+            return id;
+        }
+    }
+
+    struct asm_ir_effects pop_effects;
+    asm_ir_instruction_effects(asm_ir_at(ir, pop_index), &pop_effects);
+    busy |= pop_effects.reads | live_after[pop_index];
+    for (int i = 0; i < sizeof(regalloc_preference) / sizeof(regalloc_preference[0]); i++)
+    {
+        if (!(ASM_IR_REG_MASK(regalloc_preference[i]) & busy))
+        {
+            return regalloc_preference[i];
+        }
+    }
+
+    return -1;
+}
+
+void regalloc_temporaries(struct asm_ir *ir)
+{
+    int total = vector_count(ir->instructions);
+    if (total == 0)
+    {
+        return;
+    }
+
+    int *live_after = calloc(total, sizeof(int));
+    asm_ir_liveness(ir, live_after);
+
+    struct vector *blocks = asm_ir_basic_blocks(ir);
+    struct vector *pending = vector_create(sizeof(int));
+    struct vector *pairs = vector_create(sizeof(int[2]));
+    for (int i = 0; i < vector_count(blocks); i++)
+    {
+        struct asm_ir_block *block = vector_at(blocks, i);
+        vector_clear(pairs);
+        regalloc_match_pushes(ir, block->start, block->end, pending, pairs);
+        for (int k = 0; k < vector_count(pairs); k++)
+        {
+            int *pair = vector_at(pairs, k);
+            int reg = regalloc_choose_register(ir, pair[0], pair[1], live_after);
+            if (reg != -1)
+            {
+                regalloc_assign(asm_ir_at(ir, pair[0]), asm_ir_at(ir, pair[1]), reg);
+            }
+        }
+    }
+
+    vector_free(pairs);
+    vector_free(pending);
+    vector_free(blocks);
+    free(live_after);
+    asm_ir_compact(ir);
+}
+
+/**
+ * Codegen saves and restores every callee saved register of the target around each function, here the
+ * saves and restores of registers the function never writes are dropped again. Calls do not count as
+ * writes, whoever we call hands the registers back to us.
+ */
+void regalloc_callee_saved(struct asm_ir *ir)
+{
+    int written = 0;
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        struct asm_ir_effects effects;
+        asm_ir_instruction_effects(ins, &effects);
+        if (!(ins->flags & ASM_IR_INSTRUCTION_FLAG_CALLEE_SAVED))
+        {
+            written |= effects.writes;
+        }
+    }
+
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        if (!(ins->flags & ASM_IR_INSTRUCTION_FLAG_CALLEE_SAVED))
+        {
+            continue;
+        }
+
+        // mov [ebp-x], reg saves and mov reg, [ebp-x] restores
+        struct asm_ir_operand *reg = ins->operands[0].type == ASM_IR_OPERAND_REGISTER ? &ins->operands[0] : &ins->operands[1];
+        if (!(written & ASM_IR_REG_MASK(asm_ir_register_id(reg->reg))))
+        {
+            ins->flags |= ASM_IR_INSTRUCTION_FLAG_DELETED;
+        }
+    }
+
+    asm_ir_compact(ir);
+}
@@ -2,6 +2,7 @@
 #include "helpers/vector.h"
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
 void resolver_follow_part(struct resolver_process *resolver, struct node *node, struct resolver_result *result);
 struct resolver_entity *resolver_follow_exp(struct resolver_process *resolver, struct node *node, struct resolver_result *result);
 struct resolver_result *resolver_follow(struct resolver_process *resolver, struct node *node);
@@ -33,15 +34,16 @@ struct resolver_entity *resolver_result_entity_next(struct resolver_entity *enti
     return entity->next;
 }
 
-struct resolver_entity *resolver_entity_clone(struct resolver_entity *entity)
+struct resolver_entity *resolver_entity_clone(struct resolver_result *result, struct resolver_entity *entity)
 {
     if (!entity)
     {
         return NULL;
     }
 
-    struct resolver_entity *new_entity = calloc(1, sizeof(struct resolver_entity));
+    struct resolver_entity *new_entity = resolver_result_alloc(result, sizeof(struct resolver_entity));
     memcpy(new_entity, entity, sizeof(struct resolver_entity));
+    new_entity->result = result;
     return new_entity;
 }
 
@@ -55,17 +57,93 @@ struct resolver_entity *resolver_result_entity(struct resolver_result *result)
     return result->entity;
 }
 
-struct resolver_result *resolver_new_result(struct resolver_process *process)
+void *resolver_pool_alloc(struct resolver_pool *pool, size_t size)
 {
-    struct resolver_result *result = calloc(1, sizeof(struct resolver_result));
-    result->array_data.array_entities = vector_create(sizeof(struct resolver_entity *));
-    return result;
+    size = align_value(size, sizeof(long long));
+    struct resolver_pool_chunk *chunk = pool->chunks;
+    if (!chunk || chunk->used + size > chunk->size)
+    {
+        chunk = pool->free_chunks;
+        if (chunk && size <= chunk->size)
+        {
+            pool->free_chunks = chunk->next;
+        }
+        else
+        {
+            size_t chunk_size = size > RESOLVER_POOL_CHUNK_SIZE ? size : RESOLVER_POOL_CHUNK_SIZE;
+            chunk = malloc(sizeof(struct resolver_pool_chunk) + chunk_size);
+            chunk->size = chunk_size;
+        }
+
+        chunk->used = 0;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+    }
+
+    void *ptr = &chunk->data[chunk->used];
+    chunk->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+struct vector *resolver_pool_vector(struct resolver_pool *pool, size_t esize)
+{
+    if (!pool->vectors)
+    {
+        pool->vectors = vector_create(sizeof(struct vector *));
+    }
+
+    struct vector *vector = vector_create(esize);
+    vector_push(pool->vectors, &vector);
+    return vector;
+}
+
+void resolver_pool_reset(struct resolver_pool *pool)
+{
+    for (int i = 0; pool->vectors && i < vector_count(pool->vectors); i++)
+    {
+        vector_free(*(struct vector **)vector_at(pool->vectors, i));
+    }
+
+    if (pool->vectors)
+    {
+        vector_clear(pool->vectors);
+    }
+
+    while (pool->chunks)
+    {
+        struct resolver_pool_chunk *chunk = pool->chunks;
+        pool->chunks = chunk->next;
+        chunk->next = pool->free_chunks;
+        pool->free_chunks = chunk;
+    }
+}
+
+void *resolver_result_alloc(struct resolver_result *result, size_t size)
+{
+    if (!result)
+    {
+        return calloc(1, size);
+    }
+
+    return resolver_pool_alloc(&result->resolver->pool, size);
 }
 
-void resolver_result_free(struct resolver_result *result)
+struct vector *resolver_result_vector(struct resolver_result *result, size_t esize)
 {
-    vector_free(result->array_data.array_entities);
-    free(result);
+    if (!result)
+    {
+        return vector_create(esize);
+    }
+
+    return resolver_pool_vector(&result->resolver->pool, esize);
+}
+
+struct resolver_result *resolver_new_result(struct resolver_process *process)
+{
+    struct resolver_result *result = resolver_pool_alloc(&process->pool, sizeof(struct resolver_result));
+    result->resolver = process;
+    return result;
 }
 
 struct resolver_scope *resolver_process_scope_current(struct resolver_process *process)
@@ -148,6 +226,10 @@ out:
 
 struct vector *resolver_array_data_vec(struct resolver_result *result)
 {
+    if (!result->array_data.array_entities)
+    {
+        result->array_data.array_entities = resolver_result_vector(result, sizeof(struct resolver_entity *));
+    }
     return result->array_data.array_entities;
 }
 
@@ -166,6 +248,11 @@ struct resolver_scope *resolver_scope_root(struct resolver_process *process)
     return process->scope.root;
 }
 
+void resolver_follow_cache_invalidate(struct resolver_process *resolver)
+{
+    resolver->follow_cache.generation++;
+}
+
 struct resolver_scope *resolver_new_scope_create()
 {
     struct resolver_scope *scope = calloc(1, sizeof(struct resolver_scope));
@@ -186,15 +273,43 @@ struct resolver_scope *resolver_new_scope(struct resolver_process *resolver, voi
     resolver->scope.current = scope;
     scope->private = private;
     scope->flags = flags;
+    resolver_follow_cache_invalidate(resolver);
     return scope;
 }
 
+void resolver_follow_stats_print(struct resolver_process *resolver, FILE *out)
+{
+    fprintf(out, "resolver followed %i nodes, %i from the cache, %i missed after an invalidation\n", resolver->follow_cache.follows, resolver->follow_cache.hits, resolver->follow_cache.stale);
+}
+
+void resolver_begin_statement(struct resolver_process *resolver)
+{
+    resolver->statement_depth++;
+}
+
+void resolver_finish_statement(struct resolver_process *resolver)
+{
+    assert(resolver->statement_depth > 0);
+    resolver->statement_depth--;
+    if (resolver->statement_depth == 0)
+    {
+        resolver_pool_reset(&resolver->pool);
+        resolver_follow_cache_invalidate(resolver);
+    }
+}
+
 void resolver_finish_scope(struct resolver_process *resolver)
 {
     struct resolver_scope *scope = resolver->scope.current;
     resolver->scope.current = scope->prev;
     resolver->callbacks.delete_scope(scope);
     free(scope);
+    resolver_follow_cache_invalidate(resolver);
+    if (resolver->scope.current == resolver->scope.root)
+    {
+        // Results followed outside any statement, i.e. in global initializers, go with the function.
+        resolver_pool_reset(&resolver->pool);
+    }
 }
 
 struct resolver_process *resolver_new_process(struct compile_process *compiler, struct resolver_callbacks *callbacks)
@@ -209,14 +324,20 @@ struct resolver_process *resolver_new_process(struct compile_process *compiler,
 
 struct resolver_entity *resolver_create_new_entity(struct resolver_result *result, int type, void *private)
 {
-    struct resolver_entity *entity = calloc(1, sizeof(struct resolver_entity));
+    struct resolver_entity *entity = resolver_result_alloc(result, sizeof(struct resolver_entity));
     if (!entity)
     {
         return NULL;
     }
 
+    entity->result = result;
     entity->type = type;
     entity->private = private;
+    if (result)
+    {
+        // Rules and unary entities only get a datatype once they are finalized
+        entity->dtype = resolver_compiler(result->resolver)->datatypes->empty;
+    }
     return entity;
 }
 
@@ -233,7 +354,7 @@ struct resolver_entity *resolver_create_new_entity_for_unsupported_node(struct r
     return entity;
 }
 
-struct resolver_entity *resolver_create_new_entity_for_array_bracket(struct resolver_result *result, struct resolver_process *process, struct node *node, struct node *array_index_node, int index, struct datatype *dtype, void *private, struct resolver_scope *scope)
+struct resolver_entity *resolver_create_new_entity_for_array_bracket(struct resolver_result *result, struct resolver_process *process, struct node *node, struct node *array_index_node, int index, const struct datatype *dtype, void *private, struct resolver_scope *scope)
 {
     struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_ARRAY_BRACKET, private);
     if (!entity)
@@ -244,10 +365,10 @@ struct resolver_entity *resolver_create_new_entity_for_array_bracket(struct reso
     entity->scope = scope;
     assert(entity->scope);
     entity->name = NULL;
-    entity->dtype = *dtype;
+    entity->dtype = dtype;
     entity->node = node;
     entity->array.index = index;
-    entity->array.dtype = *dtype;
+    entity->array.dtype = dtype;
     entity->array.array_index_node = array_index_node;
     int array_index_val = 1;
     if (array_index_node->type == NODE_TYPE_NUMBER)
@@ -258,7 +379,7 @@ struct resolver_entity *resolver_create_new_entity_for_array_bracket(struct reso
     return entity;
 }
 
-struct resolver_entity *resolver_create_new_entity_for_merged_array_bracket(struct resolver_result *result, struct resolver_process *process, struct node *node, struct node *array_index_node, int index, struct datatype *dtype, void *private, struct resolver_scope *scope)
+struct resolver_entity *resolver_create_new_entity_for_merged_array_bracket(struct resolver_result *result, struct resolver_process *process, struct node *node, struct node *array_index_node, int index, const struct datatype *dtype, void *private, struct resolver_scope *scope)
 {
     struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_ARRAY_BRACKET, private);
     if (!entity)
@@ -269,15 +390,15 @@ struct resolver_entity *resolver_create_new_entity_for_merged_array_bracket(stru
     entity->scope = scope;
     assert(entity->scope);
     entity->name = NULL;
-    entity->dtype = *dtype;
+    entity->dtype = dtype;
     entity->node = node;
     entity->array.index = index;
-    entity->array.dtype = *dtype;
+    entity->array.dtype = dtype;
     entity->array.array_index_node = array_index_node;
     return entity;
 }
 
-struct resolver_entity *resolver_create_new_unknown_entity(struct resolver_process *process, struct resolver_result *result, struct datatype *dtype, struct node *node, struct resolver_scope *scope, int offset)
+struct resolver_entity *resolver_create_new_unknown_entity(struct resolver_process *process, struct resolver_result *result, const struct datatype *dtype, struct node *node, struct resolver_scope *scope, int offset)
 {
     struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_GENERAL, NULL);
     if (!entity)
@@ -287,7 +408,7 @@ struct resolver_entity *resolver_create_new_unknown_entity(struct resolver_proce
 
     entity->flags |= RESOLVER_ENTITY_FLAG_NO_MERGE_WITH_NEXT_ENTITY | RESOLVER_ENTITY_FLAG_NO_MERGE_WITH_LEFT_ENTITY;
     entity->scope = scope;
-    entity->dtype = *dtype;
+    entity->dtype = dtype;
     entity->node = node;
     entity->offset = offset;
     return entity;
@@ -318,7 +439,7 @@ struct resolver_entity *resolver_create_new_unary_indirection_entity(struct reso
  * @param offset
  * @return struct resolver_entity*
  */
-struct resolver_entity *resolver_create_new_unary_get_address_entity(struct resolver_process *process, struct resolver_result *result, struct datatype *dtype, struct node *node, struct resolver_scope *scope, int offset)
+struct resolver_entity *resolver_create_new_unary_get_address_entity(struct resolver_process *process, struct resolver_result *result, const struct datatype *dtype, struct node *node, struct resolver_scope *scope, int offset)
 {
     struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_UNARY_GET_ADDRESS, NULL);
     if (!entity)
@@ -330,15 +451,16 @@ struct resolver_entity *resolver_create_new_unary_get_address_entity(struct reso
     entity->node = node;
     entity->scope = scope;
 
-    entity->dtype = *dtype;
-    entity->dtype.flags |= DATATYPE_FLAG_IS_POINTER;
-    entity->dtype.pointer_depth++;
+    struct datatype address_dtype = *dtype;
+    address_dtype.flags |= DATATYPE_FLAG_IS_POINTER;
+    address_dtype.pointer_depth++;
+    entity->dtype = datatype_intern(resolver_compiler(process), &address_dtype);
     return entity;
 }
 
-struct resolver_entity *resolver_create_new_cast_entity(struct resolver_process *process, struct resolver_scope *scope, struct datatype *cast_dtype)
+struct resolver_entity *resolver_create_new_cast_entity(struct resolver_process *process, struct resolver_result *result, struct resolver_scope *scope, const struct datatype *cast_dtype)
 {
-    struct resolver_entity *entity = resolver_create_new_entity(NULL, RESOLVER_ENTITY_TYPE_CAST, NULL);
+    struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_CAST, NULL);
     if (!entity)
     {
         return NULL;
@@ -346,14 +468,14 @@ struct resolver_entity *resolver_create_new_cast_entity(struct resolver_process
 
     entity->flags = RESOLVER_ENTITY_FLAG_NO_MERGE_WITH_LEFT_ENTITY | RESOLVER_ENTITY_FLAG_NO_MERGE_WITH_NEXT_ENTITY;
     entity->scope = scope;
-    entity->dtype = *cast_dtype;
+    entity->dtype = cast_dtype;
     return entity;
 }
 
-struct resolver_entity *resolver_create_new_entity_for_var_node_custom_scope(struct resolver_process *process, struct node *var_node, void *private, struct resolver_scope *scope, int offset)
+struct resolver_entity *resolver_create_new_entity_for_var_node_custom_scope(struct resolver_process *process, struct resolver_result *result, struct node *var_node, void *private, struct resolver_scope *scope, int offset)
 {
     assert(var_node->type == NODE_TYPE_VARIABLE);
-    struct resolver_entity *entity = resolver_create_new_entity(NULL, RESOLVER_ENTITY_TYPE_VARIABLE, private);
+    struct resolver_entity *entity = resolver_create_new_entity(result, RESOLVER_ENTITY_TYPE_VARIABLE, private);
     if (!entity)
     {
         return NULL;
@@ -371,12 +493,12 @@ struct resolver_entity *resolver_create_new_entity_for_var_node_custom_scope(str
 
 struct resolver_entity *resolver_create_new_entity_for_var_node(struct resolver_process *process, struct node *var_node, void *private, int offset)
 {
-    return resolver_create_new_entity_for_var_node_custom_scope(process, var_node, private, resolver_scope_current(process), offset);
+    return resolver_create_new_entity_for_var_node_custom_scope(process, NULL, var_node, private, resolver_scope_current(process), offset);
 }
 
-struct resolver_entity *resolver_new_entity_for_var_node_no_push(struct resolver_process *process, struct node *var_node, void *private, int offset, struct resolver_scope *scope)
+struct resolver_entity *resolver_new_entity_for_var_node_no_push(struct resolver_process *process, struct resolver_result *result, struct node *var_node, void *private, int offset, struct resolver_scope *scope)
 {
-    struct resolver_entity *entity = resolver_create_new_entity_for_var_node_custom_scope(process, var_node, private, scope, offset);
+    struct resolver_entity *entity = resolver_create_new_entity_for_var_node_custom_scope(process, result, var_node, private, scope, offset);
     if (!entity)
     {
         return NULL;
@@ -392,13 +514,14 @@ struct resolver_entity *resolver_new_entity_for_var_node_no_push(struct resolver
 
 struct resolver_entity *resolver_new_entity_for_var_node(struct resolver_process *process, struct node *var_node, void *private, int offset)
 {
-    struct resolver_entity *entity = resolver_new_entity_for_var_node_no_push(process, var_node, private, offset, resolver_process_scope_current(process));
+    struct resolver_entity *entity = resolver_new_entity_for_var_node_no_push(process, NULL, var_node, private, offset, resolver_process_scope_current(process));
     if (!entity)
     {
         return NULL;
     }
 
     vector_push(process->scope.current->entities, &entity);
+    resolver_follow_cache_invalidate(process);
     return entity;
 }
 
@@ -409,7 +532,7 @@ void resolver_new_entity_for_rule(struct resolver_process *process, struct resol
     resolver_result_entity_push(result, entity_rule);
 }
 
-struct resolver_entity *resolver_make_entity(struct resolver_process *process, struct resolver_result *result, struct datatype *custom_dtype, struct node *node, struct resolver_entity *guided_entity, struct resolver_scope *scope)
+struct resolver_entity *resolver_make_entity(struct resolver_process *process, struct resolver_result *result, const struct datatype *custom_dtype, struct node *node, struct resolver_entity *guided_entity, struct resolver_scope *scope)
 {
     struct resolver_entity *entity = NULL;
     int offset = guided_entity->offset;
@@ -417,7 +540,7 @@ struct resolver_entity *resolver_make_entity(struct resolver_process *process, s
     switch (node->type)
     {
     case NODE_TYPE_VARIABLE:
-        entity = resolver_new_entity_for_var_node_no_push(process, node, NULL, offset, scope);
+        entity = resolver_new_entity_for_var_node_no_push(process, result, node, NULL, offset, scope);
         break;
 
     default:
@@ -429,7 +552,7 @@ struct resolver_entity *resolver_make_entity(struct resolver_process *process, s
         entity->flags |= flags;
         if (custom_dtype)
         {
-            entity->dtype = *custom_dtype;
+            entity->dtype = custom_dtype;
         }
 
         entity->private = process->callbacks.make_private(entity, node, offset, scope);
@@ -447,7 +570,7 @@ struct resolver_entity *resolver_create_new_entity_for_function_call(struct reso
 
     entity->dtype = left_operand_entity->dtype;
     entity->name = left_operand_entity->name;
-    entity->func_call_data.arguments = vector_create(sizeof(struct node *));
+    entity->func_call_data.arguments = resolver_result_vector(result, sizeof(struct node *));
     return entity;
 }
 
@@ -464,6 +587,7 @@ struct resolver_entity *resolver_register_function(struct resolver_process *proc
     entity->dtype = func_node->func.rtype;
     entity->scope = resolver_process_scope_current(process);
     vector_push(process->scope.root->entities, &entity);
+    resolver_follow_cache_invalidate(process);
     return entity;
 }
 
@@ -476,13 +600,16 @@ struct resolver_entity* resolver_create_new_entity_for_native_function(struct re
     }
 
     // Make a void return type
-    datatype_set_void(&entity->dtype);
-    make_function_node(&entity->dtype, name, NULL, NULL);
+    struct datatype void_dtype;
+    datatype_set_void(&void_dtype);
+    entity->dtype = datatype_intern(resolver_compiler(process), &void_dtype);
+    make_function_node(entity->dtype, name, NULL, NULL);
     entity->node = node_pop();
     entity->name = name;
     entity->native_func.symbol = native_func_symbol;
     entity->scope = resolver_process_scope_current(process);
     vector_push(process->scope.root->entities, &entity);
+    resolver_follow_cache_invalidate(process);
     return entity;
 }
 
@@ -495,14 +622,13 @@ struct resolver_entity *resolver_get_entity_in_scope_with_entity_type(struct res
     if (result && result->last_struct_union_entity)
     {
         struct resolver_scope *scope = result->last_struct_union_entity->scope;
-        struct node *out_node = NULL;
-        struct datatype *node_var_datatype = &result->last_struct_union_entity->dtype;
-        int offset = struct_offset(resolver_compiler(resolver), node_var_datatype->type_str, entity_name, &out_node, 0, 0);
-        if (node_var_datatype->type == DATA_TYPE_UNION)
+        const struct datatype *node_var_datatype = result->last_struct_union_entity->dtype;
+        struct struct_layout_field *field = struct_layout_field_for_name(resolver_compiler(resolver), node_var_datatype->type_str, entity_name);
+        if (!field)
         {
-            offset = 0;
+            compiler_error(resolver_compiler(resolver), "%s %s has no member named %s\n", node_var_datatype->type == DATA_TYPE_UNION ? "union" : "struct", node_var_datatype->type_str, entity_name);
         }
-        return resolver_make_entity(resolver, result, NULL, out_node, &(struct resolver_entity){.type = RESOLVER_ENTITY_TYPE_VARIABLE, .offset = offset}, scope);
+        return resolver_make_entity(resolver, result, NULL, field->var_node, &(struct resolver_entity){.type = RESOLVER_ENTITY_TYPE_VARIABLE, .offset = field->offset}, scope);
     }
 
     // Dealing with a primtiive type
@@ -594,7 +720,7 @@ struct resolver_entity *resolver_get_function(struct resolver_result *result, st
 
 struct resolver_entity *resolver_follow_for_name(struct resolver_process *resolver, const char *name, struct resolver_result *result)
 {
-    struct resolver_entity *entity = resolver_entity_clone(resolver_get_entity(result, resolver, name));
+    struct resolver_entity *entity = resolver_entity_clone(result, resolver_get_entity(result, resolver, name));
     if (!entity)
     {
         return NULL;
@@ -608,8 +734,8 @@ struct resolver_entity *resolver_follow_for_name(struct resolver_process *resolv
         result->identifier = entity;
     }
 
-    if (entity->type == RESOLVER_ENTITY_TYPE_VARIABLE && datatype_is_struct_or_union(&entity->var_data.dtype) ||
-        (entity->type == RESOLVER_ENTITY_TYPE_FUNCTION && datatype_is_struct_or_union(&entity->dtype)))
+    if (entity->type == RESOLVER_ENTITY_TYPE_VARIABLE && datatype_is_struct_or_union(entity->var_data.dtype) ||
+        (entity->type == RESOLVER_ENTITY_TYPE_FUNCTION && datatype_is_struct_or_union(entity->dtype)))
     {
         result->last_struct_union_entity = entity;
     }
@@ -682,7 +808,7 @@ struct resolver_entity *resolver_follow_array(struct resolver_process *resolver,
     return left_entity;
 }
 
-struct datatype *resolver_get_datatype(struct resolver_process *resolver, struct node *node)
+const struct datatype *resolver_get_datatype(struct resolver_process *resolver, struct node *node)
 {
     struct resolver_result *result = resolver_follow(resolver, node);
     if (!resolver_result_ok(result))
@@ -690,7 +816,7 @@ struct datatype *resolver_get_datatype(struct resolver_process *resolver, struct
         return NULL;
     }
 
-    return &result->last_entity->dtype;
+    return result->last_entity->dtype;
 }
 
 void resolver_build_function_call_arguments(struct resolver_process *resolver, struct node *argument_node, struct resolver_entity *root_func_call_entity, size_t *total_size_out)
@@ -709,18 +835,18 @@ void resolver_build_function_call_arguments(struct resolver_process *resolver, s
     else if (node_valid(argument_node))
     {
         vector_push(root_func_call_entity->func_call_data.arguments, &argument_node);
-        size_t stack_change = DATA_SIZE_DWORD;
-        struct datatype *dtype = resolver_get_datatype(resolver, argument_node);
+        size_t stack_change = STACK_PUSH_SIZE;
+        const struct datatype *dtype = resolver_get_datatype(resolver, argument_node);
         if (dtype)
         {
-            // 4 bytes unless its a structure
+            // One push unless its a structure
             stack_change = datatype_element_size(dtype);
-            if (stack_change < DATA_SIZE_DWORD)
+            if (stack_change < STACK_PUSH_SIZE)
             {
-                stack_change = DATA_SIZE_DWORD;
+                stack_change = STACK_PUSH_SIZE;
             }
 
-            stack_change = align_value(stack_change, DATA_SIZE_DWORD);
+            stack_change = align_value(stack_change, STACK_PUSH_SIZE);
         }
         *total_size_out += stack_change;
     }
@@ -792,7 +918,7 @@ struct resolver_entity *resolver_follow_array_bracket(struct resolver_process *r
     struct resolver_scope *scope = NULL;
     struct resolver_entity *last_entity = resolver_result_peek_ignore_rule_entity(result);
     scope = last_entity->scope;
-    dtype = last_entity->dtype;
+    dtype = *last_entity->dtype;
     if (last_entity->type == RESOLVER_ENTITY_TYPE_ARRAY_BRACKET)
     {
         index = last_entity->array.index + 1;
@@ -805,13 +931,14 @@ struct resolver_entity *resolver_follow_array_bracket(struct resolver_process *r
 
     // We need to reduce the dtype
     void *private = resolver->callbacks.new_array_entity(result, node);
-    struct resolver_entity *array_bracket_entity = resolver_create_new_entity_for_array_bracket(result, resolver, node, node->bracket.inner, index, &dtype, private, scope);
+    struct resolver_entity *array_bracket_entity = resolver_create_new_entity_for_array_bracket(result, resolver, node, node->bracket.inner, index, datatype_intern(resolver_compiler(resolver), &dtype), private, scope);
     struct resolver_entity_rule rule = {};
     resolver_array_bracket_set_flags(array_bracket_entity, &dtype, node, index);
     last_entity->flags |= RESOLVER_ENTITY_FLAG_USES_ARRAY_BRACKETS;
     if (array_bracket_entity->flags & RESOLVER_ENTITY_FLAG_IS_POINTER_ARRAY_ENTITY)
     {
-        datatype_decrement_pointer(&array_bracket_entity->dtype);
+        datatype_decrement_pointer(&dtype);
+        array_bracket_entity->dtype = datatype_intern(resolver_compiler(resolver), &dtype);
     }
 
     resolver_result_entity_push(result, array_bracket_entity);
@@ -854,8 +981,8 @@ struct resolver_entity *resolver_follow_cast(struct resolver_process *resolver,
     operand_entity = resolver_result_peek(result);
     operand_entity->flags |= RESOLVER_ENTITY_FLAG_WAS_CASTED;
 
-    struct resolver_entity *cast_entity = resolver_create_new_cast_entity(resolver, operand_entity->scope, &node->cast.dtype);
-    if (datatype_is_struct_or_union(&node->cast.dtype))
+    struct resolver_entity *cast_entity = resolver_create_new_cast_entity(resolver, result, operand_entity->scope, node->cast.dtype);
+    if (datatype_is_struct_or_union(node->cast.dtype))
     {
         if (!cast_entity->scope)
         {
@@ -890,7 +1017,7 @@ struct resolver_entity *resolver_follow_unary_address(struct resolver_process *r
     result->flags |= RESOLVER_RESULT_FLAG_DOES_GET_ADDRESS;
     resolver_follow_part(resolver, node->unary.operand, result);
     struct resolver_entity *last_entity = resolver_result_peek(result);
-    struct resolver_entity *unary_address_entity = resolver_create_new_unary_get_address_entity(resolver, result, &last_entity->dtype, node, last_entity->scope, last_entity->offset);
+    struct resolver_entity *unary_address_entity = resolver_create_new_unary_get_address_entity(resolver, result, last_entity->dtype, node, last_entity->scope, last_entity->offset);
     resolver_result_entity_push(result, unary_address_entity);
     return unary_address_entity;
 }
@@ -1093,7 +1220,7 @@ void resolver_finalize_result_flags(struct resolver_process *resolver, struct re
     {
         // We only have one entity
         if (last_entity->type == RESOLVER_ENTITY_TYPE_VARIABLE &&
-            datatype_is_struct_or_union_non_pointer(&last_entity->dtype))
+            datatype_is_struct_or_union_non_pointer(last_entity->dtype))
         {
             flags |= RESOLVER_RESULT_FLAG_FIRST_ENTITY_LOAD_TO_EBX;
             flags &= ~RESOLVER_RESULT_FLAG_FIRST_ENTITY_PUSH_VALUE;
@@ -1127,7 +1254,7 @@ void resolver_finalize_result_flags(struct resolver_process *resolver, struct re
 
         if (entity->type == RESOLVER_ENTITY_TYPE_ARRAY_BRACKET)
         {
-            if(entity->dtype.flags & DATATYPE_FLAG_IS_POINTER)
+            if(entity->dtype->flags & DATATYPE_FLAG_IS_POINTER)
             {
                 flags |= RESOLVER_RESULT_FLAG_FIRST_ENTITY_PUSH_VALUE;
                 flags &= ~RESOLVER_RESULT_FLAG_FIRST_ENTITY_LOAD_TO_EBX;
@@ -1153,7 +1280,7 @@ void resolver_finalize_result_flags(struct resolver_process *resolver, struct re
         entity = entity->next;
     }
 
-    if (last_entity->dtype.flags & DATATYPE_FLAG_IS_ARRAY && (!does_get_address && last_entity->type == RESOLVER_ENTITY_TYPE_VARIABLE && !(last_entity->flags & RESOLVER_ENTITY_FLAG_USES_ARRAY_BRACKETS)))
+    if (last_entity->dtype->flags & DATATYPE_FLAG_IS_ARRAY && (!does_get_address && last_entity->type == RESOLVER_ENTITY_TYPE_VARIABLE && !(last_entity->flags & RESOLVER_ENTITY_FLAG_USES_ARRAY_BRACKETS)))
     {
         // char abc[50]; char* p = abc; abc[0];
         flags &= ~RESOLVER_RESULT_FLAG_FINAL_INDIRECTION_REQUIRED_FOR_VALUE;
@@ -1179,22 +1306,23 @@ void resolver_finalize_unary(struct resolver_process* resolver, struct resolver_
     }
 
     entity->scope = previous_entity->scope;
-    entity->dtype = previous_entity->dtype;
     entity->offset = previous_entity->offset;
+    struct datatype dtype = *previous_entity->dtype;
     if(entity->type == RESOLVER_ENTITY_TYPE_UNARY_INDIRECTION)
     {
         int indirection_depth = entity->indirection.depth;
-        entity->dtype.pointer_depth -= indirection_depth;
-        if (entity->dtype.pointer_depth <= 0)
+        dtype.pointer_depth -= indirection_depth;
+        if (dtype.pointer_depth <= 0)
         {
-            entity->dtype.flags &= ~DATATYPE_FLAG_IS_POINTER;
+            dtype.flags &= ~DATATYPE_FLAG_IS_POINTER;
         }
     }
     else if(entity->type == RESOLVER_ENTITY_TYPE_UNARY_GET_ADDRESS)
     {
-        entity->dtype.flags |= DATATYPE_FLAG_IS_POINTER;
-        entity->dtype.pointer_depth++;
+        dtype.flags |= DATATYPE_FLAG_IS_POINTER;
+        dtype.pointer_depth++;
     }
+    entity->dtype = datatype_intern(resolver_compiler(resolver), &dtype);
 }
 void resolver_finalize_last_entity(struct resolver_process* resolver, struct resolver_result* result)
 {
@@ -1219,10 +1347,48 @@ void resolver_finalize_result(struct resolver_process *resolver, struct resolver
     resolver_finalize_result_flags(resolver, result);
     resolver_finalize_last_entity(resolver, result);
 }
+static struct resolver_follow_cache_entry *resolver_follow_cache_entry_for(struct resolver_process *resolver, struct node *node)
+{
+    uintptr_t key = (uintptr_t)node;
+    unsigned int bucket = ((key >> 4) ^ (key >> 14)) & (RESOLVER_FOLLOW_CACHE_BUCKETS - 1);
+    struct resolver_follow_cache_entry *entry = resolver->follow_cache.buckets[bucket];
+    while (entry && entry->node != node)
+    {
+        entry = entry->next;
+    }
+
+    if (!entry)
+    {
+        entry = calloc(1, sizeof(struct resolver_follow_cache_entry));
+        entry->node = node;
+        entry->next = resolver->follow_cache.buckets[bucket];
+        resolver->follow_cache.buckets[bucket] = entry;
+    }
+
+    return entry;
+}
+
+/**
+ * Results are shared between callers that follow the same node in the same scope state,
+ * they must be treated as read only.
+ */
 struct resolver_result *resolver_follow(struct resolver_process *resolver, struct node *node)
 {
     assert(resolver);
     assert(node);
+    struct resolver_follow_cache_entry *cached = resolver_follow_cache_entry_for(resolver, node);
+    resolver->follow_cache.follows++;
+    if (cached->result && cached->scope == resolver->scope.current && cached->generation == resolver->follow_cache.generation)
+    {
+        resolver->follow_cache.hits++;
+        return cached->result;
+    }
+
+    if (cached->result)
+    {
+        resolver->follow_cache.stale++;
+    }
+
     struct resolver_result *result = resolver_new_result(resolver);
     resolver_follow_part(resolver, node, result);
     if (!resolver_result_entity_root(result))
@@ -1232,5 +1398,10 @@ struct resolver_result *resolver_follow(struct resolver_process *resolver, struc
     resolver_execute_rules(resolver, result);
     resolver_merge_compile_times(resolver, result);
     resolver_finalize_result(resolver, result);
+
+    // Following can register native functions, only cache against the state we finished in.
+    cached->result = result;
+    cached->scope = resolver->scope.current;
+    cached->generation = resolver->follow_cache.generation;
     return result;
 }
@@ -0,0 +1,336 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+
+/**
+ * A compile job is a single request line "flags\tcwd\tinput\toutput\n". The server streams
+ * back diagnostics, then a single final byte holding the compile_file result.
+ *
+ * Each job runs in a worker forked from the server, so a compiler error only ends the worker
+ * and every worker starts with the header cache already warm. Workers are reaped from the
+ * same poll loop that accepts new jobs, several jobs compile at once.
+ */
+
+struct compile_server_job
+{
+    int flags;
+    char *cwd;
+    char *input_file;
+    char *output_file;
+};
+
+struct compile_server_worker
+{
+    pid_t pid;
+    int client_fd;
+
+    // Read end of the pipe the worker writes its header cache misses to, -1 for a free slot
+    int misses_fd;
+    char cwd[PATH_MAX];
+
+    char *misses;
+    size_t misses_len;
+    size_t misses_size;
+};
+
+static int compile_server_socket_address(struct sockaddr_un *address, const char *socket_path)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path))
+    {
+        return -1;
+    }
+
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+static int compile_server_read_request(int client_fd, char *buf, size_t size)
+{
+    size_t len = 0;
+    while (len < size - 1)
+    {
+        ssize_t res = read(client_fd, &buf[len], 1);
+        if (res <= 0)
+        {
+            return -1;
+        }
+
+        if (buf[len] == '\n')
+        {
+            break;
+        }
+        len++;
+    }
+
+    buf[len] = 0;
+    return 0;
+}
+
+static int compile_server_parse_request(char *request, struct compile_server_job *job)
+{
+    char *parts[4];
+    for (int i = 0; i < 4; i++)
+    {
+        parts[i] = strsep(&request, "\t");
+        if (!parts[i])
+        {
+            return -1;
+        }
+    }
+
+    job->flags = atoi(parts[0]);
+    job->cwd = parts[1];
+    job->input_file = parts[2];
+    job->output_file = parts[3];
+    return 0;
+}
+
+static void compile_server_worker(struct compile_server_job *job, int client_fd, int misses_fd)
+{
+    if (chdir(job->cwd) != 0)
+    {
+        dprintf(client_fd, "Cannot change to directory %s\n", job->cwd);
+        _exit(COMPILER_FAILED_WITH_ERRORS);
+    }
+
+    // Diagnostics go back to the client, the echoed assembly is discarded.
+    freopen("/dev/null", "w", stdout);
+    dup2(client_fd, STDERR_FILENO);
+    int res = compile_file(job->input_file, job->output_file, job->flags);
+    if (res == COMPILER_FILE_COMPILED_OK)
+    {
+        FILE *misses = fdopen(misses_fd, "w");
+        header_cache_write_misses(misses);
+        fclose(misses);
+    }
+    _exit(res);
+}
+
+static void compile_server_reject(int client_fd)
+{
+    dprintf(client_fd, "Malformed compile request\n");
+    unsigned char status = COMPILER_FAILED_WITH_ERRORS;
+    write(client_fd, &status, 1);
+    close(client_fd);
+}
+
+static void compile_server_start(struct compile_server_worker *workers, int slot, int client_fd, int server_fd)
+{
+    char request[PATH_MAX * 3 + 32];
+    struct compile_server_job job;
+    if (compile_server_read_request(client_fd, request, sizeof(request)) < 0 ||
+        compile_server_parse_request(request, &job) < 0 || strlen(job.cwd) >= PATH_MAX)
+    {
+        compile_server_reject(client_fd);
+        return;
+    }
+
+    int misses_pipe[2];
+    if (pipe(misses_pipe) != 0)
+    {
+        close(client_fd);
+        return;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Other jobs' clients only see their end of file once no worker holds them open
+        close(server_fd);
+        for (int i = 0; i < COMPILE_SERVER_MAX_WORKERS; i++)
+        {
+            if (workers[i].misses_fd >= 0)
+            {
+                close(workers[i].misses_fd);
+                close(workers[i].client_fd);
+            }
+        }
+        close(misses_pipe[0]);
+        compile_server_worker(&job, client_fd, misses_pipe[1]);
+    }
+
+    close(misses_pipe[1]);
+    if (pid < 0)
+    {
+        close(misses_pipe[0]);
+        compile_server_reject(client_fd);
+        return;
+    }
+
+    struct compile_server_worker *worker = &workers[slot];
+    worker->pid = pid;
+    worker->client_fd = client_fd;
+    worker->misses_fd = misses_pipe[0];
+    strcpy(worker->cwd, job.cwd);
+    worker->misses_len = 0;
+}
+
+static void compile_server_finish(struct compile_server_worker *worker)
+{
+    close(worker->misses_fd);
+    worker->misses_fd = -1;
+
+    // The worker closed its pipe by exiting, so this does not wait on a running compile
+    int status = 0;
+    unsigned char res = COMPILER_FAILED_WITH_ERRORS;
+    if (waitpid(worker->pid, &status, 0) == worker->pid && WIFEXITED(status))
+    {
+        res = WEXITSTATUS(status);
+    }
+    write(worker->client_fd, &res, 1);
+    close(worker->client_fd);
+
+    // Warm the cache with whatever the worker had to lex, after the client has its answer.
+    if (worker->misses_len && chdir(worker->cwd) == 0)
+    {
+        FILE *fp = fmemopen(worker->misses, worker->misses_len, "r");
+        header_cache_read_misses(fp);
+        fclose(fp);
+    }
+}
+
+/**
+ * Reads what the worker has written of its misses so far, returns false once the worker is done.
+ */
+static bool compile_server_read_misses(struct compile_server_worker *worker)
+{
+    if (worker->misses_len == worker->misses_size)
+    {
+        worker->misses_size = worker->misses_size ? worker->misses_size * 2 : 1024;
+        worker->misses = realloc(worker->misses, worker->misses_size);
+    }
+
+    ssize_t res = read(worker->misses_fd, &worker->misses[worker->misses_len], worker->misses_size - worker->misses_len);
+    if (res <= 0)
+    {
+        return false;
+    }
+
+    worker->misses_len += res;
+    return true;
+}
+
+int compile_server_run(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if (compile_server_socket_address(&address, socket_path) < 0)
+    {
+        fprintf(stderr, "Socket path too long %s\n", socket_path);
+        return -1;
+    }
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (server_fd < 0 || bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server_fd, 64) < 0)
+    {
+        perror("compile server");
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    header_cache_enable();
+    printf("Compile server listening on %s\n", socket_path);
+    fflush(stdout);
+
+    struct compile_server_worker workers[COMPILE_SERVER_MAX_WORKERS] = {};
+    for (int i = 0; i < COMPILE_SERVER_MAX_WORKERS; i++)
+    {
+        workers[i].misses_fd = -1;
+    }
+
+    // fds[0] is the listening socket, fds[1 + i] the misses pipe of workers[i]
+    struct pollfd fds[1 + COMPILE_SERVER_MAX_WORKERS];
+    while (1)
+    {
+        int free_slot = -1;
+        for (int i = 0; i < COMPILE_SERVER_MAX_WORKERS; i++)
+        {
+            fds[1 + i].fd = workers[i].misses_fd;
+            fds[1 + i].events = POLLIN;
+            if (workers[i].misses_fd < 0 && free_slot < 0)
+            {
+                free_slot = i;
+            }
+        }
+
+        // Negative descriptors are ignored, new jobs wait in the backlog while every slot is busy
+        fds[0].fd = free_slot >= 0 ? server_fd : -1;
+        fds[0].events = POLLIN;
+        if (poll(fds, 1 + COMPILE_SERVER_MAX_WORKERS, -1) < 0)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < COMPILE_SERVER_MAX_WORKERS; i++)
+        {
+            if (fds[1 + i].fd >= 0 && fds[1 + i].revents && !compile_server_read_misses(&workers[i]))
+            {
+                compile_server_finish(&workers[i]);
+            }
+        }
+
+        if (fds[0].fd >= 0 && (fds[0].revents & POLLIN))
+        {
+            int client_fd = accept(server_fd, NULL, NULL);
+            if (client_fd >= 0)
+            {
+                compile_server_start(workers, free_slot, client_fd, server_fd);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int compile_client_run(const char *socket_path, const char *input_file, const char *output_file, int flags)
+{
+    struct sockaddr_un address;
+    if (compile_server_socket_address(&address, socket_path) < 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        close(fd);
+        return -1;
+    }
+    dprintf(fd, "%i\t%s\t%s\t%s\n", flags, cwd, input_file, output_file);
+
+    // The last byte received is the status, everything before it is diagnostics.
+    int pending = -1;
+    char buf[1024];
+    ssize_t len = 0;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        if (pending >= 0)
+        {
+            fputc(pending, stderr);
+        }
+        fwrite(buf, 1, len - 1, stderr);
+        pending = (unsigned char)buf[len - 1];
+    }
+
+    close(fd);
+    if (pending < 0)
+    {
+        return -1;
+    }
+
+    return pending == COMPILER_FILE_COMPILED_OK ? COMPILER_FILE_COMPILED_OK : COMPILER_FAILED_WITH_ERRORS;
+}
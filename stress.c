@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "compiler.h"
+
+/**
+ * Compiles translation units on several threads of one process at once and checks every
+ * output against a serial compile of the same file.
+ *
+ * ./stress [-m32|-m64] [-j<threads>] [-r<rounds>] <file.c> <file.c> ...
+ */
+
+struct stress_thread
+{
+    pthread_t thread;
+    int id;
+    int failures;
+};
+
+static const char **stress_sources;
+static int stress_total_sources;
+static int stress_rounds = 4;
+static int stress_flags = 0;
+static char stress_dir[PATH_MAX];
+
+static void stress_serial_file(char *out, int source)
+{
+    sprintf(out, "%s/serial_%i.asm", stress_dir, source);
+}
+
+static bool stress_files_equal(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "r");
+    FILE *fb = fopen(b, "r");
+    bool equal = fa && fb;
+    while (equal)
+    {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+        if (ca != cb)
+        {
+            equal = false;
+        }
+
+        if (ca == EOF || cb == EOF)
+        {
+            break;
+        }
+    }
+
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return equal;
+}
+
+static void *stress_thread_run(void *arg)
+{
+    struct stress_thread *thread = arg;
+    for (int round = 0; round < stress_rounds; round++)
+    {
+        for (int i = 0; i < stress_total_sources; i++)
+        {
+            // Every thread starts on a different file so unlike units overlap as well
+            int source = (i + thread->id) % stress_total_sources;
+            char out[PATH_MAX];
+            char serial[PATH_MAX];
+            sprintf(out, "%s/thread_%i_%i.asm", stress_dir, thread->id, source);
+            stress_serial_file(serial, source);
+            if (compile_file(stress_sources[source], out, stress_flags) != COMPILER_FILE_COMPILED_OK ||
+                !stress_files_equal(out, serial))
+            {
+                fprintf(stderr, "thread %i round %i: %s differs from the serial compile\n", thread->id, round, stress_sources[source]);
+                thread->failures++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int total_threads = 8;
+    int first_source = 1;
+    for (; first_source < argc && argv[first_source][0] == '-'; first_source++)
+    {
+        const char *arg = argv[first_source];
+        if (S_EQ(arg, "-m64"))
+        {
+            stress_flags = COMPILE_PROCESS_TARGET_X86_64;
+        }
+        else if (S_EQ(arg, "-m32"))
+        {
+            stress_flags = 0;
+        }
+        else if (strncmp(arg, "-j", 2) == 0)
+        {
+            total_threads = atoi(arg + 2);
+        }
+        else if (strncmp(arg, "-r", 2) == 0)
+        {
+            stress_rounds = atoi(arg + 2);
+        }
+    }
+
+    if (first_source >= argc || total_threads < 1)
+    {
+        printf("Usage: %s [-m32|-m64] [-j<threads>] [-r<rounds>] <file.c>...\n", argv[0]);
+        return -1;
+    }
+
+    stress_sources = (const char **)&argv[first_source];
+    stress_total_sources = argc - first_source;
+    strcpy(stress_dir, "/tmp/peachcc-stress-XXXXXX");
+    if (!mkdtemp(stress_dir))
+    {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    for (int i = 0; i < stress_total_sources; i++)
+    {
+        char serial[PATH_MAX];
+        stress_serial_file(serial, i);
+        if (compile_file(stress_sources[i], serial, stress_flags) != COMPILER_FILE_COMPILED_OK)
+        {
+            printf("%s does not compile serially\n", stress_sources[i]);
+            return -1;
+        }
+    }
+
+    struct stress_thread *threads = calloc(total_threads, sizeof(struct stress_thread));
+    for (int i = 0; i < total_threads; i++)
+    {
+        threads[i].id = i;
+        pthread_create(&threads[i].thread, NULL, stress_thread_run, &threads[i]);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < total_threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        failures += threads[i].failures;
+    }
+
+    int total = total_threads * stress_rounds * stress_total_sources;
+    printf("%i of %i threaded compiles matched the serial output, files in %s\n", total - failures, total, stress_dir);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <assert.h>
+#include <stdlib.h>
+
+
+static unsigned int struct_layout_hash(const char *name)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+        name++;
+    }
+    return hash;
+}
+
+static struct node *struct_layout_body_node(struct node *struct_or_union_node)
+{
+    assert(node_is_struct_or_union(struct_or_union_node));
+    if (struct_or_union_node->type == NODE_TYPE_UNION)
+    {
+        return struct_or_union_node->_union.body_n;
+    }
+
+    return struct_or_union_node->_struct.body_n;
+}
+
+static void struct_layout_build_table(struct struct_layout *layout)
+{
+    int total_fields = vector_count(layout->fields);
+    size_t table_size = 1;
+    while (table_size < total_fields * 2)
+    {
+        table_size <<= 1;
+    }
+
+    layout->table = malloc(sizeof(int) * table_size);
+    layout->table_size = table_size;
+    for (size_t i = 0; i < table_size; i++)
+    {
+        layout->table[i] = -1;
+    }
+
+    for (int i = 0; i < total_fields; i++)
+    {
+        struct struct_layout_field *field = vector_at(layout->fields, i);
+        size_t slot = struct_layout_hash(field->name) & (table_size - 1);
+        while (layout->table[slot] != -1)
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        layout->table[slot] = i;
+    }
+}
+
+static void struct_layout_add_field(struct struct_layout *layout, struct node *var_node, bool is_union)
+{
+    size_t size = variable_size(var_node);
+    size_t align = datatype_align(var_node->var.type);
+    int offset = 0;
+    if (!is_union)
+    {
+        offset = align_value(layout->size, align);
+    }
+
+    struct struct_layout_field field = {
+        .name = var_node->var.name,
+        .var_node = var_node,
+        .offset = offset,
+        .size = size};
+    vector_push(layout->fields, &field);
+    layout->size = offset + size > layout->size ? offset + size : layout->size;
+    layout->align = align > layout->align ? align : layout->align;
+}
+
+/**
+ * Lays the members out the way the SysV ABI does, every member starts at the next multiple of its
+ * own alignment and the size is rounded up to the alignment of the most aligned member.
+ */
+struct struct_layout *struct_layout_build(struct node *body_node, bool is_union)
+{
+    struct struct_layout *layout = calloc(1, sizeof(struct struct_layout));
+    layout->fields = vector_create(sizeof(struct struct_layout_field));
+    layout->align = 1;
+
+    struct vector *statements = body_node->body.statements;
+    for (int i = 0; i < vector_count(statements); i++)
+    {
+        struct node *stmt_node = vector_peek_ptr_at(statements, i);
+        if (stmt_node->type == NODE_TYPE_VARIABLE_LIST)
+        {
+            struct vector *list = stmt_node->var_list.list;
+            for (int j = 0; j < vector_count(list); j++)
+            {
+                struct_layout_add_field(layout, vector_peek_ptr_at(list, j), is_union);
+            }
+            continue;
+        }
+
+        struct node *var_node = variable_node(stmt_node);
+        if (var_node)
+        {
+            struct_layout_add_field(layout, var_node, is_union);
+        }
+    }
+    layout->size = align_value(layout->size, layout->align);
+
+    if (vector_count(layout->fields) > STRUCT_LAYOUT_HASH_THRESHOLD)
+    {
+        struct_layout_build_table(layout);
+    }
+
+    return layout;
+}
+
+struct struct_layout *struct_layout_for_node(struct node *struct_or_union_node)
+{
+    struct node *body_node = struct_layout_body_node(struct_or_union_node);
+    assert(body_node);
+
+    // The parser builds it when it finishes the body, bodies read back from an AST file build it here
+    if (!body_node->body.layout)
+    {
+        body_node->body.layout = struct_layout_build(body_node, struct_or_union_node->type == NODE_TYPE_UNION);
+    }
+
+    return body_node->body.layout;
+}
+
+struct struct_layout_field *struct_layout_field_get(struct struct_layout *layout, const char *name)
+{
+    if (layout->table)
+    {
+        size_t slot = struct_layout_hash(name) & (layout->table_size - 1);
+        while (layout->table[slot] != -1)
+        {
+            struct struct_layout_field *field = vector_at(layout->fields, layout->table[slot]);
+            if (S_EQ(field->name, name))
+            {
+                return field;
+            }
+            slot = (slot + 1) & (layout->table_size - 1);
+        }
+        return NULL;
+    }
+
+    for (int i = 0; i < vector_count(layout->fields); i++)
+    {
+        struct struct_layout_field *field = vector_at(layout->fields, i);
+        if (S_EQ(field->name, name))
+        {
+            return field;
+        }
+    }
+
+    return NULL;
+}
+
+struct struct_layout_field *struct_layout_field_for_name(struct compile_process *compile_proc, const char *struct_name, const char *field_name)
+{
+    struct symbol *struct_sym = symresolver_get_symbol(compile_proc, struct_name);
+    assert(struct_sym && struct_sym->type == SYMBOL_TYPE_NODE);
+    struct node *node = struct_sym->data;
+    return struct_layout_field_get(struct_layout_for_node(node), field_name);
+}
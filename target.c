@@ -0,0 +1,33 @@
+#include "compiler.h"
+
+/**
+ * The machine we generate code for. Everything that depends on the width of the machine,
+ * the size of a pointer, a long or a stack slot and how the output is assembled, asks here.
+ */
+static struct compile_target targets[] = {
+    {.type = COMPILE_TARGET_X86, .name = "x86", .pointer_size = DATA_SIZE_DWORD, .long_size = DATA_SIZE_DWORD, .stack_push_size = DATA_SIZE_DWORD, .nasm_format = "elf32", .link_flags = "-m32", .callee_saved_registers = {"ebx", "esi", "edi"}, .total_callee_saved_registers = 3},
+    {.type = COMPILE_TARGET_X86_64, .name = "x86-64", .pointer_size = DATA_SIZE_DDWORD, .long_size = DATA_SIZE_DDWORD, .stack_push_size = DATA_SIZE_DDWORD, .nasm_format = "elf64", .link_flags = "", .callee_saved_registers = {"rbx"}, .total_callee_saved_registers = 1, .aligned_calls = true},
+};
+
+// Selected by the compile process being worked on in this thread
+static COMPILER_THREAD_LOCAL struct compile_target *current_target = &targets[COMPILE_TARGET_X86];
+
+struct compile_target *target_for_flags(int flags)
+{
+    return (flags & COMPILE_PROCESS_TARGET_X86_64) ? &targets[COMPILE_TARGET_X86_64] : &targets[COMPILE_TARGET_X86];
+}
+
+void target_select(int flags)
+{
+    current_target = target_for_flags(flags);
+}
+
+struct compile_target *target_current()
+{
+    return current_target;
+}
+
+bool target_is_x86_64()
+{
+    return current_target->type == COMPILE_TARGET_X86_64;
+}
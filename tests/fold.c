@@ -0,0 +1,119 @@
+/**
+ * Constant expressions the folder sees, printed one per line. tests/fold.sh builds this with gcc
+ * with FOLD_AT_RUNTIME defined, so every operand comes out of a call and gcc computes the value at
+ * run time, and diffs what both print. Division by zero and INT_MIN / -1 trap, they stay in a branch
+ * never taken and only have to compile without being folded.
+ */
+int printf(const char* fmt, ...);
+
+#ifdef FOLD_AT_RUNTIME
+int keep(int x)
+{
+    return x;
+}
+#define K(x) keep(x)
+#endif
+
+#ifndef FOLD_AT_RUNTIME
+#define K(x) (x)
+#endif
+
+void casts()
+{
+    printf("(char)200: %d\n", (char)K(200));
+    printf("(char)-129: %d\n", (char)K(-129));
+    printf("(unsigned char)-1: %d\n", (unsigned char)K(-1));
+    printf("(unsigned char)300 + 1: %d\n", ((unsigned char)K(300)) + K(1));
+    printf("(short)40000: %d\n", (short)K(40000));
+    printf("(unsigned short)-1: %d\n", (unsigned short)K(-1));
+    printf("(unsigned short)65535 + 1: %d\n", ((unsigned short)K(65535)) + K(1));
+    printf("(char)(100 + 100): %d\n", (char)(K(100) + K(100)));
+    printf("(int)-5: %d\n", (int)K(-5));
+    printf("(unsigned int)-1: %u\n", (unsigned int)K(-1));
+}
+
+void shifts()
+{
+    printf("1 << 0: %d\n", K(1) << K(0));
+    printf("1 << 30: %d\n", K(1) << K(30));
+    printf("1 << 31: %d\n", K(1) << K(31));
+    printf("-8 >> 1: %d\n", K(-8) >> K(1));
+    printf("-1 >> 31: %d\n", K(-1) >> K(31));
+    printf("2147483647 >> 30: %d\n", K(2147483647) >> K(30));
+    printf("(unsigned int)-8 >> 1: %u\n", ((unsigned int)K(-8)) >> K(1));
+    printf("(unsigned int)-1 >> 31: %u\n", ((unsigned int)K(-1)) >> K(31));
+}
+
+void divisions()
+{
+    printf("7 / 2: %d\n", K(7) / K(2));
+    printf("-7 / 2: %d\n", K(-7) / K(2));
+    printf("7 / -2: %d\n", K(7) / K(-2));
+    printf("-7 / -2: %d\n", K(-7) / K(-2));
+    printf("7 %% 2: %d\n", K(7) % K(2));
+    printf("-7 %% 2: %d\n", K(-7) % K(2));
+    printf("7 %% -2: %d\n", K(7) % K(-2));
+    printf("INT_MIN / 2: %d\n", (K(-2147483647) - K(1)) / K(2));
+    printf("INT_MIN / 1: %d\n", (K(-2147483647) - K(1)) / K(1));
+    printf("INT_MIN %% 3: %d\n", (K(-2147483647) - K(1)) % K(3));
+    printf("INT_MAX / -1: %d\n", K(2147483647) / K(-1));
+    printf("(unsigned int)-7 / 2: %u\n", ((unsigned int)K(-7)) / K(2));
+    printf("(unsigned int)-7 %% 10: %u\n", ((unsigned int)K(-7)) % K(10));
+}
+
+void signed_unsigned()
+{
+    printf("-1 < 0: %d\n", K(-1) < K(0));
+    printf("(unsigned int)-1 > 1: %d\n", ((unsigned int)K(-1)) > K(1));
+    printf("(unsigned int)1 < -1: %d\n", ((unsigned int)K(1)) < K(-1));
+    printf("(unsigned char)-1 == 255: %d\n", ((unsigned char)K(-1)) == K(255));
+    printf("(char)-1 == 255: %d\n", ((char)K(-1)) == K(255));
+    printf("(unsigned short)-1 > 0: %d\n", ((unsigned short)K(-1)) > K(0));
+    printf("(unsigned int)3 - 5: %u\n", ((unsigned int)K(3)) - K(5));
+    printf("(unsigned int)65536 * 65536: %u\n", ((unsigned int)K(65536)) * K(65536));
+}
+
+void others()
+{
+    printf("2147483647 + 1: %d\n", K(2147483647) + K(1));
+    printf("65536 * 65536: %d\n", K(65536) * K(65536));
+    printf("-INT_MIN: %d\n", -(K(-2147483647) - K(1)));
+    printf("~0: %d\n", ~K(0));
+    printf("!5: %d\n", !K(5));
+    printf("0 && 1 / 0: %d\n", K(0) && K(1) / K(0));
+    printf("1 || 1 / 0: %d\n", K(1) || K(1) / K(0));
+    printf("3 ? 4 : 1 / 0: %d\n", K(3) ? K(4) : K(1) / K(0));
+    printf("(6 & 3) | (8 ^ 1): %d\n", (K(6) & K(3)) | (K(8) ^ K(1)));
+}
+
+// Left for the shift instruction, which only looks at the low five bits of the count like gcc's code does
+void out_of_range_shifts()
+{
+    printf("1 << 32: %d\n", K(1) << K(32));
+    printf("1 << 33: %d\n", K(1) << K(33));
+    printf("1 << -1: %d\n", K(1) << K(-1));
+    printf("-1 >> 40: %d\n", K(-1) >> K(40));
+}
+
+void undefined(int never)
+{
+    if (never)
+    {
+        printf("1 / 0: %d\n", K(1) / K(0));
+        printf("1 %% 0: %d\n", K(1) % K(0));
+        printf("INT_MIN / -1: %d\n", (K(-2147483647) - K(1)) / K(-1));
+        printf("INT_MIN %% -1: %d\n", (K(-2147483647) - K(1)) % K(-1));
+    }
+}
+
+int main()
+{
+    casts();
+    shifts();
+    divisions();
+    signed_unsigned();
+    others();
+    out_of_range_shifts();
+    undefined(0);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds tests/fold.c with this compiler, which folds its constants, and with gcc computing them
+# at run time, then diffs what both print.
+#
+# ./tests/fold.sh
+dir=$(mktemp -d)
+status=1
+# Signed overflow has to wrap for gcc the same way it does in our code
+if gcc -m32 -fwrapv -DFOLD_AT_RUNTIME -o "$dir/gcc" tests/fold.c &&
+    ./main build "$dir/peachcc" tests/fold.c > /dev/null; then
+    "$dir/gcc" > "$dir/gcc.out"
+    "$dir/peachcc" > "$dir/peachcc.out"
+    diff "$dir/gcc.out" "$dir/peachcc.out"
+    status=$?
+fi
+
+rm -rf "$dir"
+if [ $status -eq 0 ]; then
+    echo "constant folding matches gcc"
+fi
+exit $status
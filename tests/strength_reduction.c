@@ -0,0 +1,165 @@
+/**
+ * Multiplication, division and modulo by constants over sampled operands. Every case
+ * prints a hash of its results, tests/strength_reduction.sh diffs them against gcc.
+ */
+int printf(const char* fmt, ...);
+
+// Boundaries first, then pseudo random operands and operands next to a multiple of d
+int sample(int i, int d)
+{
+    unsigned int r;
+    switch (i)
+    {
+    case 0:
+        return 0;
+    case 1:
+        return 1;
+    case 2:
+        return -1;
+    case 3:
+        return 2147483647;
+    case 4:
+        return -2147483647 - 1;
+    case 5:
+        return -2147483647;
+    case 6:
+        return d;
+    case 7:
+        return -d;
+    }
+
+    r = i;
+    r = r * 1103515245 + 12345;
+    if (i % 3 == 0)
+    {
+        return (int)(r >> 16) * d + i % 5 - 2;
+    }
+
+    if (i % 3 == 1)
+    {
+        return (int)(r >> 7);
+    }
+    return r;
+}
+
+#define SIGNED_CASE(name, d) \
+int name() \
+{ \
+    int i; \
+    int x; \
+    int h = 0; \
+    for (i = 0; i < 3000; i++) \
+    { \
+        x = sample(i, d); \
+        h = h * 31 + x / d; \
+        h = h * 17 + x % d; \
+        h = h * 5 + x * d; \
+    } \
+    return h; \
+}
+
+#define UNSIGNED_CASE(name, d) \
+int name() \
+{ \
+    int i; \
+    unsigned int u; \
+    unsigned int h = 0; \
+    for (i = 0; i < 3000; i++) \
+    { \
+        u = sample(i, d); \
+        h = h * 31 + u / d; \
+        h = h * 17 + u % d; \
+        h = h * 5 + u * d; \
+    } \
+    return h; \
+}
+
+SIGNED_CASE(signed_1, 1)
+SIGNED_CASE(signed_2, 2)
+SIGNED_CASE(signed_3, 3)
+SIGNED_CASE(signed_4, 4)
+SIGNED_CASE(signed_5, 5)
+SIGNED_CASE(signed_6, 6)
+SIGNED_CASE(signed_7, 7)
+SIGNED_CASE(signed_9, 9)
+SIGNED_CASE(signed_10, 10)
+SIGNED_CASE(signed_12, 12)
+SIGNED_CASE(signed_16, 16)
+SIGNED_CASE(signed_25, 25)
+SIGNED_CASE(signed_100, 100)
+SIGNED_CASE(signed_641, 641)
+SIGNED_CASE(signed_1024, 1024)
+SIGNED_CASE(signed_7919, 7919)
+SIGNED_CASE(signed_65537, 65537)
+SIGNED_CASE(signed_1000000007, 1000000007)
+SIGNED_CASE(signed_1073741824, 1073741824)
+SIGNED_CASE(signed_2147483647, 2147483647)
+SIGNED_CASE(signed_minus_2, -2)
+SIGNED_CASE(signed_minus_3, -3)
+SIGNED_CASE(signed_minus_7, -7)
+SIGNED_CASE(signed_minus_16, -16)
+SIGNED_CASE(signed_minus_1073741824, -1073741824)
+SIGNED_CASE(signed_minus_2147483647, -2147483647)
+
+UNSIGNED_CASE(unsigned_1, 1)
+UNSIGNED_CASE(unsigned_2, 2)
+UNSIGNED_CASE(unsigned_3, 3)
+UNSIGNED_CASE(unsigned_5, 5)
+UNSIGNED_CASE(unsigned_6, 6)
+UNSIGNED_CASE(unsigned_7, 7)
+UNSIGNED_CASE(unsigned_10, 10)
+UNSIGNED_CASE(unsigned_16, 16)
+UNSIGNED_CASE(unsigned_100, 100)
+UNSIGNED_CASE(unsigned_641, 641)
+UNSIGNED_CASE(unsigned_7919, 7919)
+UNSIGNED_CASE(unsigned_65536, 65536)
+UNSIGNED_CASE(unsigned_65537, 65537)
+UNSIGNED_CASE(unsigned_1000000007, 1000000007)
+UNSIGNED_CASE(unsigned_2147483647, 2147483647)
+
+int main()
+{
+    printf("x / 1: %d\n", signed_1());
+    printf("x / 2: %d\n", signed_2());
+    printf("x / 3: %d\n", signed_3());
+    printf("x / 4: %d\n", signed_4());
+    printf("x / 5: %d\n", signed_5());
+    printf("x / 6: %d\n", signed_6());
+    printf("x / 7: %d\n", signed_7());
+    printf("x / 9: %d\n", signed_9());
+    printf("x / 10: %d\n", signed_10());
+    printf("x / 12: %d\n", signed_12());
+    printf("x / 16: %d\n", signed_16());
+    printf("x / 25: %d\n", signed_25());
+    printf("x / 100: %d\n", signed_100());
+    printf("x / 641: %d\n", signed_641());
+    printf("x / 1024: %d\n", signed_1024());
+    printf("x / 7919: %d\n", signed_7919());
+    printf("x / 65537: %d\n", signed_65537());
+    printf("x / 1000000007: %d\n", signed_1000000007());
+    printf("x / 1073741824: %d\n", signed_1073741824());
+    printf("x / 2147483647: %d\n", signed_2147483647());
+    printf("x / -2: %d\n", signed_minus_2());
+    printf("x / -3: %d\n", signed_minus_3());
+    printf("x / -7: %d\n", signed_minus_7());
+    printf("x / -16: %d\n", signed_minus_16());
+    printf("x / -1073741824: %d\n", signed_minus_1073741824());
+    printf("x / -2147483647: %d\n", signed_minus_2147483647());
+
+    printf("u / 1: %d\n", unsigned_1());
+    printf("u / 2: %d\n", unsigned_2());
+    printf("u / 3: %d\n", unsigned_3());
+    printf("u / 5: %d\n", unsigned_5());
+    printf("u / 6: %d\n", unsigned_6());
+    printf("u / 7: %d\n", unsigned_7());
+    printf("u / 10: %d\n", unsigned_10());
+    printf("u / 16: %d\n", unsigned_16());
+    printf("u / 100: %d\n", unsigned_100());
+    printf("u / 641: %d\n", unsigned_641());
+    printf("u / 7919: %d\n", unsigned_7919());
+    printf("u / 65536: %d\n", unsigned_65536());
+    printf("u / 65537: %d\n", unsigned_65537());
+    printf("u / 1000000007: %d\n", unsigned_1000000007());
+    printf("u / 2147483647: %d\n", unsigned_2147483647());
+    return 0;
+}
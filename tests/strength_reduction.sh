@@ -0,0 +1,20 @@
+#!/bin/sh
+# Builds tests/strength_reduction.c with gcc and with this compiler and diffs what both print.
+#
+# ./tests/strength_reduction.sh
+dir=$(mktemp -d)
+status=1
+# Signed overflow has to wrap for gcc the same way it does in our code
+if gcc -m32 -fwrapv -o "$dir/gcc" tests/strength_reduction.c &&
+    ./main build "$dir/peachcc" tests/strength_reduction.c > /dev/null; then
+    "$dir/gcc" > "$dir/gcc.out"
+    "$dir/peachcc" > "$dir/peachcc.out"
+    diff "$dir/gcc.out" "$dir/peachcc.out"
+    status=$?
+fi
+
+rm -rf "$dir"
+if [ $status -eq 0 ]; then
+    echo "strength reduction matches gcc"
+fi
+exit $status
@@ -1,8 +1,8 @@
 #include "compiler.h"
 #include "helpers/vector.h"
 
-static struct compile_process* validator_current_compile_process;
-static struct node* current_function;
+static COMPILER_THREAD_LOCAL struct compile_process* validator_current_compile_process;
+static COMPILER_THREAD_LOCAL struct node* current_function;
 
 void validate_variable(struct node* var_node);
 void validate_body(struct body* body);
@@ -65,7 +65,7 @@ void validate_return_node(struct node* node)
 {    
     if (node->stmt.return_stmt.exp)
     {
-        if(datatype_is_void_no_ptr(&current_function->func.rtype))
+        if(datatype_is_void_no_ptr(current_function->func.rtype))
         {
             compiler_node_error(node, "You are returning a value in a function %s which has a return type of void\n", current_function->func.name);
         }
@@ -89,6 +89,7 @@ void validate_if_stmt(struct node* node)
 
 void validate_statement(struct node* node)
 {
+    resolver_begin_statement(validator_current_compile_process->resolver);
     switch(node->type)
     {
         case NODE_TYPE_VARIABLE:
@@ -103,6 +104,8 @@ void validate_statement(struct node* node)
         validate_if_stmt(node);
         break;
     }
+
+    resolver_finish_statement(validator_current_compile_process->resolver);
 }
 void validate_body(struct body* body)
 {
@@ -0,0 +1,154 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+
+/**
+ * Lowering of the IR to x86-64, runs after register allocation and before the peephole pass.
+ *
+ * Codegen writes values in the 32 bit registers unless a value needs all 64 bits, then it names the
+ * 64 bit register itself. What is left for here is everything that holds an address or a stack slot:
+ * the stack and frame pointers, registers used to address memory and registers that are pushed or
+ * popped all become 64 bit. A push is always eight bytes, so a dword in memory goes through r11 first.
+ *
+ * The SysV classification of arguments and results is here as well.
+ */
+
+static void x86_64_lower_memory(struct asm_operand *mem)
+{
+    if (asm_ir_register_id(mem->base) != -1)
+    {
+        mem->base = asm_ir_register_64(mem->base);
+    }
+
+    if (asm_ir_register_id(mem->index) != -1)
+    {
+        mem->index = asm_ir_register_64(mem->index);
+    }
+}
+
+static void x86_64_lower_operand(struct asm_ir_instruction *ins, struct asm_ir_operand *operand)
+{
+    switch (operand->type)
+    {
+    case ASM_IR_OPERAND_REGISTER:
+    {
+        int id = asm_ir_register_id(operand->reg);
+        bool is_stack_register = id == ASM_IR_REG_EBP || id == ASM_IR_REG_ESP;
+        bool holds_address = ins->op == ASM_OP_PUSH || ins->op == ASM_OP_POP || ins->op == ASM_OP_CALL || ins->op == ASM_OP_JMP;
+        if (is_stack_register || holds_address)
+        {
+            operand->reg = asm_ir_register_64(operand->reg);
+        }
+        break;
+    }
+
+    case ASM_IR_OPERAND_MEMORY:
+        x86_64_lower_memory(&operand->mem);
+        break;
+
+    case ASM_IR_OPERAND_IMMEDIATE:
+        // push dword 5 does not exist, push 5 pushes all eight bytes
+        if (ins->op == ASM_OP_PUSH)
+        {
+            operand->size = 0;
+        }
+        break;
+    }
+}
+
+static bool x86_64_is_dword_memory_push(struct asm_ir_instruction *ins)
+{
+    return ins->op == ASM_OP_PUSH && ins->operands[0].type == ASM_IR_OPERAND_MEMORY && ins->operands[0].mem.size != DATA_SIZE_DDWORD;
+}
+
+void x86_64_lower(struct asm_ir *ir)
+{
+    // Built again as pushes from memory become two instructions
+    struct vector *lowered = vector_create(sizeof(struct asm_ir_instruction *));
+    for (int i = 0; i < vector_count(ir->instructions); i++)
+    {
+        struct asm_ir_instruction *ins = asm_ir_at(ir, i);
+        if (ins->flags & ASM_IR_INSTRUCTION_FLAG_DELETED)
+        {
+            asm_ir_instruction_free(ins);
+            continue;
+        }
+
+        for (int k = 0; k < ins->total_operands; k++)
+        {
+            x86_64_lower_operand(ins, &ins->operands[k]);
+        }
+
+        if (!x86_64_is_dword_memory_push(ins))
+        {
+            vector_push(lowered, &ins);
+            continue;
+        }
+
+        // The memory operand moves over to the load together with the symbol it may own
+        struct asm_ir_instruction *load = asm_ir_instruction_new(ASM_OP_MOV, NULL);
+        load->operands[0] = asm_ir_reg("r11d");
+        load->operands[1] = ins->operands[0];
+        load->operands[1].mem.size = DATA_SIZE_DWORD;
+        load->total_operands = 2;
+        ins->operands[0] = asm_ir_reg("r11");
+        vector_push(lowered, &load);
+        vector_push(lowered, &ins);
+    }
+
+    vector_free(ir->instructions);
+    ir->instructions = lowered;
+}
+
+/**
+ * Codegen keeps every scalar, float and double included, in the integer registers, so every eightbyte is of
+ * the INTEGER class. A structure or union of up to two eightbytes goes in registers, a larger one in memory.
+ */
+int x86_64_eightbytes(const struct datatype *dtype)
+{
+    if (!datatype_is_struct_or_union_non_pointer(dtype))
+    {
+        return 1;
+    }
+
+    size_t size = datatype_size(dtype);
+    if (size == 0 || size > CODEGEN_X86_64_REGISTER_STRUCTURE_MAX_SIZE)
+    {
+        return 0;
+    }
+    return align_value(size, DATA_SIZE_DDWORD) / DATA_SIZE_DDWORD;
+}
+
+void x86_64_placement_start(struct x86_64_argument_placement *placement, const struct datatype *rtype)
+{
+    placement->registers = 0;
+    placement->stack_size = 0;
+    if (datatype_is_struct_or_union_non_pointer(rtype) && !x86_64_eightbytes(rtype))
+    {
+        placement->registers = 1;
+    }
+}
+
+size_t x86_64_stack_argument_size(const struct datatype *dtype)
+{
+    if (!datatype_is_struct_or_union_non_pointer(dtype))
+    {
+        return DATA_SIZE_DDWORD;
+    }
+    return align_value(datatype_size(dtype), DATA_SIZE_DDWORD);
+}
+
+// An argument that does not fit the registers left goes on the stack whole, later ones may still take registers
+int x86_64_place_argument(struct x86_64_argument_placement *placement, const struct datatype *dtype, size_t *stack_offset_out)
+{
+    int eightbytes = x86_64_eightbytes(dtype);
+    if (eightbytes && placement->registers + eightbytes <= CODEGEN_X86_64_REGISTER_ARGUMENTS)
+    {
+        int reg = placement->registers;
+        placement->registers += eightbytes;
+        return reg;
+    }
+
+    *stack_offset_out = placement->stack_size;
+    placement->stack_size += x86_64_stack_argument_size(dtype);
+    return -1;
+}